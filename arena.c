@@ -0,0 +1,72 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char* data;
+};
+
+static void* arena_alloc_aligned(Arena* arena, size_t size, size_t alignment) {
+    ArenaBlock* block = arena->head;
+    size_t padding = 0;
+    if (block) {
+        padding = (alignment - (block->used & (alignment - 1))) & (alignment - 1);
+    }
+
+    if (!block || block->size - block->used < size + padding) {
+        if (arena->block_size == 0) {
+            arena->block_size = ARENA_DEFAULT_BLOCK_SIZE;
+        }
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+
+        block = malloc(sizeof(ArenaBlock) + ARENA_ALIGNMENT + block_size);
+        if (!block) return NULL;
+        block->data = (char*)(((size_t)(block + 1) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1));
+        block->size = block_size;
+        block->used = 0;
+
+        /* Keep a partly used head block in front when an oversized request gets its own block. */
+        if (arena->head && size > arena->block_size) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+        padding = 0;
+    }
+
+    void* result = block->data + block->used + padding;
+    block->used += size + padding;
+    arena->bytes_used += size + padding;
+    return result;
+}
+
+void* winctrl_arena_alloc(Arena* arena, size_t size) {
+    return arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+}
+
+char* winctrl_arena_strndup(Arena* arena, const char* str, size_t len) {
+    char* copy = arena_alloc_aligned(arena, len + 1, 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void winctrl_arena_free(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->bytes_used = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef WINCONTROL_ARENA_H
+#define WINCONTROL_ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+/* A zero-initialized Arena is ready to use; everything is released at once by winctrl_arena_free. */
+typedef struct {
+    ArenaBlock* head;
+    size_t block_size;
+    size_t bytes_used;
+} Arena;
+
+void* winctrl_arena_alloc(Arena* arena, size_t size);
+char* winctrl_arena_strndup(Arena* arena, const char* str, size_t len);
+void winctrl_arena_free(Arena* arena);
+
+#endif
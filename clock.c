@@ -0,0 +1,86 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef _WIN32
+
+static long long system_now_us(void* clock) {
+    (void)clock;
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (long long)(counter.QuadPart / frequency.QuadPart * 1000000 +
+                       counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
+
+/* Sleep has millisecond resolution, so shorter waits are rounded up rather than skipped. */
+static void system_sleep_us(void* clock, long long microseconds) {
+    (void)clock;
+    Sleep((DWORD)((microseconds + 999) / 1000));
+}
+
+#else
+
+static long long system_now_us(void* clock) {
+    (void)clock;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void system_sleep_us(void* clock, long long microseconds) {
+    (void)clock;
+    struct timespec delay = { (time_t)(microseconds / 1000000), (long)(microseconds % 1000000) * 1000 };
+    while (nanosleep(&delay, &delay) != 0) {
+    }
+}
+
+#endif
+
+static const ClockOps SYSTEM_CLOCK_OPS = {
+    system_now_us,
+    system_sleep_us
+};
+
+const Clock SYSTEM_CLOCK = { &SYSTEM_CLOCK_OPS, NULL };
+
+long long winctrl_clock_now_ms(const Clock* clock) {
+    return clock->ops->now_us(clock->clock) / 1000;
+}
+
+void winctrl_clock_sleep_ms(const Clock* clock, int milliseconds) {
+    winctrl_clock_sleep_us(clock, (long long)milliseconds * 1000);
+}
+
+void winctrl_clock_sleep_us(const Clock* clock, long long microseconds) {
+    if (microseconds > 0) {
+        clock->ops->sleep_us(clock->clock, microseconds);
+    }
+}
+
+static long long virtual_now_us(void* clock) {
+    VirtualClock* virtual_clock = clock;
+    return virtual_clock->now_us;
+}
+
+static void virtual_sleep_us(void* clock, long long microseconds) {
+    VirtualClock* virtual_clock = clock;
+    virtual_clock->now_us += microseconds;
+    virtual_clock->sleeps++;
+}
+
+const ClockOps VIRTUAL_CLOCK_OPS = {
+    virtual_now_us,
+    virtual_sleep_us
+};
@@ -0,0 +1,41 @@
+#ifndef WINCONTROL_CLOCK_H
+#define WINCONTROL_CLOCK_H
+
+#include <stdbool.h>
+
+/*
+ * Where time comes from. now_us reads a monotonic clock in microseconds
+ * and sleep_us waits. Every deliberate wait goes through a Clock, so a
+ * virtual one can stand in for real time.
+ */
+typedef struct {
+    long long (*now_us)(void* clock);
+    void (*sleep_us)(void* clock, long long microseconds);
+} ClockOps;
+
+typedef struct {
+    const ClockOps* ops;
+    void* clock;
+} Clock;
+
+long long winctrl_clock_now_ms(const Clock* clock);
+void winctrl_clock_sleep_ms(const Clock* clock, int milliseconds);
+void winctrl_clock_sleep_us(const Clock* clock, long long microseconds);
+
+/* The operating system's clock; sleeps really sleep. */
+extern const Clock SYSTEM_CLOCK;
+
+/*
+ * Time that only moves when something sleeps: a sleep returns at once
+ * and moves now forward by its length. Waits keep their order and
+ * timeouts still expire, and now reads the time a real run would have
+ * taken. Only for single-threaded use against simulated targets.
+ */
+typedef struct {
+    long long now_us;
+    long sleeps;
+} VirtualClock;
+
+extern const ClockOps VIRTUAL_CLOCK_OPS;
+
+#endif
@@ -0,0 +1,168 @@
+#include "desktop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int winctrl_desktop_find(const Desktop* desktop, void* root, const char* selector, void** element,
+                         char* error, size_t error_size) {
+    *element = NULL;
+    Selector compiled;
+    if (!winctrl_selector_compile(selector, &compiled, error, error_size)) {
+        return -1;
+    }
+
+    SelectorTreeOps tree = { desktop->ops->find, desktop->ops->release };
+    int status = winctrl_selector_evaluate(&compiled, &tree, desktop->backend, root, element);
+    winctrl_selector_free(&compiled);
+    if (status < 0) {
+        snprintf(error, error_size, "Search failed for selector: %s", selector);
+    } else if (status == 0) {
+        snprintf(error, error_size, "No element matches selector: %s", selector);
+    }
+    return status;
+}
+
+bool winctrl_desktop_click(const Desktop* desktop, void* element, DesktopButton button, int count,
+                           char* error, size_t error_size) {
+    ElementInfo info;
+    if (!desktop->ops->read(desktop->backend, element, &info)) {
+        snprintf(error, error_size, "Could not read element bounds");
+        return false;
+    }
+    if (info.offscreen) {
+        snprintf(error, error_size, "Element '%s' is offscreen", info.name);
+        return false;
+    }
+
+    desktop->ops->click(desktop->backend, (info.rect.left + info.rect.right) / 2, (info.rect.top + info.rect.bottom) / 2,
+                        button, count);
+    return true;
+}
+
+static bool send_keys(const Desktop* desktop, const KeyEventBuffer* keys, int delay_ms, char* error, size_t error_size) {
+    int sent = winctrl_keys_send(keys, &desktop->ops->keys, desktop->backend, delay_ms);
+    if (sent != keys->count) {
+        snprintf(error, error_size, "Input was blocked after %d of %d key events", sent, keys->count);
+        return false;
+    }
+    return true;
+}
+
+bool winctrl_desktop_type(const Desktop* desktop, KeyEventBuffer* keys, const char* text, int delay_ms,
+                          char* error, size_t error_size) {
+    winctrl_keys_clear(keys);
+    return winctrl_keys_encode(keys, text, desktop->ops->map_key, desktop->backend, error, error_size) &&
+           send_keys(desktop, keys, delay_ms, error, error_size);
+}
+
+bool winctrl_desktop_chord(const Desktop* desktop, KeyEventBuffer* keys, const uint16_t* modifiers,
+                           int modifier_count, uint16_t key, char* error, size_t error_size) {
+    winctrl_keys_clear(keys);
+    if (!winctrl_keys_chord(keys, modifiers, modifier_count, key)) {
+        snprintf(error, error_size, "Out of memory encoding key events");
+        return false;
+    }
+    return send_keys(desktop, keys, 0, error, error_size);
+}
+
+uint16_t winctrl_desktop_modifier_key(const char* name) {
+    if (strcmp(name, "CTRL") == 0) return KEY_VK_CONTROL;
+    if (strcmp(name, "ALT") == 0) return 0x12;
+    if (strcmp(name, "SHIFT") == 0) return KEY_VK_SHIFT;
+    if (strcmp(name, "WIN") == 0) return 0x5B;
+    return 0;
+}
+
+uint16_t winctrl_desktop_named_key(const Desktop* desktop, const char* name) {
+    if (name[0] && !name[1]) {
+        uint16_t vkey = 0, scan = 0;
+        uint8_t state = 0;
+        if (desktop->ops->map_key && desktop->ops->map_key(desktop->backend, (unsigned char)name[0], &vkey, &scan, &state)) {
+            return vkey;
+        }
+        return winctrl_keys_us_layout(NULL, (unsigned char)name[0], &vkey, &scan, &state) ? vkey : 0;
+    }
+    if (strcmp(name, "TAB") == 0) return KEY_VK_TAB;
+    if (strcmp(name, "ENTER") == 0) return KEY_VK_RETURN;
+    if (strcmp(name, "ESC") == 0) return 0x1B;
+    if (strcmp(name, "DELETE") == 0) return 0x2E;
+    return 0;
+}
+
+static const char* const ACTION_NAMES[] = {
+    "invoke", "set the value of", "toggle", "expand", "collapse", "select", "focus"
+};
+
+bool winctrl_desktop_perform(const Desktop* desktop, void* element, DesktopAction action, const char* value,
+                             KeyEventBuffer* keys, int delay_ms, char* error, size_t error_size) {
+    int status = desktop->ops->act(desktop->backend, element, action, value);
+    if (status == DESKTOP_DONE) {
+        return true;
+    }
+    if (status == DESKTOP_FAILED) {
+        snprintf(error, error_size, "Failed to %s element", ACTION_NAMES[action]);
+        return false;
+    }
+
+    if (action != DESKTOP_SET_VALUE) {
+        printf("Element has no pattern to %s it, clicking it\n", ACTION_NAMES[action]);
+        return winctrl_desktop_click(desktop, element, DESKTOP_LEFT, 1, error, error_size);
+    }
+
+    printf("Element has no Value pattern, typing the value\n");
+    static const uint16_t CTRL[] = { KEY_VK_CONTROL };
+    if (desktop->ops->act(desktop->backend, element, DESKTOP_FOCUS, NULL) != DESKTOP_DONE) {
+        snprintf(error, error_size, "Could not focus element to type its value");
+        return false;
+    }
+    return winctrl_desktop_chord(desktop, keys, CTRL, 1, 'A', error, error_size) &&
+           winctrl_desktop_type(desktop, keys, value, delay_ms, error, error_size);
+}
+
+/* Toggling cycles through off, on and, for three-state boxes, indeterminate, so it takes at most two toggles. */
+bool winctrl_desktop_set_toggle(const Desktop* desktop, void* element, bool on, char* error, size_t error_size) {
+    int wanted = on ? 1 : 0;
+    int state = desktop->ops->toggle_state(desktop->backend, element);
+    if (state < 0) {
+        snprintf(error, error_size, "Element has no Toggle pattern, so its state cannot be set");
+        return false;
+    }
+    for (int i = 0; state >= 0 && state != wanted && i < 2; i++) {
+        state = desktop->ops->act(desktop->backend, element, DESKTOP_TOGGLE, NULL) == DESKTOP_DONE
+            ? desktop->ops->toggle_state(desktop->backend, element)
+            : -1;
+    }
+    if (state != wanted) {
+        snprintf(error, error_size, "Could not turn element %s", on ? "on" : "off");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Combo boxes often create their list items only when the list is open,
+ * so the list is expanded before the item is looked up by name.
+ */
+bool winctrl_desktop_select_item(const Desktop* desktop, void* element, const char* item,
+                                 char* error, size_t error_size) {
+    if (desktop->ops->act(desktop->backend, element, DESKTOP_EXPAND, NULL) == DESKTOP_FAILED) {
+        snprintf(error, error_size, "Failed to open combo box");
+        return false;
+    }
+
+    Locator locator = { NULL, NULL, -1, item };
+    SelectorMatches matches = { NULL, 0, 0 };
+    bool searched = desktop->ops->find(desktop->backend, element, true, &locator, true, &matches);
+    void* found = matches.count > 0 ? matches.items[0] : NULL;
+    free(matches.items);
+
+    bool selected = false;
+    if (!searched || !found) {
+        snprintf(error, error_size, "Combo box has no item named '%s'", item);
+    } else {
+        selected = winctrl_desktop_perform(desktop, found, DESKTOP_SELECT, NULL, NULL, 0, error, error_size);
+        desktop->ops->release(desktop->backend, found);
+    }
+    desktop->ops->act(desktop->backend, element, DESKTOP_COLLAPSE, NULL);
+    return selected;
+}
@@ -0,0 +1,111 @@
+#ifndef WINCONTROL_DESKTOP_H
+#define WINCONTROL_DESKTOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "keys.h"
+#include "locator.h"
+#include "registry.h"
+#include "selector.h"
+
+typedef struct {
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+} DesktopRect;
+
+typedef struct {
+    char name[256];
+    char automation_id[128];
+    char class_name[128];
+    int control_type;
+    DesktopRect rect;
+    bool enabled;
+    bool offscreen;
+} ElementInfo;
+
+typedef enum {
+    DESKTOP_INVOKE,
+    DESKTOP_SET_VALUE,
+    DESKTOP_TOGGLE,
+    DESKTOP_EXPAND,
+    DESKTOP_COLLAPSE,
+    DESKTOP_SELECT,
+    DESKTOP_FOCUS
+} DesktopAction;
+
+typedef enum {
+    DESKTOP_LEFT,
+    DESKTOP_RIGHT
+} DesktopButton;
+
+/* Results of act: the control did it, has no pattern for it, or failed. */
+#define DESKTOP_DONE 1
+#define DESKTOP_UNSUPPORTED 0
+#define DESKTOP_FAILED -1
+
+/*
+ * Everything the automation commands need from the platform. Elements
+ * are opaque; find returns new references in matches, like the selector
+ * tree it doubles as, and release drops them. window_root returns a new
+ * reference to a top-level window's element, which main_window in
+ * processes found. Expanding something already expanded, or collapsing
+ * something collapsed, is DESKTOP_DONE. toggle_state returns 0 for off,
+ * 1 for on, 2 for indeterminate and -1 without a toggle pattern. map_key
+ * has the layout argument of KeyLayoutMap set to backend.
+ */
+typedef struct {
+    ProcessSourceOps processes;
+    void* (*window_root)(void* backend, uintptr_t window);
+    bool (*find)(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+                 SelectorMatches* matches);
+    void (*release)(void* backend, void* element);
+    bool (*read)(void* backend, void* element, ElementInfo* info);
+    bool (*read_value)(void* backend, void* element, char* value, size_t value_size);
+    int (*act)(void* backend, void* element, DesktopAction action, const char* value);
+    int (*toggle_state)(void* backend, void* element);
+    void (*click)(void* backend, int x, int y, DesktopButton button, int count);
+    KeyLayoutMap map_key;
+    KeySinkOps keys;
+} DesktopOps;
+
+typedef struct {
+    const DesktopOps* ops;
+    void* backend;
+} Desktop;
+
+/* Returns 1 with the first match in element, 0 when nothing matches, -1 on a bad selector or failed search. */
+int winctrl_desktop_find(const Desktop* desktop, void* root, const char* selector, void** element,
+                         char* error, size_t error_size);
+
+bool winctrl_desktop_click(const Desktop* desktop, void* element, DesktopButton button, int count,
+                           char* error, size_t error_size);
+bool winctrl_desktop_type(const Desktop* desktop, KeyEventBuffer* keys, const char* text, int delay_ms,
+                          char* error, size_t error_size);
+bool winctrl_desktop_chord(const Desktop* desktop, KeyEventBuffer* keys, const uint16_t* modifiers,
+                           int modifier_count, uint16_t key, char* error, size_t error_size);
+
+/*
+ * Key names of SendModKey: the virtual key of CTRL, ALT, SHIFT or WIN,
+ * and of TAB, ENTER, ESC, DELETE or a single character on the desktop's
+ * layout, or the US one when it has no key for it. Both return 0 for a name they do not know.
+ */
+uint16_t winctrl_desktop_modifier_key(const char* name);
+uint16_t winctrl_desktop_named_key(const Desktop* desktop, const char* name);
+
+/*
+ * Runs an action through the element's pattern and falls back to input
+ * when it has none: invoke, toggle, expand, collapse and select click the
+ * element, and setting a value focuses it, selects all and types.
+ */
+bool winctrl_desktop_perform(const Desktop* desktop, void* element, DesktopAction action, const char* value,
+                             KeyEventBuffer* keys, int delay_ms, char* error, size_t error_size);
+/* Toggles until the element is on or off; needs a toggle pattern to read the state. */
+bool winctrl_desktop_set_toggle(const Desktop* desktop, void* element, bool on, char* error, size_t error_size);
+/* Opens a combo box, selects its item with this name and closes it again. */
+bool winctrl_desktop_select_item(const Desktop* desktop, void* element, const char* item,
+                                 char* error, size_t error_size);
+
+#endif
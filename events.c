@@ -0,0 +1,174 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "events.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static bool simulated_subscribe(void* source, void* root, UiEventCallback callback, void* user) {
+    SimulatedEventSource* sim = source;
+    sim->root = root;
+    sim->callback = callback;
+    sim->user = user;
+    return true;
+}
+
+static void simulated_unsubscribe(void* source) {
+    SimulatedEventSource* sim = source;
+    sim->root = NULL;
+    sim->callback = NULL;
+    sim->user = NULL;
+}
+
+void winctrl_simulated_events_init(SimulatedEventSource* sim, UiEventSource* source) {
+    memset(sim, 0, sizeof(*sim));
+    source->ops.subscribe = simulated_subscribe;
+    source->ops.unsubscribe = simulated_unsubscribe;
+    source->source = sim;
+}
+
+/* Delivers on the calling thread; fire from another thread to mimic UI Automation. */
+void winctrl_simulated_events_fire(SimulatedEventSource* sim, UiEventKind kind) {
+    if (sim->callback) {
+        sim->fired++;
+        sim->callback(sim->user, kind);
+    }
+}
+
+#ifdef _WIN32
+
+static long long monotonic_ms(void) {
+    return (long long)GetTickCount64();
+}
+
+bool winctrl_waiter_init(UiWaiter* waiter) {
+    memset(waiter, 0, sizeof(*waiter));
+    waiter->event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    return waiter->event != NULL;
+}
+
+void winctrl_waiter_signal(UiWaiter* waiter) {
+    SetEvent(waiter->event);
+}
+
+static void reset_waiter(UiWaiter* waiter) {
+    ResetEvent(waiter->event);
+}
+
+static bool wait_for_signal(UiWaiter* waiter, int timeout_ms) {
+    return WaitForSingleObject(waiter->event, (DWORD)timeout_ms) == WAIT_OBJECT_0;
+}
+
+void winctrl_waiter_free(UiWaiter* waiter) {
+    if (waiter->event) {
+        CloseHandle(waiter->event);
+        waiter->event = NULL;
+    }
+}
+
+#else
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool winctrl_waiter_init(UiWaiter* waiter) {
+    memset(waiter, 0, sizeof(*waiter));
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0) {
+        return false;
+    }
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    bool ok = pthread_mutex_init(&waiter->lock, NULL) == 0;
+    if (ok && pthread_cond_init(&waiter->cond, &attr) != 0) {
+        pthread_mutex_destroy(&waiter->lock);
+        ok = false;
+    }
+    pthread_condattr_destroy(&attr);
+    return ok;
+}
+
+void winctrl_waiter_signal(UiWaiter* waiter) {
+    pthread_mutex_lock(&waiter->lock);
+    waiter->pending = true;
+    pthread_cond_signal(&waiter->cond);
+    pthread_mutex_unlock(&waiter->lock);
+}
+
+static void reset_waiter(UiWaiter* waiter) {
+    pthread_mutex_lock(&waiter->lock);
+    waiter->pending = false;
+    pthread_mutex_unlock(&waiter->lock);
+}
+
+static bool wait_for_signal(UiWaiter* waiter, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&waiter->lock);
+    while (!waiter->pending) {
+        if (pthread_cond_timedwait(&waiter->cond, &waiter->lock, &deadline) != 0) {
+            break;
+        }
+    }
+    bool signalled = waiter->pending;
+    waiter->pending = false;
+    pthread_mutex_unlock(&waiter->lock);
+    return signalled;
+}
+
+void winctrl_waiter_free(UiWaiter* waiter) {
+    pthread_cond_destroy(&waiter->cond);
+    pthread_mutex_destroy(&waiter->lock);
+}
+
+#endif
+
+bool winctrl_waiter_wait(UiWaiter* waiter, int timeout_ms) {
+    if (wait_for_signal(waiter, timeout_ms)) {
+        waiter->wakeups++;
+        return true;
+    }
+    waiter->polls++;
+    return false;
+}
+
+int winctrl_wait_until(UiWaiter* waiter, WaitProbe probe, void* user, int timeout_ms, int max_poll_ms) {
+    long long deadline = monotonic_ms() + timeout_ms;
+    int poll_ms = WAIT_POLL_INITIAL_MS < max_poll_ms ? WAIT_POLL_INITIAL_MS : max_poll_ms;
+
+    /* Events raised before the first probe are already reflected in its result. */
+    reset_waiter(waiter);
+    for (;;) {
+        int status = probe(user);
+        if (status != 0) {
+            return status;
+        }
+
+        long long remaining = deadline - monotonic_ms();
+        if (remaining <= 0) {
+            return 0;
+        }
+
+        if (wait_for_signal(waiter, remaining < poll_ms ? (int)remaining : poll_ms)) {
+            waiter->wakeups++;
+        } else {
+            waiter->polls++;
+            poll_ms = poll_ms * 2 < max_poll_ms ? poll_ms * 2 : max_poll_ms;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef WINCONTROL_EVENTS_H
+#define WINCONTROL_EVENTS_H
+
+#include <stdbool.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef enum {
+    UI_EVENT_STRUCTURE_CHANGED,
+    UI_EVENT_PROPERTY_CHANGED,
+    UI_EVENT_WINDOW_OPENED
+} UiEventKind;
+
+/* May be called on any thread, so it must only do thread-safe work. */
+typedef void (*UiEventCallback)(void* user, UiEventKind kind);
+
+/*
+ * Reports changes anywhere below a root element and top-level windows
+ * being opened. The Windows source registers UI Automation handlers; the
+ * simulated source below fires events on request.
+ * Subscribing again replaces the previous subscription.
+ */
+typedef struct {
+    bool (*subscribe)(void* source, void* root, UiEventCallback callback, void* user);
+    void (*unsubscribe)(void* source);
+} UiEventSourceOps;
+
+typedef struct {
+    UiEventSourceOps ops;
+    void* source;
+} UiEventSource;
+
+#define WAIT_POLL_INITIAL_MS 20
+
+/*
+ * Lets the thread running the script sleep until a UI event arrives.
+ * Signals from event threads are coalesced, so a burst of events causes
+ * a single wakeup.
+ */
+typedef struct {
+#ifdef _WIN32
+    void* event;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool pending;
+#endif
+    long wakeups;
+    long polls;
+} UiWaiter;
+
+/* Returns 1 when the awaited state is reached, 0 to keep waiting, -1 on error. */
+typedef int (*WaitProbe)(void* user);
+
+bool winctrl_waiter_init(UiWaiter* waiter);
+void winctrl_waiter_signal(UiWaiter* waiter);
+void winctrl_waiter_free(UiWaiter* waiter);
+/* Sleeps up to timeout_ms; returns true early when signalled. */
+bool winctrl_waiter_wait(UiWaiter* waiter, int timeout_ms);
+
+/*
+ * Runs probe once, then again after every event signal. Events can be
+ * missed (providers that raise none, windows outside the subscription),
+ * so it also polls, doubling the interval from WAIT_POLL_INITIAL_MS up to
+ * max_poll_ms. Returns the probe's 1 or -1, or 0 once timeout_ms passes.
+ */
+int winctrl_wait_until(UiWaiter* waiter, WaitProbe probe, void* user, int timeout_ms, int max_poll_ms);
+
+typedef struct {
+    void* root;
+    UiEventCallback callback;
+    void* user;
+    long fired;
+} SimulatedEventSource;
+
+void winctrl_simulated_events_init(SimulatedEventSource* sim, UiEventSource* source);
+void winctrl_simulated_events_fire(SimulatedEventSource* sim, UiEventKind kind);
+
+#endif
@@ -0,0 +1,777 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "clock.h"
+#include "desktop.h"
+#include "registry.h"
+#include "script.h"
+#include "settle.h"
+#include "simdesktop.h"
+#include "trace.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WAIT_POLL_MS 100
+
+/*
+ * Runs scripts against a simulated desktop loaded from JSON, on any
+ * platform. The element commands go through the same desktop.c code as
+ * on Windows; only the backend differs. Every wait, including the
+ * simulated call latency, goes through clock, which --virtual-time
+ * replaces with a virtual one. With -p the desktop is a recorded trace
+ * instead, and -r records the calls a run makes.
+ */
+struct WinControlContext {
+    Desktop desktop;
+    SimDesktop sim;
+    TraceReplay replay;
+    TraceRecorder recorder;
+    bool replaying;
+    Clock clock;
+    VirtualClock virtual_clock;
+    SettlePolicies settle;
+    ProcessRegistry processes;
+    uint32_t process_id;
+    void* root;
+    VariableContext vars;
+    ModuleCache modules;
+    int if_condition_slot;
+    int contains_result_slot;
+    int typing_delay_ms;
+    KeyEventBuffer keys;
+    long traced_calls;
+    char last_error[256];
+};
+
+static bool equals_ignore_case(const char* a, const char* b) {
+    for (; *a && *b; a++, b++) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) return false;
+    }
+    return *a == *b;
+}
+
+static const char* operand_value(WinControlContext* ctx, const Operand* operand) {
+    if (operand->slot < 0) {
+        return operand->str;
+    }
+
+    const VariableValue* value = ctx->vars.variables[operand->slot].value;
+    if (!value) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Variable used before it was set: %s", operand->str + 1);
+        return NULL;
+    }
+    return value->data;
+}
+
+static long desktop_calls(const WinControlContext* ctx) {
+    return ctx->replaying ? ctx->replay.replayed + ctx->replay.misses : ctx->sim.calls;
+}
+
+void winctrl_trace_finished(WinControlContext* ctx, const Instruction* insn) {
+    printf("Desktop calls for %s: %ld\n", insn->def->name, desktop_calls(ctx) - ctx->traced_calls);
+    ctx->traced_calls = desktop_calls(ctx);
+}
+
+static bool attached(WinControlContext* ctx) {
+    if (!ctx->root) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "No window attached");
+        return false;
+    }
+    return true;
+}
+
+/* The simulated desktop is never busy with input; every change it makes counts as a UI change. */
+static long long sim_settle_now(void* signals) {
+    WinControlContext* ctx = signals;
+    return winctrl_clock_now_ms(&ctx->clock);
+}
+
+static void sim_settle_wait(void* signals, int timeout_ms) {
+    WinControlContext* ctx = signals;
+    winctrl_clock_sleep_ms(&ctx->clock, timeout_ms);
+}
+
+static long sim_settle_changes(void* signals) {
+    WinControlContext* ctx = signals;
+    return ctx->sim.changes;
+}
+
+static bool sim_settle_input_idle(void* signals) {
+    (void)signals;
+    return true;
+}
+
+static const SettleSignalOps SIM_SETTLE_OPS = {
+    sim_settle_now,
+    sim_settle_wait,
+    sim_settle_changes,
+    sim_settle_input_idle
+};
+
+/* Runs the action's settle policy after it succeeded; a settle that times out does not fail the action. */
+static bool settle_after(WinControlContext* ctx, SettleAction action, bool done) {
+    if (done && ctx->root) {
+        winctrl_settle(&ctx->settle, &ctx->settle.policies[action], &SIM_SETTLE_OPS, ctx);
+    }
+    return done;
+}
+
+/* Returns a new reference to the first element the selector operand finds from the attached window. */
+static void* find_selector(WinControlContext* ctx, const Operand* operand) {
+    const char* selector = operand_value(ctx, operand);
+    void* element = NULL;
+    if (!selector || !attached(ctx) ||
+        winctrl_desktop_find(&ctx->desktop, ctx->root, selector, &element, ctx->last_error,
+                             sizeof(ctx->last_error)) != 1) {
+        return NULL;
+    }
+    return element;
+}
+
+static bool handle_attach_process(WinControlContext* ctx, const Instruction* insn) {
+    if (insn->argc != 1) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Named attachments are not simulated");
+        return false;
+    }
+    printf("Attaching to process: %s\n", insn->args[0].str);
+    uint32_t pid = winctrl_registry_find_name(&ctx->processes, insn->args[0].str);
+    uintptr_t window = pid ? winctrl_registry_main_window(&ctx->processes, pid) : 0;
+    void* root = window ? ctx->desktop.ops->window_root(ctx->desktop.backend, window) : NULL;
+    if (!root) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Process not found or has no window: %s",
+                 insn->args[0].str);
+        return false;
+    }
+
+    if (ctx->root) {
+        ctx->desktop.ops->release(ctx->desktop.backend, ctx->root);
+    }
+    ctx->process_id = pid;
+    ctx->root = root;
+    printf("Attached to PID %u\n", (unsigned)pid);
+    return true;
+}
+
+static bool click_at(WinControlContext* ctx, const Instruction* insn, DesktopButton button, int count) {
+    ctx->desktop.ops->click(ctx->desktop.backend, insn->args[0].num, insn->args[1].num, button, count);
+    return settle_after(ctx, SETTLE_INPUT, true);
+}
+
+static bool handle_click(WinControlContext* ctx, const Instruction* insn) {
+    return click_at(ctx, insn, DESKTOP_LEFT, 1);
+}
+
+static bool handle_right_click(WinControlContext* ctx, const Instruction* insn) {
+    return click_at(ctx, insn, DESKTOP_RIGHT, 1);
+}
+
+static bool handle_double_click(WinControlContext* ctx, const Instruction* insn) {
+    return click_at(ctx, insn, DESKTOP_LEFT, 2);
+}
+
+static bool handle_send_keystroke(WinControlContext* ctx, const Instruction* insn) {
+    const char* text = operand_value(ctx, &insn->args[0]);
+    if (!text) {
+        return false;
+    }
+    printf("Sending keystroke: %s\n", text);
+    return settle_after(ctx, SETTLE_INPUT, winctrl_desktop_type(&ctx->desktop, &ctx->keys, text, ctx->typing_delay_ms,
+                                                                ctx->last_error, sizeof(ctx->last_error)));
+}
+
+static bool handle_set_delay(WinControlContext* ctx, const Instruction* insn) {
+    ctx->typing_delay_ms = insn->args[0].num;
+    return true;
+}
+
+static bool handle_sleep(WinControlContext* ctx, const Instruction* insn) {
+    printf("Sleeping for %d ms\n", insn->args[0].num);
+    winctrl_clock_sleep_ms(&ctx->clock, insn->args[0].num);
+    return true;
+}
+
+static bool parse_milliseconds(WinControlContext* ctx, const Operand* operand, int* milliseconds) {
+    const char* text = operand_value(ctx, operand);
+    if (!text) {
+        return false;
+    }
+    char* end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end || value < 0 || value > INT_MAX) {
+        return false;
+    }
+    *milliseconds = (int)value;
+    return true;
+}
+
+static bool handle_wait_idle(WinControlContext* ctx, const Instruction* insn) {
+    int timeout_ms = 0;
+    if (insn->argc > 1 || (insn->argc == 1 && !parse_milliseconds(ctx, &insn->args[0], &timeout_ms))) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Usage: WaitIdle [timeout_ms]");
+        return false;
+    }
+    SettlePolicy policy = ctx->settle.policies[SETTLE_IDLE];
+    if (timeout_ms > 0) {
+        policy.timeout_ms = timeout_ms;
+    }
+    printf("Waiting for the application to become idle\n");
+    if (ctx->root && !winctrl_settle(&ctx->settle, &policy, &SIM_SETTLE_OPS, ctx)) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Application did not become idle within %d ms",
+                 policy.timeout_ms);
+        return false;
+    }
+    return true;
+}
+
+static bool handle_set_settle(WinControlContext* ctx, const Instruction* insn) {
+    SettleAction action;
+    if (!winctrl_settle_action_from_name(insn->args[0].str, &action)) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error),
+                 "Unknown settle action '%s' (expected input, element or idle)", insn->args[0].str);
+        return false;
+    }
+    SettlePolicy* policy = &ctx->settle.policies[action];
+    policy->min_ms = insn->args[1].num;
+    policy->quiet_ms = insn->args[2].num;
+    policy->timeout_ms = insn->args[3].num;
+    return true;
+}
+
+static bool click_selector(WinControlContext* ctx, const Instruction* insn, DesktopButton button, int count) {
+    void* element = find_selector(ctx, &insn->args[0]);
+    if (!element) {
+        return false;
+    }
+    bool clicked = winctrl_desktop_click(&ctx->desktop, element, button, count, ctx->last_error,
+                                         sizeof(ctx->last_error));
+    ctx->desktop.ops->release(ctx->desktop.backend, element);
+    return settle_after(ctx, SETTLE_ELEMENT, clicked);
+}
+
+static bool handle_click_selector(WinControlContext* ctx, const Instruction* insn) {
+    return click_selector(ctx, insn, DESKTOP_LEFT, 1);
+}
+
+static bool handle_right_click_selector(WinControlContext* ctx, const Instruction* insn) {
+    return click_selector(ctx, insn, DESKTOP_RIGHT, 1);
+}
+
+static bool handle_double_click_selector(WinControlContext* ctx, const Instruction* insn) {
+    return click_selector(ctx, insn, DESKTOP_LEFT, 2);
+}
+
+static bool perform_selector(WinControlContext* ctx, const Instruction* insn, DesktopAction action,
+                             const char* value) {
+    void* element = find_selector(ctx, &insn->args[0]);
+    if (!element) {
+        return false;
+    }
+    bool done = winctrl_desktop_perform(&ctx->desktop, element, action, value, &ctx->keys, ctx->typing_delay_ms,
+                                        ctx->last_error, sizeof(ctx->last_error));
+    ctx->desktop.ops->release(ctx->desktop.backend, element);
+    return settle_after(ctx, SETTLE_ELEMENT, done);
+}
+
+static bool handle_invoke_selector(WinControlContext* ctx, const Instruction* insn) {
+    return perform_selector(ctx, insn, DESKTOP_INVOKE, NULL);
+}
+
+static bool handle_set_element_value(WinControlContext* ctx, const Instruction* insn) {
+    const char* value = operand_value(ctx, &insn->args[1]);
+    return value && perform_selector(ctx, insn, DESKTOP_SET_VALUE, value);
+}
+
+static bool handle_expand(WinControlContext* ctx, const Instruction* insn) {
+    return perform_selector(ctx, insn, DESKTOP_EXPAND, NULL);
+}
+
+static bool handle_collapse(WinControlContext* ctx, const Instruction* insn) {
+    return perform_selector(ctx, insn, DESKTOP_COLLAPSE, NULL);
+}
+
+static bool handle_toggle(WinControlContext* ctx, const Instruction* insn) {
+    const char* state = insn->argc > 1 ? operand_value(ctx, &insn->args[1]) : "";
+    if (!state) {
+        return false;
+    }
+    if (insn->argc > 2 || (state[0] && !equals_ignore_case(state, "on") && !equals_ignore_case(state, "off"))) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Usage: Toggle \"selector\" [on|off]");
+        return false;
+    }
+    if (!state[0]) {
+        return perform_selector(ctx, insn, DESKTOP_TOGGLE, NULL);
+    }
+
+    void* element = find_selector(ctx, &insn->args[0]);
+    if (!element) {
+        return false;
+    }
+    bool toggled = winctrl_desktop_set_toggle(&ctx->desktop, element, equals_ignore_case(state, "on"),
+                                              ctx->last_error, sizeof(ctx->last_error));
+    ctx->desktop.ops->release(ctx->desktop.backend, element);
+    return settle_after(ctx, SETTLE_ELEMENT, toggled);
+}
+
+static bool handle_select_item(WinControlContext* ctx, const Instruction* insn) {
+    if (insn->argc > 2) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Usage: SelectItem \"selector\" [\"item\"]");
+        return false;
+    }
+    if (insn->argc == 1) {
+        return perform_selector(ctx, insn, DESKTOP_SELECT, NULL);
+    }
+
+    const char* item = operand_value(ctx, &insn->args[1]);
+    void* element = item ? find_selector(ctx, &insn->args[0]) : NULL;
+    if (!element) {
+        return false;
+    }
+    bool selected = winctrl_desktop_select_item(&ctx->desktop, element, item, ctx->last_error,
+                                                sizeof(ctx->last_error));
+    ctx->desktop.ops->release(ctx->desktop.backend, element);
+    return settle_after(ctx, SETTLE_ELEMENT, selected);
+}
+
+static bool handle_log(WinControlContext* ctx, const Instruction* insn) {
+    (void)ctx;
+    printf("[%s] %s\n", insn->def->name, insn->args[0].str);
+    return true;
+}
+
+static bool handle_set(WinControlContext* ctx, const Instruction* insn) {
+    if (!winctrl_vars_assign(&ctx->vars, insn->args[0].slot, insn->args[1].str, strlen(insn->args[1].str))) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Out of memory while setting variable: %s",
+                 insn->args[0].str);
+        return false;
+    }
+    return true;
+}
+
+static bool test_condition(WinControlContext* ctx, const Instruction* insn, bool* result) {
+    if (!winctrl_condition_evaluate(ctx, &ctx->vars, insn->condition, result,
+                                    ctx->last_error, sizeof(ctx->last_error))) {
+        return false;
+    }
+    return winctrl_vars_assign(&ctx->vars, ctx->if_condition_slot, *result ? "true" : "false", *result ? 4 : 5);
+}
+
+static bool locator_from_operands(WinControlContext* ctx, const Operand* args, int argc, Locator* locator) {
+    const char* id = operand_value(ctx, &args[0]);
+    const char* class_name = argc > 1 ? operand_value(ctx, &args[1]) : "null";
+    if (!id || !class_name || !attached(ctx)) {
+        return false;
+    }
+
+    *locator = (Locator){ strcmp(id, "null") == 0 ? NULL : id, strcmp(class_name, "null") == 0 ? NULL : class_name,
+                          argc > 2 ? args[2].num : -1, NULL };
+    return true;
+}
+
+/* Returns a new reference to the first element under the attached window the locator matches, or NULL. */
+static void* find_properties(WinControlContext* ctx, const Locator* locator, bool* searched) {
+    SelectorMatches matches = { NULL, 0, 0 };
+    *searched = ctx->desktop.ops->find(ctx->desktop.backend, ctx->root, true, locator, true, &matches);
+    void* element = matches.count > 0 ? matches.items[0] : NULL;
+    for (int i = 1; i < matches.count; i++) {
+        ctx->desktop.ops->release(ctx->desktop.backend, matches.items[i]);
+    }
+    free(matches.items);
+    if (!*searched) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Element search failed");
+    }
+    return element;
+}
+
+static bool predicate_element_exists(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    Locator locator;
+    bool searched;
+    if (!locator_from_operands(ctx, args, argc, &locator)) {
+        return false;
+    }
+    void* element = find_properties(ctx, &locator, &searched);
+    *result = element != NULL;
+    if (element) {
+        ctx->desktop.ops->release(ctx->desktop.backend, element);
+    }
+    return searched;
+}
+
+static bool predicate_element_not_exists(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    if (!predicate_element_exists(ctx, args, argc, result)) {
+        return false;
+    }
+    *result = !*result;
+    return true;
+}
+
+/* The element's name, which is the text ContainsElementText checks on Windows too. */
+static bool element_text(WinControlContext* ctx, const Operand* args, int argc, char* text, size_t text_size) {
+    Locator locator;
+    bool searched;
+    void* element = locator_from_operands(ctx, args, argc, &locator) ? find_properties(ctx, &locator, &searched) : NULL;
+    if (!element) {
+        return false;
+    }
+    ElementInfo info;
+    bool read = ctx->desktop.ops->read(ctx->desktop.backend, element, &info);
+    if (read) {
+        snprintf(text, text_size, "%s", info.name);
+    }
+    ctx->desktop.ops->release(ctx->desktop.backend, element);
+    return read;
+}
+
+static bool handle_contains_element_text(WinControlContext* ctx, const Instruction* insn) {
+    char text[256] = {0};
+    const char* search_text = operand_value(ctx, &insn->args[3]);
+    if (!search_text) {
+        return false;
+    }
+    if (!element_text(ctx, insn->args, 3, text, sizeof(text))) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Could not get element text");
+        return false;
+    }
+
+    bool contains = strstr(text, search_text) != NULL;
+    printf("Checking if element text '%s' contains '%s': %s\n", text, search_text, contains ? "yes" : "no");
+    return winctrl_vars_assign(&ctx->vars, ctx->contains_result_slot, contains ? "true" : "false", contains ? 4 : 5);
+}
+
+static bool predicate_contains_element_text(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    char text[256] = {0};
+    const char* search_text = operand_value(ctx, &args[3]);
+    if (!search_text) {
+        return false;
+    }
+    *result = element_text(ctx, args, argc < 3 ? argc : 3, text, sizeof(text)) && strstr(text, search_text) != NULL;
+    return true;
+}
+
+static bool handle_wait_for_element(WinControlContext* ctx, const Instruction* insn) {
+    Locator locator;
+    if (!locator_from_operands(ctx, insn->args, 3, &locator)) {
+        return false;
+    }
+
+    int timeout_ms = insn->args[3].num;
+    printf("Waiting up to %d ms for element\n", timeout_ms);
+    long long deadline = winctrl_clock_now_ms(&ctx->clock) + timeout_ms;
+    for (;;) {
+        bool searched;
+        void* element = find_properties(ctx, &locator, &searched);
+        if (element) {
+            ctx->desktop.ops->release(ctx->desktop.backend, element);
+            return true;
+        }
+        long long remaining = deadline - winctrl_clock_now_ms(&ctx->clock);
+        if (remaining <= 0) {
+            break;
+        }
+        winctrl_clock_sleep_ms(&ctx->clock, remaining < WAIT_POLL_MS ? (int)remaining : WAIT_POLL_MS);
+    }
+    snprintf(ctx->last_error, sizeof(ctx->last_error), "Timeout after %d ms waiting for element: %s", timeout_ms,
+             locator.automation_id ? locator.automation_id : locator.class_name ? locator.class_name : "(any)");
+    return false;
+}
+
+static bool click_properties(WinControlContext* ctx, const Instruction* insn, DesktopButton button, int count) {
+    Locator locator;
+    bool searched;
+    void* element = locator_from_operands(ctx, insn->args, 3, &locator) ? find_properties(ctx, &locator, &searched)
+                                                                          : NULL;
+    if (!element) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Could not find element with specified properties");
+        return false;
+    }
+    bool clicked = winctrl_desktop_click(&ctx->desktop, element, button, count, ctx->last_error,
+                                         sizeof(ctx->last_error));
+    ctx->desktop.ops->release(ctx->desktop.backend, element);
+    return settle_after(ctx, SETTLE_ELEMENT, clicked);
+}
+
+static bool handle_click_properties(WinControlContext* ctx, const Instruction* insn) {
+    return click_properties(ctx, insn, DESKTOP_LEFT, 1);
+}
+
+static bool handle_right_click_properties(WinControlContext* ctx, const Instruction* insn) {
+    return click_properties(ctx, insn, DESKTOP_RIGHT, 1);
+}
+
+static bool handle_double_click_properties(WinControlContext* ctx, const Instruction* insn) {
+    return click_properties(ctx, insn, DESKTOP_LEFT, 2);
+}
+
+/* Presses the last operand with the modifiers named before it held down; unknown modifiers are ignored. */
+static bool send_mod_key(WinControlContext* ctx, const Instruction* insn) {
+    uint16_t modifiers[4];
+    int modifier_count = 0;
+    for (int i = 0; i < insn->argc - 1; i++) {
+        uint16_t modifier = winctrl_desktop_modifier_key(insn->args[i].str);
+        bool repeated = false;
+        for (int j = 0; j < modifier_count; j++) {
+            repeated = repeated || modifiers[j] == modifier;
+        }
+        if (modifier && !repeated) {
+            modifiers[modifier_count++] = modifier;
+        }
+    }
+
+    const char* name = insn->args[insn->argc - 1].str;
+    uint16_t key = winctrl_desktop_named_key(&ctx->desktop, name);
+    if (!key) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Invalid key combination: unknown key %s", name);
+        return false;
+    }
+    return settle_after(ctx, SETTLE_INPUT, winctrl_desktop_chord(&ctx->desktop, &ctx->keys, modifiers, modifier_count,
+                                                                 key, ctx->last_error, sizeof(ctx->last_error)));
+}
+
+static bool handle_send_mod_key(WinControlContext* ctx, const Instruction* insn) {
+    printf("Sending modified key: %s + %s\n", insn->args[0].str, insn->args[1].str);
+    return send_mod_key(ctx, insn);
+}
+
+static bool handle_send_multi_mod_key(WinControlContext* ctx, const Instruction* insn) {
+    if (insn->argc < 1) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Usage: SendMultiModKey [modifiers...] key");
+        return false;
+    }
+    return send_mod_key(ctx, insn);
+}
+
+static bool predicate_element_matches(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    (void)argc;
+    const char* selector = operand_value(ctx, &args[0]);
+    void* element = NULL;
+    if (!selector || !attached(ctx)) {
+        return false;
+    }
+    int status = winctrl_desktop_find(&ctx->desktop, ctx->root, selector, &element, ctx->last_error,
+                                      sizeof(ctx->last_error));
+    if (element) {
+        ctx->desktop.ops->release(ctx->desktop.backend, element);
+    }
+    *result = status == 1;
+    return status >= 0;
+}
+
+static const CommandDefinition COMMAND_TABLE[] = {
+    {"Click", "ii", handle_click},
+    {"RightClick", "ii", handle_right_click},
+    {"DoubleClick", "ii", handle_double_click},
+    {"SendKeystroke", "v", handle_send_keystroke},
+    {"SendModKey", "ss", handle_send_mod_key},
+    {"SendMultiModKey", "*", handle_send_multi_mod_key},
+    {"SetDelay", "i", handle_set_delay},
+    {"Sleep", "i", handle_sleep},
+    {"WaitIdle", "*", handle_wait_idle},
+    {"SetSettle", "siii", handle_set_settle},
+    {"AttachProcess", "s*", handle_attach_process},
+    {"Log", "s", handle_log},
+    {"LogWarning", "s", handle_log},
+    {"LogError", "s", handle_log},
+    {"LogHeader", "s", handle_log},
+    {"SET", "ws", handle_set},
+    {"IF", "*", NULL, FLOW_IF, test_condition},
+    {"ELSEIF", "*", NULL, FLOW_ELSEIF, test_condition},
+    {"ELSE", "", NULL, FLOW_ELSE},
+    {"ENDIF", "", NULL, FLOW_ENDIF},
+    {"LOOP", "v", NULL, FLOW_LOOP},
+    {"ENDLOOP", "", NULL, FLOW_ENDLOOP},
+    {"WHILE", "*", NULL, FLOW_WHILE, test_condition},
+    {"ENDWHILE", "", NULL, FLOW_ENDWHILE},
+    {"FOREACH", "ws*", NULL, FLOW_FOREACH},
+    {"ENDFOREACH", "", NULL, FLOW_ENDFOREACH},
+    {"BREAK", "", NULL, FLOW_BREAK},
+    {"CONTINUE", "", NULL, FLOW_CONTINUE},
+    {"SUB", "s*", NULL, FLOW_SUB},
+    {"ENDSUB", "", NULL, FLOW_ENDSUB},
+    {"RETURN", "", NULL, FLOW_RETURN},
+    {"CALL", "s*", NULL, FLOW_CALL},
+    {"INCLUDE", "s", NULL, FLOW_INCLUDE},
+    {"ElementExists", "v?vn", NULL, FLOW_PREDICATE, NULL, predicate_element_exists},
+    {"ElementNotExists", "v?vn", NULL, FLOW_PREDICATE, NULL, predicate_element_not_exists},
+    {"ElementMatches", "v", NULL, FLOW_PREDICATE, NULL, predicate_element_matches},
+    {"ContainsElementText", "ssnv", handle_contains_element_text, FLOW_NONE, NULL, predicate_contains_element_text},
+    {"WaitForElement", "vvni", handle_wait_for_element},
+    {"ClickElementByProperties", "ssn", handle_click_properties},
+    {"RightClickElementByProperties", "ssn", handle_right_click_properties},
+    {"DoubleClickElementByProperties", "ssn", handle_double_click_properties},
+    {"ClickElement", "v", handle_click_selector},
+    {"RightClickElement", "v", handle_right_click_selector},
+    {"DoubleClickElement", "v", handle_double_click_selector},
+    {"InvokeElement", "v", handle_invoke_selector},
+    {"SetElementValue", "vv", handle_set_element_value},
+    {"Toggle", "v*", handle_toggle},
+    {"Expand", "v", handle_expand},
+    {"Collapse", "v", handle_collapse},
+    {"SelectItem", "v*", handle_select_item},
+    {NULL, NULL, NULL}
+};
+
+static bool run_script_file(WinControlContext* ctx, const char* filename, bool trace) {
+    Script script;
+    if (!winctrl_script_load(filename, &script, ctx->last_error, sizeof(ctx->last_error))) {
+        printf("Error parsing script file: %s\n", ctx->last_error);
+        return false;
+    }
+
+    Program program;
+    bool compiled = winctrl_program_compile(COMMAND_TABLE, script.first, script.count, script.path, &ctx->modules,
+                                            &ctx->vars, &program, ctx->last_error, sizeof(ctx->last_error));
+    winctrl_script_free(&script);
+    if (!compiled) {
+        printf("Error compiling script file: %s\n", ctx->last_error);
+        return false;
+    }
+
+    printf("Executing script with %d commands...\n", program.count);
+
+    int fault_index = -1;
+    ctx->traced_calls = desktop_calls(ctx);
+    bool ok = winctrl_program_run(ctx, &program, trace, ctx->last_error, sizeof(ctx->last_error), &fault_index);
+    if (!ok) {
+        const Instruction* fault = &program.code[fault_index];
+        printf("Error executing command '%s' (%s%sline %d): %s\n",
+            fault->def->name, fault->file ? fault->file : "", fault->file ? " " : "", fault->line, ctx->last_error);
+    }
+    winctrl_program_free(&program);
+
+    printf("Script: %s\n", filename);
+    return ok;
+}
+
+static void print_usage(void) {
+    printf("Usage: WinControlSim (-d <desktop.json> | -p <trace.wct>) -s <script_file> [more_script_files...]\n");
+    printf("                     [-r <trace.wct>] [-v] [--virtual-time]\n\n");
+    printf("Runs WinControl scripts against a simulated desktop described in JSON, or replays a recorded trace.\n");
+    printf("  -p trace.wct                  - Answer desktop calls from a trace recorded with -r\n");
+    printf("  -r trace.wct                  - Record every desktop call with its results and latency\n");
+    printf("  -v                            - Trace every executed command and its desktop calls\n");
+    printf("  --virtual-time                - Advance a virtual clock instead of waiting; timings stay as modeled\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool trace = false;
+    bool virtual_time = false;
+    const char* record_path = NULL;
+    int script_end = argc;
+    while (script_end > 5) {
+        if (strcmp(argv[script_end - 1], "-v") == 0) {
+            trace = true;
+            script_end--;
+        } else if (strcmp(argv[script_end - 1], "--virtual-time") == 0) {
+            virtual_time = true;
+            script_end--;
+        } else if (script_end > 6 && strcmp(argv[script_end - 2], "-r") == 0) {
+            record_path = argv[script_end - 1];
+            script_end -= 2;
+        } else {
+            break;
+        }
+    }
+    bool replaying = argc > 1 && strcmp(argv[1], "-p") == 0;
+    if (script_end < 5 || (!replaying && strcmp(argv[1], "-d") != 0) || strcmp(argv[3], "-s") != 0) {
+        print_usage();
+        return 1;
+    }
+
+    WinControlContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.clock = SYSTEM_CLOCK;
+    if (virtual_time) {
+        ctx.clock = (Clock){ &VIRTUAL_CLOCK_OPS, &ctx.virtual_clock };
+    }
+    ctx.replaying = replaying;
+    if (replaying) {
+        if (!winctrl_trace_replay_load(&ctx.replay, argv[2], ctx.last_error, sizeof(ctx.last_error))) {
+            printf("Error: %s\n", ctx.last_error);
+            return 1;
+        }
+        ctx.replay.clock = ctx.clock;
+        ctx.desktop = (Desktop){ &TRACE_REPLAY_OPS, &ctx.replay };
+        printf("Replaying trace: %d calls, %.3f s recorded%s\n", ctx.replay.record_count, ctx.replay.recorded_us / 1e6,
+            virtual_time ? ", virtual time" : "");
+    } else {
+        if (!winctrl_sim_desktop_load(&ctx.sim, argv[2], ctx.last_error, sizeof(ctx.last_error))) {
+            printf("Error: %s\n", ctx.last_error);
+            return 1;
+        }
+        ctx.sim.clock = ctx.clock;
+        ctx.desktop = (Desktop){ &SIM_DESKTOP_OPS, &ctx.sim };
+        printf("Simulated desktop: %d processes, %d us per call%s\n", ctx.sim.process_count, ctx.sim.latency_us,
+            virtual_time ? ", virtual time" : "");
+    }
+    if (record_path) {
+        if (!winctrl_trace_record_open(&ctx.recorder, &ctx.desktop, &ctx.clock, record_path, ctx.last_error,
+                                       sizeof(ctx.last_error))) {
+            printf("Error: %s\n", ctx.last_error);
+            winctrl_trace_replay_free(&ctx.replay);
+            winctrl_sim_desktop_free(&ctx.sim);
+            return 1;
+        }
+        ctx.desktop = (Desktop){ &TRACE_RECORD_OPS, &ctx.recorder };
+    }
+    winctrl_registry_init(&ctx.processes, &ctx.desktop.ops->processes, ctx.desktop.backend);
+    winctrl_keys_init(&ctx.keys);
+    winctrl_settle_defaults(&ctx.settle);
+    ctx.if_condition_slot = winctrl_vars_declare(&ctx.vars, "_IF_CONDITION");
+    ctx.contains_result_slot = winctrl_vars_declare(&ctx.vars, "_CONTAINS_RESULT");
+    if (ctx.if_condition_slot == -1 || ctx.contains_result_slot == -1 ||
+        !winctrl_vars_assign(&ctx.vars, ctx.if_condition_slot, "true", 4) ||
+        !winctrl_vars_assign(&ctx.vars, ctx.contains_result_slot, "false", 5)) {
+        printf("Error: Failed to allocate variable store\n");
+        winctrl_trace_replay_free(&ctx.replay);
+        winctrl_sim_desktop_free(&ctx.sim);
+        return 1;
+    }
+
+    int status = 0;
+    long long started = ctx.clock.ops->now_us(ctx.clock.clock);
+    long long wall_started = SYSTEM_CLOCK.ops->now_us(NULL);
+    for (int i = 4; i < script_end; i++) {
+        if (!run_script_file(&ctx, argv[i], trace)) {
+            status = 1;
+        }
+    }
+    long long elapsed = ctx.clock.ops->now_us(ctx.clock.clock) - started;
+    long long wall_elapsed = SYSTEM_CLOCK.ops->now_us(NULL) - wall_started;
+
+    if (replaying) {
+        printf("Replayed calls: %ld, %ld not in the trace\n", ctx.replay.replayed, ctx.replay.misses);
+    } else {
+        printf("Simulated calls: %ld, %ld key events, %ld clicks\n", ctx.sim.calls, ctx.sim.keys, ctx.sim.clicks);
+    }
+    printf("Time: %.3f s modeled, %.3f s wall\n", elapsed / 1e6, wall_elapsed / 1e6);
+    if (trace) {
+        printf("Process registry: %ld hits, %ld refreshes, %ld names read, %ld window scans\n",
+            ctx.processes.hits, ctx.processes.refreshes, ctx.processes.names_read, ctx.processes.window_scans);
+        printf("Settling: %ld settled, %ld timed out, %lld ms waited\n",
+            ctx.settle.settled, ctx.settle.timeouts, ctx.settle.waited_ms);
+    }
+
+    if (ctx.root) {
+        ctx.desktop.ops->release(ctx.desktop.backend, ctx.root);
+    }
+    if (record_path) {
+        long records = ctx.recorder.records;
+        if (winctrl_trace_record_close(&ctx.recorder, ctx.last_error, sizeof(ctx.last_error))) {
+            printf("Recorded %ld calls to %s\n", records, record_path);
+        } else {
+            printf("Error: %s\n", ctx.last_error);
+            status = 1;
+        }
+    }
+
+    winctrl_vars_free(&ctx.vars);
+    winctrl_modules_free(&ctx.modules);
+    winctrl_keys_free(&ctx.keys);
+    winctrl_registry_free(&ctx.processes);
+    winctrl_trace_replay_free(&ctx.replay);
+    winctrl_sim_desktop_free(&ctx.sim);
+    return status;
+}
@@ -0,0 +1,247 @@
+#include "keys.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void winctrl_keys_init(KeyEventBuffer* buffer) {
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+void winctrl_keys_clear(KeyEventBuffer* buffer) {
+    buffer->count = 0;
+}
+
+void winctrl_keys_free(KeyEventBuffer* buffer) {
+    free(buffer->events);
+    winctrl_keys_init(buffer);
+}
+
+static bool push_event(KeyEventBuffer* buffer, uint16_t code, uint16_t scan, bool up, bool unicode) {
+    if (buffer->count == buffer->capacity) {
+        int capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+        KeyEvent* events = realloc(buffer->events, (size_t)capacity * sizeof(KeyEvent));
+        if (!events) return false;
+        buffer->events = events;
+        buffer->capacity = capacity;
+    }
+    KeyEvent* event = &buffer->events[buffer->count++];
+    event->code = code;
+    event->scan = scan;
+    event->up = up;
+    event->unicode = unicode;
+    event->char_end = false;
+    return true;
+}
+
+static bool push_press(KeyEventBuffer* buffer, uint16_t code, uint16_t scan, bool unicode) {
+    return push_event(buffer, code, scan, false, unicode) && push_event(buffer, code, scan, true, unicode);
+}
+
+/* Returns the number of bytes read, or 0 for an invalid sequence. */
+static int decode_utf8(const unsigned char* text, uint32_t* codepoint) {
+    if (text[0] < 0x80) {
+        *codepoint = text[0];
+        return 1;
+    }
+
+    int length;
+    uint32_t min;
+    if ((text[0] & 0xE0) == 0xC0) {
+        length = 2;
+        min = 0x80;
+        *codepoint = text[0] & 0x1F;
+    } else if ((text[0] & 0xF0) == 0xE0) {
+        length = 3;
+        min = 0x800;
+        *codepoint = text[0] & 0x0F;
+    } else if ((text[0] & 0xF8) == 0xF0) {
+        length = 4;
+        min = 0x10000;
+        *codepoint = text[0] & 0x07;
+    } else {
+        return 0;
+    }
+
+    for (int i = 1; i < length; i++) {
+        if ((text[i] & 0xC0) != 0x80) return 0;
+        *codepoint = (*codepoint << 6) | (text[i] & 0x3F);
+    }
+    if (*codepoint < min || *codepoint > 0x10FFFF || (*codepoint >= 0xD800 && *codepoint <= 0xDFFF)) {
+        return 0;
+    }
+    return length;
+}
+
+static bool push_char(KeyEventBuffer* buffer, uint32_t codepoint, KeyLayoutMap map, void* layout) {
+    if (codepoint == '\n' || codepoint == '\r') {
+        return push_press(buffer, KEY_VK_RETURN, 0, false);
+    }
+    if (codepoint == '\t') {
+        return push_press(buffer, KEY_VK_TAB, 0, false);
+    }
+
+    uint16_t vkey, scan;
+    uint8_t state = 0;
+    if (map && map(layout, codepoint, &vkey, &scan, &state) && !(state & (KEY_STATE_CTRL | KEY_STATE_ALT))) {
+        bool shift = (state & KEY_STATE_SHIFT) != 0;
+        return (!shift || push_event(buffer, KEY_VK_SHIFT, 0, false, false)) &&
+               push_press(buffer, vkey, scan, false) &&
+               (!shift || push_event(buffer, KEY_VK_SHIFT, 0, true, false));
+    }
+
+    if (codepoint < 0x10000) {
+        return push_press(buffer, (uint16_t)codepoint, 0, true);
+    }
+    codepoint -= 0x10000;
+    return push_press(buffer, (uint16_t)(0xD800 + (codepoint >> 10)), 0, true) &&
+           push_press(buffer, (uint16_t)(0xDC00 + (codepoint & 0x3FF)), 0, true);
+}
+
+bool winctrl_keys_encode(KeyEventBuffer* buffer, const char* text, KeyLayoutMap map, void* layout,
+                         char* error, size_t error_size) {
+    const unsigned char* cursor = (const unsigned char*)text;
+    while (*cursor) {
+        if (cursor[0] == '\r' && cursor[1] == '\n') {
+            cursor++;
+            continue;
+        }
+
+        uint32_t codepoint;
+        int length = decode_utf8(cursor, &codepoint);
+        if (length == 0) {
+            snprintf(error, error_size, "Invalid UTF-8 in text at byte %d", (int)(cursor - (const unsigned char*)text));
+            return false;
+        }
+
+        int first = buffer->count;
+        if (!push_char(buffer, codepoint, map, layout)) {
+            snprintf(error, error_size, "Out of memory encoding %d key events", buffer->count);
+            return false;
+        }
+        if (buffer->count > first) {
+            buffer->events[buffer->count - 1].char_end = true;
+        }
+        cursor += length;
+    }
+    return true;
+}
+
+bool winctrl_keys_chord(KeyEventBuffer* buffer, const uint16_t* modifiers, int modifier_count, uint16_t key) {
+    for (int i = 0; i < modifier_count; i++) {
+        if (!push_event(buffer, modifiers[i], 0, false, false)) return false;
+    }
+    if (!push_press(buffer, key, 0, false)) return false;
+    for (int i = modifier_count - 1; i >= 0; i--) {
+        if (!push_event(buffer, modifiers[i], 0, true, false)) return false;
+    }
+    buffer->events[buffer->count - 1].char_end = true;
+    return true;
+}
+
+/* Sends events[0..count) in batches and returns how many were injected. */
+static int send_batches(const KeyEvent* events, int count, const KeySinkOps* ops, void* sink) {
+    int sent = 0;
+    while (sent < count) {
+        int batch = count - sent < KEY_BATCH_MAX ? count - sent : KEY_BATCH_MAX;
+        int injected = ops->send(sink, events + sent, batch);
+        sent += injected > 0 ? injected : 0;
+        if (injected != batch) break;
+    }
+    return sent;
+}
+
+int winctrl_keys_send(const KeyEventBuffer* buffer, const KeySinkOps* ops, void* sink, int delay_ms) {
+    if (delay_ms <= 0) {
+        return send_batches(buffer->events, buffer->count, ops, sink);
+    }
+
+    int sent = 0;
+    int start = 0;
+    for (int i = 0; i < buffer->count; i++) {
+        if (!buffer->events[i].char_end && i + 1 < buffer->count) continue;
+
+        int count = i + 1 - start;
+        int injected = send_batches(buffer->events + start, count, ops, sink);
+        sent += injected;
+        if (injected != count) break;
+        ops->pause(sink, delay_ms);
+        start = i + 1;
+    }
+    return sent;
+}
+
+static int simulated_send(void* sink, const KeyEvent* events, int count) {
+    SimulatedKeySink* sim = sink;
+    sim->calls++;
+    for (int i = 0; i < count; i++) {
+        if (sim->refuse_after > 0 && sim->sent.count >= sim->refuse_after) {
+            return i;
+        }
+        const KeyEvent* event = &events[i];
+        if (!push_event(&sim->sent, event->code, event->scan, event->up, event->unicode)) {
+            return i;
+        }
+        sim->sent.events[sim->sent.count - 1].char_end = event->char_end;
+    }
+    return count;
+}
+
+static void simulated_pause(void* sink, int milliseconds) {
+    SimulatedKeySink* sim = sink;
+    sim->paused_ms += milliseconds;
+}
+
+const KeySinkOps SIMULATED_KEY_SINK_OPS = {
+    simulated_send,
+    simulated_pause
+};
+
+static const char US_DIGIT_SHIFTED[] = ")!@#$%^&*(";
+
+/* Punctuation on the US layout with the OEM virtual key for each, unshifted and shifted. */
+static const struct {
+    char plain;
+    char shifted;
+    uint16_t vkey;
+} US_PUNCTUATION[] = {
+    { ';', ':', 0xBA }, { '=', '+', 0xBB }, { ',', '<', 0xBC }, { '-', '_', 0xBD },
+    { '.', '>', 0xBE }, { '/', '?', 0xBF }, { '`', '~', 0xC0 }, { '[', '{', 0xDB },
+    { '\\', '|', 0xDC }, { ']', '}', 0xDD }, { '\'', '"', 0xDE }
+};
+
+bool winctrl_keys_us_layout(void* layout, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state) {
+    (void)layout;
+    *scan = 0;
+    *state = 0;
+    if (codepoint >= 'a' && codepoint <= 'z') {
+        *vkey = (uint16_t)(codepoint - 'a' + 'A');
+        return true;
+    }
+    if (codepoint >= 'A' && codepoint <= 'Z') {
+        *vkey = (uint16_t)codepoint;
+        *state = KEY_STATE_SHIFT;
+        return true;
+    }
+    if ((codepoint >= '0' && codepoint <= '9') || codepoint == ' ') {
+        *vkey = (uint16_t)codepoint;
+        return true;
+    }
+    if (codepoint == 0 || codepoint >= 0x80) {
+        return false;
+    }
+
+    const char* digit = strchr(US_DIGIT_SHIFTED, (int)codepoint);
+    if (digit) {
+        *vkey = (uint16_t)('0' + (digit - US_DIGIT_SHIFTED));
+        *state = KEY_STATE_SHIFT;
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(US_PUNCTUATION) / sizeof(US_PUNCTUATION[0]); i++) {
+        if (US_PUNCTUATION[i].plain == (char)codepoint || US_PUNCTUATION[i].shifted == (char)codepoint) {
+            *vkey = US_PUNCTUATION[i].vkey;
+            *state = US_PUNCTUATION[i].shifted == (char)codepoint ? KEY_STATE_SHIFT : 0;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,94 @@
+#ifndef WINCONTROL_KEYS_H
+#define WINCONTROL_KEYS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEY_BATCH_MAX 256
+
+#define KEY_VK_RETURN 0x0D
+#define KEY_VK_TAB 0x09
+#define KEY_VK_SHIFT 0x10
+#define KEY_VK_CONTROL 0x11
+
+/* Shift states returned by map, as in the high byte of VkKeyScanEx. */
+#define KEY_STATE_SHIFT 0x01
+#define KEY_STATE_CTRL 0x02
+#define KEY_STATE_ALT 0x04
+
+/*
+ * One key going down or up. A unicode event carries a UTF-16 code unit
+ * in code and needs no keyboard layout; otherwise code is a virtual key
+ * and scan its scan code. char_end marks the last event of a character,
+ * which is where a throttled send may pause.
+ */
+typedef struct {
+    uint16_t code;
+    uint16_t scan;
+    bool up;
+    bool unicode;
+    bool char_end;
+} KeyEvent;
+
+typedef struct {
+    KeyEvent* events;
+    int count;
+    int capacity;
+} KeyEventBuffer;
+
+/*
+ * Looks a character up on the active keyboard layout. Returns false when
+ * the layout has no key for it, in which case it is sent as Unicode.
+ */
+typedef bool (*KeyLayoutMap)(void* layout, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state);
+
+/*
+ * Where encoded events go. send injects count events in order and
+ * returns how many were injected; pause waits between throttled
+ * characters.
+ */
+typedef struct {
+    int (*send)(void* sink, const KeyEvent* events, int count);
+    void (*pause)(void* sink, int milliseconds);
+} KeySinkOps;
+
+void winctrl_keys_init(KeyEventBuffer* buffer);
+void winctrl_keys_clear(KeyEventBuffer* buffer);
+void winctrl_keys_free(KeyEventBuffer* buffer);
+
+/*
+ * Appends the events that type a UTF-8 string. Characters the layout maps
+ * with at most Shift are sent as virtual keys, newlines and tabs as
+ * Return and Tab, and everything else, including characters that need
+ * Ctrl or AltGr, as Unicode events. map may be NULL to send all printable
+ * characters as Unicode.
+ */
+bool winctrl_keys_encode(KeyEventBuffer* buffer, const char* text, KeyLayoutMap map, void* layout,
+                         char* error, size_t error_size);
+
+/* Appends modifiers going down in order, a press of key, and the modifiers going up in reverse. */
+bool winctrl_keys_chord(KeyEventBuffer* buffer, const uint16_t* modifiers, int modifier_count, uint16_t key);
+
+/*
+ * Sends the buffer in batches of up to KEY_BATCH_MAX events. With a delay
+ * of 0 nothing waits; otherwise each character is sent on its own
+ * followed by a pause of delay_ms. Returns the number of events injected,
+ * which is less than the buffer holds when the sink refused some.
+ */
+int winctrl_keys_send(const KeyEventBuffer* buffer, const KeySinkOps* ops, void* sink, int delay_ms);
+
+/* Sink of SIMULATED_KEY_SINK_OPS; keeps every event it is sent. */
+typedef struct {
+    KeyEventBuffer sent;
+    long calls;
+    long paused_ms;
+    int refuse_after;
+} SimulatedKeySink;
+
+extern const KeySinkOps SIMULATED_KEY_SINK_OPS;
+
+/* A layout with the US keys for ASCII letters, digits, space and common punctuation. */
+bool winctrl_keys_us_layout(void* layout, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state);
+
+#endif
@@ -0,0 +1,188 @@
+#include "script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOADER_CHUNK_SIZE (64 * 1024)
+#define LOADER_MAX_TOKENS 64
+
+typedef struct {
+    const char* start;
+    size_t length;
+} Token;
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static int tokenize(const char* line, size_t length, Token* tokens, int max_tokens, int line_number,
+                    char* error, size_t error_size) {
+    const char* p = line;
+    const char* end = line + length;
+    int count = 0;
+
+    while (p < end) {
+        while (p < end && is_blank(*p)) p++;
+        if (p == end || *p == '#') break;
+
+        if (count == max_tokens) {
+            snprintf(error, error_size, "Line %d: Too many parameters (limit is %d)",
+                line_number, max_tokens - 1);
+            return -1;
+        }
+
+        if (*p == '"') {
+            const char* close = memchr(p + 1, '"', (size_t)(end - p - 1));
+            if (!close) {
+                snprintf(error, error_size, "Line %d: Unterminated string", line_number);
+                return -1;
+            }
+            tokens[count].start = p + 1;
+            tokens[count].length = (size_t)(close - p - 1);
+            p = close + 1;
+        } else {
+            const char* start = p;
+            while (p < end && !is_blank(*p) && *p != '#') p++;
+            tokens[count].start = start;
+            tokens[count].length = (size_t)(p - start);
+        }
+        count++;
+    }
+
+    return count;
+}
+
+bool winctrl_script_parse_line(Script* script, const char* line, size_t length, int line_number,
+                               char* error, size_t error_size) {
+    Token tokens[LOADER_MAX_TOKENS];
+    int token_count = tokenize(line, length, tokens, LOADER_MAX_TOKENS, line_number, error, error_size);
+    if (token_count < 0) return false;
+    if (token_count == 0) return true;
+
+    Command* cmd = winctrl_arena_alloc(&script->arena, sizeof(Command));
+    const char** params = NULL;
+    if (cmd && token_count > 1) {
+        params = winctrl_arena_alloc(&script->arena, (size_t)(token_count - 1) * sizeof(const char*));
+    }
+    if (!cmd || (token_count > 1 && !params)) {
+        snprintf(error, error_size, "Line %d: Out of memory while loading script", line_number);
+        return false;
+    }
+
+    cmd->name = winctrl_arena_strndup(&script->arena, tokens[0].start, tokens[0].length);
+    cmd->params = params;
+    cmd->param_count = token_count - 1;
+    cmd->line = line_number;
+    cmd->next = NULL;
+
+    for (int i = 1; i < token_count; i++) {
+        params[i - 1] = winctrl_arena_strndup(&script->arena, tokens[i].start, tokens[i].length);
+        if (!params[i - 1]) {
+            snprintf(error, error_size, "Line %d: Out of memory while loading script", line_number);
+            return false;
+        }
+    }
+    if (!cmd->name) {
+        snprintf(error, error_size, "Line %d: Out of memory while loading script", line_number);
+        return false;
+    }
+
+    if (script->last) {
+        script->last->next = cmd;
+    } else {
+        script->first = cmd;
+    }
+    script->last = cmd;
+    script->count++;
+    return true;
+}
+
+bool winctrl_script_load(const char* filename, Script* script, char* error, size_t error_size) {
+    memset(script, 0, sizeof(*script));
+    script->path = winctrl_arena_strndup(&script->arena, filename, strlen(filename));
+
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        snprintf(error, error_size, "Could not open script file: %s", filename);
+        return false;
+    }
+
+    size_t capacity = LOADER_CHUNK_SIZE;
+    char* buffer = malloc(capacity);
+    size_t filled = 0;
+    int line_number = 0;
+    bool first_chunk = true;
+    bool ok = buffer != NULL;
+    if (!ok) {
+        snprintf(error, error_size, "Out of memory while loading script");
+    }
+
+    while (ok) {
+        if (filled == capacity) {
+            char* grown = realloc(buffer, capacity * 2);
+            if (!grown) {
+                snprintf(error, error_size, "Line %d: Out of memory while loading script", line_number + 1);
+                ok = false;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        size_t read = fread(buffer + filled, 1, capacity - filled, file);
+        if (read == 0 && ferror(file)) {
+            snprintf(error, error_size, "Failed to read script file: %s", filename);
+            ok = false;
+            break;
+        }
+        filled += read;
+        bool at_eof = read == 0;
+
+        size_t consumed = 0;
+        if (first_chunk && filled >= 3 && memcmp(buffer, "\xEF\xBB\xBF", 3) == 0) {
+            consumed = 3;
+        }
+        first_chunk = false;
+
+        for (;;) {
+            const char* newline = memchr(buffer + consumed, '\n', filled - consumed);
+            size_t line_length;
+            if (newline) {
+                line_length = (size_t)(newline - (buffer + consumed));
+            } else if (at_eof && consumed < filled) {
+                line_length = filled - consumed;
+            } else {
+                break;
+            }
+
+            line_number++;
+            if (!winctrl_script_parse_line(script, buffer + consumed, line_length, line_number,
+                                           error, error_size)) {
+                ok = false;
+                break;
+            }
+            consumed += line_length + (newline ? 1 : 0);
+        }
+
+        memmove(buffer, buffer + consumed, filled - consumed);
+        filled -= consumed;
+
+        if (at_eof) break;
+    }
+
+    free(buffer);
+    fclose(file);
+
+    if (!ok) {
+        winctrl_script_free(script);
+    }
+    return ok;
+}
+
+void winctrl_script_free(Script* script) {
+    winctrl_arena_free(&script->arena);
+    script->first = NULL;
+    script->last = NULL;
+    script->count = 0;
+    script->path = NULL;
+}
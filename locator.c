@@ -0,0 +1,171 @@
+#include "locator.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define bump_counter(counter) InterlockedIncrement(counter)
+#define read_counter(counter) InterlockedCompareExchange(counter, 0, 0)
+#else
+#define bump_counter(counter) __atomic_add_fetch(counter, 1, __ATOMIC_SEQ_CST)
+#define read_counter(counter) __atomic_load_n(counter, __ATOMIC_SEQ_CST)
+#endif
+
+static size_t hash_field(size_t hash, const char* str) {
+    if (!str) {
+        return (hash ^ 0xFF) * 16777619u;
+    }
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return (hash ^ 0) * 16777619u;
+}
+
+static size_t hash_locator(const Locator* locator) {
+    size_t hash = 2166136261u;
+    hash = hash_field(hash, locator->automation_id);
+    hash = hash_field(hash, locator->class_name);
+    hash = hash_field(hash, locator->name);
+    hash ^= (size_t)(unsigned int)locator->control_type;
+    return hash * 16777619u;
+}
+
+static bool same_field(const char* a, const char* b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static bool same_locator(const Locator* a, const Locator* b) {
+    return a->control_type == b->control_type &&
+           same_field(a->automation_id, b->automation_id) &&
+           same_field(a->class_name, b->class_name) &&
+           same_field(a->name, b->name);
+}
+
+static const char* copy_field(Arena* arena, const char* str) {
+    return str ? winctrl_arena_strndup(arena, str, strlen(str)) : NULL;
+}
+
+static bool grow_entries(LocatorCache* cache) {
+    size_t capacity = cache->capacity ? cache->capacity * 2 : 64;
+    LocatorEntry* entries = calloc(capacity, sizeof(LocatorEntry));
+    if (!entries) return false;
+
+    for (size_t i = 0; i < cache->capacity; i++) {
+        if (!cache->entries[i].value) continue;
+        size_t slot = cache->entries[i].hash & (capacity - 1);
+        while (entries[slot].value) slot = (slot + 1) & (capacity - 1);
+        entries[slot] = cache->entries[i];
+    }
+
+    free(cache->entries);
+    cache->entries = entries;
+    cache->capacity = capacity;
+    return true;
+}
+
+/* Backward-shift deletion keeps every probe chain intact without tombstones. */
+static void remove_entry(LocatorCache* cache, size_t slot) {
+    size_t mask = cache->capacity - 1;
+    size_t next = (slot + 1) & mask;
+    while (cache->entries[next].value) {
+        size_t home = cache->entries[next].hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            cache->entries[slot] = cache->entries[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    cache->entries[slot].value = NULL;
+    cache->count--;
+}
+
+void winctrl_locator_cache_init(LocatorCache* cache, const LocatorCacheOps* ops, void* backend, int limit) {
+    memset(cache, 0, sizeof(*cache));
+    cache->ops = *ops;
+    cache->backend = backend;
+    cache->limit = limit;
+}
+
+void* winctrl_locator_cache_get(LocatorCache* cache, const Locator* locator) {
+    long changes = read_counter(&cache->changes);
+    if (changes != cache->seen_changes) {
+        cache->seen_changes = changes;
+        if (cache->count > 0) {
+            winctrl_locator_cache_clear(cache);
+            cache->invalidations++;
+        }
+    }
+
+    size_t hash = hash_locator(locator);
+    if (cache->capacity > 0) {
+        size_t slot = hash & (cache->capacity - 1);
+        while (cache->entries[slot].value) {
+            LocatorEntry* entry = &cache->entries[slot];
+            if (entry->hash == hash && same_locator(&entry->key, locator)) {
+                if (!cache->ops.validate || cache->ops.validate(cache->backend, &entry->value)) {
+                    cache->hits++;
+                    return entry->value;
+                }
+                cache->stale++;
+                cache->ops.release(cache->backend, entry->value);
+                remove_entry(cache, slot);
+                break;
+            }
+            slot = (slot + 1) & (cache->capacity - 1);
+        }
+    }
+
+    cache->misses++;
+    void* value = cache->ops.build(cache->backend, locator);
+    if (!value) return NULL;
+
+    if (cache->count >= cache->limit) {
+        winctrl_locator_cache_clear(cache);
+        cache->flushes++;
+    }
+    if (((size_t)cache->count + 1) * 2 > cache->capacity && !grow_entries(cache)) {
+        cache->ops.release(cache->backend, value);
+        return NULL;
+    }
+
+    Locator key = { NULL, NULL, locator->control_type, NULL };
+    key.automation_id = copy_field(&cache->arena, locator->automation_id);
+    key.class_name = copy_field(&cache->arena, locator->class_name);
+    key.name = copy_field(&cache->arena, locator->name);
+    if ((locator->automation_id && !key.automation_id) || (locator->class_name && !key.class_name) ||
+        (locator->name && !key.name)) {
+        cache->ops.release(cache->backend, value);
+        return NULL;
+    }
+
+    size_t slot = hash & (cache->capacity - 1);
+    while (cache->entries[slot].value) slot = (slot + 1) & (cache->capacity - 1);
+    cache->entries[slot].key = key;
+    cache->entries[slot].hash = hash;
+    cache->entries[slot].value = value;
+    cache->count++;
+    return value;
+}
+
+void winctrl_locator_cache_invalidate(LocatorCache* cache) {
+    bump_counter(&cache->changes);
+}
+
+void winctrl_locator_cache_clear(LocatorCache* cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        if (cache->entries[i].value) {
+            cache->ops.release(cache->backend, cache->entries[i].value);
+            cache->entries[i].value = NULL;
+        }
+    }
+    cache->count = 0;
+    winctrl_arena_free(&cache->arena);
+}
+
+void winctrl_locator_cache_free(LocatorCache* cache) {
+    winctrl_locator_cache_clear(cache);
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->capacity = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef WINCONTROL_LOCATOR_H
+#define WINCONTROL_LOCATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+
+/* Describes an element search; NULL strings and a control_type of -1 match anything. */
+typedef struct {
+    const char* automation_id;
+    const char* class_name;
+    int control_type;
+    const char* name;
+} Locator;
+
+/*
+ * Produces the value cached for a locator: a search condition, or the
+ * element a search found. build returns NULL when there is nothing to
+ * cache. validate is optional and is asked on every hit whether a value
+ * is still usable; it may swap in a refreshed value, releasing the old
+ * one. A stale value is released and built again. The Windows
+ * backend works on UI Automation objects; a fake backend can return
+ * anything and count the calls.
+ */
+typedef struct {
+    void* (*build)(void* backend, const Locator* locator);
+    void (*release)(void* backend, void* value);
+    bool (*validate)(void* backend, void** value);
+} LocatorCacheOps;
+
+typedef struct {
+    Locator key;
+    size_t hash;
+    void* value;
+} LocatorEntry;
+
+/*
+ * Maps all four locator fields to a value owned by the cache. When limit
+ * entries are cached the whole cache is flushed, which bounds memory for
+ * scripts whose locators come from data.
+ *
+ * winctrl_locator_cache_invalidate may be called from any thread, such as
+ * a UI Automation event handler; the owning thread drops every entry on
+ * its next lookup.
+ */
+typedef struct {
+    LocatorCacheOps ops;
+    void* backend;
+    Arena arena;
+    LocatorEntry* entries;
+    size_t capacity;
+    int count;
+    int limit;
+    volatile long changes;
+    long seen_changes;
+    long hits;
+    long misses;
+    long stale;
+    long flushes;
+    long invalidations;
+} LocatorCache;
+
+void winctrl_locator_cache_init(LocatorCache* cache, const LocatorCacheOps* ops, void* backend, int limit);
+void* winctrl_locator_cache_get(LocatorCache* cache, const Locator* locator);
+void winctrl_locator_cache_invalidate(LocatorCache* cache);
+void winctrl_locator_cache_clear(LocatorCache* cache);
+void winctrl_locator_cache_free(LocatorCache* cache);
+
+#endif
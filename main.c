@@ -20,26 +20,58 @@ void print_usage(void) {
 
 
     printf("More info: http://www.dries.jp\n\n");
-    printf("Usage: WinControl.exe -s <script_file>\n\n");
+    printf("Usage: WinControl.exe -s <script_file> [more_script_files...] [-r <trace.wct>] [-v]\n\n");
+    printf("  -r trace.wct                  - Record every desktop call, for WinControlSim -p to replay\n");
+    printf("  -v                            - Trace every executed command and its UI Automation calls\n\n");
     printf("Available script commands:\n");
     printf("  AttachProcess \"processname\" - Attach to a running process\n");
+    printf("  AttachProcess \"processname\" AS name - Attach and keep the attachment under a name\n");
+    printf("  USE name                      - Switch to a named attachment\n");
     printf("  BringToFront                  - Bring current window to front\n");
     printf("  Click x y                     - Click at coordinates\n");
     printf("  RightClick x y                - Right click at coordinates\n");
     printf("  DoubleClick x y               - Double click at coordinates\n");
     printf("  SendKeystroke \"text\"        - Send keystrokes\n");
-    printf("  Sleep milliseconds            - Wait specified time\n\n");
+    printf("  Sleep milliseconds            - Wait specified time\n");
+    printf("  WaitIdle [timeout_ms]         - Wait until the application has settled\n");
+    printf("  SetSettle action min quiet timeout - How long input, element or idle waits settle\n");
+    printf("  WaitForElement \"id\" \"class\" \"type\" ms - Wait until an element appears\n");
+    printf("  ClickElement \"Pane[id=main] > Button[name=Save]\" - Click the element a selector finds\n");
+    printf("  RightClickElement / DoubleClickElement \"selector\"\n");
+    printf("  InvokeElement \"selector\"      - Press a button without the mouse\n");
+    printf("  SetElementValue \"selector\" \"text\" - Set the value of a text field\n");
+    printf("  Toggle \"selector\" [on|off]    - Toggle a check box, or set its state\n");
+    printf("  Expand / Collapse \"selector\"  - Expand or collapse a tree item or combo box\n");
+    printf("  SelectItem \"selector\" [\"item\"] - Select a list item, or an item of a combo box\n");
+    printf("  Snapshot                      - Capture the window so element checks run from memory\n");
+    printf("  SaveSnapshot \"file.snap\"      - Write the last snapshot to a file\n\n");
     printf("  SET mytext \"Hello World\"    - Set variable\n  e.g.\n");
     printf("  SendKeystroke \"$mytext\"     - Use variable for SendKeyStroke\n\n");
 
     printf("  Conditional execution:\n");
     printf("  IF ElementExists \"id\" \"class\" \"type\"\n    # code\n  ENDIF\n\n");
+    printf("  IF ElementMatches \"Pane > Button[name=OK]\"\n    # code\n  ENDIF\n\n");
     printf("  IF ElementNotExists \"id\" \"class\" \"type\"\n    # code\n  ENDIF\n\n");
     printf("  IF ContainsElementText \"textbox_id\" \"textbox_class\" \"50011\" \"$mytext\"\n    #blabla\n  ENDIF\n\n");
+    printf("  IF \"$mode\" == \"fast\" AND NOT ElementExists \"id\"\n    # code\n  ENDIF\n\n");
+    printf("  IF ElementExists \"id\"\n    # code\n  ELSEIF ElementExists \"other_id\"\n    # code\n  ELSE\n    # code\n  ENDIF\n\n");
 
 
     printf("");
 
+    printf("  Loops:\n");
+    printf("  LOOP 10\n    # code\n  ENDLOOP\n\n");
+    printf("  WHILE ElementExists \"id\"\n    # code\n  ENDWHILE\n\n");
+    printf("  FOREACH item IN \"a\" \"b\" \"c\"\n    # code using $item\n  ENDFOREACH\n\n");
+    printf("  FOREACH ROW \"data.csv\"\n    # code using one $variable per column\n  ENDFOREACH\n\n");
+    printf("  BREAK / CONTINUE                  - Leave or restart the innermost loop\n\n");
+
+    printf("  Subroutines:\n");
+    printf("  SUB Login user password\n    # code using $user and $password\n  ENDSUB\n\n");
+    printf("  CALL Login \"admin\" \"$pw\"          - Run a SUB with arguments\n");
+    printf("  RETURN                            - Leave the current SUB\n");
+    printf("  INCLUDE \"lib.wc\"                  - Compile another script file in place\n\n");
+
     printf("  Logging:\n");
     printf("  StartLog \"AutomationTest\"       - Create log file and open filestream\n");
     printf("  LogHeader \"Starting test\"       - Create big log entry\n");
@@ -58,8 +90,45 @@ void print_usage(void) {
 
 }
 
+static bool run_script_file(WinControlContext* ctx, const char* filename, bool trace) {
+    Script script;
+    if (!winctrl_parse_script(ctx, filename, &script)) {
+        printf("Error parsing script file: %s\n", winctrl_get_last_error(ctx));
+        return false;
+    }
+
+    Program program;
+    bool compiled = winctrl_compile_script(ctx, &script, &program);
+    winctrl_script_free(&script);
+    if (!compiled) {
+        printf("Error compiling script file: %s\n", winctrl_get_last_error(ctx));
+        return false;
+    }
+
+    printf("Executing script with %d commands...\n", program.count);
+
+    int fault_index = -1;
+    if (!winctrl_run_script(ctx, &program, trace, &fault_index)) {
+        const Instruction* fault = &program.code[fault_index];
+        printf("Error executing command '%s' (%s%sline %d): %s\n",
+            fault->def->name, fault->file ? fault->file : "", fault->file ? " " : "", fault->line,
+            winctrl_get_last_error(ctx));
+    }
+    winctrl_program_free(&program);
+
+    printf("Script: %s\n", filename);
+    return true;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 3 || strcmp(argv[1], "-s") != 0) {
+    bool trace = argc > 3 && strcmp(argv[argc - 1], "-v") == 0;
+    int script_end = trace ? argc - 1 : argc;
+    const char* record_path = NULL;
+    if (script_end > 4 && strcmp(argv[script_end - 2], "-r") == 0) {
+        record_path = argv[script_end - 1];
+        script_end -= 2;
+    }
+    if (script_end < 3 || strcmp(argv[1], "-s") != 0) {
         print_usage();
         return 1;
     }
@@ -70,30 +139,47 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    Command commands[100];
-    int cmd_count = winctrl_parse_script(argv[2], commands, 100);
+    char current_dir[MAX_PATH];
+    GetCurrentDirectoryA(MAX_PATH, current_dir);
+    printf("Current directory: %s\n", current_dir);
 
-    if (cmd_count < 0) {
-        printf("Error parsing script file: %s\n", winctrl_get_last_error(&ctx));
+    if (record_path && !winctrl_start_recording(&ctx, record_path)) {
+        printf("Error: %s\n", winctrl_get_last_error(&ctx));
         winctrl_cleanup(&ctx);
         return 1;
     }
 
-    printf("Executing script with %d commands...\n", cmd_count);
-
-    for (int i = 0; i < cmd_count; i++) {
-        if (!winctrl_execute_command(&ctx, &commands[i])) {
-            printf("Error executing command '%s': %s\n",
-                commands[i].name, winctrl_get_last_error(&ctx));
-            break;
+    /* Scripts run in one session, so files they INCLUDE are parsed once for all of them. */
+    int status = 0;
+    for (int i = 2; i < script_end; i++) {
+        if (!run_script_file(&ctx, argv[i], trace)) {
+            status = 1;
         }
     }
 
-    char current_dir[MAX_PATH];
-    GetCurrentDirectoryA(MAX_PATH, current_dir);
-    printf("Current directory: %s\n", current_dir);
-    printf("Script: %s\n", argv[2]);
+    if (trace) {
+        printf("Condition cache: %ld hits, %ld misses, %ld flushes\n",
+            ctx.conditions.hits, ctx.conditions.misses, ctx.conditions.flushes);
+        for (int i = 0; i < ctx.attachment_count; i++) {
+            const Attachment* attachment = ctx.attachments[i];
+            printf("Element cache%s%s: %ld hits, %ld misses, %ld stale, %ld invalidations\n",
+                attachment->name[0] ? " " : "", attachment->name,
+                attachment->elements.hits, attachment->elements.misses,
+                attachment->elements.stale, attachment->elements.invalidations);
+        }
+        printf("Learned paths: %ld hits, %ld misses, %ld learned\n",
+            ctx.paths.hits, ctx.paths.misses, ctx.paths.learned);
+        printf("Process registry: %ld hits, %ld refreshes, %ld names read, %ld window scans\n",
+            ctx.processes.hits, ctx.processes.refreshes, ctx.processes.names_read, ctx.processes.window_scans);
+        printf("Settling: %ld settled, %ld timed out, %lld ms waited\n",
+            ctx.settle.settled, ctx.settle.timeouts, ctx.settle.waited_ms);
+        printf("UI Automation calls: %ld\n", winctrl_uia_call_count());
+    }
+    if (!winctrl_stop_recording(&ctx)) {
+        printf("Error: %s\n", winctrl_get_last_error(&ctx));
+        status = 1;
+    }
 
     winctrl_cleanup(&ctx);
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
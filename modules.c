@@ -0,0 +1,91 @@
+#include "script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static bool is_absolute(const char* path) {
+    return path[0] == '/' || path[0] == '\\' || (path[0] != '\0' && path[1] == ':');
+}
+
+void winctrl_modules_resolve(const char* origin, const char* path, char* resolved, size_t resolved_size) {
+    size_t directory = 0;
+    if (origin && !is_absolute(path)) {
+        for (size_t i = 0; origin[i]; i++) {
+            if (origin[i] == '/' || origin[i] == '\\') directory = i + 1;
+        }
+    }
+    snprintf(resolved, resolved_size, "%.*s%s", (int)directory, origin ? origin : "", path);
+}
+
+static Module* find_module(ModuleCache* cache, const char* path) {
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->modules[i]->path, path) == 0) {
+            return cache->modules[i];
+        }
+    }
+    return NULL;
+}
+
+bool winctrl_modules_get(ModuleCache* cache, const char* path, const Module** module,
+                         char* error, size_t error_size) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        snprintf(error, error_size, "Could not open included file: %s", path);
+        return false;
+    }
+    long long mtime = (long long)info.st_mtime;
+
+    Module* entry = find_module(cache, path);
+    if (entry && entry->mtime == mtime) {
+        *module = entry;
+        return true;
+    }
+
+    if (!entry) {
+        if (cache->count == cache->capacity) {
+            int capacity = cache->capacity ? cache->capacity * 2 : 8;
+            Module** modules = realloc(cache->modules, (size_t)capacity * sizeof(Module*));
+            if (!modules) {
+                snprintf(error, error_size, "Out of memory while loading %s", path);
+                return false;
+            }
+            cache->modules = modules;
+            cache->capacity = capacity;
+        }
+
+        entry = calloc(1, sizeof(Module));
+        char* copy = malloc(strlen(path) + 1);
+        if (!entry || !copy) {
+            free(entry);
+            free(copy);
+            snprintf(error, error_size, "Out of memory while loading %s", path);
+            return false;
+        }
+        strcpy(copy, path);
+        entry->path = copy;
+        cache->modules[cache->count++] = entry;
+    } else {
+        winctrl_script_free(&entry->script);
+    }
+
+    /* A failed load leaves an empty entry that is retried on the next INCLUDE. */
+    entry->mtime = -1;
+    if (!winctrl_script_load(path, &entry->script, error, error_size)) {
+        return false;
+    }
+    entry->mtime = mtime;
+    cache->loads++;
+    *module = entry;
+    return true;
+}
+
+void winctrl_modules_free(ModuleCache* cache) {
+    for (int i = 0; i < cache->count; i++) {
+        winctrl_script_free(&cache->modules[i]->script);
+        free(cache->modules[i]->path);
+        free(cache->modules[i]);
+    }
+    free(cache->modules);
+    memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,328 @@
+#include "paths.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATHS_MAGIC "WCPATH1\n"
+#define PATHS_MAX_STRING 4096
+#define NO_STRING UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t count;
+} PathsHeader;
+
+/* process, window class, automation id, class name and name; NO_STRING stands for NULL. */
+typedef struct {
+    uint32_t lengths[5];
+    int32_t control_type;
+    uint32_t step_count;
+    uint32_t runtime_id_length;
+} PathRecord;
+
+static size_t hash_field(size_t hash, const char* str) {
+    if (!str) {
+        return (hash ^ 0xFF) * 16777619u;
+    }
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return (hash ^ 0) * 16777619u;
+}
+
+static size_t hash_key(const char* process, const char* window_class, const Locator* locator) {
+    size_t hash = 2166136261u;
+    hash = hash_field(hash, process);
+    hash = hash_field(hash, window_class);
+    hash = hash_field(hash, locator->automation_id);
+    hash = hash_field(hash, locator->class_name);
+    hash = hash_field(hash, locator->name);
+    hash ^= (size_t)(unsigned int)locator->control_type;
+    return hash * 16777619u;
+}
+
+static bool same_field(const char* a, const char* b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static bool same_key(const LearnedPath* path, size_t hash, const char* process, const char* window_class,
+                     const Locator* locator) {
+    return path->hash == hash && path->locator.control_type == locator->control_type &&
+           same_field(path->process, process) && same_field(path->window_class, window_class) &&
+           same_field(path->locator.automation_id, locator->automation_id) &&
+           same_field(path->locator.class_name, locator->class_name) &&
+           same_field(path->locator.name, locator->name);
+}
+
+static const char* place_field(char** cursor, const char* str, size_t length) {
+    if (!str) return NULL;
+    char* copy = *cursor;
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    *cursor += length + 1;
+    return copy;
+}
+
+/* One allocation holds the entry, its arrays and its strings, so forgetting a path is a single free. */
+static LearnedPath* create_path(const char* const fields[5], const size_t lengths[5], int control_type,
+                                const int32_t* steps, int step_count,
+                                const int32_t* runtime_id, int runtime_id_length) {
+    size_t size = sizeof(LearnedPath) + ((size_t)step_count + (size_t)runtime_id_length) * sizeof(int32_t);
+    for (int i = 0; i < 5; i++) {
+        size += fields[i] ? lengths[i] + 1 : 0;
+    }
+
+    LearnedPath* path = malloc(size);
+    if (!path) return NULL;
+
+    path->steps = (int32_t*)(path + 1);
+    path->step_count = step_count;
+    path->runtime_id = path->steps + step_count;
+    path->runtime_id_length = runtime_id_length;
+    if (step_count) memcpy(path->steps, steps, (size_t)step_count * sizeof(int32_t));
+    if (runtime_id_length) memcpy(path->runtime_id, runtime_id, (size_t)runtime_id_length * sizeof(int32_t));
+
+    char* cursor = (char*)(path->runtime_id + runtime_id_length);
+    path->process = place_field(&cursor, fields[0], lengths[0]);
+    path->window_class = place_field(&cursor, fields[1], lengths[1]);
+    path->locator.automation_id = place_field(&cursor, fields[2], lengths[2]);
+    path->locator.class_name = place_field(&cursor, fields[3], lengths[3]);
+    path->locator.name = place_field(&cursor, fields[4], lengths[4]);
+    path->locator.control_type = control_type;
+    path->hash = hash_key(path->process, path->window_class, &path->locator);
+    return path;
+}
+
+static bool grow_slots(PathIndex* index) {
+    size_t capacity = index->capacity ? index->capacity * 2 : 64;
+    LearnedPath** slots = calloc(capacity, sizeof(LearnedPath*));
+    if (!slots) return false;
+
+    for (size_t i = 0; i < index->capacity; i++) {
+        if (!index->slots[i]) continue;
+        size_t slot = index->slots[i]->hash & (capacity - 1);
+        while (slots[slot]) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = index->slots[i];
+    }
+
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    return true;
+}
+
+static size_t find_slot(const PathIndex* index, size_t hash, const char* process, const char* window_class,
+                        const Locator* locator) {
+    if (index->capacity == 0) return SIZE_MAX;
+    size_t slot = hash & (index->capacity - 1);
+    while (index->slots[slot]) {
+        if (same_key(index->slots[slot], hash, process, window_class, locator)) {
+            return slot;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    return SIZE_MAX;
+}
+
+/* Backward-shift deletion, as in the locator cache. */
+static void remove_slot(PathIndex* index, size_t slot) {
+    size_t mask = index->capacity - 1;
+    free(index->slots[slot]);
+    size_t next = (slot + 1) & mask;
+    while (index->slots[next]) {
+        size_t home = index->slots[next]->hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            index->slots[slot] = index->slots[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index->slots[slot] = NULL;
+    index->count--;
+}
+
+static bool insert_path(PathIndex* index, LearnedPath* path) {
+    size_t existing = find_slot(index, path->hash, path->process, path->window_class, &path->locator);
+    if (existing != SIZE_MAX) {
+        free(index->slots[existing]);
+        index->slots[existing] = path;
+        return true;
+    }
+    if (((size_t)index->count + 1) * 2 > index->capacity && !grow_slots(index)) {
+        return false;
+    }
+    size_t slot = path->hash & (index->capacity - 1);
+    while (index->slots[slot]) slot = (slot + 1) & (index->capacity - 1);
+    index->slots[slot] = path;
+    index->count++;
+    return true;
+}
+
+void winctrl_path_index_init(PathIndex* index) {
+    memset(index, 0, sizeof(*index));
+}
+
+const LearnedPath* winctrl_path_index_find(const PathIndex* index, const char* process, const char* window_class,
+                                           const Locator* locator) {
+    size_t hash = hash_key(process, window_class, locator);
+    size_t slot = find_slot(index, hash, process, window_class, locator);
+    return slot == SIZE_MAX ? NULL : index->slots[slot];
+}
+
+bool winctrl_path_index_learn(PathIndex* index, const char* process, const char* window_class,
+                              const Locator* locator, const int32_t* steps, int step_count,
+                              const int32_t* runtime_id, int runtime_id_length) {
+    if (step_count < 0 || step_count > PATH_MAX_STEPS ||
+        runtime_id_length < 0 || runtime_id_length > PATH_MAX_RUNTIME_ID) {
+        return false;
+    }
+
+    const char* fields[5] = { process, window_class, locator->automation_id, locator->class_name, locator->name };
+    size_t lengths[5];
+    for (int i = 0; i < 5; i++) {
+        lengths[i] = fields[i] ? strlen(fields[i]) : 0;
+    }
+
+    LearnedPath* path = create_path(fields, lengths, locator->control_type, steps, step_count,
+                                    runtime_id, runtime_id_length);
+    if (!path || !insert_path(index, path)) {
+        free(path);
+        return false;
+    }
+    index->dirty = true;
+    index->learned++;
+    return true;
+}
+
+void winctrl_path_index_forget(PathIndex* index, const char* process, const char* window_class,
+                               const Locator* locator) {
+    size_t hash = hash_key(process, window_class, locator);
+    size_t slot = find_slot(index, hash, process, window_class, locator);
+    if (slot != SIZE_MAX) {
+        remove_slot(index, slot);
+        index->dirty = true;
+    }
+}
+
+static bool write_path(FILE* file, const LearnedPath* path) {
+    const char* fields[5] = {
+        path->process, path->window_class,
+        path->locator.automation_id, path->locator.class_name, path->locator.name
+    };
+
+    PathRecord record;
+    for (int i = 0; i < 5; i++) {
+        record.lengths[i] = fields[i] ? (uint32_t)strlen(fields[i]) : NO_STRING;
+    }
+    record.control_type = path->locator.control_type;
+    record.step_count = (uint32_t)path->step_count;
+    record.runtime_id_length = (uint32_t)path->runtime_id_length;
+
+    if (fwrite(&record, sizeof(record), 1, file) != 1) return false;
+    for (int i = 0; i < 5; i++) {
+        if (fields[i] && fwrite(fields[i], 1, record.lengths[i], file) != record.lengths[i]) return false;
+    }
+    return fwrite(path->steps, sizeof(int32_t), record.step_count, file) == record.step_count &&
+           fwrite(path->runtime_id, sizeof(int32_t), record.runtime_id_length, file) == record.runtime_id_length;
+}
+
+bool winctrl_path_index_save(const PathIndex* index, const char* path, char* error, size_t error_size) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        snprintf(error, error_size, "Could not create learned path file: %s", path);
+        return false;
+    }
+
+    PathsHeader header;
+    memcpy(header.magic, PATHS_MAGIC, sizeof(header.magic));
+    header.count = (uint32_t)index->count;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < index->capacity; i++) {
+        if (index->slots[i]) {
+            ok = write_path(file, index->slots[i]);
+        }
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        snprintf(error, error_size, "Failed to write learned path file: %s", path);
+    }
+    return ok;
+}
+
+static LearnedPath* read_path(FILE* file) {
+    PathRecord record;
+    if (fread(&record, sizeof(record), 1, file) != 1 ||
+        record.step_count > PATH_MAX_STEPS || record.runtime_id_length > PATH_MAX_RUNTIME_ID) {
+        return NULL;
+    }
+
+    char* strings[5] = { NULL };
+    size_t lengths[5] = { 0 };
+    int32_t steps[PATH_MAX_STEPS];
+    int32_t runtime_id[PATH_MAX_RUNTIME_ID];
+    bool ok = true;
+    for (int i = 0; ok && i < 5; i++) {
+        if (record.lengths[i] == NO_STRING) continue;
+        lengths[i] = record.lengths[i];
+        strings[i] = lengths[i] <= PATHS_MAX_STRING ? malloc(lengths[i] + 1) : NULL;
+        ok = strings[i] && fread(strings[i], 1, lengths[i], file) == lengths[i] &&
+             memchr(strings[i], '\0', lengths[i]) == NULL;
+    }
+    ok = ok && fread(steps, sizeof(int32_t), record.step_count, file) == record.step_count &&
+         fread(runtime_id, sizeof(int32_t), record.runtime_id_length, file) == record.runtime_id_length;
+    for (uint32_t i = 0; ok && i < record.step_count; i++) {
+        ok = steps[i] >= 0;
+    }
+
+    LearnedPath* path = NULL;
+    if (ok) {
+        const char* fields[5] = { strings[0], strings[1], strings[2], strings[3], strings[4] };
+        path = create_path(fields, lengths, record.control_type, steps, (int)record.step_count,
+                           runtime_id, (int)record.runtime_id_length);
+    }
+    for (int i = 0; i < 5; i++) {
+        free(strings[i]);
+    }
+    return path;
+}
+
+bool winctrl_path_index_load(PathIndex* index, const char* path, char* error, size_t error_size) {
+    winctrl_path_index_init(index);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return true;
+    }
+
+    PathsHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, PATHS_MAGIC, sizeof(header.magic)) != 0) {
+        fclose(file);
+        snprintf(error, error_size, "Not a learned path file: %s", path);
+        return false;
+    }
+
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < header.count; i++) {
+        LearnedPath* learned = read_path(file);
+        ok = learned && insert_path(index, learned);
+        if (!ok) free(learned);
+    }
+    fclose(file);
+
+    if (!ok) {
+        snprintf(error, error_size, "Learned path file is truncated or corrupt: %s", path);
+        winctrl_path_index_free(index);
+        return false;
+    }
+    return true;
+}
+
+void winctrl_path_index_free(PathIndex* index) {
+    for (size_t i = 0; i < index->capacity; i++) {
+        free(index->slots[i]);
+    }
+    free(index->slots);
+    winctrl_path_index_init(index);
+}
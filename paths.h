@@ -0,0 +1,58 @@
+#ifndef WINCONTROL_PATHS_H
+#define WINCONTROL_PATHS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "locator.h"
+
+#define PATH_MAX_STEPS 64
+#define PATH_MAX_RUNTIME_ID 16
+
+/*
+ * Where a locator was found last time: the child index taken at each
+ * level below the window root, and the runtime ID the element had. A
+ * path is only a hint; the element it leads to is checked against the
+ * locator before it is used.
+ */
+typedef struct {
+    const char* process;
+    const char* window_class;
+    Locator locator;
+    size_t hash;
+    int32_t* steps;
+    int step_count;
+    int32_t* runtime_id;
+    int runtime_id_length;
+} LearnedPath;
+
+/*
+ * Learned paths keyed by process name, window class and all four locator
+ * fields, so one file can serve several applications. The index is kept
+ * in memory and written back with winctrl_path_index_save when dirty.
+ */
+typedef struct {
+    LearnedPath** slots;
+    size_t capacity;
+    int count;
+    bool dirty;
+    long hits;
+    long misses;
+    long learned;
+} PathIndex;
+
+void winctrl_path_index_init(PathIndex* index);
+const LearnedPath* winctrl_path_index_find(const PathIndex* index, const char* process, const char* window_class,
+                                           const Locator* locator);
+/* Records or replaces the path for a locator; returns false when out of memory. */
+bool winctrl_path_index_learn(PathIndex* index, const char* process, const char* window_class,
+                              const Locator* locator, const int32_t* steps, int step_count,
+                              const int32_t* runtime_id, int runtime_id_length);
+void winctrl_path_index_forget(PathIndex* index, const char* process, const char* window_class,
+                               const Locator* locator);
+bool winctrl_path_index_save(const PathIndex* index, const char* path, char* error, size_t error_size);
+/* A missing file loads as an empty index; a corrupt one is an error and leaves the index empty. */
+bool winctrl_path_index_load(PathIndex* index, const char* path, char* error, size_t error_size);
+void winctrl_path_index_free(PathIndex* index);
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "registry.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#define REGISTRY_INITIAL_PIDS 1024
+
+static void lower_name(char* dest, size_t dest_size, const char* name) {
+    size_t i = 0;
+    for (; name[i] && i + 1 < dest_size; i++) {
+        dest[i] = (char)tolower((unsigned char)name[i]);
+    }
+    dest[i] = '\0';
+}
+
+static size_t hash_name(const char* name) {
+    size_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t hash_pid(uint32_t pid) {
+    return (size_t)pid * 2654435761u;
+}
+
+static int find_pid_index(const ProcessRegistry* registry, uint32_t pid) {
+    if (!registry->by_pid) return -1;
+    size_t slot = hash_pid(pid) & registry->mask;
+    while (registry->by_pid[slot] != -1) {
+        int index = registry->by_pid[slot];
+        if (registry->processes[index].pid == pid) {
+            return index;
+        }
+        slot = (slot + 1) & registry->mask;
+    }
+    return -1;
+}
+
+static int first_with_name(const ProcessRegistry* registry, const char* name) {
+    if (!registry->name_heads) return -1;
+    int index = registry->name_heads[hash_name(name) & registry->mask];
+    while (index != -1 && strcmp(registry->processes[index].name, name) != 0) {
+        index = registry->name_next[index];
+    }
+    return index;
+}
+
+/* Takes the name rather than reading it from index, whose entry a failed check may have blanked. */
+static int next_with_name(const ProcessRegistry* registry, int index, const char* name) {
+    index = registry->name_next[index];
+    while (index != -1 && strcmp(registry->processes[index].name, name) != 0) {
+        index = registry->name_next[index];
+    }
+    return index;
+}
+
+/* Both indices are rebuilt after a refresh; that is arithmetic only, the system calls are what a refresh saves. */
+static bool rebuild_indices(ProcessRegistry* registry) {
+    size_t size = 64;
+    while (size < (size_t)registry->count * 2) size *= 2;
+
+    int32_t* by_pid = realloc(registry->by_pid, size * sizeof(int32_t));
+    if (by_pid) registry->by_pid = by_pid;
+    int32_t* name_heads = realloc(registry->name_heads, size * sizeof(int32_t));
+    if (name_heads) registry->name_heads = name_heads;
+    int32_t* name_next = realloc(registry->name_next, (size_t)(registry->capacity ? registry->capacity : 1) * sizeof(int32_t));
+    if (name_next) registry->name_next = name_next;
+    if (!by_pid || !name_heads || !name_next) {
+        return false;
+    }
+
+    registry->mask = size - 1;
+    memset(registry->by_pid, 0xFF, size * sizeof(int32_t));
+    memset(registry->name_heads, 0xFF, size * sizeof(int32_t));
+    /* Pushing in reverse keeps each name chain in enumeration order. */
+    for (int i = registry->count - 1; i >= 0; i--) {
+        const RegisteredProcess* process = &registry->processes[i];
+        size_t slot = hash_pid(process->pid) & registry->mask;
+        while (registry->by_pid[slot] != -1) slot = (slot + 1) & registry->mask;
+        registry->by_pid[slot] = i;
+
+        size_t head = hash_name(process->name) & registry->mask;
+        registry->name_next[i] = registry->name_heads[head];
+        registry->name_heads[head] = i;
+    }
+    return true;
+}
+
+static bool read_name(ProcessRegistry* registry, uint32_t pid, char* name) {
+    char raw[REGISTRY_NAME_MAX];
+    registry->names_read++;
+    if (!registry->ops.process_name(registry->backend, pid, raw, sizeof(raw))) {
+        return false;
+    }
+    lower_name(name, REGISTRY_NAME_MAX, raw);
+    return true;
+}
+
+void winctrl_registry_init(ProcessRegistry* registry, const ProcessSourceOps* ops, void* backend) {
+    memset(registry, 0, sizeof(*registry));
+    registry->ops = *ops;
+    registry->backend = backend;
+}
+
+static bool list_pids(ProcessRegistry* registry, int* count) {
+    if (registry->pids_capacity == 0) {
+        registry->pids = malloc(REGISTRY_INITIAL_PIDS * sizeof(uint32_t));
+        if (!registry->pids) return false;
+        registry->pids_capacity = REGISTRY_INITIAL_PIDS;
+    }
+    for (;;) {
+        *count = registry->ops.list_pids(registry->backend, registry->pids, registry->pids_capacity);
+        if (*count < 0) return false;
+        if (*count <= registry->pids_capacity) return true;
+
+        int capacity = *count + *count / 4;
+        uint32_t* pids = realloc(registry->pids, (size_t)capacity * sizeof(uint32_t));
+        if (!pids) return false;
+        registry->pids = pids;
+        registry->pids_capacity = capacity;
+    }
+}
+
+static bool add_process(ProcessRegistry* registry, uint32_t pid) {
+    if (registry->count == registry->capacity) {
+        int capacity = registry->capacity ? registry->capacity * 2 : 256;
+        RegisteredProcess* processes = realloc(registry->processes, (size_t)capacity * sizeof(RegisteredProcess));
+        if (!processes) return false;
+        registry->processes = processes;
+        registry->capacity = capacity;
+    }
+
+    RegisteredProcess* process = &registry->processes[registry->count];
+    if (!read_name(registry, pid, process->name)) {
+        return true;
+    }
+    process->pid = pid;
+    process->window = 0;
+    process->seen = true;
+    registry->count++;
+    return true;
+}
+
+/*
+ * Names are only read for PIDs that are new, or whose entry a failed
+ * check blanked because the PID may have been reused.
+ */
+bool winctrl_registry_refresh(ProcessRegistry* registry) {
+    int count = 0;
+    if (!list_pids(registry, &count)) {
+        return false;
+    }
+    registry->refreshes++;
+
+    for (int i = 0; i < registry->count; i++) {
+        registry->processes[i].seen = false;
+    }
+    int known = registry->count;
+    bool ok = true;
+    for (int i = 0; ok && i < count; i++) {
+        int index = find_pid_index(registry, registry->pids[i]);
+        if (index == -1 || index >= known) {
+            ok = add_process(registry, registry->pids[i]);
+            continue;
+        }
+        RegisteredProcess* process = &registry->processes[index];
+        process->seen = process->name[0] != '\0' || read_name(registry, process->pid, process->name);
+    }
+
+    int kept = 0;
+    for (int i = 0; i < registry->count; i++) {
+        if (registry->processes[i].seen) {
+            registry->processes[kept++] = registry->processes[i];
+        }
+    }
+    registry->count = kept;
+    return rebuild_indices(registry) && ok;
+}
+
+/* Blanks an entry whose PID no longer runs the process recorded for it; the next refresh drops or re-reads it. */
+static bool still_running(ProcessRegistry* registry, int index) {
+    RegisteredProcess* process = &registry->processes[index];
+    char name[REGISTRY_NAME_MAX];
+    if (read_name(registry, process->pid, name) && strcmp(name, process->name) == 0) {
+        return true;
+    }
+    process->name[0] = '\0';
+    process->window = 0;
+    return false;
+}
+
+uint32_t winctrl_registry_find_name(ProcessRegistry* registry, const char* name) {
+    char key[REGISTRY_NAME_MAX];
+    lower_name(key, sizeof(key), name);
+
+    for (int index = first_with_name(registry, key); index != -1; index = next_with_name(registry, index, key)) {
+        uint32_t pid = registry->processes[index].pid;
+        if (still_running(registry, index)) {
+            registry->hits++;
+            return pid;
+        }
+    }
+
+    if (!winctrl_registry_refresh(registry)) {
+        return 0;
+    }
+    int index = first_with_name(registry, key);
+    return index == -1 ? 0 : registry->processes[index].pid;
+}
+
+bool winctrl_registry_has_pid(ProcessRegistry* registry, uint32_t pid) {
+    int index = find_pid_index(registry, pid);
+    if (index != -1 && still_running(registry, index)) {
+        registry->hits++;
+        return true;
+    }
+    return winctrl_registry_refresh(registry) && find_pid_index(registry, pid) != -1;
+}
+
+uintptr_t winctrl_registry_main_window(ProcessRegistry* registry, uint32_t pid) {
+    if (!winctrl_registry_has_pid(registry, pid)) {
+        return 0;
+    }
+    RegisteredProcess* process = &registry->processes[find_pid_index(registry, pid)];
+    if (process->window && registry->ops.window_alive(registry->backend, process->window, pid)) {
+        return process->window;
+    }
+    registry->window_scans++;
+    process->window = registry->ops.main_window(registry->backend, pid);
+    return process->window;
+}
+
+const char* winctrl_registry_process_name(const ProcessRegistry* registry, uint32_t pid) {
+    int index = find_pid_index(registry, pid);
+    return index == -1 || !registry->processes[index].name[0] ? NULL : registry->processes[index].name;
+}
+
+void winctrl_registry_free(ProcessRegistry* registry) {
+    free(registry->processes);
+    free(registry->by_pid);
+    free(registry->name_heads);
+    free(registry->name_next);
+    free(registry->pids);
+    ProcessSourceOps ops = registry->ops;
+    void* backend = registry->backend;
+    winctrl_registry_init(registry, &ops, backend);
+}
+
+#ifdef __linux__
+
+static int proc_list_pids(void* backend, uint32_t* pids, int capacity) {
+    (void)backend;
+    DIR* proc = opendir("/proc");
+    if (!proc) return -1;
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(proc)) != NULL) {
+        char* end = NULL;
+        unsigned long pid = strtoul(entry->d_name, &end, 10);
+        if (end == entry->d_name || *end != '\0') continue;
+        if (count < capacity) pids[count] = (uint32_t)pid;
+        count++;
+    }
+    closedir(proc);
+    return count;
+}
+
+/* The executable's file name, or the 15-character comm when /proc/pid/exe cannot be read. */
+static bool proc_process_name(void* backend, uint32_t pid, char* name, size_t name_size) {
+    (void)backend;
+    char path[64];
+    char target[4096];
+    snprintf(path, sizeof(path), "/proc/%u/exe", pid);
+    ssize_t length = readlink(path, target, sizeof(target) - 1);
+    if (length > 0) {
+        target[length] = '\0';
+        const char* base = strrchr(target, '/');
+        snprintf(name, name_size, "%s", base ? base + 1 : target);
+        return true;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%u/comm", pid);
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+    bool ok = fgets(name, (int)name_size, file) != NULL;
+    fclose(file);
+    if (ok) name[strcspn(name, "\n")] = '\0';
+    return ok;
+}
+
+static uintptr_t proc_main_window(void* backend, uint32_t pid) {
+    (void)backend;
+    (void)pid;
+    return 0;
+}
+
+static bool proc_window_alive(void* backend, uintptr_t window, uint32_t pid) {
+    (void)backend;
+    (void)window;
+    (void)pid;
+    return false;
+}
+
+const ProcessSourceOps PROC_FS_PROCESS_OPS = {
+    proc_list_pids,
+    proc_process_name,
+    proc_main_window,
+    proc_window_alive
+};
+
+#endif
+
+static const SimulatedProcess* find_simulated(const SimulatedProcesses* sim, uint32_t pid) {
+    for (int i = 0; i < sim->count; i++) {
+        if (sim->processes[i].pid == pid) return &sim->processes[i];
+    }
+    return NULL;
+}
+
+static int simulated_list_pids(void* backend, uint32_t* pids, int capacity) {
+    SimulatedProcesses* sim = backend;
+    sim->pid_lists++;
+    for (int i = 0; i < sim->count && i < capacity; i++) {
+        pids[i] = sim->processes[i].pid;
+    }
+    return sim->count;
+}
+
+static bool simulated_process_name(void* backend, uint32_t pid, char* name, size_t name_size) {
+    SimulatedProcesses* sim = backend;
+    sim->name_reads++;
+    const SimulatedProcess* process = find_simulated(sim, pid);
+    if (!process) return false;
+    snprintf(name, name_size, "%s", process->name);
+    return true;
+}
+
+static uintptr_t simulated_main_window(void* backend, uint32_t pid) {
+    SimulatedProcesses* sim = backend;
+    sim->window_scans++;
+    const SimulatedProcess* process = find_simulated(sim, pid);
+    return process ? process->window : 0;
+}
+
+static bool simulated_window_alive(void* backend, uintptr_t window, uint32_t pid) {
+    const SimulatedProcess* process = find_simulated(backend, pid);
+    return process && process->window == window;
+}
+
+const ProcessSourceOps SIMULATED_PROCESS_OPS = {
+    simulated_list_pids,
+    simulated_process_name,
+    simulated_main_window,
+    simulated_window_alive
+};
+
+bool winctrl_simulated_process_start(SimulatedProcesses* sim, uint32_t pid, const char* name, uintptr_t window) {
+    if (sim->count == SIMULATED_PROCESS_MAX) return false;
+    SimulatedProcess* process = &sim->processes[sim->count++];
+    process->pid = pid;
+    snprintf(process->name, sizeof(process->name), "%s", name);
+    process->window = window;
+    return true;
+}
+
+void winctrl_simulated_process_exit(SimulatedProcesses* sim, uint32_t pid) {
+    for (int i = 0; i < sim->count; i++) {
+        if (sim->processes[i].pid == pid) {
+            sim->processes[i] = sim->processes[--sim->count];
+            return;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef WINCONTROL_REGISTRY_H
+#define WINCONTROL_REGISTRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REGISTRY_NAME_MAX 260
+
+/*
+ * How the registry asks the operating system about processes.
+ * list_pids fills pids with the running process IDs and returns how many
+ * there are; a result larger than capacity asks for a bigger buffer, -1
+ * is an error. process_name writes the executable's file name and returns
+ * false when pid is not a running process. main_window returns the
+ * window an attach should use, or 0, and window_alive tells whether a
+ * window returned earlier still belongs to pid and can be used.
+ */
+typedef struct {
+    int (*list_pids)(void* backend, uint32_t* pids, int capacity);
+    bool (*process_name)(void* backend, uint32_t pid, char* name, size_t name_size);
+    uintptr_t (*main_window)(void* backend, uint32_t pid);
+    bool (*window_alive)(void* backend, uintptr_t window, uint32_t pid);
+} ProcessSourceOps;
+
+typedef struct {
+    uint32_t pid;
+    char name[REGISTRY_NAME_MAX];
+    uintptr_t window;
+    bool seen;
+} RegisteredProcess;
+
+/*
+ * Running processes indexed by PID and by lower-case executable name.
+ * A lookup checks the one process it found against the operating system
+ * and only refreshes on a miss. A refresh lists the PIDs and reads names
+ * for the new ones only; processes that exited are dropped. Main windows
+ * are looked up on first use and kept while they stay valid.
+ */
+typedef struct {
+    ProcessSourceOps ops;
+    void* backend;
+    RegisteredProcess* processes;
+    int count;
+    int capacity;
+    int32_t* by_pid;
+    int32_t* name_heads;
+    int32_t* name_next;
+    size_t mask;
+    uint32_t* pids;
+    int pids_capacity;
+    long hits;
+    long refreshes;
+    long names_read;
+    long window_scans;
+} ProcessRegistry;
+
+void winctrl_registry_init(ProcessRegistry* registry, const ProcessSourceOps* ops, void* backend);
+bool winctrl_registry_refresh(ProcessRegistry* registry);
+/* Returns the PID of a running process with this executable name, compared without case, or 0. */
+uint32_t winctrl_registry_find_name(ProcessRegistry* registry, const char* name);
+bool winctrl_registry_has_pid(ProcessRegistry* registry, uint32_t pid);
+uintptr_t winctrl_registry_main_window(ProcessRegistry* registry, uint32_t pid);
+/* The lower-case executable name last read for pid, or NULL when it is not registered. */
+const char* winctrl_registry_process_name(const ProcessRegistry* registry, uint32_t pid);
+void winctrl_registry_free(ProcessRegistry* registry);
+
+#ifdef __linux__
+/* Lists /proc; processes have no windows. */
+extern const ProcessSourceOps PROC_FS_PROCESS_OPS;
+#endif
+
+#define SIMULATED_PROCESS_MAX 256
+
+typedef struct {
+    uint32_t pid;
+    char name[64];
+    uintptr_t window;
+} SimulatedProcess;
+
+/* Backend of SIMULATED_PROCESS_OPS; start and exit change it between lookups. */
+typedef struct {
+    SimulatedProcess processes[SIMULATED_PROCESS_MAX];
+    int count;
+    long pid_lists;
+    long name_reads;
+    long window_scans;
+} SimulatedProcesses;
+
+extern const ProcessSourceOps SIMULATED_PROCESS_OPS;
+
+bool winctrl_simulated_process_start(SimulatedProcesses* sim, uint32_t pid, const char* name, uintptr_t window);
+void winctrl_simulated_process_exit(SimulatedProcesses* sim, uint32_t pid);
+
+#endif
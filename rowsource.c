@@ -0,0 +1,581 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "rowsource.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef bool (*FieldSink)(RowReader* reader, void* user, int column, const char* value, size_t length,
+                          char* error, size_t error_size);
+
+static bool map_file(RowReader* reader, const char* path, char* error, size_t error_size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        snprintf(error, error_size, "Could not open data file: %s", path);
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        snprintf(error, error_size, "Could not read size of data file: %s", path);
+        return false;
+    }
+
+    reader->file_handle = file;
+    reader->size = (size_t)size.QuadPart;
+    if (reader->size == 0) {
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        snprintf(error, error_size, "Could not map data file: %s", path);
+        return false;
+    }
+    reader->mapping_handle = mapping;
+
+    reader->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!reader->data) {
+        snprintf(error, error_size, "Could not map data file: %s", path);
+        return false;
+    }
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        snprintf(error, error_size, "Could not open data file: %s", path);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        snprintf(error, error_size, "Could not read size of data file: %s", path);
+        return false;
+    }
+
+    reader->size = (size_t)info.st_size;
+    if (reader->size > 0) {
+        void* data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            snprintf(error, error_size, "Could not map data file: %s", path);
+            return false;
+        }
+        posix_madvise(data, reader->size, POSIX_MADV_SEQUENTIAL);
+        reader->data = data;
+    }
+    close(fd);
+    return true;
+#endif
+}
+
+static void unmap_file(RowReader* reader) {
+#ifdef _WIN32
+    if (reader->data) UnmapViewOfFile(reader->data);
+    if (reader->mapping_handle) CloseHandle(reader->mapping_handle);
+    if (reader->file_handle) CloseHandle(reader->file_handle);
+#else
+    if (reader->data) munmap((void*)reader->data, reader->size);
+#endif
+    reader->data = NULL;
+    reader->mapping_handle = NULL;
+    reader->file_handle = NULL;
+}
+
+static bool reserve_scratch(RowReader* reader, size_t size, char* error, size_t error_size) {
+    if (size <= reader->scratch_capacity) return true;
+
+    size_t capacity = reader->scratch_capacity ? reader->scratch_capacity * 2 : 256;
+    while (capacity < size) capacity *= 2;
+    char* scratch = realloc(reader->scratch, capacity);
+    if (!scratch) {
+        snprintf(error, error_size, "Out of memory while reading %s", reader->path);
+        return false;
+    }
+    reader->scratch = scratch;
+    reader->scratch_capacity = capacity;
+    return true;
+}
+
+static bool add_column(RowReader* reader, int column, const char* name, size_t length,
+                       char* error, size_t error_size) {
+    (void)column;
+    for (int i = 0; i < reader->column_count; i++) {
+        if (strlen(reader->columns[i]) == length && memcmp(reader->columns[i], name, length) == 0) {
+            snprintf(error, error_size, "%s:%d: Duplicate column '%.*s'",
+                reader->path, reader->line, (int)length, name);
+            return false;
+        }
+    }
+
+    char** columns = realloc(reader->columns, (size_t)(reader->column_count + 1) * sizeof(char*));
+    char* copy = malloc(length + 1);
+    if (columns) reader->columns = columns;
+    if (!columns || !copy) {
+        free(copy);
+        snprintf(error, error_size, "Out of memory while reading %s", reader->path);
+        return false;
+    }
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    reader->columns[reader->column_count++] = copy;
+    return true;
+}
+
+static void skip_blank_lines(RowReader* reader) {
+    while (reader->pos < reader->size) {
+        size_t p = reader->pos;
+        while (p < reader->size && (reader->data[p] == ' ' || reader->data[p] == '\t' || reader->data[p] == '\r')) p++;
+        if (p < reader->size && reader->data[p] == '\n') {
+            reader->pos = p + 1;
+            reader->line++;
+        } else if (p == reader->size) {
+            reader->pos = p;
+        } else {
+            return;
+        }
+    }
+}
+
+static int read_csv_row(RowReader* reader, FieldSink sink, void* sink_user, char* error, size_t error_size) {
+    const char* data = reader->data;
+    size_t size = reader->size;
+
+    skip_blank_lines(reader);
+    if (reader->pos >= size) return 0;
+
+    reader->line++;
+    int row_line = reader->line;
+    int column = 0;
+    size_t pos = reader->pos;
+
+    for (;;) {
+        const char* value;
+        size_t length;
+
+        if (pos < size && data[pos] == '"') {
+            size_t start = ++pos;
+            bool escaped = false;
+            for (;;) {
+                const char* quote = pos < size ? memchr(data + pos, '"', size - pos) : NULL;
+                if (!quote) {
+                    snprintf(error, error_size, "%s:%d: Unterminated quoted field", reader->path, row_line);
+                    return -1;
+                }
+                for (const char* p = data + pos; p < quote; p++) {
+                    if (*p == '\n') reader->line++;
+                }
+                pos = (size_t)(quote - data) + 1;
+                if (pos < size && data[pos] == '"') {
+                    escaped = true;
+                    pos++;
+                    continue;
+                }
+                break;
+            }
+
+            value = data + start;
+            length = pos - 1 - start;
+            if (escaped) {
+                if (!reserve_scratch(reader, length, error, error_size)) return -1;
+                size_t out = 0;
+                for (size_t i = 0; i < length; i++) {
+                    reader->scratch[out++] = value[i];
+                    if (value[i] == '"') i++;
+                }
+                value = reader->scratch;
+                length = out;
+            }
+
+            if (pos < size && data[pos] != ',' && data[pos] != '\n' && data[pos] != '\r') {
+                snprintf(error, error_size, "%s:%d: Unexpected character after quoted field",
+                    reader->path, row_line);
+                return -1;
+            }
+        } else {
+            size_t start = pos;
+            while (pos < size && data[pos] != ',' && data[pos] != '\n') pos++;
+            length = pos - start;
+            if (length > 0 && data[start + length - 1] == '\r') length--;
+            value = data + start;
+        }
+
+        if (!sink(reader, sink_user, column, value, length, error, error_size)) return -1;
+        column++;
+
+        if (pos < size && data[pos] == ',') {
+            pos++;
+            continue;
+        }
+        if (pos < size && data[pos] == '\r') pos++;
+        if (pos < size && data[pos] == '\n') pos++;
+        break;
+    }
+
+    reader->pos = pos;
+    return column;
+}
+
+static void skip_json_space(const char* data, size_t size, size_t* pos) {
+    while (*pos < size && (data[*pos] == ' ' || data[*pos] == '\t' || data[*pos] == '\r')) (*pos)++;
+}
+
+static size_t encode_utf8(unsigned long code, char* out) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+static bool read_hex4(const char* p, const char* end, unsigned long* code) {
+    if (end - p < 4) return false;
+    *code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        *code <<= 4;
+        if (c >= '0' && c <= '9') *code |= (unsigned long)(c - '0');
+        else if (c >= 'a' && c <= 'f') *code |= (unsigned long)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') *code |= (unsigned long)(c - 'A' + 10);
+        else return false;
+    }
+    return true;
+}
+
+/* Parses the string starting at the opening quote; escaped strings are decoded into the scratch buffer. */
+static bool read_json_string(RowReader* reader, size_t* pos, const char** value, size_t* length,
+                             char* error, size_t error_size) {
+    const char* data = reader->data;
+    size_t size = reader->size;
+    size_t start = ++(*pos);
+    bool escaped = false;
+
+    while (*pos < size && data[*pos] != '"') {
+        if (data[*pos] == '\n') break;
+        if (data[*pos] == '\\') {
+            escaped = true;
+            (*pos)++;
+        }
+        (*pos)++;
+    }
+    if (*pos >= size || data[*pos] != '"') {
+        snprintf(error, error_size, "%s:%d: Unterminated string", reader->path, reader->line);
+        return false;
+    }
+
+    size_t raw_length = *pos - start;
+    (*pos)++;
+
+    if (!escaped) {
+        *value = data + start;
+        *length = raw_length;
+        return true;
+    }
+
+    if (!reserve_scratch(reader, raw_length, error, error_size)) return false;
+    const char* p = data + start;
+    const char* end = p + raw_length;
+    size_t out = 0;
+    while (p < end) {
+        if (*p != '\\') {
+            reader->scratch[out++] = *p++;
+            continue;
+        }
+        p++;
+        switch (*p) {
+        case '"': reader->scratch[out++] = '"'; p++; break;
+        case '\\': reader->scratch[out++] = '\\'; p++; break;
+        case '/': reader->scratch[out++] = '/'; p++; break;
+        case 'b': reader->scratch[out++] = '\b'; p++; break;
+        case 'f': reader->scratch[out++] = '\f'; p++; break;
+        case 'n': reader->scratch[out++] = '\n'; p++; break;
+        case 'r': reader->scratch[out++] = '\r'; p++; break;
+        case 't': reader->scratch[out++] = '\t'; p++; break;
+        case 'u': {
+            unsigned long code;
+            if (!read_hex4(p + 1, end, &code)) {
+                snprintf(error, error_size, "%s:%d: Invalid \\u escape", reader->path, reader->line);
+                return false;
+            }
+            p += 5;
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                unsigned long low;
+                if (end - p >= 6 && p[0] == '\\' && p[1] == 'u' && read_hex4(p + 2, end, &low) &&
+                    low >= 0xDC00 && low <= 0xDFFF) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+            }
+            out += encode_utf8(code, reader->scratch + out);
+            break;
+        }
+        default:
+            snprintf(error, error_size, "%s:%d: Invalid escape sequence", reader->path, reader->line);
+            return false;
+        }
+    }
+
+    *value = reader->scratch;
+    *length = out;
+    return true;
+}
+
+static int find_column(const RowReader* reader, int expected, const char* key, size_t length) {
+    if (expected < reader->column_count && strncmp(reader->columns[expected], key, length) == 0 &&
+        reader->columns[expected][length] == '\0') {
+        return expected;
+    }
+    for (int i = 0; i < reader->column_count; i++) {
+        if (strncmp(reader->columns[i], key, length) == 0 && reader->columns[i][length] == '\0') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int read_json_row(RowReader* reader, bool collect_keys, FieldSink sink, void* sink_user,
+                         char* error, size_t error_size) {
+    const char* data = reader->data;
+    size_t size = reader->size;
+
+    skip_blank_lines(reader);
+    if (reader->pos >= size) return 0;
+
+    reader->line++;
+    size_t pos = reader->pos;
+    skip_json_space(data, size, &pos);
+    if (pos >= size || data[pos] != '{') {
+        snprintf(error, error_size, "%s:%d: Expected a JSON object", reader->path, reader->line);
+        return -1;
+    }
+    pos++;
+
+    int fields = 0;
+    for (;;) {
+        skip_json_space(data, size, &pos);
+        if (pos < size && data[pos] == '}' && fields == 0) {
+            pos++;
+            break;
+        }
+        if (pos >= size || data[pos] != '"') {
+            snprintf(error, error_size, "%s:%d: Expected a string key", reader->path, reader->line);
+            return -1;
+        }
+
+        const char* key;
+        size_t key_length;
+        if (!read_json_string(reader, &pos, &key, &key_length, error, error_size)) return -1;
+
+        int column = -1;
+        if (collect_keys) {
+            if (!add_column(reader, fields, key, key_length, error, error_size)) return -1;
+        } else {
+            column = find_column(reader, fields, key, key_length);
+        }
+
+        skip_json_space(data, size, &pos);
+        if (pos >= size || data[pos] != ':') {
+            snprintf(error, error_size, "%s:%d: Expected ':' after key", reader->path, reader->line);
+            return -1;
+        }
+        pos++;
+        skip_json_space(data, size, &pos);
+
+        const char* value;
+        size_t length;
+        if (pos < size && data[pos] == '"') {
+            if (!read_json_string(reader, &pos, &value, &length, error, error_size)) return -1;
+        } else if (pos < size && (data[pos] == '{' || data[pos] == '[')) {
+            snprintf(error, error_size, "%s:%d: Nested objects and arrays are not supported",
+                reader->path, reader->line);
+            return -1;
+        } else {
+            size_t start = pos;
+            while (pos < size && data[pos] != ',' && data[pos] != '}' && data[pos] != '\n' &&
+                   data[pos] != ' ' && data[pos] != '\t' && data[pos] != '\r') {
+                pos++;
+            }
+            value = data + start;
+            length = pos - start;
+            if (length == 0) {
+                snprintf(error, error_size, "%s:%d: Expected a value", reader->path, reader->line);
+                return -1;
+            }
+            if (length == 4 && memcmp(value, "null", 4) == 0) {
+                length = 0;
+            }
+        }
+
+        if (column >= 0) {
+            if (!sink(reader, sink_user, column, value, length, error, error_size)) return -1;
+        }
+        fields++;
+
+        skip_json_space(data, size, &pos);
+        if (pos < size && data[pos] == ',') {
+            pos++;
+            continue;
+        }
+        if (pos < size && data[pos] == '}') {
+            pos++;
+            break;
+        }
+        snprintf(error, error_size, "%s:%d: Expected ',' or '}'", reader->path, reader->line);
+        return -1;
+    }
+
+    skip_json_space(data, size, &pos);
+    if (pos < size && data[pos] != '\n') {
+        snprintf(error, error_size, "%s:%d: Unexpected data after object", reader->path, reader->line);
+        return -1;
+    }
+    if (pos < size) pos++;
+
+    if (!collect_keys) {
+        reader->pos = pos;
+    }
+    return 1;
+}
+
+static bool collect_column(RowReader* reader, void* user, int column, const char* value, size_t length,
+                           char* error, size_t error_size) {
+    (void)user;
+    return add_column(reader, column, value, length, error, error_size);
+}
+
+bool winctrl_rows_open(RowReader* reader, const char* path, char* error, size_t error_size) {
+    memset(reader, 0, sizeof(*reader));
+    snprintf(reader->path, sizeof(reader->path), "%s", path);
+
+    size_t path_length = strlen(path);
+    if ((path_length > 6 && strcmp(path + path_length - 6, ".jsonl") == 0) ||
+        (path_length > 7 && strcmp(path + path_length - 7, ".ndjson") == 0)) {
+        reader->format = ROWS_JSONL;
+    } else {
+        reader->format = ROWS_CSV;
+    }
+
+    if (!map_file(reader, path, error, error_size)) {
+        winctrl_rows_close(reader);
+        return false;
+    }
+
+    if (reader->size >= 3 && memcmp(reader->data, "\xEF\xBB\xBF", 3) == 0) {
+        reader->pos = 3;
+    }
+
+    int header;
+    if (reader->format == ROWS_CSV) {
+        header = read_csv_row(reader, collect_column, NULL, error, error_size);
+    } else {
+        size_t pos = reader->pos;
+        int line = reader->line;
+        header = read_json_row(reader, true, NULL, NULL, error, error_size);
+        reader->pos = pos;
+        reader->line = line;
+    }
+
+    if (header == 0 || (header > 0 && reader->column_count == 0)) {
+        snprintf(error, error_size, "%s: File has no columns", path);
+        header = -1;
+    }
+    if (header < 0) {
+        winctrl_rows_close(reader);
+        return false;
+    }
+
+    reader->seen = calloc((size_t)reader->column_count, 1);
+    if (!reader->seen) {
+        snprintf(error, error_size, "Out of memory while reading %s", path);
+        winctrl_rows_close(reader);
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    RowFieldBinder bind;
+    void* user;
+} BindTarget;
+
+static bool bind_field(RowReader* reader, void* user, int column, const char* value, size_t length,
+                       char* error, size_t error_size) {
+    BindTarget* target = user;
+    if (column >= reader->column_count) {
+        snprintf(error, error_size, "%s:%d: Row has more fields than the header (%d)",
+            reader->path, reader->line, reader->column_count);
+        return false;
+    }
+    reader->seen[column] = 1;
+    if (!target->bind(target->user, column, value, length)) {
+        snprintf(error, error_size, "%s:%d: Could not bind column '%s'",
+            reader->path, reader->line, reader->columns[column]);
+        return false;
+    }
+    return true;
+}
+
+int winctrl_rows_next(RowReader* reader, RowFieldBinder bind, void* user, char* error, size_t error_size) {
+    BindTarget target = { bind, user };
+    memset(reader->seen, 0, (size_t)reader->column_count);
+
+    int fields = reader->format == ROWS_CSV
+        ? read_csv_row(reader, bind_field, &target, error, error_size)
+        : read_json_row(reader, false, bind_field, &target, error, error_size);
+    if (fields <= 0) return fields;
+
+    /* Short CSV rows and JSON objects without some keys leave those columns empty. */
+    for (int i = 0; i < reader->column_count; i++) {
+        if (!reader->seen[i] && !bind(user, i, "", 0)) {
+            snprintf(error, error_size, "%s:%d: Could not bind column '%s'",
+                reader->path, reader->line, reader->columns[i]);
+            return -1;
+        }
+    }
+    return 1;
+}
+
+void winctrl_rows_close(RowReader* reader) {
+    unmap_file(reader);
+    for (int i = 0; i < reader->column_count; i++) {
+        free(reader->columns[i]);
+    }
+    free(reader->columns);
+    free(reader->scratch);
+    free(reader->seen);
+    reader->columns = NULL;
+    reader->column_count = 0;
+    reader->scratch = NULL;
+    reader->scratch_capacity = 0;
+    reader->seen = NULL;
+}
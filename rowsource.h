@@ -0,0 +1,42 @@
+#ifndef WINCONTROL_ROWSOURCE_H
+#define WINCONTROL_ROWSOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    ROWS_CSV,
+    ROWS_JSONL
+} RowFormat;
+
+/* Receives one field of the current row; value is not NUL-terminated and only valid during the call. */
+typedef bool (*RowFieldBinder)(void* user, int column, const char* value, size_t length);
+
+/*
+ * Reads a CSV file (header line first) or a JSONL file (one flat object
+ * per line, keys of the first object define the columns) straight from a
+ * read-only memory map, one row at a time. Fields are handed to the binder
+ * as slices of the map; only quoted CSV fields containing "" and JSON
+ * strings containing escapes are decoded through a scratch buffer first.
+ */
+typedef struct {
+    RowFormat format;
+    const char* data;
+    size_t size;
+    size_t pos;
+    int line;
+    char** columns;
+    int column_count;
+    char* scratch;
+    size_t scratch_capacity;
+    unsigned char* seen;
+    char path[260];
+    void* file_handle;
+    void* mapping_handle;
+} RowReader;
+
+bool winctrl_rows_open(RowReader* reader, const char* path, char* error, size_t error_size);
+int winctrl_rows_next(RowReader* reader, RowFieldBinder bind, void* user, char* error, size_t error_size);
+void winctrl_rows_close(RowReader* reader);
+
+#endif
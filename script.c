@@ -0,0 +1,1554 @@
+#include "script.h"
+#include "rowsource.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+    size_t* slots;
+    size_t slot_count;
+    size_t used;
+} StringPool;
+
+typedef struct {
+    size_t offset;
+    int num;
+    int slot;
+} PendingOperand;
+
+/* A variable read or assignment, with the SUB it appears in or -1 outside of any SUB. */
+typedef struct {
+    int slot;
+    int owner;
+    int line;
+    const char* file;
+    const char* name;
+} VariableUse;
+
+/* A CALL instruction, the SUB it appears in and, once linked, the SUB it calls. */
+typedef struct {
+    int insn;
+    int owner;
+    int sub;
+} PendingCall;
+
+#define POOL_EMPTY_SLOT ((size_t)-1)
+
+static size_t hash_string(const char* str) {
+    size_t hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool pool_grow_slots(StringPool* pool) {
+    size_t new_count = pool->slot_count ? pool->slot_count * 2 : 64;
+    size_t* slots = malloc(new_count * sizeof(size_t));
+    if (!slots) return false;
+    for (size_t i = 0; i < new_count; i++) slots[i] = POOL_EMPTY_SLOT;
+
+    for (size_t i = 0; i < pool->slot_count; i++) {
+        size_t offset = pool->slots[i];
+        if (offset == POOL_EMPTY_SLOT) continue;
+        size_t slot = hash_string(pool->data + offset) & (new_count - 1);
+        while (slots[slot] != POOL_EMPTY_SLOT) slot = (slot + 1) & (new_count - 1);
+        slots[slot] = offset;
+    }
+
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slot_count = new_count;
+    return true;
+}
+
+static bool pool_intern(StringPool* pool, const char* str, size_t* offset_out) {
+    if ((pool->used + 1) * 2 > pool->slot_count && !pool_grow_slots(pool)) {
+        return false;
+    }
+
+    size_t slot = hash_string(str) & (pool->slot_count - 1);
+    while (pool->slots[slot] != POOL_EMPTY_SLOT) {
+        if (strcmp(pool->data + pool->slots[slot], str) == 0) {
+            *offset_out = pool->slots[slot];
+            return true;
+        }
+        slot = (slot + 1) & (pool->slot_count - 1);
+    }
+
+    size_t len = strlen(str) + 1;
+    if (pool->size + len > pool->capacity) {
+        size_t new_capacity = pool->capacity ? pool->capacity * 2 : 1024;
+        while (new_capacity < pool->size + len) new_capacity *= 2;
+        char* data = realloc(pool->data, new_capacity);
+        if (!data) return false;
+        pool->data = data;
+        pool->capacity = new_capacity;
+    }
+
+    memcpy(pool->data + pool->size, str, len);
+    pool->slots[slot] = pool->size;
+    pool->used++;
+    *offset_out = pool->size;
+    pool->size += len;
+    return true;
+}
+
+static const CommandDefinition* find_definition(const CommandDefinition* table, const char* name) {
+    for (const CommandDefinition* def = table; def->name != NULL; def++) {
+        if (strcmp(name, def->name) == 0) {
+            return def;
+        }
+    }
+    return NULL;
+}
+
+static bool parse_int_operand(const char* text, int* value) {
+    if (!*text) return false;
+
+    char* end = NULL;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (errno != 0 || *end != '\0' || parsed < INT_MIN || parsed > INT_MAX) {
+        return false;
+    }
+    *value = (int)parsed;
+    return true;
+}
+
+typedef struct {
+    CommandFlow kind;
+    int line;
+    int pending_test;
+    int pending_exits;
+    int continue_target;
+    bool seen_else;
+} Block;
+
+typedef struct {
+    const char* name;
+    int header;
+    int param_count;
+    int line;
+    const char* file;
+    SubroutineLocals locals;
+} Subroutine;
+
+/* Children are node indices and args an operand index until the program is finalized. */
+typedef struct {
+    ConditionKind kind;
+    CompareOp compare;
+    int left;
+    int right;
+    const CommandDefinition* predicate;
+    int first_arg;
+    int argc;
+} PendingCondition;
+
+typedef struct {
+    int insn;
+    int root;
+} ConditionRoot;
+
+typedef struct {
+    const CommandDefinition* table;
+    VariableContext* vars;
+    ModuleCache* modules;
+    const char* origin;
+    const char* file;
+    Program* program;
+    int code_capacity;
+    int* first_operand;
+    PendingOperand* pending;
+    int pending_count;
+    int pending_capacity;
+    StringPool pool;
+    VariableUse* reads;
+    int read_count;
+    int read_capacity;
+    VariableUse* writes;
+    int write_count;
+    int write_capacity;
+    Block* blocks;
+    int depth;
+    int block_capacity;
+    Subroutine* subs;
+    int sub_count;
+    int sub_capacity;
+    PendingCall* calls;
+    int call_count;
+    int call_capacity;
+    const Module** included;
+    int included_count;
+    int included_capacity;
+    PendingCondition* conditions;
+    int condition_count;
+    int condition_capacity;
+    ConditionRoot* roots;
+    int root_count;
+    int root_capacity;
+    bool error_located;
+    char* error;
+    size_t error_size;
+} Compiler;
+
+static bool out_of_memory(Compiler* c) {
+    snprintf(c->error, c->error_size, "Out of memory while compiling script");
+    return false;
+}
+
+static bool reserve(Compiler* c, void** items, int* capacity, int count, size_t item_size) {
+    if (count < *capacity) return true;
+
+    int grown = *capacity ? *capacity * 2 : 16;
+    void* resized = realloc(*items, (size_t)grown * item_size);
+    if (!resized) return out_of_memory(c);
+    *items = resized;
+    *capacity = grown;
+    return true;
+}
+
+static int current_sub(const Compiler* c) {
+    return c->depth > 0 && c->blocks[0].kind == FLOW_SUB ? c->sub_count - 1 : -1;
+}
+
+/*
+ * Reads are only recorded here: whether a variable is ever set depends on
+ * which SUBs run, so check_variables decides once calls are linked.
+ */
+static bool resolve_variable(Compiler* c, const Command* cmd, const char* name, bool write, int* slot) {
+    if (!*name) {
+        snprintf(c->error, c->error_size, "Line %d: Missing variable name in %s", cmd->line, cmd->name);
+        return false;
+    }
+
+    *slot = winctrl_vars_declare(c->vars, name);
+    if (*slot == -1) return out_of_memory(c);
+
+    VariableUse** uses = write ? &c->writes : &c->reads;
+    int* count = write ? &c->write_count : &c->read_count;
+    if (!reserve(c, (void**)uses, write ? &c->write_capacity : &c->read_capacity, *count, sizeof(VariableUse))) {
+        return false;
+    }
+    (*uses)[(*count)++] = (VariableUse){ *slot, current_sub(c), cmd->line, c->file, name };
+    return true;
+}
+
+static Instruction* emit(Compiler* c, Opcode op, const Command* cmd, const CommandDefinition* def) {
+    Program* program = c->program;
+    if (program->count == c->code_capacity) {
+        int capacity = c->code_capacity ? c->code_capacity * 2 : 64;
+        Instruction* code = realloc(program->code, (size_t)capacity * sizeof(Instruction));
+        int* first_operand = realloc(c->first_operand, (size_t)capacity * sizeof(int));
+        if (code) program->code = code;
+        if (first_operand) c->first_operand = first_operand;
+        if (!code || !first_operand) {
+            out_of_memory(c);
+            return NULL;
+        }
+        c->code_capacity = capacity;
+    }
+
+    c->first_operand[program->count] = c->pending_count;
+    Instruction* insn = &program->code[program->count++];
+    memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->def = def;
+    insn->line = cmd->line;
+    insn->jump = -1;
+    insn->file = c->file;
+    return insn;
+}
+
+static PendingOperand* add_operand(Compiler* c, const char* text) {
+    if (c->pending_count == c->pending_capacity) {
+        int capacity = c->pending_capacity ? c->pending_capacity * 2 : 256;
+        PendingOperand* pending = realloc(c->pending, (size_t)capacity * sizeof(PendingOperand));
+        if (!pending) {
+            out_of_memory(c);
+            return NULL;
+        }
+        c->pending = pending;
+        c->pending_capacity = capacity;
+    }
+
+    PendingOperand* operand = &c->pending[c->pending_count];
+    if (!pool_intern(&c->pool, text, &operand->offset)) {
+        out_of_memory(c);
+        return NULL;
+    }
+    operand->num = 0;
+    operand->slot = -1;
+    c->pending_count++;
+    return operand;
+}
+
+static bool compile_operands(Compiler* c, Instruction* insn, const Command* cmd, const CommandDefinition* def) {
+    int fixed = (int)strlen(def->signature);
+    bool variadic = fixed > 0 && def->signature[fixed - 1] == '*';
+    if (variadic) fixed--;
+
+    if (variadic ? cmd->param_count < fixed : cmd->param_count != fixed) {
+        snprintf(c->error, c->error_size,
+            "Line %d: Invalid parameter count for %s: expected %s%d, got %d",
+            cmd->line, cmd->name, variadic ? "at least " : "", fixed, cmd->param_count);
+        return false;
+    }
+
+    insn->argc = cmd->param_count;
+    for (int p = 0; p < cmd->param_count; p++) {
+        PendingOperand* operand = add_operand(c, cmd->params[p]);
+        if (!operand) return false;
+
+        char kind = p < fixed ? def->signature[p] : 'v';
+        if (kind == 'w') {
+            if (!resolve_variable(c, cmd, cmd->params[p], true, &operand->slot)) {
+                return false;
+            }
+        } else if (kind == 'v' && cmd->params[p][0] == '$') {
+            if (!resolve_variable(c, cmd, cmd->params[p] + 1, false, &operand->slot)) {
+                return false;
+            }
+        } else if (kind == 'n' && strcmp(cmd->params[p], "null") == 0) {
+            operand->num = -1;
+        } else if ((kind == 'i' || kind == 'n') &&
+                   !parse_int_operand(cmd->params[p], &operand->num)) {
+            snprintf(c->error, c->error_size,
+                "Line %d: %s expects an integer for parameter %d, got '%s'",
+                cmd->line, cmd->name, p + 1, cmd->params[p]);
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    Compiler* c;
+    const Command* cmd;
+    int first;
+    int pos;
+} ConditionParser;
+
+static const char* const CONDITION_OPERATORS[] = {
+    "AND", "OR", "NOT", "(", ")", "==", "!=", "<", "<=", ">", ">=", NULL
+};
+
+static bool is_condition_operator(const ConditionParser* p, int index, const char* op) {
+    if (index >= p->cmd->param_count || p->c->pending[p->first + index].slot != -1) {
+        return false;
+    }
+    const char* token = p->cmd->params[index];
+    if (op) return strcmp(token, op) == 0;
+
+    for (int i = 0; CONDITION_OPERATORS[i]; i++) {
+        if (strcmp(token, CONDITION_OPERATORS[i]) == 0) return true;
+    }
+    return false;
+}
+
+static int add_condition(ConditionParser* p, ConditionKind kind, int left, int right) {
+    Compiler* c = p->c;
+    if (!reserve(c, (void**)&c->conditions, &c->condition_capacity, c->condition_count,
+                 sizeof(PendingCondition))) {
+        return -1;
+    }
+
+    PendingCondition* node = &c->conditions[c->condition_count];
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    return c->condition_count++;
+}
+
+static int parse_or(ConditionParser* p);
+
+static int condition_error(ConditionParser* p, const char* message) {
+    if (p->pos < p->cmd->param_count) {
+        snprintf(p->c->error, p->c->error_size, "Line %d: %s at '%s'",
+            p->cmd->line, message, p->cmd->params[p->pos]);
+    } else {
+        snprintf(p->c->error, p->c->error_size, "Line %d: %s at end of condition", p->cmd->line, message);
+    }
+    return -1;
+}
+
+static int parse_predicate(ConditionParser* p, const CommandDefinition* def) {
+    Compiler* c = p->c;
+    int start = ++p->pos;
+    int required = -1;
+    int maximum = 0;
+    int argc = 0;
+
+    for (const char* kind = def->signature; *kind; kind++) {
+        if (*kind == '?') {
+            required = maximum;
+            continue;
+        }
+        maximum++;
+        if (argc + 1 != maximum || p->pos == p->cmd->param_count || is_condition_operator(p, p->pos, NULL)) {
+            continue;
+        }
+
+        PendingOperand* operand = &c->pending[p->first + p->pos];
+        if (*kind == 'n' && operand->slot == -1 && strcmp(p->cmd->params[p->pos], "null") == 0) {
+            operand->num = -1;
+        } else if (*kind == 'n' && (operand->slot != -1 ||
+                                    !parse_int_operand(p->cmd->params[p->pos], &operand->num))) {
+            snprintf(c->error, c->error_size, "Line %d: %s expects an integer for parameter %d, got '%s'",
+                p->cmd->line, def->name, argc + 1, p->cmd->params[p->pos]);
+            return -1;
+        }
+        argc++;
+        p->pos++;
+    }
+
+    if (required == -1) required = maximum;
+    if (argc < required) {
+        snprintf(c->error, c->error_size, "Line %d: %s expects %s%d parameters, got %d", p->cmd->line,
+            def->name, required < maximum ? "at least " : "", required, argc);
+        return -1;
+    }
+
+    int node = add_condition(p, COND_PREDICATE, -1, -1);
+    if (node == -1) return -1;
+    c->conditions[node].predicate = def;
+    c->conditions[node].first_arg = p->first + start;
+    c->conditions[node].argc = argc;
+    return node;
+}
+
+static int parse_primary(ConditionParser* p) {
+    Compiler* c = p->c;
+    if (p->pos == p->cmd->param_count) {
+        return condition_error(p, "Missing value");
+    }
+
+    if (is_condition_operator(p, p->pos, "(")) {
+        p->pos++;
+        int inner = parse_or(p);
+        if (inner == -1) return -1;
+        if (!is_condition_operator(p, p->pos, ")")) {
+            return condition_error(p, "Missing ')'");
+        }
+        p->pos++;
+        return inner;
+    }
+    if (is_condition_operator(p, p->pos, NULL)) {
+        return condition_error(p, "Expected a value");
+    }
+
+    if (c->pending[p->first + p->pos].slot == -1) {
+        const CommandDefinition* def = find_definition(c->table, p->cmd->params[p->pos]);
+        if (def && def->predicate) {
+            return parse_predicate(p, def);
+        }
+    }
+
+    static const struct {
+        const char* token;
+        CompareOp op;
+    } comparisons[] = {
+        {"==", CMP_EQ}, {"!=", CMP_NE}, {"<", CMP_LT}, {"<=", CMP_LE}, {">", CMP_GT}, {">=", CMP_GE}
+    };
+
+    int value = p->pos++;
+    for (size_t i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]); i++) {
+        if (!is_condition_operator(p, p->pos, comparisons[i].token)) continue;
+
+        p->pos++;
+        if (p->pos == p->cmd->param_count || is_condition_operator(p, p->pos, NULL)) {
+            return condition_error(p, "Expected a value");
+        }
+        p->pos++;
+
+        int node = add_condition(p, COND_COMPARE, -1, -1);
+        if (node == -1) return -1;
+        c->conditions[node].compare = comparisons[i].op;
+        c->conditions[node].first_arg = p->first + value;
+        c->conditions[node].argc = 3;
+        return node;
+    }
+
+    int node = add_condition(p, COND_VALUE, -1, -1);
+    if (node == -1) return -1;
+    c->conditions[node].first_arg = p->first + value;
+    c->conditions[node].argc = 1;
+    return node;
+}
+
+static int parse_unary(ConditionParser* p) {
+    if (is_condition_operator(p, p->pos, "NOT")) {
+        p->pos++;
+        int operand = parse_unary(p);
+        return operand == -1 ? -1 : add_condition(p, COND_NOT, operand, -1);
+    }
+    return parse_primary(p);
+}
+
+static int parse_and(ConditionParser* p) {
+    int left = parse_unary(p);
+    while (left != -1 && is_condition_operator(p, p->pos, "AND")) {
+        p->pos++;
+        int right = parse_unary(p);
+        left = right == -1 ? -1 : add_condition(p, COND_AND, left, right);
+    }
+    return left;
+}
+
+static int parse_or(ConditionParser* p) {
+    int left = parse_and(p);
+    while (left != -1 && is_condition_operator(p, p->pos, "OR")) {
+        p->pos++;
+        int right = parse_and(p);
+        left = right == -1 ? -1 : add_condition(p, COND_OR, left, right);
+    }
+    return left;
+}
+
+static bool emit_test(Compiler* c, const Command* cmd, const CommandDefinition* def) {
+    int index = c->program->count;
+    Instruction* test = emit(c, OP_TEST, cmd, def);
+    if (!test) return false;
+    test->test = def->test;
+    if (!compile_operands(c, test, cmd, def)) return false;
+
+    ConditionParser parser = { c, cmd, c->first_operand[index], 0 };
+    int root = parse_or(&parser);
+    if (root == -1) return false;
+    if (parser.pos < cmd->param_count) {
+        condition_error(&parser, "Unexpected token");
+        return false;
+    }
+
+    if (!reserve(c, (void**)&c->roots, &c->root_capacity, c->root_count, sizeof(ConditionRoot))) return false;
+    c->roots[c->root_count].insn = index;
+    c->roots[c->root_count].root = root;
+    c->root_count++;
+    return true;
+}
+
+static Block* push_block(Compiler* c, CommandFlow kind, int line) {
+    if (c->depth == c->block_capacity) {
+        int capacity = c->block_capacity ? c->block_capacity * 2 : 16;
+        Block* blocks = realloc(c->blocks, (size_t)capacity * sizeof(Block));
+        if (!blocks) {
+            out_of_memory(c);
+            return NULL;
+        }
+        c->blocks = blocks;
+        c->block_capacity = capacity;
+    }
+
+    Block* block = &c->blocks[c->depth++];
+    block->kind = kind;
+    block->line = line;
+    block->pending_test = -1;
+    block->pending_exits = -1;
+    block->continue_target = -1;
+    block->seen_else = false;
+    return block;
+}
+
+/* Pending exit jumps are chained through their jump fields until the block closes. */
+static void patch_chain(Program* program, int head, int target) {
+    while (head != -1) {
+        int next = program->code[head].jump;
+        program->code[head].jump = target;
+        head = next;
+    }
+}
+
+static bool emit_exit_jump(Compiler* c, Block* block, const Command* cmd, const CommandDefinition* def) {
+    Instruction* jump = emit(c, OP_JUMP, cmd, def);
+    if (!jump) return false;
+    jump->jump = block->pending_exits;
+    block->pending_exits = c->program->count - 1;
+    return true;
+}
+
+static const char* block_opener(CommandFlow kind) {
+    switch (kind) {
+    case FLOW_LOOP: return "LOOP";
+    case FLOW_WHILE: return "WHILE";
+    case FLOW_FOREACH: return "FOREACH";
+    case FLOW_SUB: return "SUB";
+    default: return "IF";
+    }
+}
+
+static const char* block_closer(CommandFlow kind) {
+    switch (kind) {
+    case FLOW_LOOP: return "ENDLOOP";
+    case FLOW_WHILE: return "ENDWHILE";
+    case FLOW_FOREACH: return "ENDFOREACH";
+    case FLOW_SUB: return "ENDSUB";
+    default: return "ENDIF";
+    }
+}
+
+static bool compile_if(Compiler* c, Block* block, const Command* cmd, const CommandDefinition* def) {
+    Program* program = c->program;
+
+    switch (def->flow) {
+    case FLOW_IF:
+    case FLOW_ELSEIF: {
+        if (def->flow == FLOW_ELSEIF) {
+            if (block->seen_else) {
+                snprintf(c->error, c->error_size, "Line %d: ELSEIF after ELSE", cmd->line);
+                return false;
+            }
+            if (!emit_exit_jump(c, block, cmd, def)) return false;
+            program->code[block->pending_test].jump = program->count;
+        } else {
+            block = push_block(c, FLOW_IF, cmd->line);
+            if (!block) return false;
+        }
+
+        block->pending_test = program->count;
+        return emit_test(c, cmd, def);
+    }
+
+    case FLOW_ELSE:
+        if (block->seen_else) {
+            snprintf(c->error, c->error_size, "Line %d: Duplicate ELSE", cmd->line);
+            return false;
+        }
+        if (!emit_exit_jump(c, block, cmd, def)) return false;
+        program->code[block->pending_test].jump = program->count;
+        block->pending_test = -1;
+        block->seen_else = true;
+        return true;
+
+    default:
+        if (block->pending_test != -1) {
+            program->code[block->pending_test].jump = program->count;
+        }
+        patch_chain(program, block->pending_exits, program->count);
+        c->depth--;
+        return true;
+    }
+}
+
+/*
+ * FOREACH ROW "file" reads the column names once at compile time and
+ * declares a variable per column; the head instruction carries the path
+ * followed by one operand per column holding its variable slot.
+ */
+static bool compile_row_loop(Compiler* c, Block* block, const Command* cmd, const CommandDefinition* def) {
+    Program* program = c->program;
+    RowReader reader;
+    char reader_error[512];
+    if (!winctrl_rows_open(&reader, cmd->params[1], reader_error, sizeof(reader_error))) {
+        snprintf(c->error, c->error_size, "Line %d: %s", cmd->line, reader_error);
+        return false;
+    }
+
+    int source = program->row_source_count++;
+    Instruction* init = emit(c, OP_ROWS_INIT, cmd, def);
+    bool ok = init != NULL;
+    if (ok) {
+        init->counter = source;
+        block->continue_target = program->count;
+    }
+    Instruction* head = ok ? emit(c, OP_ROWS_NEXT, cmd, def) : NULL;
+    ok = head != NULL;
+    if (ok) {
+        head->counter = source;
+        ok = add_operand(c, cmd->params[0]) && add_operand(c, cmd->params[1]);
+    }
+
+    for (int i = 0; ok && i < reader.column_count; i++) {
+        PendingOperand* column = add_operand(c, reader.columns[i]);
+        ok = column && resolve_variable(c, cmd, reader.columns[i], true, &column->slot);
+    }
+
+    if (ok) {
+        program->code[block->continue_target - 1].argc = 2 + reader.column_count;
+        program->code[block->continue_target].argc = 2 + reader.column_count;
+    }
+    winctrl_rows_close(&reader);
+    return ok;
+}
+
+/*
+ * Loops compile to an optional init instruction, a head instruction that
+ * is the CONTINUE target and leaves the loop when it is exhausted, the body
+ * and a jump back to the head. The head and every BREAK share the block's
+ * exit chain, which the closing keyword patches.
+ */
+static bool compile_loop_open(Compiler* c, const Command* cmd, const CommandDefinition* def) {
+    Program* program = c->program;
+    Block* block = push_block(c, def->flow, cmd->line);
+    if (!block) return false;
+
+    Instruction* head;
+    switch (def->flow) {
+    case FLOW_LOOP: {
+        int counter = program->counter_count++;
+        Instruction* init = emit(c, OP_LOOP_INIT, cmd, def);
+        if (!init) return false;
+        init->counter = counter;
+        if (!compile_operands(c, init, cmd, def)) return false;
+
+        PendingOperand* count = &c->pending[c->pending_count - 1];
+        if (count->slot == -1 && !parse_int_operand(cmd->params[0], &count->num)) {
+            snprintf(c->error, c->error_size,
+                "Line %d: LOOP expects an iteration count, got '%s'", cmd->line, cmd->params[0]);
+            return false;
+        }
+
+        block->continue_target = program->count;
+        head = emit(c, OP_LOOP_NEXT, cmd, def);
+        if (!head) return false;
+        head->counter = counter;
+        break;
+    }
+
+    case FLOW_WHILE:
+        block->continue_target = program->count;
+        if (!emit_test(c, cmd, def)) return false;
+        break;
+
+    default: {
+        if (cmd->param_count == 2 && strcmp(cmd->params[0], "ROW") == 0 && strcmp(cmd->params[1], "IN") != 0) {
+            if (!compile_row_loop(c, block, cmd, def)) return false;
+            break;
+        }
+        if (cmd->param_count >= 2 && strcmp(cmd->params[1], "IN") != 0) {
+            snprintf(c->error, c->error_size,
+                "Line %d: Expected FOREACH <variable> IN <values...>", cmd->line);
+            return false;
+        }
+
+        int counter = program->counter_count++;
+        Instruction* init = emit(c, OP_FOREACH_INIT, cmd, def);
+        if (!init) return false;
+        init->counter = counter;
+
+        block->continue_target = program->count;
+        head = emit(c, OP_FOREACH_NEXT, cmd, def);
+        if (!head) return false;
+        head->counter = counter;
+        if (!compile_operands(c, head, cmd, def)) return false;
+        break;
+    }
+    }
+
+    head = &program->code[block->continue_target];
+    head->jump = block->pending_exits;
+    block->pending_exits = block->continue_target;
+    return true;
+}
+
+static Block* innermost_loop(Compiler* c) {
+    for (int i = c->depth - 1; i >= 0; i--) {
+        CommandFlow kind = c->blocks[i].kind;
+        if (kind == FLOW_LOOP || kind == FLOW_WHILE || kind == FLOW_FOREACH) {
+            return &c->blocks[i];
+        }
+    }
+    return NULL;
+}
+
+static Subroutine* find_subroutine(Compiler* c, const char* name) {
+    for (int i = 0; i < c->sub_count; i++) {
+        if (strcmp(c->subs[i].name, name) == 0) {
+            return &c->subs[i];
+        }
+    }
+    return NULL;
+}
+
+static bool compile_sub(Compiler* c, const Command* cmd, const CommandDefinition* def) {
+    if (c->depth > 0) {
+        snprintf(c->error, c->error_size, "Line %d: SUB must not be nested inside %s from line %d",
+            cmd->line, block_opener(c->blocks[c->depth - 1].kind), c->blocks[c->depth - 1].line);
+        return false;
+    }
+    if (cmd->param_count < 1) {
+        snprintf(c->error, c->error_size, "Line %d: Expected SUB <name> [parameters...]", cmd->line);
+        return false;
+    }
+
+    const Subroutine* existing = find_subroutine(c, cmd->params[0]);
+    if (existing) {
+        snprintf(c->error, c->error_size, "Line %d: SUB %s is already defined at %s%sline %d",
+            cmd->line, cmd->params[0], existing->file ? existing->file : "", existing->file ? " " : "",
+            existing->line);
+        return false;
+    }
+    if (!reserve(c, (void**)&c->subs, &c->sub_capacity, c->sub_count, sizeof(Subroutine))) return false;
+
+    Subroutine* sub = &c->subs[c->sub_count++];
+    sub->name = cmd->params[0];
+    sub->header = c->program->count;
+    sub->param_count = cmd->param_count - 1;
+    sub->line = cmd->line;
+    sub->file = c->file;
+    sub->locals = (SubroutineLocals){ c->program->counter_count, 0, c->program->row_source_count, 0 };
+
+    Instruction* header = emit(c, OP_JUMP, cmd, def);
+    if (!header || !push_block(c, FLOW_SUB, cmd->line)) return false;
+    header->argc = cmd->param_count;
+    header->counter = c->sub_count - 1;
+
+    if (!add_operand(c, cmd->params[0])) return false;
+    for (int p = 1; p < cmd->param_count; p++) {
+        PendingOperand* param = add_operand(c, cmd->params[p]);
+        if (!param || !resolve_variable(c, cmd, cmd->params[p], true, &param->slot)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool compile_call(Compiler* c, const Command* cmd, const CommandDefinition* def) {
+    if (!reserve(c, (void**)&c->calls, &c->call_capacity, c->call_count, sizeof(PendingCall))) return false;
+    c->calls[c->call_count++] = (PendingCall){ c->program->count, current_sub(c), -1 };
+
+    Instruction* call = emit(c, OP_CALL_SUB, cmd, def);
+    return call && compile_operands(c, call, cmd, def);
+}
+
+/* Calls may precede the SUB they name, so they are bound once the whole program is compiled. */
+static bool link_calls(Compiler* c) {
+    Program* program = c->program;
+    for (int i = 0; i < c->call_count; i++) {
+        Instruction* call = &program->code[c->calls[i].insn];
+        const char* name = c->pool.data + c->pending[c->first_operand[c->calls[i].insn]].offset;
+        const Subroutine* sub = find_subroutine(c, name);
+
+        if (!sub) {
+            snprintf(c->error, c->error_size, "%s%sLine %d: CALL to undefined SUB %s",
+                call->file ? call->file : "", call->file ? ": " : "", call->line, name);
+            return false;
+        }
+        if (call->argc - 1 != sub->param_count) {
+            snprintf(c->error, c->error_size, "%s%sLine %d: SUB %s expects %d arguments, got %d",
+                call->file ? call->file : "", call->file ? ": " : "", call->line, name,
+                sub->param_count, call->argc - 1);
+            return false;
+        }
+        call->jump = sub->header;
+        c->calls[i].sub = (int)(sub - c->subs);
+    }
+    return true;
+}
+
+/*
+ * A variable counts as defined for code that can run when it is assigned
+ * somewhere that can run too: outside of any SUB or in a SUB reachable
+ * through CALLs from there, in either order, or when the host set it.
+ * SUBs nothing calls, such as unused ones from an INCLUDE library, are
+ * checked against every assignment in the program.
+ */
+static bool check_variables(Compiler* c) {
+    int slots = c->vars->variable_count;
+    unsigned char* reachable = calloc((size_t)c->sub_count + 1, 1);
+    unsigned char* assigned = calloc((size_t)slots + 1, 1);
+    unsigned char* anywhere = calloc((size_t)slots + 1, 1);
+    bool ok = reachable && assigned && anywhere;
+    if (!ok) out_of_memory(c);
+
+    for (bool changed = ok; changed;) {
+        changed = false;
+        for (int i = 0; i < c->call_count; i++) {
+            const PendingCall* call = &c->calls[i];
+            if ((call->owner < 0 || reachable[call->owner]) && !reachable[call->sub]) {
+                reachable[call->sub] = 1;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; ok && i < c->write_count; i++) {
+        const VariableUse* write = &c->writes[i];
+        anywhere[write->slot] = 1;
+        if (write->owner < 0 || reachable[write->owner]) assigned[write->slot] = 1;
+    }
+
+    for (int i = 0; ok && i < c->read_count; i++) {
+        const VariableUse* read = &c->reads[i];
+        const unsigned char* defined = read->owner < 0 || reachable[read->owner] ? assigned : anywhere;
+        if (!defined[read->slot] && !c->vars->variables[read->slot].value) {
+            snprintf(c->error, c->error_size, "%s%sLine %d: Undefined variable: %s",
+                read->file ? read->file : "", read->file ? ": " : "", read->line, read->name);
+            ok = false;
+        }
+    }
+
+    free(reachable);
+    free(assigned);
+    free(anywhere);
+    return ok;
+}
+
+static bool compile_commands(Compiler* c, const Command* first, int count);
+
+/* Each file is compiled into a program at most once, which also stops INCLUDE cycles. */
+static bool compile_include(Compiler* c, const Command* cmd) {
+    if (cmd->param_count != 1) {
+        snprintf(c->error, c->error_size, "Line %d: Expected INCLUDE \"file\"", cmd->line);
+        return false;
+    }
+    if (!c->modules) {
+        snprintf(c->error, c->error_size, "Line %d: INCLUDE is not available here", cmd->line);
+        return false;
+    }
+    if (c->depth > 0) {
+        snprintf(c->error, c->error_size, "Line %d: INCLUDE must not be nested inside %s from line %d",
+            cmd->line, block_opener(c->blocks[c->depth - 1].kind), c->blocks[c->depth - 1].line);
+        return false;
+    }
+
+    char path[1024];
+    winctrl_modules_resolve(c->file ? c->file : c->origin, cmd->params[0], path, sizeof(path));
+
+    const Module* module;
+    char detail[512];
+    if (!winctrl_modules_get(c->modules, path, &module, detail, sizeof(detail))) {
+        snprintf(c->error, c->error_size, "Line %d: %s", cmd->line, detail);
+        return false;
+    }
+
+    for (int i = 0; i < c->included_count; i++) {
+        if (c->included[i] == module) return true;
+    }
+    if (!reserve(c, (void**)&c->included, &c->included_capacity, c->included_count, sizeof(Module*))) {
+        return false;
+    }
+    c->included[c->included_count++] = module;
+
+    const char* file = c->file;
+    c->file = module->path;
+    bool ok = compile_commands(c, module->script.first, module->script.count);
+    c->file = file;
+
+    if (!ok && !c->error_located) {
+        snprintf(detail, sizeof(detail), "%s", c->error);
+        snprintf(c->error, c->error_size, "%s: %s", module->path, detail);
+        c->error_located = true;
+    }
+    return ok;
+}
+
+static bool compile_flow(Compiler* c, const Command* cmd, const CommandDefinition* def) {
+    Block* block = c->depth > 0 ? &c->blocks[c->depth - 1] : NULL;
+
+    switch (def->flow) {
+    case FLOW_PREDICATE:
+        snprintf(c->error, c->error_size, "Line %d: %s can only be used in a condition", cmd->line, cmd->name);
+        return false;
+    case FLOW_SUB: return compile_sub(c, cmd, def);
+    case FLOW_CALL: return compile_call(c, cmd, def);
+    case FLOW_INCLUDE: return compile_include(c, cmd);
+    default: break;
+    }
+
+    if (!def->test && def->flow != FLOW_LOOP && def->flow != FLOW_FOREACH && cmd->param_count != 0) {
+        snprintf(c->error, c->error_size, "Line %d: %s does not take parameters", cmd->line, cmd->name);
+        return false;
+    }
+
+    CommandFlow expected = FLOW_NONE;
+    switch (def->flow) {
+    case FLOW_ELSEIF:
+    case FLOW_ELSE:
+    case FLOW_ENDIF: expected = FLOW_IF; break;
+    case FLOW_ENDLOOP: expected = FLOW_LOOP; break;
+    case FLOW_ENDWHILE: expected = FLOW_WHILE; break;
+    case FLOW_ENDFOREACH: expected = FLOW_FOREACH; break;
+    case FLOW_ENDSUB: expected = FLOW_SUB; break;
+    default: break;
+    }
+
+    if (expected != FLOW_NONE && (!block || block->kind != expected)) {
+        if (block) {
+            snprintf(c->error, c->error_size, "Line %d: %s found while %s from line %d is still open",
+                cmd->line, cmd->name, block_opener(block->kind), block->line);
+        } else {
+            snprintf(c->error, c->error_size, "Line %d: %s without matching %s",
+                cmd->line, cmd->name, block_opener(expected));
+        }
+        return false;
+    }
+
+    switch (def->flow) {
+    case FLOW_IF:
+    case FLOW_ELSEIF:
+    case FLOW_ELSE:
+    case FLOW_ENDIF:
+        return compile_if(c, block, cmd, def);
+
+    case FLOW_LOOP:
+    case FLOW_WHILE:
+    case FLOW_FOREACH:
+        return compile_loop_open(c, cmd, def);
+
+    case FLOW_ENDLOOP:
+    case FLOW_ENDWHILE:
+    case FLOW_ENDFOREACH: {
+        Instruction* back = emit(c, OP_JUMP, cmd, def);
+        if (!back) return false;
+        back->jump = block->continue_target;
+        patch_chain(c->program, block->pending_exits, c->program->count);
+        c->depth--;
+        return true;
+    }
+
+    case FLOW_ENDSUB: {
+        if (!emit(c, OP_RETURN, cmd, def)) return false;
+        Subroutine* sub = &c->subs[c->sub_count - 1];
+        c->program->code[sub->header].jump = c->program->count;
+        sub->locals.counter_count = c->program->counter_count - sub->locals.first_counter;
+        sub->locals.source_count = c->program->row_source_count - sub->locals.first_source;
+        c->depth--;
+        return true;
+    }
+
+    case FLOW_RETURN:
+        if (c->depth == 0 || c->blocks[0].kind != FLOW_SUB) {
+            snprintf(c->error, c->error_size, "Line %d: RETURN outside of a SUB", cmd->line);
+            return false;
+        }
+        return emit(c, OP_RETURN, cmd, def) != NULL;
+
+    case FLOW_BREAK:
+    case FLOW_CONTINUE: {
+        Block* loop = innermost_loop(c);
+        if (!loop) {
+            snprintf(c->error, c->error_size, "Line %d: %s outside of a loop", cmd->line, cmd->name);
+            return false;
+        }
+        if (def->flow == FLOW_BREAK) {
+            return emit_exit_jump(c, loop, cmd, def);
+        }
+        Instruction* jump = emit(c, OP_JUMP, cmd, def);
+        if (!jump) return false;
+        jump->jump = loop->continue_target;
+        return true;
+    }
+
+    default:
+        return true;
+    }
+}
+
+static bool compile_commands(Compiler* c, const Command* first, int count) {
+    int base_depth = c->depth;
+    const Command* cmd = first;
+    for (int i = 0; i < count; i++, cmd = cmd->next) {
+        const CommandDefinition* def = find_definition(c->table, cmd->name);
+        if (!def) {
+            snprintf(c->error, c->error_size, "Line %d: Unknown command: %s", cmd->line, cmd->name);
+            return false;
+        }
+
+        if (def->flow != FLOW_NONE) {
+            if (!compile_flow(c, cmd, def)) return false;
+            continue;
+        }
+
+        Instruction* insn = emit(c, OP_CALL, cmd, def);
+        if (!insn) return false;
+        insn->handler = def->handler;
+        if (!compile_operands(c, insn, cmd, def)) return false;
+    }
+
+    if (c->depth > base_depth) {
+        const Block* open = &c->blocks[c->depth - 1];
+        snprintf(c->error, c->error_size, "Line %d: %s without matching %s",
+            open->line, block_opener(open->kind), block_closer(open->kind));
+        return false;
+    }
+    return true;
+}
+
+bool winctrl_program_compile(const CommandDefinition* table, const Command* first, int count,
+                             const char* origin, ModuleCache* modules, VariableContext* vars,
+                             Program* program, char* error, size_t error_size) {
+    memset(program, 0, sizeof(*program));
+
+    Compiler c = {0};
+    c.table = table;
+    c.vars = vars;
+    c.modules = modules;
+    c.origin = origin;
+    c.program = program;
+    c.error = error;
+    c.error_size = error_size;
+    bool ok = false;
+
+    if (!compile_commands(&c, first, count) || !link_calls(&c) || !check_variables(&c)) goto done;
+
+    program->operands = malloc((c.pending_count > 0 ? (size_t)c.pending_count : 1) * sizeof(Operand));
+    if (!program->operands) {
+        out_of_memory(&c);
+        goto done;
+    }
+
+    program->pool = c.pool.data;
+    program->pool_size = c.pool.size;
+    c.pool.data = NULL;
+
+    for (int i = 0; i < c.pending_count; i++) {
+        program->operands[i].str = program->pool + c.pending[i].offset;
+        program->operands[i].num = c.pending[i].num;
+        program->operands[i].slot = c.pending[i].slot;
+    }
+    for (int i = 0; i < program->count; i++) {
+        program->code[i].args = program->operands + c.first_operand[i];
+    }
+    program->operand_count = c.pending_count;
+
+    if (c.condition_count > 0) {
+        program->conditions = malloc((size_t)c.condition_count * sizeof(ConditionNode));
+        if (!program->conditions) {
+            out_of_memory(&c);
+            goto done;
+        }
+    }
+    for (int i = 0; i < c.condition_count; i++) {
+        const PendingCondition* pending = &c.conditions[i];
+        ConditionNode* node = &program->conditions[i];
+        node->kind = pending->kind;
+        node->compare = pending->compare;
+        node->left = pending->left >= 0 ? program->conditions + pending->left : NULL;
+        node->right = pending->right >= 0 ? program->conditions + pending->right : NULL;
+        node->predicate = pending->predicate;
+        node->args = program->operands + pending->first_arg;
+        node->argc = pending->argc;
+    }
+    for (int i = 0; i < c.root_count; i++) {
+        program->code[c.roots[i].insn].condition = program->conditions + c.roots[i].root;
+    }
+    program->condition_count = c.condition_count;
+
+    if (c.sub_count > 0) {
+        program->subs = malloc((size_t)c.sub_count * sizeof(SubroutineLocals));
+        if (!program->subs) {
+            out_of_memory(&c);
+            goto done;
+        }
+    }
+    for (int i = 0; i < c.sub_count; i++) {
+        program->subs[i] = c.subs[i].locals;
+    }
+    program->sub_count = c.sub_count;
+    program->vars = vars;
+    ok = true;
+
+done:
+    free(c.pool.data);
+    free(c.pool.slots);
+    free(c.reads);
+    free(c.writes);
+    free(c.pending);
+    free(c.first_operand);
+    free(c.blocks);
+    free(c.subs);
+    free(c.calls);
+    free(c.included);
+    free(c.conditions);
+    free(c.roots);
+    if (!ok) {
+        winctrl_program_free(program);
+    }
+    return ok;
+}
+
+static void trace_instruction(const Instruction* insn) {
+    printf("Executing command: %s with %d parameters\n", insn->def->name, insn->argc);
+    for (int i = 0; i < insn->argc; i++) {
+        printf("Parameter %d: '%s'\n", i, insn->args[i].str);
+    }
+}
+
+static const char* operand_text(const VariableContext* vars, const Operand* operand, char* error, size_t error_size) {
+    if (operand->slot < 0) {
+        return operand->str;
+    }
+
+    const VariableValue* value = vars->variables[operand->slot].value;
+    if (!value) {
+        snprintf(error, error_size, "Variable used before it was set: %s", operand->str + 1);
+        return NULL;
+    }
+    return value->data;
+}
+
+static int compare_values(const char* left, const char* right) {
+    char* left_end;
+    char* right_end;
+    double left_number = strtod(left, &left_end);
+    double right_number = strtod(right, &right_end);
+    if (*left && *right && *left_end == '\0' && *right_end == '\0') {
+        return (left_number > right_number) - (left_number < right_number);
+    }
+    return strcmp(left, right);
+}
+
+bool winctrl_condition_evaluate(WinControlContext* ctx, const VariableContext* vars, const ConditionNode* node,
+                                bool* result, char* error, size_t error_size) {
+    switch (node->kind) {
+    case COND_AND:
+    case COND_OR:
+        if (!winctrl_condition_evaluate(ctx, vars, node->left, result, error, error_size)) return false;
+        if (*result == (node->kind == COND_OR)) return true;
+        return winctrl_condition_evaluate(ctx, vars, node->right, result, error, error_size);
+
+    case COND_NOT:
+        if (!winctrl_condition_evaluate(ctx, vars, node->left, result, error, error_size)) return false;
+        *result = !*result;
+        return true;
+
+    case COND_COMPARE: {
+        const char* left = operand_text(vars, &node->args[0], error, error_size);
+        const char* right = left ? operand_text(vars, &node->args[2], error, error_size) : NULL;
+        if (!right) return false;
+
+        int order = compare_values(left, right);
+        switch (node->compare) {
+        case CMP_EQ: *result = order == 0; break;
+        case CMP_NE: *result = order != 0; break;
+        case CMP_LT: *result = order < 0; break;
+        case CMP_LE: *result = order <= 0; break;
+        case CMP_GT: *result = order > 0; break;
+        case CMP_GE: *result = order >= 0; break;
+        }
+        return true;
+    }
+
+    case COND_VALUE: {
+        const char* value = operand_text(vars, &node->args[0], error, error_size);
+        if (!value) return false;
+        *result = *value && strcmp(value, "false") != 0 && strcmp(value, "0") != 0;
+        return true;
+    }
+
+    case COND_PREDICATE:
+        return node->predicate->predicate(ctx, node->args, node->argc, result);
+    }
+    return false;
+}
+
+static bool loop_count(const Program* program, const Instruction* insn, int* count,
+                       char* error, size_t error_size) {
+    const Operand* operand = &insn->args[0];
+    if (operand->slot < 0) {
+        *count = operand->num;
+        return true;
+    }
+
+    const char* text = operand_text(program->vars, operand, error, error_size);
+    if (!text) return false;
+    if (!parse_int_operand(text, count)) {
+        snprintf(error, error_size, "LOOP count %s is not a number: '%s'", operand->str, text);
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    VariableContext* vars;
+    const Operand* columns;
+} RowBinding;
+
+static bool bind_row_field(void* user, int column, const char* value, size_t length) {
+    const RowBinding* binding = user;
+    return winctrl_vars_assign(binding->vars, binding->columns[column].slot, value, length);
+}
+
+static bool open_rows(RowReader* reader, const Instruction* insn, char* error, size_t error_size) {
+    winctrl_rows_close(reader);
+    if (!winctrl_rows_open(reader, insn->args[1].str, error, error_size)) return false;
+
+    bool same = reader->column_count == insn->argc - 2;
+    for (int i = 0; same && i < reader->column_count; i++) {
+        same = strcmp(reader->columns[i], insn->args[2 + i].str) == 0;
+    }
+    if (!same) {
+        snprintf(error, error_size, "Columns of %s changed since the script was compiled", insn->args[1].str);
+        winctrl_rows_close(reader);
+        return false;
+    }
+    return true;
+}
+
+#define MAX_CALL_DEPTH 1000
+
+typedef struct {
+    int return_pc;
+    int sub;
+} CallFrame;
+
+/* The callers' SUB locals are pushed onto saved_counters and saved_readers, one range per frame. */
+typedef struct {
+    CallFrame* frames;
+    int depth;
+    int capacity;
+    char* values;
+    size_t values_capacity;
+    int* saved_counters;
+    int saved_counter_count;
+    int saved_counter_capacity;
+    RowReader* saved_readers;
+    int saved_reader_count;
+    int saved_reader_capacity;
+} CallStack;
+
+static bool stack_reserve(void** items, int* capacity, int needed, size_t item_size) {
+    if (needed <= *capacity) return true;
+
+    int grown = *capacity ? *capacity : 16;
+    while (grown < needed) grown *= 2;
+    void* resized = realloc(*items, (size_t)grown * item_size);
+    if (!resized) return false;
+    *items = resized;
+    *capacity = grown;
+    return true;
+}
+
+/* Arguments are all evaluated before any parameter is assigned, since an argument may name a parameter. */
+static bool call_subroutine(const Program* program, const Instruction* insn, CallStack* stack, int return_pc,
+                            int* counters, RowReader* readers, char* error, size_t error_size) {
+    const Instruction* sub = &program->code[insn->jump];
+    if (stack->depth == MAX_CALL_DEPTH) {
+        snprintf(error, error_size, "SUB %s nested deeper than %d calls", sub->args[0].str, MAX_CALL_DEPTH);
+        return false;
+    }
+
+    size_t total = 0;
+    for (int i = 1; i < insn->argc; i++) {
+        const char* value = operand_text(program->vars, &insn->args[i], error, error_size);
+        if (!value) return false;
+        total += strlen(value) + 1;
+    }
+    if (total > stack->values_capacity) {
+        char* values = realloc(stack->values, total);
+        if (!values) {
+            snprintf(error, error_size, "Out of memory while calling SUB %s", sub->args[0].str);
+            return false;
+        }
+        stack->values = values;
+        stack->values_capacity = total;
+    }
+
+    char* out = stack->values;
+    for (int i = 1; i < insn->argc; i++) {
+        const char* value = operand_text(program->vars, &insn->args[i], error, error_size);
+        size_t length = strlen(value) + 1;
+        memcpy(out, value, length);
+        out += length;
+    }
+
+    const char* value = stack->values;
+    for (int i = 1; i < insn->argc; i++) {
+        size_t length = strlen(value);
+        if (!winctrl_vars_assign(program->vars, sub->args[i].slot, value, length)) {
+            snprintf(error, error_size, "Out of memory while setting variable: %s", sub->args[i].str);
+            return false;
+        }
+        value += length + 1;
+    }
+
+    const SubroutineLocals* locals = &program->subs[sub->counter];
+    if (!stack_reserve((void**)&stack->frames, &stack->capacity, stack->depth + 1, sizeof(CallFrame)) ||
+        !stack_reserve((void**)&stack->saved_counters, &stack->saved_counter_capacity,
+                       stack->saved_counter_count + locals->counter_count, sizeof(int)) ||
+        !stack_reserve((void**)&stack->saved_readers, &stack->saved_reader_capacity,
+                       stack->saved_reader_count + locals->source_count, sizeof(RowReader))) {
+        snprintf(error, error_size, "Out of memory while calling SUB %s", sub->args[0].str);
+        return false;
+    }
+
+    if (locals->counter_count > 0) {
+        memcpy(stack->saved_counters + stack->saved_counter_count, counters + locals->first_counter,
+               (size_t)locals->counter_count * sizeof(int));
+        stack->saved_counter_count += locals->counter_count;
+    }
+    if (locals->source_count > 0) {
+        memcpy(stack->saved_readers + stack->saved_reader_count, readers + locals->first_source,
+               (size_t)locals->source_count * sizeof(RowReader));
+        memset(readers + locals->first_source, 0, (size_t)locals->source_count * sizeof(RowReader));
+        stack->saved_reader_count += locals->source_count;
+    }
+    stack->frames[stack->depth++] = (CallFrame){ return_pc, sub->counter };
+    return true;
+}
+
+/* Closes the rows the returning SUB still has open and gives the caller back its own loop state. */
+static int return_from_subroutine(const Program* program, CallStack* stack, int* counters, RowReader* readers) {
+    const CallFrame* frame = &stack->frames[--stack->depth];
+    const SubroutineLocals* locals = &program->subs[frame->sub];
+
+    if (locals->counter_count > 0) {
+        stack->saved_counter_count -= locals->counter_count;
+        memcpy(counters + locals->first_counter, stack->saved_counters + stack->saved_counter_count,
+               (size_t)locals->counter_count * sizeof(int));
+    }
+    if (locals->source_count > 0) {
+        for (int i = 0; i < locals->source_count; i++) {
+            winctrl_rows_close(&readers[locals->first_source + i]);
+        }
+        stack->saved_reader_count -= locals->source_count;
+        memcpy(readers + locals->first_source, stack->saved_readers + stack->saved_reader_count,
+               (size_t)locals->source_count * sizeof(RowReader));
+    }
+    return frame->return_pc;
+}
+
+bool winctrl_program_run(WinControlContext* ctx, const Program* program, bool trace,
+                         char* error, size_t error_size, int* fault_index) {
+    int* counters = NULL;
+    if (program->counter_count > 0) {
+        counters = calloc((size_t)program->counter_count, sizeof(int));
+        if (!counters) {
+            snprintf(error, error_size, "Out of memory while running script");
+            if (fault_index) *fault_index = 0;
+            return false;
+        }
+    }
+
+    RowReader* readers = NULL;
+    if (program->row_source_count > 0) {
+        readers = calloc((size_t)program->row_source_count, sizeof(RowReader));
+        if (!readers) {
+            snprintf(error, error_size, "Out of memory while running script");
+            if (fault_index) *fault_index = 0;
+            free(counters);
+            return false;
+        }
+    }
+
+    CallStack stack = {0};
+    int pc = 0;
+    bool ok = true;
+    while (ok && pc < program->count) {
+        const Instruction* insn = &program->code[pc];
+
+        switch (insn->op) {
+        case OP_CALL:
+            if (trace) trace_instruction(insn);
+            ok = insn->handler(ctx, insn);
+            if (trace) winctrl_trace_finished(ctx, insn);
+            if (ok) pc++;
+            break;
+
+        case OP_TEST: {
+            if (trace) trace_instruction(insn);
+            bool result = false;
+            ok = insn->test(ctx, insn, &result);
+            if (trace) winctrl_trace_finished(ctx, insn);
+            if (ok) pc = result ? pc + 1 : insn->jump;
+            break;
+        }
+
+        case OP_JUMP:
+            pc = insn->jump;
+            break;
+
+        case OP_LOOP_INIT:
+            if (trace) trace_instruction(insn);
+            ok = loop_count(program, insn, &counters[insn->counter], error, error_size);
+            if (ok) pc++;
+            break;
+
+        case OP_LOOP_NEXT:
+            if (counters[insn->counter] > 0) {
+                counters[insn->counter]--;
+                pc++;
+            } else {
+                pc = insn->jump;
+            }
+            break;
+
+        case OP_FOREACH_INIT:
+            counters[insn->counter] = 0;
+            pc++;
+            break;
+
+        case OP_FOREACH_NEXT: {
+            int index = counters[insn->counter];
+            if (index >= insn->argc - 2) {
+                pc = insn->jump;
+                break;
+            }
+
+            const char* value = operand_text(program->vars, &insn->args[2 + index], error, error_size);
+            ok = value != NULL;
+            if (ok && !winctrl_vars_assign(program->vars, insn->args[0].slot, value, strlen(value))) {
+                snprintf(error, error_size, "Out of memory while setting variable: %s", insn->args[0].str);
+                ok = false;
+            }
+            if (ok) {
+                counters[insn->counter]++;
+                pc++;
+            }
+            break;
+        }
+
+        case OP_ROWS_INIT:
+            if (trace) trace_instruction(insn);
+            ok = open_rows(&readers[insn->counter], insn, error, error_size);
+            if (ok) pc++;
+            break;
+
+        case OP_ROWS_NEXT: {
+            RowBinding binding = { program->vars, insn->args + 2 };
+            int status = winctrl_rows_next(&readers[insn->counter], bind_row_field, &binding,
+                                           error, error_size);
+            if (status > 0) {
+                pc++;
+            } else if (status == 0) {
+                winctrl_rows_close(&readers[insn->counter]);
+                pc = insn->jump;
+            } else {
+                ok = false;
+            }
+            break;
+        }
+
+        case OP_CALL_SUB:
+            if (trace) trace_instruction(insn);
+            ok = call_subroutine(program, insn, &stack, pc + 1, counters, readers, error, error_size);
+            if (ok) pc = insn->jump + 1;
+            break;
+
+        case OP_RETURN:
+            pc = return_from_subroutine(program, &stack, counters, readers);
+            break;
+        }
+    }
+
+    if (!ok && fault_index) *fault_index = pc;
+    for (int i = 0; i < program->row_source_count; i++) {
+        winctrl_rows_close(&readers[i]);
+    }
+    for (int i = 0; i < stack.saved_reader_count; i++) {
+        winctrl_rows_close(&stack.saved_readers[i]);
+    }
+    free(readers);
+    free(counters);
+    free(stack.frames);
+    free(stack.values);
+    free(stack.saved_counters);
+    free(stack.saved_readers);
+    return ok;
+}
+
+void winctrl_program_free(Program* program) {
+    free(program->code);
+    free(program->operands);
+    free(program->pool);
+    free(program->conditions);
+    free(program->subs);
+    memset(program, 0, sizeof(*program));
+}
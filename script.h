@@ -0,0 +1,231 @@
+#ifndef WINCONTROL_SCRIPT_H
+#define WINCONTROL_SCRIPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "variables.h"
+
+typedef struct WinControlContext WinControlContext;
+
+typedef struct Command Command;
+
+struct Command {
+    const char* name;
+    const char** params;
+    int param_count;
+    int line;
+    Command* next;
+};
+
+/* Commands and their strings live in the script's arena and are chained in source order. */
+typedef struct {
+    Arena arena;
+    Command* first;
+    Command* last;
+    int count;
+    const char* path;
+} Script;
+
+/*
+ * Parsed INCLUDE files, keyed by resolved path and modification time. A
+ * module is loaded again only when its file changes, so every script
+ * compiled against the same cache shares one parse of a library.
+ */
+typedef struct {
+    char* path;
+    long long mtime;
+    Script script;
+} Module;
+
+typedef struct {
+    Module** modules;
+    int count;
+    int capacity;
+    int loads;
+} ModuleCache;
+
+/* slot is the variable-store index of a $name reference, or -1 for a literal. */
+typedef struct {
+    const char* str;
+    int num;
+    int slot;
+} Operand;
+
+typedef struct Instruction Instruction;
+typedef bool (*CommandHandler)(WinControlContext* ctx, const Instruction* insn);
+typedef bool (*ConditionHandler)(WinControlContext* ctx, const Instruction* insn, bool* result);
+typedef bool (*PredicateHandler)(WinControlContext* ctx, const Operand* args, int argc, bool* result);
+
+typedef enum {
+    FLOW_NONE,
+    FLOW_IF,
+    FLOW_ELSEIF,
+    FLOW_ELSE,
+    FLOW_ENDIF,
+    FLOW_LOOP,
+    FLOW_ENDLOOP,
+    FLOW_WHILE,
+    FLOW_ENDWHILE,
+    FLOW_FOREACH,
+    FLOW_ENDFOREACH,
+    FLOW_BREAK,
+    FLOW_CONTINUE,
+    FLOW_SUB,
+    FLOW_ENDSUB,
+    FLOW_RETURN,
+    FLOW_CALL,
+    FLOW_INCLUDE,
+    FLOW_PREDICATE
+} CommandFlow;
+
+/*
+ * signature holds one character per operand: 's' for a string, 'i' for an
+ * integer that is parsed once at compile time, 'n' for an integer that may
+ * also be "null" (stored as -1), 'v' for a string that may be a $variable
+ * reference and 'w' for the name of a variable that is assigned. A
+ * trailing '*' accepts any number of further 'v' operands; operands after
+ * a '?' may be left out.
+ *
+ * Block commands set flow instead of handler; IF, ELSEIF and WHILE provide
+ * a test that the compiler turns into a conditional jump. Entries with a
+ * predicate can also appear in conditions; with FLOW_PREDICATE they are
+ * not commands at all, like ElementExists.
+ */
+typedef struct {
+    const char* name;
+    const char* signature;
+    CommandHandler handler;
+    CommandFlow flow;
+    ConditionHandler test;
+    PredicateHandler predicate;
+} CommandDefinition;
+
+typedef enum {
+    COND_AND,
+    COND_OR,
+    COND_NOT,
+    COND_COMPARE,
+    COND_VALUE,
+    COND_PREDICATE
+} ConditionKind;
+
+typedef enum {
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE
+} CompareOp;
+
+/*
+ * Conditions are parsed once into a tree over the test instruction's
+ * operands. AND and OR only evaluate right when left does not decide the
+ * result. A comparison uses args[0] and args[2]; a value is true unless it
+ * is empty, "false" or "0".
+ */
+typedef struct ConditionNode ConditionNode;
+struct ConditionNode {
+    ConditionKind kind;
+    CompareOp compare;
+    const ConditionNode* left;
+    const ConditionNode* right;
+    const CommandDefinition* predicate;
+    const Operand* args;
+    int argc;
+};
+
+typedef enum {
+    OP_CALL,
+    OP_TEST,
+    OP_JUMP,
+    OP_LOOP_INIT,
+    OP_LOOP_NEXT,
+    OP_FOREACH_INIT,
+    OP_FOREACH_NEXT,
+    OP_ROWS_INIT,
+    OP_ROWS_NEXT,
+    OP_CALL_SUB,
+    OP_RETURN
+} Opcode;
+
+/*
+ * OP_TEST continues at jump when its condition is false; OP_JUMP always
+ * does. The loop opcodes keep their iteration state in the run's counter
+ * array at index counter and leave the loop through jump; the row opcodes
+ * use counter to pick their reader instead.
+ *
+ * A SUB compiles to a jump over its body whose operands are the SUB name
+ * and its parameter variables, and whose counter is the SUB's index in the
+ * program's subs. OP_CALL_SUB jumps to the instruction after that header
+ * and records the return address; OP_RETURN goes back.
+ * file is the INCLUDE path an instruction came from, or NULL for the
+ * script itself.
+ */
+struct Instruction {
+    Opcode op;
+    CommandHandler handler;
+    ConditionHandler test;
+    const CommandDefinition* def;
+    const Operand* args;
+    int argc;
+    int line;
+    int jump;
+    int counter;
+    const char* file;
+    const ConditionNode* condition;
+};
+
+/*
+ * The loop counters and row readers a SUB's body uses, which are next to
+ * each other because SUBs do not nest. A CALL saves them and RETURN puts
+ * them back, so a SUB that calls itself does not disturb its own loops.
+ */
+typedef struct {
+    int first_counter;
+    int counter_count;
+    int first_source;
+    int source_count;
+} SubroutineLocals;
+
+typedef struct {
+    Instruction* code;
+    int count;
+    Operand* operands;
+    int operand_count;
+    char* pool;
+    size_t pool_size;
+    int counter_count;
+    int row_source_count;
+    SubroutineLocals* subs;
+    int sub_count;
+    ConditionNode* conditions;
+    int condition_count;
+    VariableContext* vars;
+} Program;
+
+bool winctrl_script_load(const char* filename, Script* script, char* error, size_t error_size);
+bool winctrl_script_parse_line(Script* script, const char* line, size_t length, int line_number,
+                               char* error, size_t error_size);
+void winctrl_script_free(Script* script);
+
+bool winctrl_modules_get(ModuleCache* cache, const char* path, const Module** module,
+                         char* error, size_t error_size);
+void winctrl_modules_resolve(const char* origin, const char* path, char* resolved, size_t resolved_size);
+void winctrl_modules_free(ModuleCache* cache);
+
+/* origin is the script's own path, used to resolve INCLUDE; modules may be NULL to disallow INCLUDE. */
+bool winctrl_program_compile(const CommandDefinition* table, const Command* first, int count,
+                             const char* origin, ModuleCache* modules, VariableContext* vars,
+                             Program* program, char* error, size_t error_size);
+bool winctrl_program_run(WinControlContext* ctx, const Program* program, bool trace,
+                         char* error, size_t error_size, int* fault_index);
+/* Supplied by the host; called after each traced command or condition so it can report per-action costs. */
+void winctrl_trace_finished(WinControlContext* ctx, const Instruction* insn);
+void winctrl_program_free(Program* program);
+
+bool winctrl_condition_evaluate(WinControlContext* ctx, const VariableContext* vars, const ConditionNode* node,
+                                bool* result, char* error, size_t error_size);
+
+#endif
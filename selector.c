@@ -0,0 +1,255 @@
+#include "selector.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    const char* name;
+    int id;
+} control_types[] = {
+    {"Button", 50000}, {"Calendar", 50001}, {"CheckBox", 50002}, {"ComboBox", 50003},
+    {"Edit", 50004}, {"Hyperlink", 50005}, {"Image", 50006}, {"ListItem", 50007},
+    {"List", 50008}, {"Menu", 50009}, {"MenuBar", 50010}, {"MenuItem", 50011},
+    {"ProgressBar", 50012}, {"RadioButton", 50013}, {"ScrollBar", 50014}, {"Slider", 50015},
+    {"Spinner", 50016}, {"StatusBar", 50017}, {"Tab", 50018}, {"TabItem", 50019},
+    {"Text", 50020}, {"ToolBar", 50021}, {"ToolTip", 50022}, {"Tree", 50023},
+    {"TreeItem", 50024}, {"Custom", 50025}, {"Group", 50026}, {"Thumb", 50027},
+    {"DataGrid", 50028}, {"DataItem", 50029}, {"Document", 50030}, {"SplitButton", 50031},
+    {"Window", 50032}, {"Pane", 50033}, {"Header", 50034}, {"HeaderItem", 50035},
+    {"Table", 50036}, {"TitleBar", 50037}, {"Separator", 50038}, {"SemanticZoom", 50039},
+    {"AppBar", 50040}
+};
+
+int winctrl_control_type_from_name(const char* name, size_t length) {
+    for (size_t i = 0; i < sizeof(control_types) / sizeof(control_types[0]); i++) {
+        const char* candidate = control_types[i].name;
+        size_t j = 0;
+        while (j < length && candidate[j] && tolower((unsigned char)candidate[j]) == tolower((unsigned char)name[j])) {
+            j++;
+        }
+        if (j == length && candidate[j] == '\0') {
+            return control_types[i].id;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    const char* text;
+    const char* pos;
+    Selector* selector;
+    int capacity;
+    char* error;
+    size_t error_size;
+} SelectorParser;
+
+static bool selector_error(SelectorParser* p, const char* message) {
+    snprintf(p->error, p->error_size, "Selector error at column %d: %s in '%s'",
+        (int)(p->pos - p->text) + 1, message, p->text);
+    return false;
+}
+
+static void skip_spaces(SelectorParser* p) {
+    while (*p->pos == ' ' || *p->pos == '\t') p->pos++;
+}
+
+static bool is_word_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static bool parse_attribute(SelectorParser* p, Locator* locator) {
+    p->pos++;
+    skip_spaces(p);
+    const char* key = p->pos;
+    while (is_word_char(*p->pos)) p->pos++;
+    size_t key_length = (size_t)(p->pos - key);
+    skip_spaces(p);
+    if (*p->pos != '=') {
+        return selector_error(p, "expected '=' after attribute name");
+    }
+    p->pos++;
+    skip_spaces(p);
+
+    const char* value;
+    size_t length;
+    if (*p->pos == '\'') {
+        value = ++p->pos;
+        while (*p->pos && *p->pos != '\'') p->pos++;
+        if (!*p->pos) {
+            return selector_error(p, "unterminated quoted value");
+        }
+        length = (size_t)(p->pos - value);
+        p->pos++;
+        skip_spaces(p);
+    } else {
+        value = p->pos;
+        while (*p->pos && *p->pos != ']') p->pos++;
+        length = (size_t)(p->pos - value);
+        while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t')) length--;
+    }
+    if (*p->pos != ']') {
+        return selector_error(p, "expected ']'");
+    }
+
+    if (key_length == 4 && strncmp(key, "type", 4) == 0) {
+        char* end;
+        long number = strtol(value, &end, 10);
+        if (length > 0 && end == value + length) {
+            locator->control_type = (int)number;
+        } else if ((locator->control_type = winctrl_control_type_from_name(value, length)) == -1) {
+            return selector_error(p, "unknown control type");
+        }
+        p->pos++;
+        return true;
+    }
+
+    char* copy = winctrl_arena_strndup(&p->selector->arena, value, length);
+    if (!copy) {
+        return selector_error(p, "out of memory");
+    }
+    if (key_length == 2 && strncmp(key, "id", 2) == 0) {
+        locator->automation_id = copy;
+    } else if (key_length == 5 && strncmp(key, "class", 5) == 0) {
+        locator->class_name = copy;
+    } else if (key_length == 4 && strncmp(key, "name", 4) == 0) {
+        locator->name = copy;
+    } else {
+        p->pos = key;
+        return selector_error(p, "unknown attribute (use id, class, name or type)");
+    }
+    p->pos++;
+    return true;
+}
+
+static bool parse_step(SelectorParser* p, bool descendants) {
+    Selector* selector = p->selector;
+    if (selector->count == p->capacity) {
+        int capacity = p->capacity ? p->capacity * 2 : 4;
+        SelectorStep* steps = realloc(selector->steps, (size_t)capacity * sizeof(SelectorStep));
+        if (!steps) {
+            return selector_error(p, "out of memory");
+        }
+        selector->steps = steps;
+        p->capacity = capacity;
+    }
+
+    SelectorStep* step = &selector->steps[selector->count];
+    step->descendants = descendants;
+    step->locator.automation_id = NULL;
+    step->locator.class_name = NULL;
+    step->locator.control_type = -1;
+    step->locator.name = NULL;
+
+    if (*p->pos == '*') {
+        p->pos++;
+    } else if (is_word_char(*p->pos)) {
+        const char* type = p->pos;
+        while (is_word_char(*p->pos)) p->pos++;
+        step->locator.control_type = winctrl_control_type_from_name(type, (size_t)(p->pos - type));
+        if (step->locator.control_type == -1) {
+            p->pos = type;
+            return selector_error(p, "unknown control type");
+        }
+    } else if (*p->pos != '[') {
+        return selector_error(p, "expected a control type, '*' or '['");
+    }
+
+    while (*p->pos == '[') {
+        if (!parse_attribute(p, &step->locator)) {
+            return false;
+        }
+    }
+    selector->count++;
+    return true;
+}
+
+bool winctrl_selector_compile(const char* text, Selector* selector, char* error, size_t error_size) {
+    memset(selector, 0, sizeof(*selector));
+    SelectorParser p = { text, text, selector, 0, error, error_size };
+
+    skip_spaces(&p);
+    bool descendants = true;
+    for (;;) {
+        if (!parse_step(&p, descendants)) {
+            winctrl_selector_free(selector);
+            return false;
+        }
+
+        const char* before = p.pos;
+        skip_spaces(&p);
+        if (!*p.pos) {
+            return true;
+        }
+        if (*p.pos == '>') {
+            p.pos++;
+            skip_spaces(&p);
+            descendants = false;
+        } else if (p.pos != before) {
+            descendants = true;
+        } else {
+            selector_error(&p, "expected '>' or a space between steps");
+            winctrl_selector_free(selector);
+            return false;
+        }
+    }
+}
+
+bool winctrl_selector_matches_push(SelectorMatches* matches, void* node) {
+    if (matches->count == matches->capacity) {
+        int capacity = matches->capacity ? matches->capacity * 2 : 8;
+        void** items = realloc(matches->items, (size_t)capacity * sizeof(void*));
+        if (!items) {
+            return false;
+        }
+        matches->items = items;
+        matches->capacity = capacity;
+    }
+    matches->items[matches->count++] = node;
+    return true;
+}
+
+/*
+ * Intermediate steps collect every candidate and try them in order, so
+ * "Group > Button" still succeeds when only the second Group holds a
+ * Button. The last step only needs the first match.
+ */
+static int evaluate_step(const Selector* selector, int index, const SelectorTreeOps* ops, void* backend,
+                         void* node, void** result) {
+    const SelectorStep* step = &selector->steps[index];
+    bool last = index == selector->count - 1;
+    SelectorMatches matches = { NULL, 0, 0 };
+    int status = ops->find(backend, node, step->descendants, &step->locator, last, &matches) ? 0 : -1;
+
+    int i = 0;
+    if (status == 0 && last && matches.count > 0) {
+        *result = matches.items[0];
+        status = 1;
+        i = 1;
+    }
+    for (; status == 0 && i < matches.count; i++) {
+        status = evaluate_step(selector, index + 1, ops, backend, matches.items[i], result);
+    }
+    if (ops->release) {
+        for (int j = (last && status == 1) ? 1 : 0; j < matches.count; j++) {
+            ops->release(backend, matches.items[j]);
+        }
+    }
+    free(matches.items);
+    return status;
+}
+
+int winctrl_selector_evaluate(const Selector* selector, const SelectorTreeOps* ops, void* backend, void* root,
+                              void** result) {
+    *result = NULL;
+    if (selector->count == 0) {
+        return 0;
+    }
+    return evaluate_step(selector, 0, ops, backend, root, result);
+}
+
+void winctrl_selector_free(Selector* selector) {
+    free(selector->steps);
+    winctrl_arena_free(&selector->arena);
+    memset(selector, 0, sizeof(*selector));
+}
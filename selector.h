@@ -0,0 +1,56 @@
+#ifndef WINCONTROL_SELECTOR_H
+#define WINCONTROL_SELECTOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "locator.h"
+
+/*
+ * A selector such as
+ *     Pane[id=main] > Group[class=Toolbar] > Button[name=Save]
+ * is a chain of steps. Each step names a control type (or *) and any of
+ * [id=...], [class=...], [name=...] and [type=...]. A step that follows
+ * '>' is searched among the children of the previous match only; a step
+ * that follows whitespace is searched among all its descendants. Values
+ * run to the closing bracket and may be quoted with single quotes.
+ */
+typedef struct {
+    Locator locator;
+    bool descendants;
+} SelectorStep;
+
+typedef struct {
+    SelectorStep* steps;
+    int count;
+    Arena arena;
+} Selector;
+
+typedef struct {
+    void** items;
+    int count;
+    int capacity;
+} SelectorMatches;
+
+/*
+ * How a selector walks a tree. find appends the nodes below node that
+ * match locator, in document order, stopping after the first when
+ * first_only is set; it returns false when the tree cannot be searched.
+ * Appended nodes are owned by the evaluator, which hands them to
+ * release (if any) once they are no longer needed.
+ */
+typedef struct {
+    bool (*find)(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+                 SelectorMatches* matches);
+    void (*release)(void* backend, void* node);
+} SelectorTreeOps;
+
+bool winctrl_selector_compile(const char* text, Selector* selector, char* error, size_t error_size);
+bool winctrl_selector_matches_push(SelectorMatches* matches, void* node);
+/* Returns 1 and stores the first match in result, 0 when nothing matches, -1 when a search failed. */
+int winctrl_selector_evaluate(const Selector* selector, const SelectorTreeOps* ops, void* backend, void* root,
+                              void** result);
+int winctrl_control_type_from_name(const char* name, size_t length);
+void winctrl_selector_free(Selector* selector);
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "settle.h"
+#include <string.h>
+
+#ifdef _WIN32
+#define compare_names _stricmp
+#else
+#include <strings.h>
+#define compare_names strcasecmp
+#endif
+
+static const char* const ACTION_NAMES[SETTLE_ACTION_COUNT] = {
+    "input",
+    "element",
+    "idle"
+};
+
+/*
+ * Raw input needs no settling of its own; the next element lookup waits
+ * for what it needs. Element actions wait briefly for the UI to react,
+ * and WaitIdle waits for a longer quiet period.
+ */
+void winctrl_settle_defaults(SettlePolicies* policies) {
+    memset(policies, 0, sizeof(*policies));
+    policies->policies[SETTLE_INPUT] = (SettlePolicy){ 0, 0, 0, false };
+    policies->policies[SETTLE_ELEMENT] = (SettlePolicy){ 0, 50, 1000, true };
+    policies->policies[SETTLE_IDLE] = (SettlePolicy){ 0, 200, 10000, true };
+}
+
+bool winctrl_settle_action_from_name(const char* name, SettleAction* action) {
+    for (int i = 0; i < SETTLE_ACTION_COUNT; i++) {
+        if (compare_names(name, ACTION_NAMES[i]) == 0) {
+            *action = (SettleAction)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool winctrl_settle(SettlePolicies* policies, const SettlePolicy* policy, const SettleSignalOps* ops, void* signals) {
+    if (policy->min_ms <= 0 && policy->quiet_ms <= 0 && !policy->input_idle) {
+        return true;
+    }
+
+    long long start = ops->now(signals);
+    long long deadline = start + (policy->timeout_ms > policy->min_ms ? policy->timeout_ms : policy->min_ms);
+    long long last_change = start;
+    long seen = ops->changes(signals);
+    bool settled;
+
+    for (;;) {
+        long long now = ops->now(signals);
+        long changes = ops->changes(signals);
+        if (changes != seen) {
+            seen = changes;
+            last_change = now;
+        }
+
+        long long ready_at = start + policy->min_ms;
+        if (last_change + policy->quiet_ms > ready_at) {
+            ready_at = last_change + policy->quiet_ms;
+        }
+        bool idle = now >= ready_at && (!policy->input_idle || ops->input_idle(signals));
+        if (idle) {
+            settled = true;
+            break;
+        }
+        if (now >= deadline) {
+            settled = false;
+            break;
+        }
+
+        /* Before ready_at only a change can matter; after it, input idle is polled. */
+        long long wake = now < ready_at ? ready_at : now + SETTLE_POLL_MS;
+        if (wake > deadline) {
+            wake = deadline;
+        }
+        ops->wait(signals, wake - now > 0 ? (int)(wake - now) : 1);
+    }
+
+    policies->waited_ms += ops->now(signals) - start;
+    if (settled) {
+        policies->settled++;
+    } else {
+        policies->timeouts++;
+    }
+    return settled;
+}
+
+static long long simulated_now(void* signals) {
+    SimulatedSettle* sim = signals;
+    return sim->now;
+}
+
+static void simulated_wait(void* signals, int timeout_ms) {
+    SimulatedSettle* sim = signals;
+    long long until = sim->now + timeout_ms;
+    sim->waits++;
+    for (int i = 0; i < sim->change_count; i++) {
+        if (sim->changes_at[i] > sim->now && sim->changes_at[i] < until) {
+            until = sim->changes_at[i];
+            break;
+        }
+    }
+    sim->now = until;
+}
+
+static long simulated_changes(void* signals) {
+    SimulatedSettle* sim = signals;
+    long count = 0;
+    while (count < sim->change_count && sim->changes_at[count] <= sim->now) {
+        count++;
+    }
+    return count;
+}
+
+static bool simulated_input_idle(void* signals) {
+    SimulatedSettle* sim = signals;
+    sim->idle_checks++;
+    return sim->now >= sim->busy_until;
+}
+
+const SettleSignalOps SIMULATED_SETTLE_OPS = {
+    simulated_now,
+    simulated_wait,
+    simulated_changes,
+    simulated_input_idle
+};
@@ -0,0 +1,72 @@
+#ifndef WINCONTROL_SETTLE_H
+#define WINCONTROL_SETTLE_H
+
+#include <stdbool.h>
+
+#define SETTLE_POLL_MS 10
+
+/*
+ * When the application counts as settled after an action: at least
+ * min_ms have passed, no UI change was reported for quiet_ms and, with
+ * input_idle, the target has processed its pending input. Settling gives
+ * up after timeout_ms. All zero means the action does not wait.
+ */
+typedef struct {
+    int min_ms;
+    int quiet_ms;
+    int timeout_ms;
+    bool input_idle;
+} SettlePolicy;
+
+typedef enum {
+    SETTLE_INPUT,
+    SETTLE_ELEMENT,
+    SETTLE_IDLE,
+    SETTLE_ACTION_COUNT
+} SettleAction;
+
+typedef struct {
+    SettlePolicy policies[SETTLE_ACTION_COUNT];
+    long settled;
+    long timeouts;
+    long long waited_ms;
+} SettlePolicies;
+
+/*
+ * What settling watches. now is a millisecond clock, wait sleeps up to
+ * timeout_ms and may return early when the UI reports a change, changes
+ * counts UI changes so far and input_idle tells whether the target has
+ * no pending input.
+ */
+typedef struct {
+    long long (*now)(void* signals);
+    void (*wait)(void* signals, int timeout_ms);
+    long (*changes)(void* signals);
+    bool (*input_idle)(void* signals);
+} SettleSignalOps;
+
+void winctrl_settle_defaults(SettlePolicies* policies);
+bool winctrl_settle_action_from_name(const char* name, SettleAction* action);
+
+/* Waits until policy is met and returns true, or false when it timed out. */
+bool winctrl_settle(SettlePolicies* policies, const SettlePolicy* policy, const SettleSignalOps* ops, void* signals);
+
+#define SIMULATED_SETTLE_MAX_CHANGES 64
+
+/*
+ * Signals on a virtual clock. The UI changes at each time in changes_at,
+ * which must be ascending, and the target has pending input until
+ * busy_until. Waiting moves now forward instead of sleeping.
+ */
+typedef struct {
+    long long now;
+    long long changes_at[SIMULATED_SETTLE_MAX_CHANGES];
+    int change_count;
+    long long busy_until;
+    long waits;
+    long idle_checks;
+} SimulatedSettle;
+
+extern const SettleSignalOps SIMULATED_SETTLE_OPS;
+
+#endif
@@ -0,0 +1,789 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "simdesktop.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_MAX_PROCESSES 256
+#define SIM_MAX_DEPTH 64
+
+typedef struct {
+    const char* text;
+    const char* pos;
+    const char* end;
+    int line;
+    SimDesktop* sim;
+    char* error;
+    size_t error_size;
+} JsonParser;
+
+static bool json_error(JsonParser* p, const char* message) {
+    snprintf(p->error, p->error_size, "Desktop JSON error at line %d: %s", p->line, message);
+    return false;
+}
+
+static void skip_space(JsonParser* p) {
+    while (p->pos < p->end && isspace((unsigned char)*p->pos)) {
+        if (*p->pos == '\n') p->line++;
+        p->pos++;
+    }
+}
+
+static bool peek(JsonParser* p, char c) {
+    skip_space(p);
+    return p->pos < p->end && *p->pos == c;
+}
+
+static bool expect(JsonParser* p, char c) {
+    if (!peek(p, c)) {
+        char message[32];
+        snprintf(message, sizeof(message), "expected '%c'", c);
+        return json_error(p, message);
+    }
+    p->pos++;
+    return true;
+}
+
+static size_t put_utf8(char* out, uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+static bool parse_hex4(JsonParser* p, uint32_t* value) {
+    if (p->end - p->pos < 4) return false;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *p->pos++;
+        *value <<= 4;
+        if (c >= '0' && c <= '9') *value |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') *value |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') *value |= (uint32_t)(c - 'A' + 10);
+        else return false;
+    }
+    return true;
+}
+
+/* Decodes into the arena; the result is never longer than the JSON text it came from. */
+static bool parse_string(JsonParser* p, char** result) {
+    if (!expect(p, '"')) return false;
+    const char* start = p->pos;
+    const char* close = start;
+    while (close < p->end && *close != '"') {
+        close += *close == '\\' && close + 1 < p->end ? 2 : 1;
+    }
+    if (close >= p->end) return json_error(p, "unterminated string");
+
+    char* out = winctrl_arena_alloc(&p->sim->arena, (size_t)(close - start) + 1);
+    if (!out) return json_error(p, "out of memory");
+    size_t length = 0;
+    while (p->pos < close) {
+        char c = *p->pos++;
+        if (c == '\n') return json_error(p, "newline in string");
+        if (c != '\\') {
+            out[length++] = c;
+            continue;
+        }
+        c = *p->pos++;
+        switch (c) {
+        case '"': case '\\': case '/': out[length++] = c; break;
+        case 'b': out[length++] = '\b'; break;
+        case 'f': out[length++] = '\f'; break;
+        case 'n': out[length++] = '\n'; break;
+        case 'r': out[length++] = '\r'; break;
+        case 't': out[length++] = '\t'; break;
+        case 'u': {
+            uint32_t codepoint, low;
+            if (!parse_hex4(p, &codepoint)) return json_error(p, "bad \\u escape");
+            if (codepoint >= 0xD800 && codepoint < 0xDC00) {
+                if (p->pos + 1 >= close || p->pos[0] != '\\' || p->pos[1] != 'u') {
+                    return json_error(p, "unpaired surrogate");
+                }
+                p->pos += 2;
+                if (!parse_hex4(p, &low) || low < 0xDC00 || low > 0xDFFF) return json_error(p, "unpaired surrogate");
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+            } else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+                return json_error(p, "unpaired surrogate");
+            }
+            length += put_utf8(out + length, codepoint);
+            break;
+        }
+        default:
+            return json_error(p, "bad escape");
+        }
+    }
+    out[length] = '\0';
+    p->pos = close + 1;
+    *result = out;
+    return true;
+}
+
+static bool parse_int(JsonParser* p, int* value) {
+    skip_space(p);
+    char* number_end;
+    long parsed = strtol(p->pos, &number_end, 10);
+    if (number_end == p->pos || number_end > p->end || *number_end == '.' || *number_end == 'e' || *number_end == 'E') {
+        return json_error(p, "expected an integer");
+    }
+    p->pos = number_end;
+    *value = (int)parsed;
+    return true;
+}
+
+static bool parse_bool(JsonParser* p, bool* value) {
+    skip_space(p);
+    if (p->end - p->pos >= 4 && strncmp(p->pos, "true", 4) == 0) {
+        p->pos += 4;
+        *value = true;
+        return true;
+    }
+    if (p->end - p->pos >= 5 && strncmp(p->pos, "false", 5) == 0) {
+        p->pos += 5;
+        *value = false;
+        return true;
+    }
+    return json_error(p, "expected true or false");
+}
+
+/* Parses "[item, ...]", calling item for each one with p at its start. */
+static bool parse_array(JsonParser* p, bool (*item)(JsonParser* p, void* user, int index), void* user) {
+    if (!expect(p, '[')) return false;
+    if (peek(p, ']')) {
+        p->pos++;
+        return true;
+    }
+    for (int index = 0;; index++) {
+        if (!item(p, user, index)) return false;
+        if (peek(p, ',')) {
+            p->pos++;
+            continue;
+        }
+        return expect(p, ']');
+    }
+}
+
+static bool skip_value(JsonParser* p, int depth);
+
+static bool skip_item(JsonParser* p, void* user, int index) {
+    (void)index;
+    return skip_value(p, *(int*)user);
+}
+
+static bool skip_value(JsonParser* p, int depth) {
+    if (depth > SIM_MAX_DEPTH) return json_error(p, "nested too deeply");
+    skip_space(p);
+    if (p->pos >= p->end) return json_error(p, "unexpected end");
+    char* str;
+    int next = depth + 1;
+    switch (*p->pos) {
+    case '"':
+        return parse_string(p, &str);
+    case '[':
+        return parse_array(p, skip_item, &next);
+    case '{':
+        p->pos++;
+        if (peek(p, '}')) {
+            p->pos++;
+            return true;
+        }
+        do {
+            if (!parse_string(p, &str) || !expect(p, ':') || !skip_value(p, next)) return false;
+        } while (peek(p, ',') && p->pos++);
+        return expect(p, '}');
+    case 'n':
+        if (p->end - p->pos >= 4 && strncmp(p->pos, "null", 4) == 0) {
+            p->pos += 4;
+            return true;
+        }
+        return json_error(p, "unexpected value");
+    case 't':
+    case 'f': {
+        bool value;
+        return parse_bool(p, &value);
+    }
+    default: {
+        char* number_end;
+        strtod(p->pos, &number_end);
+        if (number_end == p->pos || number_end > p->end) return json_error(p, "unexpected value");
+        p->pos = number_end;
+        return true;
+    }
+    }
+}
+
+/*
+ * Calls field for every key of an object, with p at its value; field
+ * returns 0 when it does not know the key, which is then skipped.
+ */
+static bool parse_object(JsonParser* p, int depth, int (*field)(JsonParser* p, void* user, const char* key), void* user) {
+    if (depth > SIM_MAX_DEPTH) return json_error(p, "nested too deeply");
+    if (!expect(p, '{')) return false;
+    if (peek(p, '}')) {
+        p->pos++;
+        return true;
+    }
+    for (;;) {
+        char* key;
+        if (!parse_string(p, &key) || !expect(p, ':')) return false;
+        int status = field(p, user, key);
+        if (status < 0 || (status == 0 && !skip_value(p, depth + 1))) return false;
+        if (peek(p, ',')) {
+            p->pos++;
+            continue;
+        }
+        return expect(p, '}');
+    }
+}
+
+typedef struct {
+    SimElement* parent;
+    SimElement** tail;
+    int depth;
+} ElementList;
+
+static int element_field(JsonParser* p, void* user, const char* key);
+
+static bool element_item(JsonParser* p, void* user, int index) {
+    (void)index;
+    ElementList* list = user;
+    SimElement* element = winctrl_arena_alloc(&p->sim->arena, sizeof(SimElement));
+    if (!element) return json_error(p, "out of memory");
+    memset(element, 0, sizeof(*element));
+    element->control_type = 50033;
+    element->enabled = true;
+    element->parent = list->parent;
+
+    ElementList children = { element, &element->first_child, list->depth + 1 };
+    *list->tail = element;
+    list->tail = &element->next_sibling;
+    return parse_object(p, list->depth, element_field, &children);
+}
+
+static bool rect_item(JsonParser* p, void* user, int index) {
+    int32_t* fields = user;
+    int value;
+    if (index >= 4) return json_error(p, "rect has more than four numbers");
+    if (!parse_int(p, &value)) return false;
+    fields[index] = value;
+    return true;
+}
+
+static bool pattern_item(JsonParser* p, void* user, int index) {
+    static const struct {
+        const char* name;
+        unsigned bit;
+    } PATTERNS[] = {
+        { "invoke", SIM_PATTERN_INVOKE }, { "value", SIM_PATTERN_VALUE }, { "toggle", SIM_PATTERN_TOGGLE },
+        { "expand", SIM_PATTERN_EXPAND }, { "select", SIM_PATTERN_SELECT }
+    };
+    (void)index;
+    unsigned* patterns = user;
+    char* name;
+    if (!parse_string(p, &name)) return false;
+    for (size_t i = 0; i < sizeof(PATTERNS) / sizeof(PATTERNS[0]); i++) {
+        if (strcmp(name, PATTERNS[i].name) == 0) {
+            *patterns |= PATTERNS[i].bit;
+            return true;
+        }
+    }
+    return json_error(p, "unknown pattern");
+}
+
+static bool set_value(SimElement* element, const char* value, size_t length) {
+    char* copy = malloc(length + 1);
+    if (!copy) return false;
+    memcpy(copy, value, length);
+    copy[length] = '\0';
+    free(element->value);
+    element->value = copy;
+    return true;
+}
+
+static int element_field(JsonParser* p, void* user, const char* key) {
+    ElementList* children = user;
+    SimElement* element = children->parent;
+    char* str;
+    bool ok;
+    if (strcmp(key, "children") == 0) {
+        ok = parse_array(p, element_item, children);
+    } else if (strcmp(key, "type") == 0) {
+        ok = parse_string(p, &str);
+        if (ok) {
+            element->control_type = winctrl_control_type_from_name(str, strlen(str));
+            ok = element->control_type != -1 || json_error(p, "unknown control type");
+        }
+    } else if (strcmp(key, "name") == 0) {
+        ok = parse_string(p, &str);
+        element->name = str;
+    } else if (strcmp(key, "id") == 0) {
+        ok = parse_string(p, &str);
+        element->automation_id = str;
+    } else if (strcmp(key, "class") == 0) {
+        ok = parse_string(p, &str);
+        element->class_name = str;
+    } else if (strcmp(key, "value") == 0) {
+        ok = parse_string(p, &str) && (set_value(element, str, strlen(str)) || json_error(p, "out of memory"));
+        element->patterns |= SIM_PATTERN_VALUE;
+    } else if (strcmp(key, "rect") == 0) {
+        int32_t fields[4] = { 0 };
+        ok = parse_array(p, rect_item, fields);
+        element->rect = (DesktopRect){ fields[0], fields[1], fields[2], fields[3] };
+    } else if (strcmp(key, "patterns") == 0) {
+        ok = parse_array(p, pattern_item, &element->patterns);
+    } else if (strcmp(key, "toggle") == 0) {
+        ok = parse_int(p, &element->toggle_state);
+        element->patterns |= SIM_PATTERN_TOGGLE;
+    } else if (strcmp(key, "enabled") == 0) {
+        ok = parse_bool(p, &element->enabled);
+    } else if (strcmp(key, "offscreen") == 0) {
+        ok = parse_bool(p, &element->offscreen);
+    } else if (strcmp(key, "readonly") == 0) {
+        ok = parse_bool(p, &element->read_only);
+    } else if (strcmp(key, "three_state") == 0) {
+        ok = parse_bool(p, &element->three_state);
+    } else if (strcmp(key, "expanded") == 0) {
+        ok = parse_bool(p, &element->expanded);
+    } else if (strcmp(key, "selected") == 0) {
+        ok = parse_bool(p, &element->selected);
+    } else {
+        return 0;
+    }
+    return ok ? 1 : -1;
+}
+
+static int process_field(JsonParser* p, void* user, const char* key) {
+    SimProcess* process = user;
+    char* str;
+    int pid;
+    bool ok;
+    if (strcmp(key, "pid") == 0) {
+        ok = parse_int(p, &pid);
+        process->pid = (uint32_t)pid;
+    } else if (strcmp(key, "name") == 0) {
+        ok = parse_string(p, &str);
+        process->name = str;
+    } else if (strcmp(key, "windows") == 0) {
+        ElementList windows = { NULL, &process->windows, 1 };
+        ok = parse_array(p, element_item, &windows);
+    } else {
+        return 0;
+    }
+    return ok ? 1 : -1;
+}
+
+static bool process_item(JsonParser* p, void* user, int index) {
+    (void)user;
+    (void)index;
+    SimDesktop* sim = p->sim;
+    if (sim->process_count == SIM_MAX_PROCESSES) return json_error(p, "too many processes");
+    SimProcess* process = &sim->processes[sim->process_count++];
+    memset(process, 0, sizeof(*process));
+    if (!parse_object(p, 1, process_field, process)) return false;
+    if (!process->pid || !process->name) return json_error(p, "process needs a pid and a name");
+    return true;
+}
+
+static int desktop_field(JsonParser* p, void* user, const char* key) {
+    (void)user;
+    bool ok;
+    if (strcmp(key, "latency_us") == 0) {
+        ok = parse_int(p, &p->sim->latency_us);
+    } else if (strcmp(key, "processes") == 0) {
+        ok = parse_array(p, process_item, NULL);
+    } else {
+        return 0;
+    }
+    return ok ? 1 : -1;
+}
+
+static void free_values(SimElement* element) {
+    for (; element; element = element->next_sibling) {
+        free(element->value);
+        element->value = NULL;
+        free_values(element->first_child);
+    }
+}
+
+void winctrl_sim_desktop_free(SimDesktop* sim) {
+    for (int i = 0; i < sim->process_count; i++) {
+        free_values(sim->processes[i].windows);
+    }
+    winctrl_arena_free(&sim->arena);
+    memset(sim, 0, sizeof(*sim));
+}
+
+bool winctrl_sim_desktop_parse(SimDesktop* sim, const char* json, size_t length, char* error, size_t error_size) {
+    memset(sim, 0, sizeof(*sim));
+    sim->clock = SYSTEM_CLOCK;
+    sim->processes = winctrl_arena_alloc(&sim->arena, SIM_MAX_PROCESSES * sizeof(SimProcess));
+    if (!sim->processes) {
+        snprintf(error, error_size, "Out of memory loading desktop");
+        return false;
+    }
+
+    JsonParser p = { json, json, json + length, 1, sim, error, error_size };
+    bool ok = parse_object(&p, 0, desktop_field, NULL);
+    skip_space(&p);
+    if (ok && p.pos != p.end) {
+        ok = json_error(&p, "trailing characters");
+    }
+    if (!ok) {
+        winctrl_sim_desktop_free(sim);
+    }
+    return ok;
+}
+
+bool winctrl_sim_desktop_load(SimDesktop* sim, const char* path, char* error, size_t error_size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        snprintf(error, error_size, "Could not open desktop file: %s", path);
+        return false;
+    }
+
+    char* json = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    bool ok = true;
+    while (ok) {
+        if (length == capacity) {
+            capacity = capacity ? capacity * 2 : 64 * 1024;
+            char* grown = realloc(json, capacity);
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            json = grown;
+        }
+        size_t read = fread(json + length, 1, capacity - length, file);
+        length += read;
+        if (read == 0) break;
+    }
+    ok = ok && !ferror(file);
+    fclose(file);
+
+    if (!ok) {
+        free(json);
+        snprintf(error, error_size, "Could not read desktop file: %s", path);
+        return false;
+    }
+    ok = winctrl_sim_desktop_parse(sim, json ? json : "", length, error, error_size);
+    free(json);
+    return ok;
+}
+
+SimProcess* winctrl_sim_desktop_process(SimDesktop* sim, uint32_t pid) {
+    for (int i = 0; i < sim->process_count; i++) {
+        if (sim->processes[i].pid == pid) {
+            return &sim->processes[i];
+        }
+    }
+    return NULL;
+}
+
+/* Every operation is one simulated cross-process call. */
+static void sim_call(SimDesktop* sim) {
+    sim->calls++;
+    winctrl_clock_sleep_us(&sim->clock, sim->latency_us);
+}
+
+static int sim_list_pids(void* backend, uint32_t* pids, int capacity) {
+    SimDesktop* sim = backend;
+    sim_call(sim);
+    int count = 0;
+    for (int i = 0; i < sim->process_count; i++) {
+        if (sim->processes[i].exited) continue;
+        if (count < capacity) pids[count] = sim->processes[i].pid;
+        count++;
+    }
+    return count;
+}
+
+static bool sim_process_name(void* backend, uint32_t pid, char* name, size_t name_size) {
+    SimDesktop* sim = backend;
+    sim_call(sim);
+    SimProcess* process = winctrl_sim_desktop_process(sim, pid);
+    if (!process || process->exited) return false;
+    snprintf(name, name_size, "%s", process->name);
+    return true;
+}
+
+static uintptr_t sim_main_window(void* backend, uint32_t pid) {
+    SimDesktop* sim = backend;
+    sim_call(sim);
+    SimProcess* process = winctrl_sim_desktop_process(sim, pid);
+    return process && !process->exited ? (uintptr_t)process->windows : 0;
+}
+
+static bool sim_window_alive(void* backend, uintptr_t window, uint32_t pid) {
+    SimDesktop* sim = backend;
+    sim_call(sim);
+    SimProcess* process = winctrl_sim_desktop_process(sim, pid);
+    if (!process || process->exited) return false;
+    for (SimElement* candidate = process->windows; candidate; candidate = candidate->next_sibling) {
+        if ((uintptr_t)candidate == window) return true;
+    }
+    return false;
+}
+
+static void* sim_window_root(void* backend, uintptr_t window) {
+    sim_call(backend);
+    return (void*)window;
+}
+
+static bool matches_locator(const SimElement* element, const Locator* locator) {
+    return (locator->control_type == -1 || element->control_type == locator->control_type) &&
+           (!locator->automation_id ||
+            (element->automation_id && strcmp(element->automation_id, locator->automation_id) == 0)) &&
+           (!locator->class_name || (element->class_name && strcmp(element->class_name, locator->class_name) == 0)) &&
+           (!locator->name || (element->name && strcmp(element->name, locator->name) == 0));
+}
+
+/* Depth-first in document order; returns false when out of memory and sets *done after the first match if asked. */
+static bool find_below(SimElement* parent, bool descendants, const Locator* locator, bool first_only,
+                       SelectorMatches* matches, bool* done) {
+    for (SimElement* child = parent->first_child; child && !*done; child = child->next_sibling) {
+        if (matches_locator(child, locator)) {
+            if (!winctrl_selector_matches_push(matches, child)) return false;
+            if (first_only) {
+                *done = true;
+                return true;
+            }
+        }
+        if (descendants && !find_below(child, true, locator, first_only, matches, done)) return false;
+    }
+    return true;
+}
+
+static bool sim_find(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+                     SelectorMatches* matches) {
+    sim_call(backend);
+    bool done = false;
+    return find_below(node, descendants, locator, first_only, matches, &done);
+}
+
+static void sim_release(void* backend, void* element) {
+    (void)backend;
+    (void)element;
+}
+
+static bool sim_read(void* backend, void* element, ElementInfo* info) {
+    SimElement* sim_element = element;
+    sim_call(backend);
+    snprintf(info->name, sizeof(info->name), "%s", sim_element->name ? sim_element->name : "");
+    snprintf(info->automation_id, sizeof(info->automation_id), "%s",
+             sim_element->automation_id ? sim_element->automation_id : "");
+    snprintf(info->class_name, sizeof(info->class_name), "%s", sim_element->class_name ? sim_element->class_name : "");
+    info->control_type = sim_element->control_type;
+    info->rect = sim_element->rect;
+    info->enabled = sim_element->enabled;
+    info->offscreen = sim_element->offscreen;
+    return true;
+}
+
+static bool sim_read_value(void* backend, void* element, char* value, size_t value_size) {
+    SimElement* sim_element = element;
+    sim_call(backend);
+    if (!(sim_element->patterns & SIM_PATTERN_VALUE)) return false;
+    snprintf(value, value_size, "%s", sim_element->value ? sim_element->value : "");
+    return true;
+}
+
+static int act(SimDesktop* sim, SimElement* target, DesktopAction action, const char* value) {
+    if (!target->enabled) {
+        return DESKTOP_FAILED;
+    }
+
+    switch (action) {
+    case DESKTOP_INVOKE:
+        if (!(target->patterns & SIM_PATTERN_INVOKE)) return DESKTOP_UNSUPPORTED;
+        target->invokes++;
+        return DESKTOP_DONE;
+    case DESKTOP_SET_VALUE:
+        if (!(target->patterns & SIM_PATTERN_VALUE)) return DESKTOP_UNSUPPORTED;
+        if (target->read_only || !set_value(target, value, strlen(value))) return DESKTOP_FAILED;
+        return DESKTOP_DONE;
+    case DESKTOP_TOGGLE:
+        if (!(target->patterns & SIM_PATTERN_TOGGLE)) return DESKTOP_UNSUPPORTED;
+        target->toggle_state = (target->toggle_state + 1) % (target->three_state ? 3 : 2);
+        return DESKTOP_DONE;
+    case DESKTOP_EXPAND:
+    case DESKTOP_COLLAPSE:
+        if (!(target->patterns & SIM_PATTERN_EXPAND)) return DESKTOP_UNSUPPORTED;
+        target->expanded = action == DESKTOP_EXPAND;
+        return DESKTOP_DONE;
+    case DESKTOP_SELECT:
+        if (!(target->patterns & SIM_PATTERN_SELECT)) return DESKTOP_UNSUPPORTED;
+        if (target->parent) {
+            for (SimElement* sibling = target->parent->first_child; sibling; sibling = sibling->next_sibling) {
+                sibling->selected = false;
+            }
+        }
+        target->selected = true;
+        return DESKTOP_DONE;
+    case DESKTOP_FOCUS:
+        sim->focus = target;
+        sim->replace_value = false;
+        return DESKTOP_DONE;
+    }
+    return DESKTOP_FAILED;
+}
+
+static int sim_act(void* backend, void* element, DesktopAction action, const char* value) {
+    SimDesktop* sim = backend;
+    sim_call(sim);
+    int status = act(sim, element, action, value);
+    if (status == DESKTOP_DONE) {
+        sim->changes++;
+    }
+    return status;
+}
+
+static int sim_toggle_state(void* backend, void* element) {
+    SimElement* sim_element = element;
+    sim_call(backend);
+    return sim_element->patterns & SIM_PATTERN_TOGGLE ? sim_element->toggle_state : -1;
+}
+
+static bool contains_point(const SimElement* element, int x, int y) {
+    return !element->offscreen && element->rect.right > element->rect.left && element->rect.bottom > element->rect.top &&
+           x >= element->rect.left && x < element->rect.right && y >= element->rect.top && y < element->rect.bottom;
+}
+
+/* The deepest element under the point; children without a rect do not hide their parent. */
+static SimElement* hit_test(SimElement* first, int x, int y) {
+    for (SimElement* element = first; element; element = element->next_sibling) {
+        SimElement* inner = hit_test(element->first_child, x, y);
+        if (inner) return inner;
+        if (contains_point(element, x, y)) return element;
+    }
+    return NULL;
+}
+
+/* A left click does what the control's own pattern does, as a real click would. */
+static void sim_click(void* backend, int x, int y, DesktopButton button, int count) {
+    SimDesktop* sim = backend;
+    sim_call(sim);
+    sim->clicks += count;
+
+    SimElement* target = NULL;
+    for (int i = 0; i < sim->process_count && !target; i++) {
+        if (!sim->processes[i].exited) {
+            target = hit_test(sim->processes[i].windows, x, y);
+        }
+    }
+    if (!target) {
+        return;
+    }
+
+    target->clicks += count;
+    sim->changes++;
+    if (button != DESKTOP_LEFT || !target->enabled) {
+        return;
+    }
+    sim->focus = target;
+    sim->replace_value = false;
+    if (target->patterns & SIM_PATTERN_INVOKE) target->invokes++;
+    if (target->patterns & SIM_PATTERN_TOGGLE) target->toggle_state = (target->toggle_state + 1) % (target->three_state ? 3 : 2);
+    if (target->patterns & SIM_PATTERN_EXPAND) target->expanded = !target->expanded;
+    if (target->patterns & SIM_PATTERN_SELECT) act(sim, target, DESKTOP_SELECT, NULL);
+}
+
+static void type_text(SimDesktop* sim, const char* text, size_t length) {
+    SimElement* focus = sim->focus;
+    if (!focus || !(focus->patterns & SIM_PATTERN_VALUE) || focus->read_only) {
+        return;
+    }
+    size_t kept = sim->replace_value || !focus->value ? 0 : strlen(focus->value);
+    char* value = malloc(kept + length + 1);
+    if (!value) return;
+    if (kept) memcpy(value, focus->value, kept);
+    memcpy(value + kept, text, length);
+    value[kept + length] = '\0';
+    free(focus->value);
+    focus->value = value;
+    sim->replace_value = false;
+    sim->changes++;
+}
+
+/* Unicode events type their character, Return and Tab type a newline and a tab, and Ctrl+A selects the value. */
+static int sim_send_keys(void* sink, const KeyEvent* events, int count) {
+    SimDesktop* sim = sink;
+    sim_call(sim);
+    for (int i = 0; i < count; i++) {
+        const KeyEvent* event = &events[i];
+        sim->keys++;
+        if (!event->unicode && event->code == KEY_VK_CONTROL) {
+            sim->ctrl_down = !event->up;
+            continue;
+        }
+        if (event->up) {
+            continue;
+        }
+
+        char text[4];
+        size_t length = 0;
+        if (event->unicode) {
+            if (event->code >= 0xD800 && event->code < 0xDC00) {
+                sim->high_surrogate = event->code;
+            } else if (event->code >= 0xDC00 && event->code <= 0xDFFF) {
+                if (sim->high_surrogate) {
+                    length = put_utf8(text, 0x10000 + ((uint32_t)(sim->high_surrogate - 0xD800) << 10) +
+                                            (uint32_t)(event->code - 0xDC00));
+                }
+                sim->high_surrogate = 0;
+            } else {
+                length = put_utf8(text, event->code);
+            }
+        } else if (event->code == KEY_VK_RETURN) {
+            text[length++] = '\n';
+        } else if (event->code == KEY_VK_TAB) {
+            text[length++] = '\t';
+        } else if (event->code == 'A' && sim->ctrl_down) {
+            sim->replace_value = true;
+        }
+        if (length) {
+            type_text(sim, text, length);
+        }
+    }
+    return count;
+}
+
+static void sim_pause(void* sink, int milliseconds) {
+    SimDesktop* sim = sink;
+    winctrl_clock_sleep_ms(&sim->clock, milliseconds);
+}
+
+const DesktopOps SIM_DESKTOP_OPS = {
+    { sim_list_pids, sim_process_name, sim_main_window, sim_window_alive },
+    sim_window_root,
+    sim_find,
+    sim_release,
+    sim_read,
+    sim_read_value,
+    sim_act,
+    sim_toggle_state,
+    sim_click,
+    NULL,
+    { sim_send_keys, sim_pause }
+};
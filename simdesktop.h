@@ -0,0 +1,93 @@
+#ifndef WINCONTROL_SIMDESKTOP_H
+#define WINCONTROL_SIMDESKTOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "clock.h"
+#include "desktop.h"
+
+#define SIM_PATTERN_INVOKE 0x01
+#define SIM_PATTERN_VALUE 0x02
+#define SIM_PATTERN_TOGGLE 0x04
+#define SIM_PATTERN_EXPAND 0x08
+#define SIM_PATTERN_SELECT 0x10
+
+typedef struct SimElement SimElement;
+
+/* value is the only string that changes, so it is allocated separately from the arena. */
+struct SimElement {
+    const char* name;
+    const char* automation_id;
+    const char* class_name;
+    int control_type;
+    DesktopRect rect;
+    bool enabled;
+    bool offscreen;
+    bool read_only;
+    bool three_state;
+    unsigned patterns;
+    char* value;
+    int toggle_state;
+    bool expanded;
+    bool selected;
+    long invokes;
+    long clicks;
+    SimElement* parent;
+    SimElement* first_child;
+    SimElement* next_sibling;
+};
+
+typedef struct {
+    uint32_t pid;
+    const char* name;
+    SimElement* windows;
+    bool exited;
+} SimProcess;
+
+/*
+ * A scripted desktop held in memory. Every call through SIM_DESKTOP_OPS
+ * is counted and first waits latency_us on clock, to stand in for the
+ * cost of a cross-process call. Input works like on a real desktop:
+ * clicks hit the deepest element under the point, and keys type into the
+ * focused one. changes counts everything that changed the desktop.
+ * Loading sets clock to SYSTEM_CLOCK.
+ */
+typedef struct {
+    Arena arena;
+    Clock clock;
+    SimProcess* processes;
+    int process_count;
+    int latency_us;
+    SimElement* focus;
+    bool ctrl_down;
+    bool replace_value;
+    uint16_t high_surrogate;
+    long calls;
+    long changes;
+    long keys;
+    long clicks;
+} SimDesktop;
+
+/*
+ * Loads a desktop from JSON such as
+ *     { "latency_us": 200,
+ *       "processes": [ { "pid": 100, "name": "notepad.exe", "windows": [
+ *           { "type": "Window", "name": "Untitled", "rect": [0, 0, 800, 600], "children": [
+ *               { "type": "Edit", "id": "15", "value": "", "rect": [0, 20, 800, 600] } ] } ] } ] }
+ * Elements take type, name, id, class, value, rect, enabled, offscreen,
+ * readonly, patterns (any of invoke, value, toggle, expand and select),
+ * toggle, three_state, expanded, selected and children. A value implies
+ * the value pattern. Elements without a rect cannot be clicked.
+ */
+bool winctrl_sim_desktop_parse(SimDesktop* sim, const char* json, size_t length, char* error, size_t error_size);
+bool winctrl_sim_desktop_load(SimDesktop* sim, const char* path, char* error, size_t error_size);
+void winctrl_sim_desktop_free(SimDesktop* sim);
+
+/* The process with this PID, for scripting starts and exits between lookups. */
+SimProcess* winctrl_sim_desktop_process(SimDesktop* sim, uint32_t pid);
+
+extern const DesktopOps SIM_DESKTOP_OPS;
+
+#endif
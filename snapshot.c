@@ -0,0 +1,345 @@
+#include "snapshot.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_MAGIC "WCSNAP1\n"
+
+typedef struct {
+    char magic[8];
+    uint32_t node_count;
+    uint32_t strings_size;
+    uint32_t runtime_ids_size;
+} SnapshotHeader;
+
+static bool grow(void** items, size_t* capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) return true;
+    size_t new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed) new_capacity *= 2;
+    void* grown = realloc(*items, new_capacity * item_size);
+    if (!grown) return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static size_t hash_string(const char* str) {
+    size_t hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t hash_type(int control_type) {
+    return (size_t)(unsigned int)control_type * 2654435761u;
+}
+
+static uint32_t add_string(Snapshot* snapshot, const char* str) {
+    if (!str || !*str) return 0;
+    size_t length = strlen(str) + 1;
+    if (!grow((void**)&snapshot->strings, &snapshot->strings_capacity, snapshot->strings_size + length, 1)) {
+        return UINT32_MAX;
+    }
+    uint32_t offset = (uint32_t)snapshot->strings_size;
+    memcpy(snapshot->strings + offset, str, length);
+    snapshot->strings_size += length;
+    return offset;
+}
+
+void winctrl_snapshot_init(Snapshot* snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+int winctrl_snapshot_add(Snapshot* snapshot, int parent, const SnapshotElement* element) {
+    if (snapshot->strings_size == 0) {
+        if (!grow((void**)&snapshot->strings, &snapshot->strings_capacity, 1, 1)) return -1;
+        snapshot->strings[0] = '\0';
+        snapshot->strings_size = 1;
+    }
+
+    size_t capacity = (size_t)snapshot->capacity;
+    if (!grow((void**)&snapshot->nodes, &capacity, (size_t)snapshot->count + 1, sizeof(SnapshotNode))) {
+        return -1;
+    }
+    snapshot->capacity = (int)capacity;
+
+    SnapshotNode node;
+    node.parent = parent;
+    node.control_type = element->control_type;
+    node.name = add_string(snapshot, element->name);
+    node.automation_id = add_string(snapshot, element->automation_id);
+    node.class_name = add_string(snapshot, element->class_name);
+    if (node.name == UINT32_MAX || node.automation_id == UINT32_MAX || node.class_name == UINT32_MAX) {
+        return -1;
+    }
+
+    node.runtime_id = (uint32_t)snapshot->runtime_ids_size;
+    node.runtime_id_length = element->runtime_id_length > 0 ? (uint32_t)element->runtime_id_length : 0;
+    if (node.runtime_id_length > 0) {
+        if (!grow((void**)&snapshot->runtime_ids, &snapshot->runtime_ids_capacity,
+                  snapshot->runtime_ids_size + node.runtime_id_length, sizeof(int32_t))) {
+            return -1;
+        }
+        memcpy(snapshot->runtime_ids + snapshot->runtime_ids_size, element->runtime_id,
+               node.runtime_id_length * sizeof(int32_t));
+        snapshot->runtime_ids_size += node.runtime_id_length;
+    }
+
+    node.left = element->left;
+    node.top = element->top;
+    node.right = element->right;
+    node.bottom = element->bottom;
+    snapshot->nodes[snapshot->count] = node;
+    return snapshot->count++;
+}
+
+static void free_index(SnapshotIndex* index) {
+    free(index->heads);
+    free(index->next);
+    memset(index, 0, sizeof(*index));
+}
+
+static size_t node_key_hash(const Snapshot* snapshot, const SnapshotIndex* index, const SnapshotNode* node) {
+    if (index == &snapshot->by_id) return hash_string(snapshot->strings + node->automation_id);
+    if (index == &snapshot->by_name) return hash_string(snapshot->strings + node->name);
+    if (index == &snapshot->by_class) return hash_string(snapshot->strings + node->class_name);
+    return hash_type(node->control_type);
+}
+
+/* Inserting from the last node to the first leaves every chain in document order. */
+static bool build_index(Snapshot* snapshot, SnapshotIndex* index) {
+    size_t buckets = 16;
+    while (buckets < (size_t)snapshot->count) buckets *= 2;
+
+    index->heads = malloc(buckets * sizeof(int32_t));
+    index->next = malloc(((size_t)snapshot->count + 1) * sizeof(int32_t));
+    if (!index->heads || !index->next) {
+        free_index(index);
+        return false;
+    }
+    memset(index->heads, 0xFF, buckets * sizeof(int32_t));
+    index->mask = buckets - 1;
+
+    for (int i = snapshot->count - 1; i >= 1; i--) {
+        size_t bucket = node_key_hash(snapshot, index, &snapshot->nodes[i]) & index->mask;
+        index->next[i] = index->heads[bucket];
+        index->heads[bucket] = i;
+    }
+    return true;
+}
+
+/* Nodes are in document order, so each subtree is the range [node, subtree_end[node]). */
+static bool build_subtree_ends(Snapshot* snapshot) {
+    snapshot->subtree_end = malloc(((size_t)snapshot->count + 1) * sizeof(int32_t));
+    if (!snapshot->subtree_end) return false;
+    for (int i = 0; i < snapshot->count; i++) {
+        snapshot->subtree_end[i] = i + 1;
+    }
+    for (int i = snapshot->count - 1; i >= 1; i--) {
+        int32_t parent = snapshot->nodes[i].parent;
+        if (parent >= 0 && snapshot->subtree_end[parent] < snapshot->subtree_end[i]) {
+            snapshot->subtree_end[parent] = snapshot->subtree_end[i];
+        }
+    }
+    return true;
+}
+
+bool winctrl_snapshot_finish(Snapshot* snapshot) {
+    return build_subtree_ends(snapshot) &&
+           build_index(snapshot, &snapshot->by_id) &&
+           build_index(snapshot, &snapshot->by_name) &&
+           build_index(snapshot, &snapshot->by_class) &&
+           build_index(snapshot, &snapshot->by_type);
+}
+
+static bool field_matches(const Snapshot* snapshot, uint32_t offset, const char* wanted) {
+    return !wanted || strcmp(snapshot->strings + offset, wanted) == 0;
+}
+
+static bool node_matches(const Snapshot* snapshot, const SnapshotNode* node, const Locator* locator) {
+    return (locator->control_type == -1 || node->control_type == locator->control_type) &&
+           field_matches(snapshot, node->automation_id, locator->automation_id) &&
+           field_matches(snapshot, node->name, locator->name) &&
+           field_matches(snapshot, node->class_name, locator->class_name);
+}
+
+static const SnapshotIndex* choose_index(const Snapshot* snapshot, const Locator* locator, size_t* hash) {
+    if (locator->automation_id) {
+        *hash = hash_string(locator->automation_id);
+        return &snapshot->by_id;
+    }
+    if (locator->name) {
+        *hash = hash_string(locator->name);
+        return &snapshot->by_name;
+    }
+    if (locator->class_name) {
+        *hash = hash_string(locator->class_name);
+        return &snapshot->by_class;
+    }
+    if (locator->control_type != -1) {
+        *hash = hash_type(locator->control_type);
+        return &snapshot->by_type;
+    }
+    return NULL;
+}
+
+/*
+ * Visits the matches inside the subtree of parent in document order.
+ * Each match is appended to matches when given, otherwise stored in
+ * *first; first_only stops after one.
+ */
+static bool collect_matches(const Snapshot* snapshot, int parent, bool descendants, const Locator* locator,
+                            bool first_only, SelectorMatches* matches, int* first) {
+    int end = snapshot->subtree_end ? snapshot->subtree_end[parent] : snapshot->count;
+    size_t hash = 0;
+    const SnapshotIndex* index = choose_index(snapshot, locator, &hash);
+    int32_t i = index && index->heads ? index->heads[hash & index->mask] : parent + 1;
+
+    while (i != -1 && i < end) {
+        if (i > parent && (descendants || snapshot->nodes[i].parent == parent) &&
+            node_matches(snapshot, &snapshot->nodes[i], locator)) {
+            if (!matches) {
+                *first = i;
+            } else if (!winctrl_selector_matches_push(matches, (void*)(intptr_t)(i + 1))) {
+                return false;
+            }
+            if (first_only) break;
+        }
+        if (index && index->heads) {
+            i = index->next[i];
+        } else {
+            i = descendants || snapshot->subtree_end == NULL ? i + 1 : snapshot->subtree_end[i];
+        }
+    }
+    return true;
+}
+
+int winctrl_snapshot_find(const Snapshot* snapshot, const Locator* locator) {
+    int first = -1;
+    if (snapshot->count > 0) {
+        collect_matches(snapshot, 0, true, locator, true, NULL, &first);
+    }
+    return first;
+}
+
+/* Selector nodes are node indices plus one, so the root is not a NULL pointer. */
+static bool snapshot_find_nodes(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+                                SelectorMatches* matches) {
+    return collect_matches(backend, (int)((intptr_t)node - 1), descendants, locator, first_only, matches, NULL);
+}
+
+static const SelectorTreeOps SNAPSHOT_TREE_OPS = {
+    snapshot_find_nodes,
+    NULL
+};
+
+int winctrl_snapshot_select(const Snapshot* snapshot, const Selector* selector) {
+    void* result = NULL;
+    if (snapshot->count == 0 ||
+        winctrl_selector_evaluate(selector, &SNAPSHOT_TREE_OPS, (void*)snapshot, (void*)(intptr_t)1, &result) != 1) {
+        return -1;
+    }
+    return (int)((intptr_t)result - 1);
+}
+
+const char* winctrl_snapshot_string(const Snapshot* snapshot, uint32_t offset) {
+    return offset < snapshot->strings_size ? snapshot->strings + offset : "";
+}
+
+bool winctrl_snapshot_save(const Snapshot* snapshot, const char* path, char* error, size_t error_size) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        snprintf(error, error_size, "Could not create snapshot file: %s", path);
+        return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.node_count = (uint32_t)snapshot->count;
+    header.strings_size = (uint32_t)snapshot->strings_size;
+    header.runtime_ids_size = (uint32_t)snapshot->runtime_ids_size;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(snapshot->nodes, sizeof(SnapshotNode), (size_t)snapshot->count, file) == (size_t)snapshot->count &&
+              fwrite(snapshot->strings, 1, snapshot->strings_size, file) == snapshot->strings_size &&
+              fwrite(snapshot->runtime_ids, sizeof(int32_t), snapshot->runtime_ids_size, file) == snapshot->runtime_ids_size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        snprintf(error, error_size, "Failed to write snapshot file: %s", path);
+    }
+    return ok;
+}
+
+static bool valid_nodes(const Snapshot* snapshot) {
+    if (snapshot->strings_size == 0 || snapshot->strings[snapshot->strings_size - 1] != '\0') {
+        return snapshot->count == 0;
+    }
+    for (int i = 0; i < snapshot->count; i++) {
+        const SnapshotNode* node = &snapshot->nodes[i];
+        if (node->parent >= i || node->parent < -1 ||
+            node->name >= snapshot->strings_size || node->automation_id >= snapshot->strings_size ||
+            node->class_name >= snapshot->strings_size ||
+            node->runtime_id > snapshot->runtime_ids_size ||
+            node->runtime_id_length > snapshot->runtime_ids_size - node->runtime_id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool winctrl_snapshot_load(Snapshot* snapshot, const char* path, char* error, size_t error_size) {
+    winctrl_snapshot_init(snapshot);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        snprintf(error, error_size, "Could not open snapshot file: %s", path);
+        return false;
+    }
+
+    SnapshotHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        fclose(file);
+        snprintf(error, error_size, "Not a snapshot file: %s", path);
+        return false;
+    }
+
+    snapshot->count = snapshot->capacity = (int)header.node_count;
+    snapshot->strings_size = snapshot->strings_capacity = header.strings_size;
+    snapshot->runtime_ids_size = snapshot->runtime_ids_capacity = header.runtime_ids_size;
+    snapshot->nodes = malloc((header.node_count ? header.node_count : 1) * sizeof(SnapshotNode));
+    snapshot->strings = malloc(header.strings_size ? header.strings_size : 1);
+    snapshot->runtime_ids = malloc((header.runtime_ids_size ? header.runtime_ids_size : 1) * sizeof(int32_t));
+
+    bool ok = snapshot->nodes && snapshot->strings && snapshot->runtime_ids &&
+              fread(snapshot->nodes, sizeof(SnapshotNode), header.node_count, file) == header.node_count &&
+              fread(snapshot->strings, 1, header.strings_size, file) == header.strings_size &&
+              fread(snapshot->runtime_ids, sizeof(int32_t), header.runtime_ids_size, file) == header.runtime_ids_size;
+    fclose(file);
+
+    if (!ok || header.node_count > INT32_MAX || !valid_nodes(snapshot)) {
+        snprintf(error, error_size, "Snapshot file is truncated or corrupt: %s", path);
+        winctrl_snapshot_free(snapshot);
+        return false;
+    }
+    if (!winctrl_snapshot_finish(snapshot)) {
+        snprintf(error, error_size, "Out of memory while loading snapshot: %s", path);
+        winctrl_snapshot_free(snapshot);
+        return false;
+    }
+    return true;
+}
+
+void winctrl_snapshot_free(Snapshot* snapshot) {
+    free(snapshot->nodes);
+    free(snapshot->strings);
+    free(snapshot->runtime_ids);
+    free(snapshot->subtree_end);
+    free_index(&snapshot->by_id);
+    free_index(&snapshot->by_name);
+    free_index(&snapshot->by_class);
+    free_index(&snapshot->by_type);
+    winctrl_snapshot_init(snapshot);
+}
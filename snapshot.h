@@ -0,0 +1,83 @@
+#ifndef WINCONTROL_SNAPSHOT_H
+#define WINCONTROL_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "locator.h"
+#include "selector.h"
+
+/*
+ * One element of a captured tree. Strings are offsets into the snapshot's
+ * string pool (0 is the empty string) and the runtime ID is a slice of
+ * its runtime ID pool, so a node is plain data that can be written to
+ * disk as is. Nodes are stored in document order and parent is always
+ * lower than the node's own index; the root has parent -1.
+ */
+typedef struct {
+    int32_t parent;
+    int32_t control_type;
+    uint32_t name;
+    uint32_t automation_id;
+    uint32_t class_name;
+    uint32_t runtime_id;
+    uint32_t runtime_id_length;
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+} SnapshotNode;
+
+/* Chains every node with the same key hash, in document order. */
+typedef struct {
+    int32_t* heads;
+    int32_t* next;
+    size_t mask;
+} SnapshotIndex;
+
+typedef struct {
+    SnapshotNode* nodes;
+    int count;
+    int capacity;
+    char* strings;
+    size_t strings_size;
+    size_t strings_capacity;
+    int32_t* runtime_ids;
+    size_t runtime_ids_size;
+    size_t runtime_ids_capacity;
+    SnapshotIndex by_id;
+    SnapshotIndex by_name;
+    SnapshotIndex by_class;
+    SnapshotIndex by_type;
+    int32_t* subtree_end;
+} Snapshot;
+
+/* Field values of one element while a snapshot is being built; NULL strings are stored as empty. */
+typedef struct {
+    const char* name;
+    const char* automation_id;
+    const char* class_name;
+    int control_type;
+    const int32_t* runtime_id;
+    int runtime_id_length;
+    int left;
+    int top;
+    int right;
+    int bottom;
+} SnapshotElement;
+
+void winctrl_snapshot_init(Snapshot* snapshot);
+/* Appends a node and returns its index, or -1 when out of memory. */
+int winctrl_snapshot_add(Snapshot* snapshot, int parent, const SnapshotElement* element);
+/* Builds the lookup indices and subtree bounds; call once after the last add. */
+bool winctrl_snapshot_finish(Snapshot* snapshot);
+/* Returns the first descendant of the root matching the locator, like FindFirst, or -1. */
+int winctrl_snapshot_find(const Snapshot* snapshot, const Locator* locator);
+/* Returns the node a selector resolves to, evaluated over the snapshot, or -1. */
+int winctrl_snapshot_select(const Snapshot* snapshot, const Selector* selector);
+const char* winctrl_snapshot_string(const Snapshot* snapshot, uint32_t offset);
+bool winctrl_snapshot_save(const Snapshot* snapshot, const char* path, char* error, size_t error_size);
+bool winctrl_snapshot_load(Snapshot* snapshot, const char* path, char* error, size_t error_size);
+void winctrl_snapshot_free(Snapshot* snapshot);
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "script.h"
+#include <string.h>
+
+/*
+ * Times the compiled instruction stream against stub handlers that do no
+ * work, so what is left is the cost of dispatch: operand lookup, the
+ * handler call, conditions and loop bookkeeping. The script is generated
+ * as blocks of ten lines; the size argument is the number of blocks.
+ */
+struct WinControlContext {
+    VariableContext vars;
+    long steps;
+    size_t bytes;
+    char last_error[256];
+};
+
+void winctrl_trace_finished(WinControlContext* ctx, const Instruction* insn) {
+    (void)ctx;
+    (void)insn;
+}
+
+static const char* operand_value(WinControlContext* ctx, const Operand* operand) {
+    if (operand->slot < 0) return operand->str;
+    const VariableValue* value = ctx->vars.variables[operand->slot].value;
+    return value ? value->data : "";
+}
+
+static bool handle_step(WinControlContext* ctx, const Instruction* insn) {
+    ctx->steps++;
+    ctx->bytes += strlen(operand_value(ctx, &insn->args[0]));
+    return true;
+}
+
+static bool handle_click(WinControlContext* ctx, const Instruction* insn) {
+    ctx->steps++;
+    ctx->bytes += (size_t)(insn->args[0].num + insn->args[1].num);
+    return true;
+}
+
+static bool handle_set(WinControlContext* ctx, const Instruction* insn) {
+    ctx->steps++;
+    return winctrl_vars_assign(&ctx->vars, insn->args[0].slot, insn->args[1].str, strlen(insn->args[1].str));
+}
+
+static bool test_condition(WinControlContext* ctx, const Instruction* insn, bool* result) {
+    ctx->steps++;
+    return winctrl_condition_evaluate(ctx, &ctx->vars, insn->condition, result,
+                                      ctx->last_error, sizeof(ctx->last_error));
+}
+
+static const CommandDefinition COMMAND_TABLE[] = {
+    {"Step", "v", handle_step},
+    {"Click", "ii", handle_click},
+    {"SET", "ws", handle_set},
+    {"IF", "*", NULL, FLOW_IF, test_condition},
+    {"ENDIF", "", NULL, FLOW_ENDIF},
+    {"LOOP", "v", NULL, FLOW_LOOP},
+    {"ENDLOOP", "", NULL, FLOW_ENDLOOP},
+    {NULL, NULL, NULL}
+};
+
+static const char* const BLOCK[] = {
+    "SET name \"value\"",
+    "Step \"literal\"",
+    "Step \"$name\"",
+    "Click 120 340",
+    "IF \"$name\" == \"value\"",
+    "Step \"taken\"",
+    "ENDIF",
+    "LOOP 2",
+    "Click 1 2",
+    "ENDLOOP",
+};
+
+static bool generate(Script* script, long blocks, char* error, size_t error_size) {
+    int line = 0;
+    for (long i = 0; i < blocks; i++) {
+        for (size_t j = 0; j < sizeof(BLOCK) / sizeof(BLOCK[0]); j++) {
+            if (!winctrl_script_parse_line(script, BLOCK[j], strlen(BLOCK[j]), ++line, error, error_size)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    long blocks = harness_size(argc, argv, 100000);
+    WinControlContext ctx = {0};
+    Script script = {0};
+    Program program = {0};
+    char error[256] = "";
+
+    bool ok = generate(&script, blocks, error, sizeof(error));
+    long long started = harness_now_us();
+    ok = ok && winctrl_program_compile(COMMAND_TABLE, script.first, script.count, NULL, NULL, &ctx.vars,
+                                       &program, error, sizeof(error));
+    long long compiled = harness_now_us();
+    ok = ok && winctrl_program_run(&ctx, &program, false, error, sizeof(error), NULL);
+    long long finished = harness_now_us();
+    if (!ok) {
+        printf("%s\n", error);
+        harness_failures++;
+    }
+
+    /* Each block runs SET, two Steps, a Click, the IF and its Step, and the loop body twice. */
+    CHECK(ctx.steps == blocks * 8);
+    harness_report("compile", script.count, "line", compiled - started);
+    harness_report("run", ctx.steps, "step", finished - compiled);
+    printf("%d instructions, %zu pool bytes\n", program.count, program.pool_size);
+
+    winctrl_program_free(&program);
+    winctrl_script_free(&script);
+    winctrl_vars_free(&ctx.vars);
+    return harness_finish();
+}
@@ -0,0 +1,74 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "script.h"
+#include <string.h>
+
+/*
+ * Writes a generated script of the given number of lines and times
+ * winctrl_script_load on it. The lines mix quoted strings, comments,
+ * blank lines and CRLF endings like the regression scripts do; the
+ * default size is about 7 MB.
+ */
+static const struct {
+    const char* text;
+    bool command;
+} LINES[] = {
+    {"# Fill in the customer form\r\n", false},
+    {"ClickElementByProperties \"CustomerName\" \"Edit\" null\r\n", true},
+    {"SendKeystroke \"$name\"\r\n", true},
+    {"SET greeting \"Hello, world with some padding text\"\r\n", true},
+    {"\r\n", false},
+    {"IF \"$greeting\" != \"\" AND ElementExists \"Window/Button[name='Save']\"\r\n", true},
+    {"    Click 120 340   # save\r\n", true},
+    {"ENDIF\r\n", true},
+};
+
+typedef struct {
+    long bytes;
+    int commands;
+    int last_line;
+} Generated;
+
+static bool write_script(const char* path, long lines, Generated* generated) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    for (long i = 0; i < lines; i++) {
+        size_t index = (size_t)i % (sizeof(LINES) / sizeof(LINES[0]));
+        fputs(LINES[index].text, file);
+        generated->bytes += (long)strlen(LINES[index].text);
+        if (LINES[index].command) {
+            generated->commands++;
+            generated->last_line = (int)i + 1;
+        }
+    }
+    return fclose(file) == 0;
+}
+
+int main(int argc, char** argv) {
+    long lines = harness_size(argc, argv, 200000);
+    const char* path = "bench_parse.wc";
+    Generated generated = {0};
+    CHECK(write_script(path, lines, &generated));
+
+    Script script;
+    char error[256] = "";
+    long long started = harness_now_us();
+    bool ok = winctrl_script_load(path, &script, error, sizeof(error));
+    long long elapsed = harness_now_us() - started;
+    CHECK(ok);
+    if (!ok) printf("%s\n", error);
+
+    CHECK(ok && script.count == generated.commands);
+    CHECK(ok && script.last && script.last->line == generated.last_line);
+
+    harness_report("load", lines, "line", elapsed);
+    printf("%.1f MB in %.3f ms, %.1f MB/s, %zu arena bytes\n", (double)generated.bytes / 1e6,
+        (double)elapsed / 1000.0, elapsed > 0 ? (double)generated.bytes / (double)elapsed : 0.0, ok ? script.arena.bytes_used : 0);
+
+    if (ok) winctrl_script_free(&script);
+    remove(path);
+    return harness_finish();
+}
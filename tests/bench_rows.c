@@ -0,0 +1,132 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "rowsource.h"
+#include "script.h"
+#include <string.h>
+
+/*
+ * Writes a CSV and a JSONL file with the given number of rows and pushes
+ * each through FOREACH ROW with a handler that does nothing, after timing
+ * the reader alone. Some fields are quoted or escaped so the decoding
+ * path is part of the measurement too.
+ */
+struct WinControlContext {
+    VariableContext vars;
+    long calls;
+    size_t bytes;
+};
+
+void winctrl_trace_finished(WinControlContext* ctx, const Instruction* insn) {
+    (void)ctx;
+    (void)insn;
+}
+
+static bool handle_fill(WinControlContext* ctx, const Instruction* insn) {
+    const VariableValue* value = ctx->vars.variables[insn->args[0].slot].value;
+    ctx->calls++;
+    ctx->bytes += value ? value->length : 0;
+    return true;
+}
+
+static const CommandDefinition COMMAND_TABLE[] = {
+    {"Fill", "v", handle_fill},
+    {"FOREACH", "ws*", NULL, FLOW_FOREACH},
+    {"ENDFOREACH", "", NULL, FLOW_ENDFOREACH},
+    {NULL, NULL, NULL}
+};
+
+static bool write_rows(const char* path, long rows, bool jsonl) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    if (!jsonl) fputs("id,name,email,amount,note\n", file);
+    for (long i = 0; i < rows; i++) {
+        bool quoted = i % 10 == 0;
+        if (jsonl) {
+            fprintf(file, "{\"id\": %ld, \"name\": \"Customer %ld\", \"email\": \"c%ld@example.com\", "
+                "\"amount\": %ld.%02ld, \"note\": \"%s\"}\n", i, i, i, i % 1000, i % 100,
+                quoted ? "says \\\"hi\\\"" : "none");
+        } else {
+            fprintf(file, "%ld,Customer %ld,c%ld@example.com,%ld.%02ld,%s\n", i, i, i, i % 1000, i % 100,
+                quoted ? "\"says \"\"hi\"\", twice\"" : "none");
+        }
+    }
+    return fclose(file) == 0;
+}
+
+static bool count_field(void* user, int column, const char* value, size_t length) {
+    (void)column;
+    (void)value;
+    *(size_t*)user += length;
+    return true;
+}
+
+static void bench_reader(const char* path, long rows, const char* label) {
+    RowReader reader;
+    char error[256] = "";
+    size_t bytes = 0;
+    long read = 0;
+    long long started = harness_now_us();
+    bool ok = winctrl_rows_open(&reader, path, error, sizeof(error));
+    int status = 0;
+    while (ok && (status = winctrl_rows_next(&reader, count_field, &bytes, error, sizeof(error))) > 0) {
+        read++;
+    }
+    long long elapsed = harness_now_us() - started;
+    if (ok) winctrl_rows_close(&reader);
+    if (!ok || status < 0) printf("%s\n", error);
+
+    CHECK(ok && status == 0);
+    CHECK(read == rows);
+    harness_report(label, read, "row", elapsed);
+}
+
+static void bench_script(const char* path, long rows, const char* label) {
+    WinControlContext ctx = {0};
+    Script script = {0};
+    Program program = {0};
+    char error[256] = "";
+    char line[300];
+    const char* body[] = { "Fill \"$name\"", "Fill \"$email\"", "Fill \"$note\"", "ENDFOREACH" };
+
+    int length = snprintf(line, sizeof(line), "FOREACH ROW \"%s\"", path);
+    bool ok = winctrl_script_parse_line(&script, line, (size_t)length, 1, error, sizeof(error));
+    for (int i = 0; ok && i < 4; i++) {
+        ok = winctrl_script_parse_line(&script, body[i], strlen(body[i]), i + 2, error, sizeof(error));
+    }
+
+    long long started = harness_now_us();
+    ok = ok && winctrl_program_compile(COMMAND_TABLE, script.first, script.count, NULL, NULL, &ctx.vars,
+                                       &program, error, sizeof(error));
+    ok = ok && winctrl_program_run(&ctx, &program, false, error, sizeof(error), NULL);
+    long long elapsed = harness_now_us() - started;
+    if (!ok) printf("%s\n", error);
+
+    CHECK(ok);
+    CHECK(ctx.calls == rows * 3);
+    harness_report(label, rows, "row", elapsed);
+
+    winctrl_program_free(&program);
+    winctrl_script_free(&script);
+    winctrl_vars_free(&ctx.vars);
+}
+
+int main(int argc, char** argv) {
+    long rows = harness_size(argc, argv, 1000000);
+    const char* csv = "bench_rows.csv";
+    const char* jsonl = "bench_rows.jsonl";
+
+    CHECK(write_rows(csv, rows, false));
+    CHECK(write_rows(jsonl, rows, true));
+
+    bench_reader(csv, rows, "read CSV");
+    bench_script(csv, rows, "FOREACH ROW over CSV");
+    bench_reader(jsonl, rows, "read JSONL");
+    bench_script(jsonl, rows, "FOREACH ROW over JSONL");
+
+    remove(csv);
+    remove(jsonl);
+    return harness_finish();
+}
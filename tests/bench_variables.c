@@ -0,0 +1,136 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "variables.h"
+#include <string.h>
+
+/*
+ * Compares the hash-indexed store with the linear table it replaced, at
+ * 10, 100 and 10k variables. The linear table keeps the old fixed-size
+ * records and strcmp scan, but grows instead of stopping at 100 so the
+ * larger sizes can be measured. Each size does the same number of
+ * lookups and updates by name in a scattered order; the size argument
+ * is that number.
+ */
+#define LINEAR_NAME 32
+#define LINEAR_VALUE 256
+
+typedef struct {
+    char name[LINEAR_NAME];
+    char value[LINEAR_VALUE];
+} LinearVariable;
+
+typedef struct {
+    LinearVariable* variables;
+    int variable_count;
+    int capacity;
+} LinearTable;
+
+static void copy_truncated(char* dest, size_t size, const char* src) {
+    size_t length = strlen(src);
+    if (length >= size) length = size - 1;
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+static bool linear_set(LinearTable* table, const char* name, const char* value) {
+    for (int i = 0; i < table->variable_count; i++) {
+        if (strcmp(table->variables[i].name, name) == 0) {
+            copy_truncated(table->variables[i].value, LINEAR_VALUE, value);
+            return true;
+        }
+    }
+    if (table->variable_count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 16;
+        LinearVariable* grown = realloc(table->variables, (size_t)capacity * sizeof(LinearVariable));
+        if (!grown) return false;
+        table->variables = grown;
+        table->capacity = capacity;
+    }
+    LinearVariable* variable = &table->variables[table->variable_count++];
+    copy_truncated(variable->name, LINEAR_NAME, name);
+    copy_truncated(variable->value, LINEAR_VALUE, value);
+    return true;
+}
+
+static const char* linear_get(const LinearTable* table, const char* name) {
+    for (int i = 0; i < table->variable_count; i++) {
+        if (strcmp(table->variables[i].name, name) == 0) {
+            return table->variables[i].value;
+        }
+    }
+    return NULL;
+}
+
+static void variable_name(char* name, size_t size, long index) {
+    snprintf(name, size, "field_%ld", index);
+}
+
+/* Visits the names in a fixed scattered order so neither store gets a run of neighbours. */
+static long scattered(long op, long count) {
+    return (long)(((unsigned long)op * 2654435761u) % (unsigned long)count);
+}
+
+static void bench_size(long count, long ops) {
+    char name[32];
+    char label[64];
+    long found = 0;
+
+    LinearTable table = {0};
+    for (long i = 0; i < count; i++) {
+        variable_name(name, sizeof(name), i);
+        CHECK(linear_set(&table, name, "initial"));
+    }
+    long long started = harness_now_us();
+    for (long op = 0; op < ops; op++) {
+        variable_name(name, sizeof(name), scattered(op, count));
+        if (op % 4 == 0) {
+            CHECK(linear_set(&table, name, "updated"));
+        } else if (linear_get(&table, name)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "linear, %ld variables", count);
+    harness_report(label, ops, "op", harness_now_us() - started);
+    free(table.variables);
+
+    VariableContext vars = {0};
+    for (long i = 0; i < count; i++) {
+        variable_name(name, sizeof(name), i);
+        CHECK(winctrl_vars_set(&vars, name, "initial"));
+    }
+    started = harness_now_us();
+    for (long op = 0; op < ops; op++) {
+        variable_name(name, sizeof(name), scattered(op, count));
+        if (op % 4 == 0) {
+            CHECK(winctrl_vars_set(&vars, name, "updated"));
+        } else if (winctrl_vars_get(&vars, name)) {
+            found--;
+        }
+    }
+    snprintf(label, sizeof(label), "hash, %ld variables", count);
+    harness_report(label, ops, "op", harness_now_us() - started);
+
+    /* Compiled scripts resolve names to slots once and assign by slot. */
+    int slot = winctrl_vars_find(&vars, "field_0");
+    started = harness_now_us();
+    for (long op = 0; op < ops; op++) {
+        CHECK(winctrl_vars_assign(&vars, slot, op % 2 ? "true" : "false", op % 2 ? 4 : 5));
+    }
+    snprintf(label, sizeof(label), "hash by slot, %ld variables", count);
+    harness_report(label, ops, "op", harness_now_us() - started);
+    CHECK(strcmp(winctrl_vars_get(&vars, "field_0"), ops % 2 ? "false" : "true") == 0);
+    winctrl_vars_free(&vars);
+
+    CHECK(found == 0);
+}
+
+int main(int argc, char** argv) {
+    long ops = harness_size(argc, argv, 100000);
+    bench_size(10, ops);
+    bench_size(100, ops);
+    bench_size(10000, ops);
+    return harness_finish();
+}
@@ -0,0 +1,50 @@
+#ifndef WINCONTROL_HARNESS_H
+#define WINCONTROL_HARNESS_H
+
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Shared by the tests and benchmarks in this directory. CHECK counts a
+ * failure and carries on, so one run reports every broken case, and
+ * harness_finish turns the count into the exit status ctest reads.
+ */
+static int harness_failures;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);    \
+            harness_failures++;                                                \
+        }                                                                      \
+    } while (0)
+
+static inline long long harness_now_us(void) {
+    return SYSTEM_CLOCK.ops->now_us(SYSTEM_CLOCK.clock);
+}
+
+/* Benchmarks take their size as the first argument; ctest passes a small one. */
+static inline long harness_size(int argc, char** argv, long fallback) {
+    if (argc > 1) {
+        long size = strtol(argv[1], NULL, 10);
+        if (size > 0) return size;
+    }
+    return fallback;
+}
+
+static inline void harness_report(const char* name, long items, const char* unit, long long elapsed_us) {
+    double per_item_ns = items > 0 ? (double)elapsed_us * 1000.0 / (double)items : 0.0;
+    printf("%-36s %10ld %-6s %10.3f ms %10.1f ns/%s\n", name, items, unit, (double)elapsed_us / 1000.0,
+        per_item_ns, unit);
+}
+
+static inline int harness_finish(void) {
+    if (harness_failures > 0) {
+        printf("%d check(s) failed\n", harness_failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "events.h"
+#include "locator.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Connects the simulated event source to an element cache and a waiter
+ * the way an attachment in wincontrol.c does, and fires events from
+ * another thread the way UI Automation delivers them.
+ */
+typedef struct {
+    LocatorCache elements;
+    UiWaiter waiter;
+    int builds;
+    int releases;
+    long changes;
+    volatile bool appeared;
+} FakeAttachment;
+
+static void* fake_build(void* backend, const Locator* locator) {
+    (void)locator;
+    FakeAttachment* attachment = backend;
+    int* value = malloc(sizeof(int));
+    if (value) *value = ++attachment->builds;
+    return value;
+}
+
+static void fake_release(void* backend, void* value) {
+    ((FakeAttachment*)backend)->releases++;
+    free(value);
+}
+
+static const LocatorCacheOps FAKE_OPS = { fake_build, fake_release, NULL };
+
+static void on_ui_event(void* user, UiEventKind kind) {
+    FakeAttachment* attachment = user;
+    if (kind != UI_EVENT_WINDOW_OPENED) {
+        winctrl_locator_cache_invalidate(&attachment->elements);
+        attachment->changes++;
+    }
+    winctrl_waiter_signal(&attachment->waiter);
+}
+
+typedef struct {
+    SimulatedEventSource* sim;
+    UiEventKind kind;
+    int count;
+    int delay_ms;
+    FakeAttachment* appear;
+} FireRequest;
+
+#ifdef _WIN32
+static DWORD WINAPI fire_thread(void* arg) {
+#else
+static void* fire_thread(void* arg) {
+#endif
+    FireRequest* request = arg;
+    winctrl_clock_sleep_ms(&SYSTEM_CLOCK, request->delay_ms);
+    if (request->appear) request->appear->appeared = true;
+    for (int i = 0; i < request->count; i++) {
+        winctrl_simulated_events_fire(request->sim, request->kind);
+    }
+    return 0;
+}
+
+#ifdef _WIN32
+typedef HANDLE FireThread;
+#else
+typedef pthread_t FireThread;
+#endif
+
+static bool start_firing(FireThread* thread, FireRequest* request) {
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, fire_thread, request, 0, NULL);
+    return *thread != NULL;
+#else
+    return pthread_create(thread, NULL, fire_thread, request) == 0;
+#endif
+}
+
+static void join_firing(FireThread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+static void fire_from_thread(SimulatedEventSource* sim, UiEventKind kind, int count) {
+    FireRequest request = { sim, kind, count, 0, NULL };
+    FireThread thread;
+    CHECK(start_firing(&thread, &request));
+    join_firing(thread);
+}
+
+static void test_events_invalidate_cache(void) {
+    FakeAttachment attachment = {0};
+    CHECK(winctrl_waiter_init(&attachment.waiter));
+    winctrl_locator_cache_init(&attachment.elements, &FAKE_OPS, &attachment, 64);
+    SimulatedEventSource sim;
+    UiEventSource source;
+    winctrl_simulated_events_init(&sim, &source);
+    int root = 0;
+    CHECK(source.ops.subscribe(source.source, &root, on_ui_event, &attachment));
+
+    Locator save = { "save", NULL, -1, NULL };
+    int* first = winctrl_locator_cache_get(&attachment.elements, &save);
+    CHECK(first && *first == 1);
+    CHECK(winctrl_locator_cache_get(&attachment.elements, &save) == first);
+
+    /* A new top-level window does not change the attached window's elements. */
+    fire_from_thread(&sim, UI_EVENT_WINDOW_OPENED, 1);
+    CHECK(winctrl_locator_cache_get(&attachment.elements, &save) == first);
+    CHECK(attachment.builds == 1);
+
+    /* A burst of changes costs one rebuild, on the next lookup. */
+    fire_from_thread(&sim, UI_EVENT_STRUCTURE_CHANGED, 100);
+    fire_from_thread(&sim, UI_EVENT_PROPERTY_CHANGED, 1);
+    CHECK(attachment.releases == 0);
+    int* rebuilt = winctrl_locator_cache_get(&attachment.elements, &save);
+    CHECK(rebuilt && *rebuilt == 2);
+    CHECK(attachment.elements.invalidations == 1);
+    CHECK(attachment.releases == 1);
+    CHECK(attachment.changes == 101);
+    CHECK(sim.fired == 102);
+
+    /* Once unsubscribed, events no longer reach the cache. */
+    source.ops.unsubscribe(source.source);
+    winctrl_simulated_events_fire(&sim, UI_EVENT_STRUCTURE_CHANGED);
+    CHECK(sim.fired == 102);
+    CHECK(winctrl_locator_cache_get(&attachment.elements, &save) == rebuilt);
+
+    winctrl_locator_cache_free(&attachment.elements);
+    CHECK(attachment.releases == attachment.builds);
+    winctrl_waiter_free(&attachment.waiter);
+}
+
+typedef struct {
+    FakeAttachment* attachment;
+    int probes;
+    int appear_after;
+    int status;
+} Probe;
+
+/* The element appears when the event thread says so, or after a number of probes when nothing fires. */
+static int probe_element(void* user) {
+    Probe* probe = user;
+    probe->probes++;
+    if (probe->status != 0) return probe->status;
+    if (probe->attachment->appeared) return 1;
+    return probe->appear_after > 0 && probe->probes >= probe->appear_after;
+}
+
+static void test_event_wakes_wait(void) {
+    FakeAttachment attachment = {0};
+    CHECK(winctrl_waiter_init(&attachment.waiter));
+    SimulatedEventSource sim;
+    UiEventSource source;
+    winctrl_simulated_events_init(&sim, &source);
+    int root = 0;
+    CHECK(source.ops.subscribe(source.source, &root, on_ui_event, &attachment));
+
+    /* Polling alone would probe at 20, 60, 140, 300 and 620 ms; the event at 320 ms wakes it at once. */
+    Probe probe = { &attachment, 0, 0, 0 };
+    FireRequest request = { &sim, UI_EVENT_STRUCTURE_CHANGED, 1, 320, &attachment };
+    FireThread thread;
+    CHECK(start_firing(&thread, &request));
+    long long started = harness_now_us();
+    int status = winctrl_wait_until(&attachment.waiter, probe_element, &probe, 5000, 10000);
+    long long elapsed_ms = (harness_now_us() - started) / 1000;
+    join_firing(thread);
+
+    CHECK(status == 1);
+    CHECK(attachment.waiter.wakeups == 1);
+    CHECK(attachment.waiter.polls == 4);
+    CHECK(elapsed_ms >= 300 && elapsed_ms < 550);
+    printf("event wake after %lld ms, %d probes\n", elapsed_ms, probe.probes);
+    winctrl_waiter_free(&attachment.waiter);
+}
+
+static void test_backoff_polling(void) {
+    FakeAttachment attachment = {0};
+    CHECK(winctrl_waiter_init(&attachment.waiter));
+
+    /* No events: the fourth probe succeeds after waits of 20, 40 and 80 ms. */
+    Probe probe = { &attachment, 0, 4, 0 };
+    long long started = harness_now_us();
+    CHECK(winctrl_wait_until(&attachment.waiter, probe_element, &probe, 5000, 10000) == 1);
+    long long elapsed_ms = (harness_now_us() - started) / 1000;
+    CHECK(attachment.waiter.polls == 3 && attachment.waiter.wakeups == 0);
+    CHECK(elapsed_ms >= 135 && elapsed_ms < 400);
+
+    /* max_poll_ms caps the doubling: 20, 30, 30. */
+    probe = (Probe){ &attachment, 0, 4, 0 };
+    started = harness_now_us();
+    CHECK(winctrl_wait_until(&attachment.waiter, probe_element, &probe, 5000, 30) == 1);
+    elapsed_ms = (harness_now_us() - started) / 1000;
+    CHECK(elapsed_ms >= 75 && elapsed_ms < 135);
+
+    /* A signal from before the wait was reflected in the first probe and does not wake it. */
+    winctrl_waiter_signal(&attachment.waiter);
+    attachment.waiter.wakeups = 0;
+    attachment.waiter.polls = 0;
+    probe = (Probe){ &attachment, 0, 2, 0 };
+    CHECK(winctrl_wait_until(&attachment.waiter, probe_element, &probe, 5000, 10000) == 1);
+    CHECK(attachment.waiter.wakeups == 0 && attachment.waiter.polls == 1);
+
+    /* Timeouts and probe errors end the wait; the deadline is kept in whole milliseconds. */
+    probe = (Probe){ &attachment, 0, 0, 0 };
+    started = harness_now_us();
+    CHECK(winctrl_wait_until(&attachment.waiter, probe_element, &probe, 100, 10000) == 0);
+    elapsed_ms = (harness_now_us() - started) / 1000;
+    CHECK(elapsed_ms >= 95 && elapsed_ms < 300);
+    probe = (Probe){ &attachment, 0, 0, -1 };
+    CHECK(winctrl_wait_until(&attachment.waiter, probe_element, &probe, 5000, 10000) == -1);
+    CHECK(probe.probes == 1);
+
+    /* A burst of signals is coalesced into one wakeup. */
+    for (int i = 0; i < 5; i++) winctrl_waiter_signal(&attachment.waiter);
+    CHECK(winctrl_waiter_wait(&attachment.waiter, 0));
+    CHECK(!winctrl_waiter_wait(&attachment.waiter, 10));
+    winctrl_waiter_free(&attachment.waiter);
+}
+
+int main(void) {
+    test_events_invalidate_cache();
+    test_event_wakes_wait();
+    test_backoff_polling();
+    return harness_finish();
+}
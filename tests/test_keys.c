@@ -0,0 +1,170 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "keys.h"
+#include <string.h>
+
+/*
+ * Checks the key events text is encoded into and how they reach a
+ * simulated sink, then times encoding and sending a long string. The
+ * size argument is the length of that string.
+ */
+typedef struct {
+    uint16_t code;
+    bool up;
+    bool unicode;
+    bool char_end;
+} ExpectedEvent;
+
+static void expect_events(const KeyEventBuffer* buffer, const ExpectedEvent* expected, int count, const char* what) {
+    bool same = buffer->count == count;
+    for (int i = 0; same && i < count; i++) {
+        const KeyEvent* event = &buffer->events[i];
+        same = event->code == expected[i].code && event->up == expected[i].up &&
+               event->unicode == expected[i].unicode && event->char_end == expected[i].char_end;
+    }
+    if (!same) {
+        printf("%s: got", what);
+        for (int i = 0; i < buffer->count; i++) {
+            const KeyEvent* event = &buffer->events[i];
+            printf(" %s%04X%s%s", event->unicode ? "U+" : "vk", event->code, event->up ? "^" : "v",
+                event->char_end ? "|" : "");
+        }
+        printf("\n");
+    }
+    CHECK(same);
+}
+
+static void encode(KeyEventBuffer* buffer, const char* text, KeyLayoutMap map) {
+    char error[128] = "";
+    winctrl_keys_clear(buffer);
+    CHECK(winctrl_keys_encode(buffer, text, map, NULL, error, sizeof(error)));
+}
+
+/* Like a German layout: '@' needs AltGr, which is Ctrl+Alt, so it has to go out as Unicode. */
+static bool altgr_layout(void* layout, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state) {
+    if (codepoint == '@') {
+        *vkey = 'Q';
+        *scan = 0x10;
+        *state = KEY_STATE_CTRL | KEY_STATE_ALT;
+        return true;
+    }
+    return winctrl_keys_us_layout(layout, codepoint, vkey, scan, state);
+}
+
+static void test_encode(void) {
+    KeyEventBuffer buffer;
+    winctrl_keys_init(&buffer);
+
+    encode(&buffer, "aB", winctrl_keys_us_layout);
+    expect_events(&buffer, (ExpectedEvent[]){
+        { 'A', false, false, false }, { 'A', true, false, true },
+        { KEY_VK_SHIFT, false, false, false }, { 'B', false, false, false }, { 'B', true, false, false },
+        { KEY_VK_SHIFT, true, false, true },
+    }, 6, "aB");
+
+    /* CRLF is one Return; tabs are Tab. */
+    encode(&buffer, "\r\n\t", winctrl_keys_us_layout);
+    expect_events(&buffer, (ExpectedEvent[]){
+        { KEY_VK_RETURN, false, false, false }, { KEY_VK_RETURN, true, false, true },
+        { KEY_VK_TAB, false, false, false }, { KEY_VK_TAB, true, false, true },
+    }, 4, "CRLF tab");
+
+    /* Characters off the layout go out as UTF-16 code units, astral ones as a surrogate pair. */
+    encode(&buffer, "\xC3\xA9\xF0\x9F\x98\x80", winctrl_keys_us_layout);
+    expect_events(&buffer, (ExpectedEvent[]){
+        { 0x00E9, false, true, false }, { 0x00E9, true, true, true },
+        { 0xD83D, false, true, false }, { 0xD83D, true, true, false },
+        { 0xDE00, false, true, false }, { 0xDE00, true, true, true },
+    }, 6, "unicode");
+
+    encode(&buffer, "@", altgr_layout);
+    expect_events(&buffer, (ExpectedEvent[]){ { '@', false, true, false }, { '@', true, true, true } }, 2, "AltGr");
+    encode(&buffer, "a", NULL);
+    expect_events(&buffer, (ExpectedEvent[]){ { 'a', false, true, false }, { 'a', true, true, true } }, 2, "no map");
+
+    const char* invalid[] = { "ab\xC3", "\xC0\xAF", "x\xED\xA0\x80", "\xF4\x90\x80\x80", "\xFF" };
+    const char* offsets[] = { "byte 2", "byte 0", "byte 1", "byte 0", "byte 0" };
+    for (int i = 0; i < 5; i++) {
+        char error[128] = "";
+        winctrl_keys_clear(&buffer);
+        CHECK(!winctrl_keys_encode(&buffer, invalid[i], winctrl_keys_us_layout, NULL, error, sizeof(error)));
+        CHECK(strstr(error, offsets[i]) != NULL);
+    }
+
+    /* A chord is one character as far as throttled sending is concerned. */
+    uint16_t modifiers[] = { KEY_VK_CONTROL, KEY_VK_SHIFT };
+    winctrl_keys_clear(&buffer);
+    CHECK(winctrl_keys_chord(&buffer, modifiers, 2, 'S'));
+    expect_events(&buffer, (ExpectedEvent[]){
+        { KEY_VK_CONTROL, false, false, false }, { KEY_VK_SHIFT, false, false, false },
+        { 'S', false, false, false }, { 'S', true, false, false },
+        { KEY_VK_SHIFT, true, false, false }, { KEY_VK_CONTROL, true, false, true },
+    }, 6, "chord");
+
+    winctrl_keys_free(&buffer);
+}
+
+static void test_send(void) {
+    KeyEventBuffer buffer;
+    winctrl_keys_init(&buffer);
+    char text[301];
+    memset(text, 'a', 300);
+    text[300] = '\0';
+    encode(&buffer, text, winctrl_keys_us_layout);
+
+    /* Unthrottled, 600 events go out in batches of KEY_BATCH_MAX. */
+    SimulatedKeySink sink = {0};
+    CHECK(winctrl_keys_send(&buffer, &SIMULATED_KEY_SINK_OPS, &sink, 0) == 600);
+    CHECK(sink.calls == 3 && sink.paused_ms == 0 && sink.sent.count == 600);
+    winctrl_keys_free(&sink.sent);
+
+    /* Throttled, each character is sent on its own and followed by the pause. */
+    encode(&buffer, "Hi!", winctrl_keys_us_layout);
+    sink = (SimulatedKeySink){0};
+    CHECK(winctrl_keys_send(&buffer, &SIMULATED_KEY_SINK_OPS, &sink, 5) == buffer.count);
+    CHECK(sink.calls == 3 && sink.paused_ms == 15);
+    winctrl_keys_free(&sink.sent);
+
+    /* When input is blocked the count says how far it got, and nothing more is sent. */
+    sink = (SimulatedKeySink){0};
+    sink.refuse_after = 5;
+    CHECK(winctrl_keys_send(&buffer, &SIMULATED_KEY_SINK_OPS, &sink, 5) == 5);
+    CHECK(sink.calls == 2 && sink.paused_ms == 5);
+    winctrl_keys_free(&sink.sent);
+
+    winctrl_keys_free(&buffer);
+}
+
+static void bench_typing(long length) {
+    char* text = malloc((size_t)length + 1);
+    if (!text) return;
+    static const char SAMPLE[] = "The quick brown fox, 42 times!\n";
+    for (long i = 0; i < length; i++) text[i] = SAMPLE[i % (long)(sizeof(SAMPLE) - 1)];
+    text[length] = '\0';
+
+    KeyEventBuffer buffer;
+    SimulatedKeySink sink = {0};
+    char error[128];
+    winctrl_keys_init(&buffer);
+    long long started = harness_now_us();
+    CHECK(winctrl_keys_encode(&buffer, text, winctrl_keys_us_layout, NULL, error, sizeof(error)));
+    long long encoded = harness_now_us();
+    CHECK(winctrl_keys_send(&buffer, &SIMULATED_KEY_SINK_OPS, &sink, 0) == buffer.count);
+    long long sent = harness_now_us();
+    harness_report("encode", length, "char", encoded - started);
+    harness_report("send", buffer.count, "event", sent - encoded);
+
+    winctrl_keys_free(&sink.sent);
+    winctrl_keys_free(&buffer);
+    free(text);
+}
+
+int main(int argc, char** argv) {
+    test_encode();
+    test_send();
+    bench_typing(harness_size(argc, argv, 1000000));
+    return harness_finish();
+}
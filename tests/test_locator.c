@@ -0,0 +1,157 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "locator.h"
+#include <string.h>
+
+/*
+ * Drives LocatorCache with a backend whose values are numbered
+ * allocations. It counts builds and releases, and a value can be marked
+ * dead so validate reports it stale.
+ */
+typedef struct {
+    int serial;
+    bool dead;
+} FakeValue;
+
+typedef struct {
+    int builds;
+    int releases;
+    bool validating;
+} FakeBackend;
+
+static void* fake_build(void* backend, const Locator* locator) {
+    FakeBackend* fake = backend;
+    if (locator->name && strcmp(locator->name, "missing") == 0) return NULL;
+    FakeValue* value = calloc(1, sizeof(FakeValue));
+    if (value) value->serial = ++fake->builds;
+    return value;
+}
+
+static void fake_release(void* backend, void* value) {
+    ((FakeBackend*)backend)->releases++;
+    free(value);
+}
+
+static bool fake_validate(void* backend, void** value) {
+    (void)backend;
+    return !((FakeValue*)*value)->dead;
+}
+
+static const LocatorCacheOps FAKE_OPS = { fake_build, fake_release, NULL };
+static const LocatorCacheOps FAKE_VALIDATED_OPS = { fake_build, fake_release, fake_validate };
+
+static void test_hits_and_keys(void) {
+    FakeBackend fake = {0};
+    LocatorCache cache;
+    winctrl_locator_cache_init(&cache, &FAKE_OPS, &fake, 64);
+
+    Locator locators[] = {
+        { "save", NULL, -1, NULL },
+        { "save", "Button", -1, NULL },
+        { "save", "Button", 50000, NULL },
+        { "save", "Button", 50000, "Save" },
+        { NULL, NULL, -1, "Save" },
+        { NULL, NULL, -1, NULL },
+        { "", NULL, -1, NULL },
+        { NULL, "save", -1, NULL },
+    };
+    int count = (int)(sizeof(locators) / sizeof(locators[0]));
+
+    FakeValue* first[8];
+    for (int i = 0; i < count; i++) {
+        first[i] = winctrl_locator_cache_get(&cache, &locators[i]);
+    }
+    /* Every field is part of the key, and the strings are copied rather than kept. */
+    char id[] = "save";
+    Locator copy = { id, NULL, -1, NULL };
+    for (int round = 0; round < 100000; round++) {
+        int i = round % count;
+        CHECK(winctrl_locator_cache_get(&cache, &locators[i]) == first[i]);
+    }
+    id[0] = 'x';
+    CHECK(winctrl_locator_cache_get(&cache, &locators[0]) == first[0]);
+    CHECK(winctrl_locator_cache_get(&cache, &copy) != first[0]);
+
+    CHECK(fake.builds == count + 1);
+    CHECK(cache.misses == count + 1);
+    CHECK(cache.hits == 100001);
+
+    /* Nothing is cached when the backend has nothing to build. */
+    Locator missing = { NULL, NULL, -1, "missing" };
+    CHECK(winctrl_locator_cache_get(&cache, &missing) == NULL);
+    CHECK(winctrl_locator_cache_get(&cache, &missing) == NULL);
+    CHECK(cache.count == count + 1);
+
+    winctrl_locator_cache_free(&cache);
+    CHECK(fake.releases == fake.builds);
+}
+
+static void test_flush_at_limit(void) {
+    FakeBackend fake = {0};
+    LocatorCache cache;
+    winctrl_locator_cache_init(&cache, &FAKE_OPS, &fake, 4);
+
+    char names[6][8];
+    for (int i = 0; i < 6; i++) {
+        snprintf(names[i], sizeof(names[i]), "item%d", i);
+        Locator locator = { names[i], NULL, -1, NULL };
+        CHECK(winctrl_locator_cache_get(&cache, &locator) != NULL);
+    }
+    /* The fifth entry flushed the first four, so only the last two are left. */
+    CHECK(cache.flushes == 1);
+    CHECK(cache.count == 2);
+    CHECK(fake.releases == 4);
+
+    Locator first = { names[0], NULL, -1, NULL };
+    Locator last = { names[5], NULL, -1, NULL };
+    winctrl_locator_cache_get(&cache, &first);
+    winctrl_locator_cache_get(&cache, &last);
+    CHECK(fake.builds == 7);
+    CHECK(cache.hits == 1);
+
+    winctrl_locator_cache_free(&cache);
+    CHECK(fake.releases == fake.builds);
+}
+
+static void test_stale_and_invalidated(void) {
+    FakeBackend fake = {0};
+    LocatorCache cache;
+    winctrl_locator_cache_init(&cache, &FAKE_VALIDATED_OPS, &fake, 64);
+
+    Locator a = { "a", NULL, -1, NULL };
+    Locator b = { "b", NULL, -1, NULL };
+    FakeValue* value_a = winctrl_locator_cache_get(&cache, &a);
+    FakeValue* value_b = winctrl_locator_cache_get(&cache, &b);
+
+    /* A stale hit is released and built again; the other entry stays. */
+    value_a->dead = true;
+    FakeValue* rebuilt = winctrl_locator_cache_get(&cache, &a);
+    CHECK(rebuilt && rebuilt->serial == 3);
+    CHECK(cache.stale == 1);
+    CHECK(fake.releases == 1);
+    CHECK(winctrl_locator_cache_get(&cache, &b) == value_b);
+
+    /* Invalidation only bumps a counter; the entries go on the next lookup. */
+    winctrl_locator_cache_invalidate(&cache);
+    winctrl_locator_cache_invalidate(&cache);
+    CHECK(cache.count == 2);
+    CHECK(fake.releases == 1);
+    FakeValue* fresh = winctrl_locator_cache_get(&cache, &b);
+    CHECK(fresh && fresh->serial == 4);
+    CHECK(cache.invalidations == 1);
+    CHECK(fake.releases == 3);
+    CHECK(cache.count == 1);
+
+    winctrl_locator_cache_free(&cache);
+    CHECK(fake.releases == fake.builds);
+}
+
+int main(void) {
+    test_hits_and_keys();
+    test_flush_at_limit();
+    test_stale_and_invalidated();
+    return harness_finish();
+}
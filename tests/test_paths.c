@@ -0,0 +1,135 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "paths.h"
+#include <string.h>
+
+/*
+ * Learns, finds and forgets paths, keyed on every locator field including
+ * the ones left NULL, and checks the file they are saved to loads back the
+ * same and is rejected when it is damaged.
+ */
+#define PATHS_FILE "test_paths.wcp"
+
+static const int32_t STEPS[] = { 0, 3, 1 };
+static const int32_t RUNTIME_ID[] = { 42, 7, 9 };
+
+static void expect_path(const PathIndex* index, const char* process, const char* window_class,
+                        const Locator* locator, int32_t last_step) {
+    const LearnedPath* path = winctrl_path_index_find(index, process, window_class, locator);
+    CHECK(path != NULL);
+    if (!path) return;
+    CHECK(path->step_count == 3 && path->steps[0] == 0 && path->steps[2] == last_step);
+    CHECK(path->runtime_id_length == 3 && memcmp(path->runtime_id, RUNTIME_ID, sizeof(RUNTIME_ID)) == 0);
+    CHECK(strcmp(path->process, process) == 0 && path->locator.control_type == locator->control_type);
+}
+
+static void learn(PathIndex* index, const char* process, const char* window_class, const Locator* locator,
+                  int32_t last_step) {
+    int32_t steps[3] = { STEPS[0], STEPS[1], last_step };
+    CHECK(winctrl_path_index_learn(index, process, window_class, locator, steps, 3, RUNTIME_ID, 3));
+}
+
+static void write_file(const void* data, size_t length) {
+    FILE* file = fopen(PATHS_FILE, "wb");
+    if (!file) return;
+    fwrite(data, 1, length, file);
+    fclose(file);
+}
+
+static void expect_load_error(const char* message) {
+    PathIndex index;
+    char error[256] = "";
+    CHECK(!winctrl_path_index_load(&index, PATHS_FILE, error, sizeof(error)));
+    if (!strstr(error, message)) printf("unexpected error: %s\n", error);
+    CHECK(strstr(error, message) != NULL);
+    CHECK(index.count == 0 && index.slots == NULL);
+}
+
+int main(void) {
+    PathIndex index;
+    winctrl_path_index_init(&index);
+    Locator save = { "btnSave", "Button", 50000, "Save" };
+    Locator by_id = { "btnSave", NULL, -1, NULL };
+    Locator by_name = { NULL, NULL, -1, "Save" };
+    Locator none = { NULL, NULL, -1, NULL };
+
+    /* NULL and "" are different keys, and so are the process and window class. */
+    learn(&index, "notepad.exe", "Notepad", &save, 1);
+    learn(&index, "notepad.exe", "Notepad", &by_id, 2);
+    learn(&index, "notepad.exe", NULL, &by_name, 3);
+    learn(&index, "notepad.exe", "Notepad", &none, 4);
+    CHECK(index.count == 4 && index.learned == 4 && index.dirty);
+    expect_path(&index, "notepad.exe", "Notepad", &by_id, 2);
+    expect_path(&index, "notepad.exe", NULL, &by_name, 3);
+    Locator empty_id = { "", NULL, -1, NULL };
+    CHECK(winctrl_path_index_find(&index, "notepad.exe", "Notepad", &empty_id) == NULL);
+    CHECK(winctrl_path_index_find(&index, "notepad.exe", "", &by_name) == NULL);
+    CHECK(winctrl_path_index_find(&index, "calc.exe", "Notepad", &save) == NULL);
+
+    /* Learning the same key again replaces the path. */
+    learn(&index, "notepad.exe", "Notepad", &save, 5);
+    CHECK(index.count == 4);
+    expect_path(&index, "notepad.exe", "Notepad", &save, 5);
+    CHECK(!winctrl_path_index_learn(&index, "notepad.exe", "Notepad", &save, STEPS, PATH_MAX_STEPS + 1,
+                                    RUNTIME_ID, 3));
+
+    /* Enough keys to grow the table; forgetting one leaves the rest findable. */
+    char names[100][16];
+    for (int i = 0; i < 100; i++) {
+        snprintf(names[i], sizeof(names[i]), "item%d", i);
+        Locator item = { NULL, "ListItem", -1, names[i] };
+        learn(&index, "explorer.exe", "CabinetWClass", &item, i);
+    }
+    winctrl_path_index_forget(&index, "notepad.exe", "Notepad", &by_id);
+    winctrl_path_index_forget(&index, "notepad.exe", "Notepad", &by_id);
+    CHECK(index.count == 103);
+    CHECK(winctrl_path_index_find(&index, "notepad.exe", "Notepad", &by_id) == NULL);
+    for (int i = 0; i < 100; i++) {
+        Locator item = { NULL, "ListItem", -1, names[i] };
+        expect_path(&index, "explorer.exe", "CabinetWClass", &item, i);
+    }
+
+    /* Everything comes back from the file, NULL fields included. */
+    char error[256] = "";
+    CHECK(winctrl_path_index_save(&index, PATHS_FILE, error, sizeof(error)));
+    PathIndex loaded;
+    CHECK(winctrl_path_index_load(&loaded, PATHS_FILE, error, sizeof(error)));
+    CHECK(loaded.count == index.count && !loaded.dirty);
+    expect_path(&loaded, "notepad.exe", "Notepad", &save, 5);
+    expect_path(&loaded, "notepad.exe", NULL, &by_name, 3);
+    expect_path(&loaded, "notepad.exe", "Notepad", &none, 4);
+    const LearnedPath* path = winctrl_path_index_find(&loaded, "notepad.exe", NULL, &by_name);
+    CHECK(path && path->window_class == NULL && path->locator.automation_id == NULL);
+    CHECK(winctrl_path_index_find(&loaded, "notepad.exe", "Notepad", &by_id) == NULL);
+    winctrl_path_index_free(&loaded);
+
+    /* Damaged files are rejected whole. */
+    FILE* file = fopen(PATHS_FILE, "rb");
+    static unsigned char data[65536];
+    size_t length = file ? fread(data, 1, sizeof(data), file) : 0;
+    if (file) fclose(file);
+    CHECK(length > 16 && length < sizeof(data));
+    write_file(data, length - 5);
+    expect_load_error("truncated or corrupt");
+    write_file(data, 20);
+    expect_load_error("truncated or corrupt");
+    write_file(data, 4);
+    expect_load_error("Not a learned path file");
+    data[0] = 'X';
+    write_file(data, length);
+    expect_load_error("Not a learned path file");
+
+    /* A missing file is an empty index. */
+    remove(PATHS_FILE);
+    CHECK(winctrl_path_index_load(&loaded, PATHS_FILE, error, sizeof(error)));
+    CHECK(loaded.count == 0);
+    winctrl_path_index_free(&loaded);
+    CHECK(!winctrl_path_index_save(&index, "no_such_dir/paths.wcp", error, sizeof(error)));
+    CHECK(strstr(error, "Could not create") != NULL);
+
+    winctrl_path_index_free(&index);
+    return harness_finish();
+}
@@ -0,0 +1,125 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "registry.h"
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+/*
+ * Looks processes up in a simulated process list that changes between
+ * lookups, counting the calls each lookup makes: a hit checks one name,
+ * and only a miss lists the PIDs and reads the names of new ones.
+ */
+static void test_lookups(void) {
+    static SimulatedProcesses sim;
+    memset(&sim, 0, sizeof(sim));
+    winctrl_simulated_process_start(&sim, 10, "Notepad.exe", 0x100);
+    winctrl_simulated_process_start(&sim, 20, "calc.exe", 0x200);
+    winctrl_simulated_process_start(&sim, 30, "explorer.exe", 0);
+    ProcessRegistry registry;
+    winctrl_registry_init(&registry, &SIMULATED_PROCESS_OPS, &sim);
+
+    /* The first lookup has to list everything; names compare without case. */
+    CHECK(winctrl_registry_find_name(&registry, "NOTEPAD.EXE") == 10);
+    CHECK(sim.pid_lists == 1 && sim.name_reads == 3 && registry.refreshes == 1);
+    CHECK(strcmp(winctrl_registry_process_name(&registry, 10), "notepad.exe") == 0);
+
+    /* A hit reads the one name it checks and lists nothing. */
+    CHECK(winctrl_registry_find_name(&registry, "calc.exe") == 20);
+    CHECK(winctrl_registry_has_pid(&registry, 30));
+    CHECK(sim.pid_lists == 1 && sim.name_reads == 5 && registry.hits == 2);
+
+    /* A miss refreshes, reading names only for the PIDs that are new. */
+    winctrl_simulated_process_start(&sim, 40, "word.exe", 0x400);
+    CHECK(winctrl_registry_find_name(&registry, "word.exe") == 40);
+    CHECK(sim.pid_lists == 2 && sim.name_reads == 6);
+    CHECK(winctrl_registry_find_name(&registry, "paint.exe") == 0);
+    CHECK(sim.pid_lists == 3 && sim.name_reads == 6);
+
+    /* A process that exited is found out by its check and dropped by the refresh that follows. */
+    winctrl_simulated_process_exit(&sim, 20);
+    CHECK(winctrl_registry_find_name(&registry, "calc.exe") == 0);
+    CHECK(sim.pid_lists == 4 && registry.count == 3);
+    CHECK(winctrl_registry_process_name(&registry, 20) == NULL);
+    CHECK(!winctrl_registry_has_pid(&registry, 20));
+
+    /* A reused PID fails the check on its old name and is read again. */
+    winctrl_simulated_process_exit(&sim, 10);
+    winctrl_simulated_process_start(&sim, 10, "calc.exe", 0x101);
+    long reads = sim.name_reads;
+    CHECK(winctrl_registry_find_name(&registry, "notepad.exe") == 0);
+    CHECK(sim.name_reads == reads + 2);
+    CHECK(strcmp(winctrl_registry_process_name(&registry, 10), "calc.exe") == 0);
+    long lists = sim.pid_lists;
+    CHECK(winctrl_registry_find_name(&registry, "calc.exe") == 10);
+    CHECK(sim.pid_lists == lists);
+
+    winctrl_registry_free(&registry);
+}
+
+static void test_same_name(void) {
+    static SimulatedProcesses sim;
+    memset(&sim, 0, sizeof(sim));
+    winctrl_simulated_process_start(&sim, 10, "notepad.exe", 0);
+    winctrl_simulated_process_start(&sim, 11, "notepad.exe", 0);
+    ProcessRegistry registry;
+    winctrl_registry_init(&registry, &SIMULATED_PROCESS_OPS, &sim);
+    CHECK(winctrl_registry_find_name(&registry, "notepad.exe") == 10);
+
+    /* When the first one has exited the next one with the name is still found without listing. */
+    winctrl_simulated_process_exit(&sim, 10);
+    CHECK(winctrl_registry_find_name(&registry, "notepad.exe") == 11);
+    CHECK(sim.pid_lists == 1 && registry.hits == 1);
+    winctrl_registry_free(&registry);
+}
+
+static void test_main_window(void) {
+    static SimulatedProcesses sim;
+    memset(&sim, 0, sizeof(sim));
+    winctrl_simulated_process_start(&sim, 10, "notepad.exe", 0x100);
+    ProcessRegistry registry;
+    winctrl_registry_init(&registry, &SIMULATED_PROCESS_OPS, &sim);
+
+    /* Scanned once, then kept while the window stays alive. */
+    CHECK(winctrl_registry_main_window(&registry, 10) == 0x100);
+    CHECK(winctrl_registry_main_window(&registry, 10) == 0x100);
+    CHECK(sim.window_scans == 1 && registry.window_scans == 1);
+
+    /* A window that closed is scanned for again. */
+    sim.processes[0].window = 0x180;
+    CHECK(winctrl_registry_main_window(&registry, 10) == 0x180);
+    CHECK(sim.window_scans == 2);
+    CHECK(winctrl_registry_main_window(&registry, 99) == 0);
+    CHECK(sim.window_scans == 2);
+    winctrl_registry_free(&registry);
+}
+
+#ifdef __linux__
+static void test_proc(void) {
+    char self[REGISTRY_NAME_MAX] = "";
+    CHECK(PROC_FS_PROCESS_OPS.process_name(NULL, (uint32_t)getpid(), self, sizeof(self)));
+    CHECK(strcmp(self, "test_registry") == 0);
+
+    ProcessRegistry registry;
+    winctrl_registry_init(&registry, &PROC_FS_PROCESS_OPS, NULL);
+    CHECK(winctrl_registry_find_name(&registry, "TEST_REGISTRY") != 0);
+    CHECK(winctrl_registry_has_pid(&registry, (uint32_t)getpid()));
+    CHECK(winctrl_registry_main_window(&registry, (uint32_t)getpid()) == 0);
+    winctrl_registry_free(&registry);
+}
+#endif
+
+int main(void) {
+    test_lookups();
+    test_same_name();
+    test_main_window();
+#ifdef __linux__
+    test_proc();
+#endif
+    return harness_finish();
+}
@@ -0,0 +1,284 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "script.h"
+#include <string.h>
+
+/*
+ * Compiles and runs small scripts against a command table whose only
+ * action, SendKeystroke, appends its text to the context's output, so a
+ * test can check what a script would have typed. The Probe predicate
+ * counts its calls, so a test can see which operands a condition reached.
+ */
+struct WinControlContext {
+    VariableContext vars;
+    int if_condition_slot;
+    char output[1024];
+    char last_error[256];
+};
+
+void winctrl_trace_finished(WinControlContext* ctx, const Instruction* insn) {
+    (void)ctx;
+    (void)insn;
+}
+
+static const char* operand_value(WinControlContext* ctx, const Operand* operand) {
+    if (operand->slot < 0) return operand->str;
+    const VariableValue* value = ctx->vars.variables[operand->slot].value;
+    if (!value) {
+        snprintf(ctx->last_error, sizeof(ctx->last_error), "Variable used before it was set: %s", operand->str + 1);
+        return NULL;
+    }
+    return value->data;
+}
+
+static bool handle_send_keystroke(WinControlContext* ctx, const Instruction* insn) {
+    const char* text = operand_value(ctx, &insn->args[0]);
+    if (!text) return false;
+    size_t used = strlen(ctx->output);
+    snprintf(ctx->output + used, sizeof(ctx->output) - used, "%s%s", used ? " " : "", text);
+    return true;
+}
+
+static bool handle_set(WinControlContext* ctx, const Instruction* insn) {
+    return winctrl_vars_assign(&ctx->vars, insn->args[0].slot, insn->args[1].str, strlen(insn->args[1].str));
+}
+
+static int probes;
+
+static bool predicate_probe(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    (void)argc;
+    const char* value = operand_value(ctx, &args[0]);
+    if (!value) return false;
+    probes++;
+    *result = strcmp(value, "yes") == 0;
+    return true;
+}
+
+static bool test_condition(WinControlContext* ctx, const Instruction* insn, bool* result) {
+    if (!winctrl_condition_evaluate(ctx, &ctx->vars, insn->condition, result,
+                                    ctx->last_error, sizeof(ctx->last_error))) {
+        return false;
+    }
+    return winctrl_vars_assign(&ctx->vars, ctx->if_condition_slot, *result ? "true" : "false", *result ? 4 : 5);
+}
+
+static const CommandDefinition COMMAND_TABLE[] = {
+    {"SendKeystroke", "v", handle_send_keystroke},
+    {"SET", "ws", handle_set},
+    {"IF", "*", NULL, FLOW_IF, test_condition},
+    {"ELSEIF", "*", NULL, FLOW_ELSEIF, test_condition},
+    {"ELSE", "", NULL, FLOW_ELSE},
+    {"ENDIF", "", NULL, FLOW_ENDIF},
+    {"LOOP", "v", NULL, FLOW_LOOP},
+    {"ENDLOOP", "", NULL, FLOW_ENDLOOP},
+    {"WHILE", "*", NULL, FLOW_WHILE, test_condition},
+    {"ENDWHILE", "", NULL, FLOW_ENDWHILE},
+    {"FOREACH", "ws*", NULL, FLOW_FOREACH},
+    {"ENDFOREACH", "", NULL, FLOW_ENDFOREACH},
+    {"BREAK", "", NULL, FLOW_BREAK},
+    {"CONTINUE", "", NULL, FLOW_CONTINUE},
+    {"SUB", "s*", NULL, FLOW_SUB},
+    {"ENDSUB", "", NULL, FLOW_ENDSUB},
+    {"RETURN", "", NULL, FLOW_RETURN},
+    {"CALL", "s*", NULL, FLOW_CALL},
+    {"Probe", "v", NULL, FLOW_PREDICATE, NULL, predicate_probe},
+    {NULL, NULL, NULL}
+};
+
+static bool run_script(const Script* script, char* output, size_t output_size, char* error, size_t error_size) {
+    WinControlContext ctx = {0};
+    Program program = {0};
+    ctx.if_condition_slot = winctrl_vars_declare(&ctx.vars, "_IF_CONDITION");
+    winctrl_vars_assign(&ctx.vars, ctx.if_condition_slot, "false", 5);
+
+    bool ok = winctrl_program_compile(COMMAND_TABLE, script->first, script->count, script->path, NULL,
+                                      &ctx.vars, &program, error, error_size);
+    if (ok && !winctrl_program_run(&ctx, &program, false, error, error_size, NULL)) {
+        if (!*error) snprintf(error, error_size, "%s", ctx.last_error);
+        ok = false;
+    }
+    snprintf(output, output_size, "%s", ctx.output);
+
+    winctrl_program_free(&program);
+    winctrl_vars_free(&ctx.vars);
+    return ok;
+}
+
+/* Lines are separated by '/' so a whole script fits on one line of the test. */
+static bool run_source(const char* source, char* output, size_t output_size, char* error, size_t error_size) {
+    Script script = {0};
+    bool ok = true;
+    int line = 0;
+    for (const char* start = source; ok && *start;) {
+        const char* end = strchr(start, '/');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        ok = winctrl_script_parse_line(&script, start, length, ++line, error, error_size);
+        start += length + (end ? 1 : 0);
+    }
+
+    ok = ok && run_script(&script, output, output_size, error, error_size);
+    winctrl_script_free(&script);
+    return ok;
+}
+
+static void expect_output(const char* source, const char* expected) {
+    char output[1024];
+    char error[256] = "";
+    bool ok = run_source(source, output, sizeof(output), error, sizeof(error));
+    if (!ok || strcmp(output, expected) != 0) {
+        printf("%s\n  expected \"%s\", got \"%s\" %s\n", source, expected, output, error);
+    }
+    CHECK(ok && strcmp(output, expected) == 0);
+}
+
+static void expect_error(const char* source, const char* expected) {
+    char output[1024];
+    char error[256] = "";
+    bool ok = run_source(source, output, sizeof(output), error, sizeof(error));
+    if (ok || strcmp(error, expected) != 0) {
+        printf("%s\n  expected error \"%s\", got \"%s\"\n", source, expected, error);
+    }
+    CHECK(!ok && strcmp(error, expected) == 0);
+}
+
+static void test_undefined_variables(void) {
+    /* A SUB that is called may set a variable for the code after the CALL. */
+    expect_output("CALL Setup/SendKeystroke \"$greeting\"/SUB Setup/SET greeting \"hi\"/ENDSUB", "hi");
+    /* Also when the assignment is reached only through another SUB. */
+    expect_output("CALL Outer/SendKeystroke \"$name\"/SUB Outer/CALL Inner/ENDSUB/SUB Inner/SET name \"x\"/ENDSUB",
+        "x");
+    /* Parameters are defined inside their SUB. */
+    expect_output("SUB Greet who/SendKeystroke \"$who\"/ENDSUB/CALL Greet \"you\"", "you");
+    /* Host variables such as _IF_CONDITION count once they have a value. */
+    expect_output("IF \"a\" == \"a\"/ENDIF/SendKeystroke \"$_IF_CONDITION\"", "true");
+
+    expect_error("SendKeystroke \"$greting\"/SET greeting \"hi\"", "Line 1: Undefined variable: greting");
+    /* A SUB nothing calls does not define anything. */
+    expect_error("SendKeystroke \"$greeting\"/SUB Setup/SET greeting \"hi\"/ENDSUB",
+        "Line 1: Undefined variable: greeting");
+    expect_error("CALL Setup/SUB Setup/SendKeystroke \"$missing\"/ENDSUB", "Line 3: Undefined variable: missing");
+    /* An unused SUB is still checked against every assignment, so typos show up. */
+    expect_output("SET greeting \"hi\"/SUB Unused/SendKeystroke \"$greeting\"/ENDSUB", "");
+    expect_error("SUB Unused/SendKeystroke \"$typo\"/ENDSUB", "Line 2: Undefined variable: typo");
+}
+
+static void test_if_chains(void) {
+    /* Only the first true branch runs, and every branch jumps past ENDIF. */
+    static const char* const VALUES[] = { "1", "2", "5", "0" };
+    static const char* const EXPECTED[] = { "one end", "two end", "again end", "other end" };
+    for (int i = 0; i < 4; i++) {
+        char source[256];
+        snprintf(source, sizeof(source), "SET v \"%s\"/IF \"$v\" == \"1\"/SendKeystroke \"one\"/"
+            "ELSEIF \"$v\" == \"2\"/SendKeystroke \"two\"/ELSEIF \"$v\" >= \"2\"/SendKeystroke \"again\"/"
+            "ELSE/SendKeystroke \"other\"/ENDIF/SendKeystroke \"end\"", VALUES[i]);
+        expect_output(source, EXPECTED[i]);
+    }
+    expect_output("IF \"a\" == \"b\"/SendKeystroke \"x\"/ELSEIF \"a\" == \"c\"/SendKeystroke \"y\"/ENDIF", "");
+    expect_output("IF \"a\" == \"b\"/ELSE/IF \"1\" < \"2\"/SendKeystroke \"inner\"/ELSE/SendKeystroke \"no\"/"
+        "ENDIF/SendKeystroke \"outer\"/ENDIF", "inner outer");
+
+    expect_error("IF \"a\" == \"a\"/SendKeystroke \"x\"", "Line 1: IF without matching ENDIF");
+    expect_error("SendKeystroke \"x\"/ENDIF", "Line 2: ENDIF without matching IF");
+    expect_error("ELSE", "Line 1: ELSE without matching IF");
+    expect_error("IF \"a\" == \"a\"/ELSE/ELSE/ENDIF", "Line 3: Duplicate ELSE");
+    expect_error("IF \"a\" == \"a\"/ELSE/ELSEIF \"b\" == \"b\"/ENDIF", "Line 3: ELSEIF after ELSE");
+    expect_error("IF \"a\" == \"a\"/ENDLOOP", "Line 2: ENDLOOP found while IF from line 1 is still open");
+    expect_error("LOOP 2/ENDIF/ENDLOOP", "Line 2: ENDIF found while LOOP from line 1 is still open");
+}
+
+static void test_loops(void) {
+    expect_output("LOOP 3/SendKeystroke \"x\"/ENDLOOP", "x x x");
+    expect_output("LOOP 0/SendKeystroke \"x\"/ENDLOOP/SendKeystroke \"after\"", "after");
+    expect_output("SET n \"2\"/LOOP \"$n\"/SendKeystroke \"$n\"/ENDLOOP", "2 2");
+    expect_error("SET n \"two\"/LOOP \"$n\"/ENDLOOP", "LOOP count $n is not a number: 'two'");
+
+    /* BREAK and CONTINUE act on the innermost loop, also from inside an IF. */
+    expect_output("LOOP 3/SendKeystroke \"a\"/CONTINUE/SendKeystroke \"no\"/ENDLOOP", "a a a");
+    expect_output("LOOP 2/LOOP 3/SendKeystroke \"i\"/BREAK/ENDLOOP/SendKeystroke \"o\"/ENDLOOP", "i o i o");
+    expect_output("SET s \"a\"/WHILE \"$s\" != \"c\"/IF \"$s\" == \"a\"/SET s \"b\"/CONTINUE/ENDIF/"
+        "SendKeystroke \"$s\"/SET s \"c\"/ENDWHILE", "b");
+    expect_output("WHILE \"1\" == \"1\"/SendKeystroke \"x\"/BREAK/ENDWHILE/SendKeystroke \"y\"", "x y");
+    expect_output("FOREACH i IN \"1\" \"2\" \"3\"/IF \"$i\" == \"2\"/CONTINUE/ENDIF/SendKeystroke \"$i\"/"
+        "ENDFOREACH", "1 3");
+    expect_output("FOREACH i IN \"1\" \"2\" \"3\"/IF \"$i\" == \"2\"/BREAK/ENDIF/SendKeystroke \"$i\"/"
+        "ENDFOREACH/SendKeystroke \"done\"", "1 done");
+
+    expect_error("BREAK", "Line 1: BREAK outside of a loop");
+    expect_error("IF \"a\" == \"a\"/CONTINUE/ENDIF", "Line 2: CONTINUE outside of a loop");
+    /* A SUB's body is not inside the loop its caller runs. */
+    expect_error("LOOP 1/CALL Leave/ENDLOOP/SUB Leave/BREAK/ENDSUB", "Line 5: BREAK outside of a loop");
+    expect_error("LOOP 2/SendKeystroke \"x\"", "Line 1: LOOP without matching ENDLOOP");
+}
+
+static void expect_probes(const char* source, const char* expected, int expected_probes) {
+    probes = 0;
+    expect_output(source, expected);
+    if (probes != expected_probes) printf("%s\n  expected %d probes, got %d\n", source, expected_probes, probes);
+    CHECK(probes == expected_probes);
+}
+
+static void test_conditions(void) {
+    /* AND binds tighter than OR, NOT tighter than both; parentheses, spaced like any token, regroup. */
+    expect_output("IF \"a\" == \"a\" OR \"a\" == \"b\" AND \"a\" == \"c\"/SendKeystroke \"t\"/ENDIF", "t");
+    expect_output("IF ( \"a\" == \"a\" OR \"a\" == \"b\" ) AND \"a\" == \"c\"/SendKeystroke \"t\"/ELSE/"
+        "SendKeystroke \"f\"/ENDIF", "f");
+    expect_output("IF NOT \"a\" == \"b\" AND NOT \"b\" == \"c\"/SendKeystroke \"t\"/ENDIF", "t");
+    expect_output("IF NOT ( \"a\" == \"a\" OR \"a\" == \"b\" )/SendKeystroke \"t\"/ELSE/SendKeystroke \"f\"/ENDIF",
+        "f");
+    expect_output("IF \"10\" > \"9\" AND \"abc\" < \"abd\" AND \"x\" != \"y\"/SendKeystroke \"t\"/ENDIF", "t");
+
+    /* The side AND/OR does not need is never evaluated. */
+    expect_probes("IF \"a\" == \"b\" AND Probe \"yes\"/SendKeystroke \"t\"/ENDIF/SendKeystroke \"end\"", "end", 0);
+    expect_probes("IF \"a\" == \"a\" OR Probe \"no\"/SendKeystroke \"t\"/ENDIF", "t", 0);
+    expect_probes("IF \"a\" == \"a\" AND Probe \"yes\"/SendKeystroke \"t\"/ENDIF", "t", 1);
+    expect_probes("IF \"a\" == \"b\" OR NOT Probe \"no\"/SendKeystroke \"t\"/ENDIF", "t", 1);
+    expect_probes("IF Probe \"no\" OR Probe \"no\" OR Probe \"yes\" OR Probe \"yes\"/SendKeystroke \"t\"/ENDIF", "t", 3);
+    /* So may an operand that is not set yet. */
+    expect_output("SET a \"1\"/IF \"$a\" == \"2\" AND \"$b\" == \"x\"/SendKeystroke \"t\"/ENDIF/SET b \"x\"/"
+        "SendKeystroke \"$b\"", "x");
+    expect_error("IF \"$b\" == \"x\"/ENDIF/SET b \"x\"", "Variable used before it was set: b");
+
+    expect_error("IF AND/ENDIF", "Line 1: Expected a value at 'AND'");
+    expect_error("IF \"a\" ==/ENDIF", "Line 1: Expected a value at end of condition");
+    expect_error("IF NOT/ENDIF", "Line 1: Missing value at end of condition");
+    expect_error("IF ( \"a\" == \"a\"/ENDIF", "Line 1: Missing ')' at end of condition");
+    expect_error("IF \"a\" == \"a\" \"b\"/ENDIF", "Line 1: Unexpected token at 'b'");
+    expect_error("Probe \"yes\"", "Line 1: Probe can only be used in a condition");
+}
+
+/* Regression scripts live in tests/scripts, which is the working directory under ctest. */
+static void expect_script_output(const char* filename, const char* expected) {
+    Script script;
+    char output[1024] = "";
+    char error[256] = "";
+    bool ok = winctrl_script_load(filename, &script, error, sizeof(error));
+    if (ok) {
+        ok = run_script(&script, output, sizeof(output), error, sizeof(error));
+        winctrl_script_free(&script);
+    }
+    if (!ok || strcmp(output, expected) != 0) {
+        printf("%s\n  expected \"%s\", got \"%s\" %s\n", filename, expected, output, error);
+    }
+    CHECK(ok && strcmp(output, expected) == 0);
+}
+
+static void test_recursion(void) {
+    expect_script_output("recursive_loop.wc", "x y y y");
+    expect_script_output("recursive_rows.wc", "a a b b");
+    /* FOREACH keeps its position too, also when the inner call RETURNs from inside its loop. */
+    expect_output("SUB Walk v/FOREACH item IN \"1\" \"2\"/SendKeystroke \"$item\"/IF \"$v\" == \"top\"/"
+        "CALL Walk \"nested\"/ELSEIF \"$item\" == \"2\"/RETURN/ENDIF/ENDFOREACH/ENDSUB/CALL Walk \"top\"",
+        "1 1 2 2");
+}
+
+int main(void) {
+    test_undefined_variables();
+    test_if_chains();
+    test_loops();
+    test_conditions();
+    test_recursion();
+    return harness_finish();
+}
@@ -0,0 +1,178 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "selector.h"
+#include "snapshot.h"
+#include <string.h>
+
+/*
+ * Evaluates selectors over a small fake tree whose search hands out a
+ * new handle per match, like UI Automation hands out element references,
+ * and checks every handle but the result is released. The same tree as
+ * a snapshot has to give the same answers.
+ */
+typedef struct {
+    int parent;
+    const char* type;
+    const char* id;
+    const char* class_name;
+    const char* name;
+} FakeNode;
+
+static const FakeNode TREE[] = {
+    { -1, "Window", NULL, NULL, "Main" },
+    { 0, "Pane", "main", NULL, NULL },
+    { 1, "Group", NULL, "Toolbar", NULL },
+    { 2, "Edit", NULL, NULL, "Search" },
+    { 1, "Group", NULL, "Toolbar", NULL },
+    { 4, "Button", NULL, NULL, "Save" },
+    { 0, "Pane", "side", NULL, NULL },
+    { 6, "Button", NULL, NULL, "Save" },
+    { 0, "Button", "top", NULL, "Save As" },
+};
+#define TREE_SIZE ((int)(sizeof(TREE) / sizeof(TREE[0])))
+
+typedef struct {
+    int handles;
+    int releases;
+    int searches;
+    bool broken;
+} FakeTree;
+
+static int node_type(int index) {
+    return winctrl_control_type_from_name(TREE[index].type, strlen(TREE[index].type));
+}
+
+static bool is_below(int node, int ancestor, bool descendants) {
+    if (!descendants) return TREE[node].parent == ancestor;
+    for (int p = TREE[node].parent; p != -1; p = TREE[p].parent) {
+        if (p == ancestor) return true;
+    }
+    return false;
+}
+
+static bool field_matches(const char* value, const char* wanted) {
+    return !wanted || strcmp(value ? value : "", wanted) == 0;
+}
+
+static bool fake_find(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+                      SelectorMatches* matches) {
+    FakeTree* tree = backend;
+    tree->searches++;
+    if (tree->broken) return false;
+
+    int parent = *(int*)node;
+    for (int i = parent + 1; i < TREE_SIZE; i++) {
+        if (!is_below(i, parent, descendants) ||
+            (locator->control_type != -1 && node_type(i) != locator->control_type) ||
+            !field_matches(TREE[i].id, locator->automation_id) ||
+            !field_matches(TREE[i].class_name, locator->class_name) ||
+            !field_matches(TREE[i].name, locator->name)) {
+            continue;
+        }
+        int* handle = malloc(sizeof(int));
+        if (!handle) return false;
+        *handle = i;
+        tree->handles++;
+        if (!winctrl_selector_matches_push(matches, handle)) {
+            free(handle);
+            return false;
+        }
+        if (first_only) break;
+    }
+    return true;
+}
+
+static void fake_release(void* backend, void* node) {
+    ((FakeTree*)backend)->releases++;
+    free(node);
+}
+
+static const SelectorTreeOps FAKE_TREE_OPS = { fake_find, fake_release };
+
+static void build_snapshot(Snapshot* snapshot) {
+    winctrl_snapshot_init(snapshot);
+    for (int i = 0; i < TREE_SIZE; i++) {
+        SnapshotElement element = {
+            TREE[i].name, TREE[i].id, TREE[i].class_name, node_type(i), NULL, 0, 0, 0, 0, 0
+        };
+        CHECK(winctrl_snapshot_add(snapshot, TREE[i].parent, &element) == i);
+    }
+    CHECK(winctrl_snapshot_finish(snapshot));
+}
+
+static void expect_match(const Snapshot* snapshot, const char* text, int expected) {
+    Selector selector;
+    char error[256] = "";
+    bool compiled = winctrl_selector_compile(text, &selector, error, sizeof(error));
+    CHECK(compiled);
+    if (!compiled) {
+        printf("%s: %s\n", text, error);
+        return;
+    }
+
+    FakeTree tree = {0};
+    int root = 0;
+    void* result = NULL;
+    int status = winctrl_selector_evaluate(&selector, &FAKE_TREE_OPS, &tree, &root, &result);
+    int found = status == 1 ? *(int*)result : -1;
+    if (found != expected) printf("%s: expected node %d, found %d\n", text, expected, found);
+    CHECK(status == (expected >= 0 ? 1 : 0));
+    CHECK(found == expected);
+    /* Every handle the search handed out is released, except the result, which the caller now owns. */
+    CHECK(tree.releases == tree.handles - (status == 1 ? 1 : 0));
+    if (status == 1) fake_release(&tree, result);
+
+    CHECK(winctrl_snapshot_select(snapshot, &selector) == expected);
+    winctrl_selector_free(&selector);
+}
+
+static void expect_compile_error(const char* text, const char* message) {
+    Selector selector;
+    char error[256] = "";
+    CHECK(!winctrl_selector_compile(text, &selector, error, sizeof(error)));
+    if (!strstr(error, message)) printf("%s: unexpected error: %s\n", text, error);
+    CHECK(strstr(error, message) != NULL);
+}
+
+int main(void) {
+    Snapshot snapshot;
+    build_snapshot(&snapshot);
+
+    /* The first Toolbar has no Button, so the search backtracks to the second. */
+    expect_match(&snapshot, "Pane[id=main] > Group[class=Toolbar] > Button[name=Save]", 5);
+    expect_match(&snapshot, "Button[name=Save]", 5);
+    expect_match(&snapshot, "Pane Button", 5);
+    expect_match(&snapshot, "Pane > Button", 7);
+    expect_match(&snapshot, "Pane[id=side] > Button[name=Save]", 7);
+    expect_match(&snapshot, "  Group >   Edit[name = Search]  ", 3);
+    expect_match(&snapshot, "*[id=top]", 8);
+    expect_match(&snapshot, "[type=Button][name='Save As']", 8);
+    expect_match(&snapshot, "*[type=50004]", 3);
+    expect_match(&snapshot, "button[name=save]", -1);
+    expect_match(&snapshot, "Pane[id=main] > Button", -1);
+    expect_match(&snapshot, "Edit Group", -1);
+
+    expect_compile_error("Bogus > Button", "unknown control type");
+    expect_compile_error("Pane[foo=1]", "unknown attribute");
+    expect_compile_error("Pane[id=main", "expected ']'");
+    expect_compile_error("Pane[id='main]", "unterminated quoted value");
+    expect_compile_error("Pane >> Button", "expected a control type");
+    expect_compile_error("Pane[id]", "expected '='");
+
+    /* A search that fails stops the evaluation with -1 instead of reporting no match. */
+    Selector selector;
+    char error[256];
+    CHECK(winctrl_selector_compile("Pane Button", &selector, error, sizeof(error)));
+    FakeTree tree = { 0, 0, 0, true };
+    int root = 0;
+    void* result = NULL;
+    CHECK(winctrl_selector_evaluate(&selector, &FAKE_TREE_OPS, &tree, &root, &result) == -1);
+    CHECK(result == NULL && tree.searches == 1);
+    winctrl_selector_free(&selector);
+
+    winctrl_snapshot_free(&snapshot);
+    return harness_finish();
+}
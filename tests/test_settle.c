@@ -0,0 +1,132 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "settle.h"
+#include <string.h>
+
+/*
+ * Runs settle policies against the simulated signals, whose clock only
+ * moves when settling waits, so every outcome lands on an exact
+ * millisecond.
+ */
+static SimulatedSettle simulated(const long long* changes, int change_count, long long busy_until) {
+    SimulatedSettle sim;
+    memset(&sim, 0, sizeof(sim));
+    for (int i = 0; i < change_count; i++) sim.changes_at[i] = changes[i];
+    sim.change_count = change_count;
+    sim.busy_until = busy_until;
+    return sim;
+}
+
+static void expect_settle(SettlePolicy policy, SimulatedSettle* sim, bool settled, long long at) {
+    SettlePolicies policies;
+    winctrl_settle_defaults(&policies);
+    bool result = winctrl_settle(&policies, &policy, &SIMULATED_SETTLE_OPS, sim);
+    if (result != settled || sim->now != at) {
+        printf("min %d quiet %d timeout %d: %s at %lld ms\n", policy.min_ms, policy.quiet_ms, policy.timeout_ms,
+            result ? "settled" : "timed out", sim->now);
+    }
+    CHECK(result == settled);
+    CHECK(sim->now == at);
+    CHECK(policies.settled == (settled ? 1 : 0) && policies.timeouts == (settled ? 0 : 1));
+    CHECK(policies.waited_ms == at);
+}
+
+static void test_quiet(void) {
+    /* Each change restarts the quiet period: the last one at 70 ms settles at 120 ms. */
+    long long burst[] = { 10, 30, 70 };
+    SimulatedSettle sim = simulated(burst, 3, 0);
+    expect_settle((SettlePolicy){ 0, 50, 1000, false }, &sim, true, 120);
+    CHECK(sim.waits == 4);
+
+    /* With nothing changing it settles after one quiet period and a single wait. */
+    sim = simulated(NULL, 0, 0);
+    expect_settle((SettlePolicy){ 0, 50, 1000, false }, &sim, true, 50);
+    CHECK(sim.waits == 1);
+
+    /* Changes that happened before settling started do not count. */
+    long long earlier[] = { 0 };
+    sim = simulated(earlier, 1, 0);
+    expect_settle((SettlePolicy){ 0, 50, 1000, false }, &sim, true, 50);
+}
+
+static void test_min(void) {
+    SimulatedSettle sim = simulated(NULL, 0, 0);
+    expect_settle((SettlePolicy){ 100, 0, 0, false }, &sim, true, 100);
+    CHECK(sim.waits == 1);
+
+    /* An early change is quiet long before min_ms, so min_ms decides. */
+    long long early[] = { 10 };
+    sim = simulated(early, 1, 0);
+    expect_settle((SettlePolicy){ 100, 20, 1000, false }, &sim, true, 100);
+
+    /* A late one pushes settling past min_ms. */
+    long long late[] = { 90 };
+    sim = simulated(late, 1, 0);
+    expect_settle((SettlePolicy){ 100, 20, 1000, false }, &sim, true, 110);
+
+    /* A timeout below min_ms still waits out min_ms. */
+    sim = simulated(NULL, 0, 0);
+    expect_settle((SettlePolicy){ 100, 0, 30, false }, &sim, true, 100);
+}
+
+static void test_timeout(void) {
+    /* A UI that changes every 30 ms never goes quiet for 50. */
+    long long busy[SIMULATED_SETTLE_MAX_CHANGES];
+    for (int i = 0; i < SIMULATED_SETTLE_MAX_CHANGES; i++) busy[i] = 10 + 30 * i;
+    SimulatedSettle sim = simulated(busy, SIMULATED_SETTLE_MAX_CHANGES, 0);
+    expect_settle((SettlePolicy){ 0, 50, 200, false }, &sim, false, 200);
+
+    /* The deadline is only reached by waiting; the wait before it is cut short to land on it. */
+    long long slower[] = { 20, 60, 100, 140, 180 };
+    sim = simulated(slower, 5, 0);
+    expect_settle((SettlePolicy){ 0, 50, 200, false }, &sim, false, 200);
+}
+
+static void test_input_idle(void) {
+    /* Once quiet, input idle is polled every SETTLE_POLL_MS until the target catches up. */
+    SimulatedSettle sim = simulated(NULL, 0, 35);
+    expect_settle((SettlePolicy){ 0, 0, 1000, true }, &sim, true, 40);
+    CHECK(sim.idle_checks == 5 && sim.waits == 4);
+
+    /* Input idle is not asked before the quiet period is over. */
+    sim = simulated(NULL, 0, 0);
+    expect_settle((SettlePolicy){ 0, 50, 1000, true }, &sim, true, 50);
+    CHECK(sim.idle_checks == 1);
+
+    sim = simulated(NULL, 0, 100000);
+    expect_settle((SettlePolicy){ 0, 0, 100, true }, &sim, false, 100);
+}
+
+static void test_policies(void) {
+    SettlePolicies policies;
+    winctrl_settle_defaults(&policies);
+    SettleAction action;
+    CHECK(winctrl_settle_action_from_name("Element", &action) && action == SETTLE_ELEMENT);
+    CHECK(winctrl_settle_action_from_name("IDLE", &action) && action == SETTLE_IDLE);
+    CHECK(!winctrl_settle_action_from_name("click", &action));
+
+    /* Raw input does not wait at all and is not counted. */
+    SimulatedSettle sim = simulated(NULL, 0, 0);
+    CHECK(winctrl_settle(&policies, &policies.policies[SETTLE_INPUT], &SIMULATED_SETTLE_OPS, &sim));
+    CHECK(sim.now == 0 && sim.waits == 0 && policies.settled == 0);
+
+    /* The counters add up across actions. */
+    CHECK(winctrl_settle(&policies, &policies.policies[SETTLE_ELEMENT], &SIMULATED_SETTLE_OPS, &sim));
+    CHECK(sim.now == 50);
+    sim.busy_until = 100000;
+    CHECK(!winctrl_settle(&policies, &policies.policies[SETTLE_IDLE], &SIMULATED_SETTLE_OPS, &sim));
+    CHECK(sim.now == 10050);
+    CHECK(policies.settled == 1 && policies.timeouts == 1 && policies.waited_ms == 10050);
+}
+
+int main(void) {
+    test_quiet();
+    test_min();
+    test_timeout();
+    test_input_idle();
+    test_policies();
+    return harness_finish();
+}
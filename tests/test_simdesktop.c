@@ -0,0 +1,134 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "simdesktop.h"
+#include <string.h>
+
+/*
+ * Drives the desktop commands against a simulated desktop on a virtual
+ * clock: finding by selector, clicking, typing, patterns and their input
+ * fallbacks, and processes exiting between lookups.
+ */
+static const char DESKTOP[] =
+    "{ \"latency_us\": 200,\n"
+    "  \"processes\": [\n"
+    "    { \"pid\": 100, \"name\": \"notepad.exe\", \"windows\": [\n"
+    "      { \"type\": \"Window\", \"name\": \"Untitled\", \"rect\": [0, 0, 800, 600], \"children\": [\n"
+    "        { \"type\": \"Edit\", \"id\": \"15\", \"class\": \"Edit\", \"value\": \"\", \"rect\": [0, 40, 800, 600] },\n"
+    "        { \"type\": \"Button\", \"name\": \"Save\", \"patterns\": [\"invoke\"], \"rect\": [0, 0, 60, 20] },\n"
+    "        { \"type\": \"Button\", \"name\": \"Close\", \"rect\": [60, 0, 120, 20] },\n"
+    "        { \"type\": \"CheckBox\", \"name\": \"Wrap\", \"toggle\": 0, \"three_state\": true },\n"
+    "        { \"type\": \"Edit\", \"id\": \"hidden\", \"value\": \"x\", \"offscreen\": true, \"rect\": [0, 0, 10, 10] },\n"
+    "        { \"type\": \"ComboBox\", \"id\": \"enc\", \"patterns\": [\"expand\"], \"children\": [\n"
+    "          { \"type\": \"ListItem\", \"name\": \"UTF-8\", \"patterns\": [\"select\"], \"selected\": true },\n"
+    "          { \"type\": \"ListItem\", \"name\": \"ANSI\", \"patterns\": [\"select\"] } ] } ] } ] },\n"
+    "    { \"pid\": 200, \"name\": \"calc.exe\", \"windows\": [ { \"type\": \"Window\", \"name\": \"Calculator\" } ] } ] }\n";
+
+static void* find(const Desktop* desktop, void* root, const char* selector) {
+    void* element = NULL;
+    char error[256] = "";
+    int status = winctrl_desktop_find(desktop, root, selector, &element, error, sizeof(error));
+    if (status != 1) printf("%s: %s\n", selector, error);
+    CHECK(status == 1);
+    return element;
+}
+
+static void test_load_errors(void) {
+    SimDesktop sim;
+    char error[256] = "";
+    CHECK(!winctrl_sim_desktop_parse(&sim, "{ \"processes\": [\n  { \"pid\": 1 } ] }", 33, error, sizeof(error)));
+    CHECK(strstr(error, "line 2") && strstr(error, "pid and a name"));
+    const char* unknown = "{ \"processes\": [ { \"pid\": 1, \"name\": \"a\", \"windows\": [ { \"type\": \"Bogus\" } ] } ] }";
+    CHECK(!winctrl_sim_desktop_parse(&sim, unknown, strlen(unknown), error, sizeof(error)));
+    CHECK(strstr(error, "unknown control type") != NULL);
+    CHECK(!winctrl_sim_desktop_parse(&sim, "{} x", 4, error, sizeof(error)));
+    CHECK(strstr(error, "trailing characters") != NULL);
+    CHECK(!winctrl_sim_desktop_load(&sim, "no_such_desktop.json", error, sizeof(error)));
+    CHECK(strstr(error, "Could not open") != NULL);
+}
+
+static void test_desktop(void) {
+    SimDesktop sim;
+    char error[256] = "";
+    CHECK(winctrl_sim_desktop_parse(&sim, DESKTOP, strlen(DESKTOP), error, sizeof(error)));
+    VirtualClock time = {0};
+    sim.clock = (Clock){ &VIRTUAL_CLOCK_OPS, &time };
+    Desktop desktop = { &SIM_DESKTOP_OPS, &sim };
+    KeyEventBuffer keys;
+    winctrl_keys_init(&keys);
+
+    /* Processes, their main windows and the selector search. */
+    ProcessRegistry registry;
+    winctrl_registry_init(&registry, &SIM_DESKTOP_OPS.processes, &sim);
+    CHECK(winctrl_registry_find_name(&registry, "NOTEPAD.EXE") == 100);
+    uintptr_t window = winctrl_registry_main_window(&registry, 100);
+    CHECK(window != 0);
+    void* root = SIM_DESKTOP_OPS.window_root(&sim, window);
+
+    SimElement* edit = find(&desktop, root, "Edit[id=15]");
+    SimElement* save = find(&desktop, root, "Button[name=Save]");
+    SimElement* item = find(&desktop, root, "ComboBox ListItem[name=ANSI]");
+    CHECK(edit && save && item && item->parent->automation_id && strcmp(item->parent->automation_id, "enc") == 0);
+    void* none = NULL;
+    CHECK(winctrl_desktop_find(&desktop, root, "Button[name=Open]", &none, error, sizeof(error)) == 0);
+    CHECK(none == NULL && strstr(error, "No element matches") != NULL);
+    CHECK(winctrl_desktop_find(&desktop, root, "Button[", &none, error, sizeof(error)) == -1);
+
+    /* A click lands on the deepest element under the centre and does what its pattern does. */
+    CHECK(winctrl_desktop_click(&desktop, save, DESKTOP_LEFT, 1, error, sizeof(error)));
+    CHECK(save->invokes == 1 && save->clicks == 1 && sim.focus == save);
+    SimElement* hidden = find(&desktop, root, "Edit[id=hidden]");
+    CHECK(!winctrl_desktop_click(&desktop, hidden, DESKTOP_LEFT, 1, error, sizeof(error)));
+    CHECK(strstr(error, "offscreen") != NULL);
+
+    /* Keys type into the focused element; Ctrl+A makes the next text replace the value. */
+    CHECK(winctrl_desktop_click(&desktop, edit, DESKTOP_LEFT, 1, error, sizeof(error)));
+    CHECK(winctrl_desktop_type(&desktop, &keys, "h\xC3\xA9llo \xF0\x9F\x98\x80\r\n\tok", 0, error, sizeof(error)));
+    CHECK(strcmp(edit->value, "h\xC3\xA9llo \xF0\x9F\x98\x80\n\tok") == 0);
+    static const uint16_t CTRL[] = { KEY_VK_CONTROL };
+    CHECK(winctrl_desktop_chord(&desktop, &keys, CTRL, 1, 'A', error, sizeof(error)));
+    CHECK(winctrl_desktop_type(&desktop, &keys, "new", 0, error, sizeof(error)));
+    CHECK(strcmp(edit->value, "new") == 0);
+
+    /* Throttled typing waits on the desktop's clock between characters. */
+    long long before = time.now_us;
+    long calls = sim.calls;
+    CHECK(winctrl_desktop_type(&desktop, &keys, "abc", 5, error, sizeof(error)));
+    CHECK(strcmp(edit->value, "newabc") == 0);
+    CHECK(time.now_us - before == 3 * 5000 + (sim.calls - calls) * sim.latency_us);
+
+    /* Patterns, and a click in place of a missing one. */
+    CHECK(winctrl_desktop_perform(&desktop, edit, DESKTOP_SET_VALUE, "set", &keys, 0, error, sizeof(error)));
+    CHECK(strcmp(edit->value, "set") == 0);
+    SimElement* close = find(&desktop, root, "Button[name=Close]");
+    CHECK(winctrl_desktop_perform(&desktop, close, DESKTOP_INVOKE, NULL, &keys, 0, error, sizeof(error)));
+    CHECK(close->clicks == 1 && close->invokes == 0);
+    SimElement* wrap = find(&desktop, root, "CheckBox");
+    CHECK(winctrl_desktop_set_toggle(&desktop, wrap, true, error, sizeof(error)) && wrap->toggle_state == 1);
+    CHECK(winctrl_desktop_set_toggle(&desktop, wrap, false, error, sizeof(error)) && wrap->toggle_state == 0);
+    CHECK(!winctrl_desktop_set_toggle(&desktop, edit, true, error, sizeof(error)));
+    SimElement* combo = find(&desktop, root, "ComboBox[id=enc]");
+    CHECK(winctrl_desktop_select_item(&desktop, combo, "ANSI", error, sizeof(error)));
+    CHECK(item->selected && !combo->first_child->selected && !combo->expanded);
+    CHECK(!winctrl_desktop_select_item(&desktop, combo, "UTF-16", error, sizeof(error)));
+
+    /* Every call waited the simulated latency and nothing else did. */
+    CHECK(time.now_us == 15000 + sim.calls * sim.latency_us);
+
+    /* A process that exits is gone from the next lookup. */
+    winctrl_sim_desktop_process(&sim, 100)->exited = true;
+    CHECK(winctrl_registry_find_name(&registry, "notepad.exe") == 0);
+    CHECK(winctrl_registry_find_name(&registry, "calc.exe") == 200);
+
+    winctrl_registry_free(&registry);
+    winctrl_keys_free(&keys);
+    winctrl_sim_desktop_free(&sim);
+}
+
+int main(void) {
+    test_load_errors();
+    test_desktop();
+    return harness_finish();
+}
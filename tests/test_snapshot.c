@@ -0,0 +1,147 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "snapshot.h"
+#include <string.h>
+
+/*
+ * Builds a generated tree, checks every indexed lookup against a plain
+ * scan in document order, which is what FindFirst returns, and round
+ * trips the tree through a file. The size argument is the node count;
+ * lookups are timed at that size.
+ */
+static unsigned long next_random(unsigned long* state) {
+    *state = *state * 6364136223846793005ul + 1442695040888963407ul;
+    return *state >> 33;
+}
+
+static bool build_tree(Snapshot* snapshot, int count) {
+    static const char* const CLASSES[] = { "Button", "Edit", "Pane", NULL };
+    int* path = malloc((size_t)count * sizeof(int));
+    int depth = 0;
+    unsigned long state = 7;
+    bool ok = path != NULL;
+    winctrl_snapshot_init(snapshot);
+
+    for (int i = 0; ok && i < count; i++) {
+        char id[16];
+        char name[16];
+        snprintf(id, sizeof(id), "id%d", i % 97);
+        snprintf(name, sizeof(name), "n%d", i % 13);
+        int32_t runtime_id[2] = { 42, i };
+        SnapshotElement element = {
+            i % 5 == 0 ? NULL : name, i % 7 == 0 ? NULL : id, CLASSES[i % 4], 50000 + i % 5,
+            runtime_id, 2, i, i, i + 10, i + 10
+        };
+
+        /* Attach to a random node on the open path, which keeps every subtree contiguous. */
+        if (depth > 1) depth = 1 + (int)(next_random(&state) % (unsigned long)depth);
+        int index = winctrl_snapshot_add(snapshot, depth > 0 ? path[depth - 1] : -1, &element);
+        ok = index == i;
+        path[depth++] = index;
+    }
+    free(path);
+    return ok && winctrl_snapshot_finish(snapshot);
+}
+
+static bool field_matches(const Snapshot* snapshot, uint32_t offset, const char* wanted) {
+    return !wanted || strcmp(winctrl_snapshot_string(snapshot, offset), wanted) == 0;
+}
+
+static int scan_find(const Snapshot* snapshot, const Locator* locator) {
+    for (int i = 1; i < snapshot->count; i++) {
+        const SnapshotNode* node = &snapshot->nodes[i];
+        if ((locator->control_type == -1 || node->control_type == locator->control_type) &&
+            field_matches(snapshot, node->automation_id, locator->automation_id) &&
+            field_matches(snapshot, node->name, locator->name) &&
+            field_matches(snapshot, node->class_name, locator->class_name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const Locator LOCATORS[] = {
+    { "id5", NULL, -1, NULL },
+    { "id5", "Edit", -1, NULL },
+    { "id96", "Pane", 50003, NULL },
+    { NULL, NULL, -1, "n12" },
+    { NULL, NULL, -1, "" },
+    { "", NULL, -1, NULL },
+    { NULL, "", -1, NULL },
+    { NULL, "Pane", -1, NULL },
+    { NULL, NULL, 50004, NULL },
+    { NULL, NULL, -1, NULL },
+    { "id3", "Button", 50001, "n4" },
+    { "missing", NULL, -1, NULL },
+    { NULL, NULL, 1, NULL },
+};
+#define LOCATOR_COUNT ((int)(sizeof(LOCATORS) / sizeof(LOCATORS[0])))
+
+static void check_lookups(const Snapshot* snapshot) {
+    for (int i = 0; i < LOCATOR_COUNT; i++) {
+        int expected = scan_find(snapshot, &LOCATORS[i]);
+        int found = winctrl_snapshot_find(snapshot, &LOCATORS[i]);
+        if (found != expected) printf("locator %d: expected node %d, found %d\n", i, expected, found);
+        CHECK(found == expected);
+    }
+}
+
+static void test_round_trip(const Snapshot* snapshot) {
+    const char* path = "test_snapshot.wcs";
+    char error[256] = "";
+    CHECK(winctrl_snapshot_save(snapshot, path, error, sizeof(error)));
+
+    Snapshot loaded;
+    CHECK(winctrl_snapshot_load(&loaded, path, error, sizeof(error)));
+    CHECK(loaded.count == snapshot->count);
+    CHECK(memcmp(loaded.nodes, snapshot->nodes, (size_t)snapshot->count * sizeof(SnapshotNode)) == 0);
+    const SnapshotNode* last = &loaded.nodes[loaded.count - 1];
+    CHECK(last->runtime_id_length == 2 && loaded.runtime_ids[last->runtime_id + 1] == loaded.count - 1);
+    check_lookups(&loaded);
+    winctrl_snapshot_free(&loaded);
+
+    /* A truncated or foreign file is rejected rather than read past its end. */
+    FILE* file = fopen(path, "rb");
+    char buffer[4096];
+    size_t length = file ? fread(buffer, 1, sizeof(buffer), file) : 0;
+    if (file) fclose(file);
+    file = fopen(path, "wb");
+    if (file) {
+        fwrite(buffer, 1, length / 2, file);
+        fclose(file);
+    }
+    CHECK(!winctrl_snapshot_load(&loaded, path, error, sizeof(error)));
+    file = fopen(path, "wb");
+    if (file) {
+        fputs("not a snapshot at all, just some text", file);
+        fclose(file);
+    }
+    CHECK(!winctrl_snapshot_load(&loaded, path, error, sizeof(error)));
+    remove(path);
+    CHECK(!winctrl_snapshot_load(&loaded, path, error, sizeof(error)));
+}
+
+int main(int argc, char** argv) {
+    int count = (int)harness_size(argc, argv, 50000);
+    Snapshot snapshot;
+    CHECK(build_tree(&snapshot, count));
+    check_lookups(&snapshot);
+    test_round_trip(&snapshot);
+
+    long lookups = 0;
+    volatile int sink = 0;
+    long long started = harness_now_us();
+    for (int round = 0; round < 10000; round++) {
+        for (int i = 0; i < 4; i++) {
+            sink += winctrl_snapshot_find(&snapshot, &LOCATORS[i]);
+            lookups++;
+        }
+    }
+    harness_report("snapshot lookups", lookups, "find", harness_now_us() - started);
+
+    winctrl_snapshot_free(&snapshot);
+    return harness_finish();
+}
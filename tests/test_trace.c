@@ -0,0 +1,190 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "simdesktop.h"
+#include "trace.h"
+#include <string.h>
+
+/*
+ * Records a session against the simulated desktop, replays the trace in
+ * its place and checks the session sees the same desktop, on the same
+ * modeled time, without a call the trace cannot answer. Damaged and
+ * missing traces have to be rejected.
+ */
+static const char DESKTOP[] =
+    "{ \"latency_us\": 200, \"processes\": [\n"
+    "  { \"pid\": 100, \"name\": \"notepad.exe\", \"windows\": [\n"
+    "    { \"type\": \"Window\", \"name\": \"Untitled\", \"rect\": [0, 0, 800, 600], \"children\": [\n"
+    "      { \"type\": \"Edit\", \"id\": \"15\", \"value\": \"old\", \"rect\": [0, 40, 800, 600] },\n"
+    "      { \"type\": \"Button\", \"name\": \"Save\", \"patterns\": [\"invoke\"], \"rect\": [0, 0, 60, 20] },\n"
+    "      { \"type\": \"CheckBox\", \"name\": \"Wrap\", \"toggle\": 0 } ] } ] } ] }\n";
+
+#define TRACE_PATH "test_trace.wct"
+
+typedef struct {
+    uint32_t pid;
+    int found[4];
+    char before[64];
+    char after[64];
+    ElementInfo save;
+    bool typed;
+    bool invoked;
+    bool toggled;
+    int toggle_state;
+} Session;
+
+static void run_session(const Desktop* desktop, Session* session) {
+    memset(session, 0, sizeof(*session));
+    char error[256];
+    KeyEventBuffer keys;
+    winctrl_keys_init(&keys);
+    ProcessRegistry registry;
+    winctrl_registry_init(&registry, &desktop->ops->processes, desktop->backend);
+    session->pid = winctrl_registry_find_name(&registry, "notepad.exe");
+    uintptr_t window = winctrl_registry_main_window(&registry, session->pid);
+    void* root = window ? desktop->ops->window_root(desktop->backend, window) : NULL;
+
+    void* edit = NULL;
+    void* save = NULL;
+    void* wrap = NULL;
+    void* none = NULL;
+    if (root) {
+        session->found[0] = winctrl_desktop_find(desktop, root, "Edit[id=15]", &edit, error, sizeof(error));
+        session->found[1] = winctrl_desktop_find(desktop, root, "Button[name=Save]", &save, error, sizeof(error));
+        session->found[2] = winctrl_desktop_find(desktop, root, "CheckBox", &wrap, error, sizeof(error));
+        session->found[3] = winctrl_desktop_find(desktop, root, "Button[name=Open]", &none, error, sizeof(error));
+    }
+    /* The same read twice, with different answers in between. */
+    if (edit) {
+        desktop->ops->read_value(desktop->backend, edit, session->before, sizeof(session->before));
+        session->typed = winctrl_desktop_perform(desktop, edit, DESKTOP_SET_VALUE, "", &keys, 0, error, sizeof(error)) &&
+                         winctrl_desktop_click(desktop, edit, DESKTOP_LEFT, 1, error, sizeof(error)) &&
+                         winctrl_desktop_type(desktop, &keys, "h\xC3\xA9 \xF0\x9F\x98\x80\n", 2, error, sizeof(error));
+        desktop->ops->read_value(desktop->backend, edit, session->after, sizeof(session->after));
+        desktop->ops->release(desktop->backend, edit);
+    }
+    if (save) {
+        desktop->ops->read(desktop->backend, save, &session->save);
+        session->invoked = winctrl_desktop_perform(desktop, save, DESKTOP_INVOKE, NULL, &keys, 0, error, sizeof(error));
+        desktop->ops->release(desktop->backend, save);
+    }
+    if (wrap) {
+        session->toggled = winctrl_desktop_set_toggle(desktop, wrap, true, error, sizeof(error));
+        session->toggle_state = desktop->ops->toggle_state(desktop->backend, wrap);
+        desktop->ops->release(desktop->backend, wrap);
+    }
+    if (root) desktop->ops->release(desktop->backend, root);
+
+    winctrl_registry_free(&registry);
+    winctrl_keys_free(&keys);
+}
+
+static void expect_load_error(const char* message) {
+    TraceReplay replay;
+    char error[256] = "";
+    CHECK(!winctrl_trace_replay_load(&replay, TRACE_PATH, error, sizeof(error)));
+    if (!strstr(error, message)) printf("unexpected error: %s\n", error);
+    CHECK(strstr(error, message) != NULL);
+}
+
+static void test_bad_files(void) {
+    FILE* file = fopen(TRACE_PATH, "rb");
+    unsigned char data[8192];
+    size_t length = file ? fread(data, 1, sizeof(data), file) : 0;
+    if (file) fclose(file);
+    CHECK(length > sizeof(TRACE_MAGIC) && length < sizeof(data));
+
+    /* Cut in the middle of a record. */
+    file = fopen(TRACE_PATH, "wb");
+    if (file) {
+        fwrite(data, 1, length - 3, file);
+        fclose(file);
+    }
+    expect_load_error("Trace is corrupt");
+
+    /* An unknown operation. */
+    data[length] = 0x7F;
+    data[length + 1] = 0;
+    data[length + 2] = 0;
+    data[length + 3] = 0;
+    file = fopen(TRACE_PATH, "wb");
+    if (file) {
+        fwrite(data, 1, length + 4, file);
+        fclose(file);
+    }
+    expect_load_error("Trace is corrupt");
+
+    file = fopen(TRACE_PATH, "wb");
+    if (file) {
+        fputs("WCTRACE0 from another version", file);
+        fclose(file);
+    }
+    expect_load_error("Not a trace file");
+    remove(TRACE_PATH);
+    expect_load_error("Could not open");
+
+    SimDesktop sim;
+    char error[256];
+    CHECK(winctrl_sim_desktop_parse(&sim, DESKTOP, strlen(DESKTOP), error, sizeof(error)));
+    Desktop inner = { &SIM_DESKTOP_OPS, &sim };
+    TraceRecorder recorder;
+    CHECK(!winctrl_trace_record_open(&recorder, &inner, &SYSTEM_CLOCK, "no_such_dir/test.wct", error, sizeof(error)));
+    CHECK(strstr(error, "Could not create") != NULL);
+    winctrl_sim_desktop_free(&sim);
+}
+
+int main(void) {
+    SimDesktop sim;
+    char error[256] = "";
+    CHECK(winctrl_sim_desktop_parse(&sim, DESKTOP, strlen(DESKTOP), error, sizeof(error)));
+    VirtualClock recorded_time = {0};
+    sim.clock = (Clock){ &VIRTUAL_CLOCK_OPS, &recorded_time };
+
+    /* Record, timing each call on the same virtual clock the desktop waits on. */
+    Desktop inner = { &SIM_DESKTOP_OPS, &sim };
+    TraceRecorder recorder;
+    CHECK(winctrl_trace_record_open(&recorder, &inner, &sim.clock, TRACE_PATH, error, sizeof(error)));
+    Desktop recording = { &TRACE_RECORD_OPS, &recorder };
+    Session recorded;
+    run_session(&recording, &recorded);
+    long records = recorder.records;
+    CHECK(winctrl_trace_record_close(&recorder, error, sizeof(error)));
+    CHECK(records > sim.calls);
+
+    CHECK(recorded.pid == 100);
+    CHECK(recorded.found[0] == 1 && recorded.found[1] == 1 && recorded.found[2] == 1 && recorded.found[3] == 0);
+    CHECK(strcmp(recorded.before, "old") == 0 && strcmp(recorded.after, "h\xC3\xA9 \xF0\x9F\x98\x80\n") == 0);
+    CHECK(strcmp(recorded.save.name, "Save") == 0 && recorded.save.rect.right == 60);
+    CHECK(recorded.typed && recorded.invoked && recorded.toggled && recorded.toggle_state == 1);
+
+    /* Replay in place of the desktop: the same answers in the same modeled time. */
+    TraceReplay replay;
+    CHECK(winctrl_trace_replay_load(&replay, TRACE_PATH, error, sizeof(error)));
+    VirtualClock replayed_time = {0};
+    replay.clock = (Clock){ &VIRTUAL_CLOCK_OPS, &replayed_time };
+    CHECK(replay.record_count == records);
+    /* Layout lookups are recorded too, but the simulated desktop has no layout and answers them at once. */
+    CHECK(replay.recorded_us == sim.calls * sim.latency_us);
+
+    Desktop replaying = { &TRACE_REPLAY_OPS, &replay };
+    Session replayed;
+    run_session(&replaying, &replayed);
+    CHECK(replay.misses == 0);
+    CHECK(replay.replayed == records);
+    CHECK(memcmp(&replayed, &recorded, sizeof(Session)) == 0);
+    CHECK(replayed_time.now_us == recorded_time.now_us);
+
+    /* A call the trace never saw fails and is counted. */
+    void* root = TRACE_REPLAY_OPS.window_root(&replay, (uintptr_t)sim.processes[0].windows);
+    void* element = NULL;
+    CHECK(root != NULL);
+    CHECK(winctrl_desktop_find(&replaying, root, "Button[name=Close]", &element, error, sizeof(error)) == -1);
+    CHECK(element == NULL && replay.misses == 1);
+    winctrl_trace_replay_free(&replay);
+
+    test_bad_files();
+    winctrl_sim_desktop_free(&sim);
+    return harness_finish();
+}
@@ -0,0 +1,133 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "harness.h"
+#include "workers.h"
+#include <string.h>
+
+/*
+ * Races simulated searches, each taking a set time to find its result,
+ * on a worker pool and without one. Destroying the pool waits for the
+ * searches a race left running, so the counts are final after it.
+ */
+static int found_a;
+static int found_b;
+
+/* Wraps the simulated search to see the order finish runs in, and to make searches that ignore cancelling. */
+typedef struct {
+    SimulatedSearch sim;
+    bool stubborn;
+    long searches_at_finish;
+    long released_at_finish;
+} Tracked;
+
+static void* tracked_search(void* backend, void* scope, const volatile long* cancelled) {
+    Tracked* tracked = backend;
+    static const volatile long never = 0;
+    return SIMULATED_SEARCH_OPS.search(&tracked->sim, scope, tracked->stubborn ? &never : cancelled);
+}
+
+static void tracked_release(void* backend, void* result) {
+    Tracked* tracked = backend;
+    SIMULATED_SEARCH_OPS.release(&tracked->sim, result);
+}
+
+static void tracked_finish(void* backend) {
+    Tracked* tracked = backend;
+    tracked->searches_at_finish = tracked->sim.searches;
+    tracked->released_at_finish = tracked->sim.released;
+    SIMULATED_SEARCH_OPS.finish(&tracked->sim);
+}
+
+static const SearchOps TRACKED_SEARCH_OPS = { tracked_search, tracked_release, tracked_finish };
+
+static void* race(WorkerPool* pool, const SearchOps* ops, void* backend, SimulatedScope* scopes, int count,
+                  int* winner) {
+    void* pointers[8];
+    for (int i = 0; i < count; i++) pointers[i] = &scopes[i];
+    return winctrl_search_race(pool, ops, backend, pointers, count, winner);
+}
+
+static void test_fastest_wins(void) {
+    WorkerPool* pool = winctrl_workers_create(WORKER_POOL_THREADS, NULL, NULL, NULL);
+    CHECK(pool != NULL);
+    SimulatedScope scopes[] = { { 1000, NULL }, { 5, &found_a }, { 1000, &found_b } };
+    SimulatedSearch sim;
+    memset(&sim, 0, sizeof(sim));
+    int winner = 0;
+
+    long long started = harness_now_us();
+    CHECK(race(pool, &SIMULATED_SEARCH_OPS, &sim, scopes, 3, &winner) == &found_a);
+    long long elapsed = harness_now_us() - started;
+    CHECK(winner == 1);
+    /* It did not wait for the slow searches, which are cancelled instead of finishing their second. */
+    CHECK(elapsed < 500000);
+    winctrl_workers_destroy(pool);
+    CHECK(sim.searches == 3 && sim.cancelled == 2 && sim.released == 0 && sim.finished == 1);
+}
+
+static void test_late_match(void) {
+    WorkerPool* pool = winctrl_workers_create(WORKER_POOL_THREADS, NULL, NULL, NULL);
+    CHECK(pool != NULL);
+    SimulatedScope scopes[] = { { 20, &found_a }, { 200, &found_b } };
+    Tracked tracked;
+    memset(&tracked, 0, sizeof(tracked));
+    tracked.stubborn = true;
+    int winner = 0;
+
+    /* The slower search still finds its match after the race is decided; the pool releases it. */
+    CHECK(race(pool, &TRACKED_SEARCH_OPS, &tracked, scopes, 2, &winner) == &found_a);
+    CHECK(winner == 0);
+    CHECK(tracked.sim.finished == 0);
+    winctrl_workers_destroy(pool);
+    CHECK(tracked.sim.searches == 2 && tracked.sim.cancelled == 0);
+    CHECK(tracked.sim.released == 1 && tracked.sim.finished == 1);
+    CHECK(tracked.searches_at_finish == 2 && tracked.released_at_finish == 1);
+}
+
+static void test_no_match(void) {
+    WorkerPool* pool = winctrl_workers_create(2, NULL, NULL, NULL);
+    CHECK(pool != NULL);
+    SimulatedScope scopes[] = { { 10, NULL }, { 0, NULL }, { 5, NULL }, { 1, NULL }, { 3, NULL } };
+    Tracked tracked;
+    memset(&tracked, 0, sizeof(tracked));
+    int winner = 0;
+
+    /* With nothing found the race waits for every search, more than there are threads. */
+    CHECK(race(pool, &TRACKED_SEARCH_OPS, &tracked, scopes, 5, &winner) == NULL);
+    CHECK(winner == -1);
+    CHECK(tracked.sim.searches == 5);
+    winctrl_workers_destroy(pool);
+    CHECK(tracked.sim.cancelled == 0 && tracked.sim.finished == 1 && tracked.searches_at_finish == 5);
+}
+
+static void test_in_turn(void) {
+    /* Without a pool, scopes are searched in order until one matches. */
+    SimulatedScope scopes[] = { { 0, NULL }, { 0, &found_a }, { 0, &found_b } };
+    SimulatedSearch sim;
+    memset(&sim, 0, sizeof(sim));
+    int winner = 0;
+    CHECK(race(NULL, &SIMULATED_SEARCH_OPS, &sim, scopes, 3, &winner) == &found_a);
+    CHECK(winner == 1 && sim.searches == 2 && sim.released == 0 && sim.finished == 1);
+
+    memset(&sim, 0, sizeof(sim));
+    CHECK(race(NULL, &SIMULATED_SEARCH_OPS, &sim, scopes, 1, &winner) == NULL);
+    CHECK(winner == -1 && sim.searches == 1 && sim.finished == 1);
+
+    /* A single scope is not worth a race and is searched on the caller's thread, finished before it returns. */
+    WorkerPool* pool = winctrl_workers_create(WORKER_POOL_THREADS, NULL, NULL, NULL);
+    CHECK(pool != NULL);
+    memset(&sim, 0, sizeof(sim));
+    CHECK(race(pool, &SIMULATED_SEARCH_OPS, &sim, &scopes[2], 1, &winner) == &found_b);
+    CHECK(winner == 0 && sim.searches == 1 && sim.finished == 1);
+    winctrl_workers_destroy(pool);
+}
+
+int main(void) {
+    test_fastest_wins();
+    test_late_match();
+    test_no_match();
+    test_in_turn();
+    return harness_finish();
+}
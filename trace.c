@@ -0,0 +1,833 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC_SIZE 8
+
+static bool reserve(TraceBuffer* buffer, size_t extra) {
+    if (buffer->failed) {
+        return false;
+    }
+    if (buffer->size + extra <= buffer->capacity) {
+        return true;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+    while (capacity < buffer->size + extra) {
+        capacity *= 2;
+    }
+    uint8_t* data = realloc(buffer->data, capacity);
+    if (!data) {
+        buffer->failed = true;
+        return false;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static void put_bytes(TraceBuffer* buffer, const void* bytes, size_t length) {
+    if (length && reserve(buffer, length)) {
+        memcpy(buffer->data + buffer->size, bytes, length);
+        buffer->size += length;
+    }
+}
+
+static void put_varint(TraceBuffer* buffer, uint64_t value) {
+    if (!reserve(buffer, 10)) {
+        return;
+    }
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buffer->data[buffer->size++] = value ? (uint8_t)(byte | 0x80) : byte;
+    } while (value);
+}
+
+static void put_signed(TraceBuffer* buffer, int64_t value) {
+    put_varint(buffer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void put_string(TraceBuffer* buffer, const char* text) {
+    size_t length = strlen(text);
+    put_varint(buffer, length);
+    put_bytes(buffer, text, length);
+}
+
+static void put_optional_string(TraceBuffer* buffer, const char* text) {
+    if (!text) {
+        put_varint(buffer, 0);
+        return;
+    }
+    size_t length = strlen(text);
+    put_varint(buffer, length + 1);
+    put_bytes(buffer, text, length);
+}
+
+typedef struct {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool failed;
+} TraceReader;
+
+static uint64_t get_varint(TraceReader* reader) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (reader->pos >= reader->end) {
+            break;
+        }
+        uint8_t byte = *reader->pos++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    reader->failed = true;
+    return 0;
+}
+
+static int64_t get_signed(TraceReader* reader) {
+    uint64_t value = get_varint(reader);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static bool get_bool(TraceReader* reader) {
+    return get_varint(reader) != 0;
+}
+
+/* Copies a string into text, truncated to text_size like the live call would. */
+static void get_string(TraceReader* reader, char* text, size_t text_size) {
+    uint64_t length = get_varint(reader);
+    if (length > (uint64_t)(reader->end - reader->pos)) {
+        reader->failed = true;
+        length = 0;
+    }
+    if (text_size) {
+        size_t copied = length < text_size - 1 ? (size_t)length : text_size - 1;
+        memcpy(text, reader->pos, copied);
+        text[copied] = '\0';
+    }
+    reader->pos += length;
+}
+
+/* The arguments of each call, encoded the same way by the recorder and the replay so they can be matched. */
+static void args_locator(TraceBuffer* args, const Locator* locator) {
+    put_optional_string(args, locator->automation_id);
+    put_optional_string(args, locator->class_name);
+    put_signed(args, locator->control_type);
+    put_optional_string(args, locator->name);
+}
+
+static void args_events(TraceBuffer* args, const KeyEvent* events, int count) {
+    put_varint(args, (uint64_t)count);
+    for (int i = 0; i < count; i++) {
+        put_varint(args, events[i].code);
+        put_varint(args, events[i].scan);
+        put_varint(args, (events[i].up ? 1u : 0u) | (events[i].unicode ? 2u : 0u) | (events[i].char_end ? 4u : 0u));
+    }
+}
+
+static void put_info(TraceBuffer* results, const ElementInfo* info) {
+    put_string(results, info->name);
+    put_string(results, info->automation_id);
+    put_string(results, info->class_name);
+    put_signed(results, info->control_type);
+    put_signed(results, info->rect.left);
+    put_signed(results, info->rect.top);
+    put_signed(results, info->rect.right);
+    put_signed(results, info->rect.bottom);
+    put_varint(results, info->enabled);
+    put_varint(results, info->offscreen);
+}
+
+static void get_info(TraceReader* reader, ElementInfo* info) {
+    get_string(reader, info->name, sizeof(info->name));
+    get_string(reader, info->automation_id, sizeof(info->automation_id));
+    get_string(reader, info->class_name, sizeof(info->class_name));
+    info->control_type = (int)get_signed(reader);
+    info->rect.left = (int32_t)get_signed(reader);
+    info->rect.top = (int32_t)get_signed(reader);
+    info->rect.right = (int32_t)get_signed(reader);
+    info->rect.bottom = (int32_t)get_signed(reader);
+    info->enabled = get_bool(reader);
+    info->offscreen = get_bool(reader);
+}
+
+/* Recording */
+
+static size_t handle_slot(const TraceRecorder* recorder, const void* element) {
+    uint64_t key = (uint64_t)(uintptr_t)element;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key & recorder->handle_mask;
+}
+
+static bool grow_handles(TraceRecorder* recorder) {
+    size_t capacity = recorder->handles ? (recorder->handle_mask + 1) * 2 : 256;
+    TraceHandle* handles = calloc(capacity, sizeof(TraceHandle));
+    if (!handles) {
+        return false;
+    }
+    TraceHandle* old = recorder->handles;
+    size_t old_capacity = old ? recorder->handle_mask + 1 : 0;
+    recorder->handles = handles;
+    recorder->handle_mask = capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].element) {
+            size_t slot = handle_slot(recorder, old[i].element);
+            while (handles[slot].element) {
+                slot = (slot + 1) & recorder->handle_mask;
+            }
+            handles[slot] = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+/*
+ * The number an element has in the trace. A returned reference always
+ * gets a new number, since the platform may reuse the pointer of a
+ * released element for another one; an argument keeps the number it was
+ * returned with.
+ */
+static uint32_t handle_id(TraceRecorder* recorder, void* element, bool returned) {
+    if (!element) {
+        return 0;
+    }
+    if ((recorder->handle_count + 1) * 2 > (recorder->handles ? recorder->handle_mask + 1 : 0) &&
+        !grow_handles(recorder)) {
+        recorder->failed = true;
+        return 0;
+    }
+
+    size_t slot = handle_slot(recorder, element);
+    while (recorder->handles[slot].element && recorder->handles[slot].element != element) {
+        slot = (slot + 1) & recorder->handle_mask;
+    }
+    TraceHandle* handle = &recorder->handles[slot];
+    if (!handle->element) {
+        handle->element = element;
+        recorder->handle_count++;
+    } else if (!returned) {
+        return handle->id;
+    }
+    handle->id = ++recorder->next_id;
+    return handle->id;
+}
+
+static long long begin_call(TraceRecorder* recorder) {
+    recorder->args.size = 0;
+    recorder->results.size = 0;
+    return recorder->clock.ops->now_us(recorder->clock.clock);
+}
+
+static void end_call(TraceRecorder* recorder, TraceOp op, long long started) {
+    long long latency = recorder->clock.ops->now_us(recorder->clock.clock) - started;
+    if (recorder->failed) {
+        return;
+    }
+
+    TraceBuffer* record = &recorder->record;
+    record->size = 0;
+    uint8_t op_byte = (uint8_t)op;
+    put_bytes(record, &op_byte, 1);
+    put_varint(record, (uint64_t)(latency > 0 ? latency : 0));
+    put_varint(record, recorder->args.size);
+    put_bytes(record, recorder->args.data, recorder->args.size);
+    put_varint(record, recorder->results.size);
+    put_bytes(record, recorder->results.data, recorder->results.size);
+    if (record->failed || recorder->args.failed || recorder->results.failed ||
+        fwrite(record->data, 1, record->size, recorder->file) != record->size) {
+        recorder->failed = true;
+        return;
+    }
+    recorder->records++;
+}
+
+static int record_list_pids(void* backend, uint32_t* pids, int capacity) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    int count = recorder->inner.ops->processes.list_pids(recorder->inner.backend, pids, capacity);
+    put_varint(&recorder->args, (uint64_t)capacity);
+    put_signed(&recorder->results, count);
+    for (int i = 0; i < count && i < capacity; i++) {
+        put_varint(&recorder->results, pids[i]);
+    }
+    end_call(recorder, TRACE_LIST_PIDS, started);
+    return count;
+}
+
+static bool record_process_name(void* backend, uint32_t pid, char* name, size_t name_size) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    bool ok = recorder->inner.ops->processes.process_name(recorder->inner.backend, pid, name, name_size);
+    put_varint(&recorder->args, pid);
+    put_varint(&recorder->results, ok);
+    if (ok) {
+        put_string(&recorder->results, name);
+    }
+    end_call(recorder, TRACE_PROCESS_NAME, started);
+    return ok;
+}
+
+static uintptr_t record_main_window(void* backend, uint32_t pid) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    uintptr_t window = recorder->inner.ops->processes.main_window(recorder->inner.backend, pid);
+    put_varint(&recorder->args, pid);
+    put_varint(&recorder->results, window);
+    end_call(recorder, TRACE_MAIN_WINDOW, started);
+    return window;
+}
+
+static bool record_window_alive(void* backend, uintptr_t window, uint32_t pid) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    bool alive = recorder->inner.ops->processes.window_alive(recorder->inner.backend, window, pid);
+    put_varint(&recorder->args, window);
+    put_varint(&recorder->args, pid);
+    put_varint(&recorder->results, alive);
+    end_call(recorder, TRACE_WINDOW_ALIVE, started);
+    return alive;
+}
+
+static void* record_window_root(void* backend, uintptr_t window) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    void* root = recorder->inner.ops->window_root(recorder->inner.backend, window);
+    put_varint(&recorder->args, window);
+    put_varint(&recorder->results, handle_id(recorder, root, true));
+    end_call(recorder, TRACE_WINDOW_ROOT, started);
+    return root;
+}
+
+static bool record_find(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+                        SelectorMatches* matches) {
+    TraceRecorder* recorder = backend;
+    int first = matches->count;
+    long long started = begin_call(recorder);
+    bool ok = recorder->inner.ops->find(recorder->inner.backend, node, descendants, locator, first_only, matches);
+    put_varint(&recorder->args, handle_id(recorder, node, false));
+    put_varint(&recorder->args, descendants);
+    put_varint(&recorder->args, first_only);
+    args_locator(&recorder->args, locator);
+    put_varint(&recorder->results, ok);
+    put_varint(&recorder->results, (uint64_t)(matches->count - first));
+    for (int i = first; i < matches->count; i++) {
+        put_varint(&recorder->results, handle_id(recorder, matches->items[i], true));
+    }
+    end_call(recorder, TRACE_FIND, started);
+    return ok;
+}
+
+static void record_release(void* backend, void* element) {
+    TraceRecorder* recorder = backend;
+    recorder->inner.ops->release(recorder->inner.backend, element);
+}
+
+static bool record_read(void* backend, void* element, ElementInfo* info) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    bool ok = recorder->inner.ops->read(recorder->inner.backend, element, info);
+    put_varint(&recorder->args, handle_id(recorder, element, false));
+    put_varint(&recorder->results, ok);
+    if (ok) {
+        put_info(&recorder->results, info);
+    }
+    end_call(recorder, TRACE_READ, started);
+    return ok;
+}
+
+static bool record_read_value(void* backend, void* element, char* value, size_t value_size) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    bool ok = recorder->inner.ops->read_value(recorder->inner.backend, element, value, value_size);
+    put_varint(&recorder->args, handle_id(recorder, element, false));
+    put_varint(&recorder->results, ok);
+    if (ok) {
+        put_string(&recorder->results, value);
+    }
+    end_call(recorder, TRACE_READ_VALUE, started);
+    return ok;
+}
+
+static int record_act(void* backend, void* element, DesktopAction action, const char* value) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    int status = recorder->inner.ops->act(recorder->inner.backend, element, action, value);
+    put_varint(&recorder->args, handle_id(recorder, element, false));
+    put_varint(&recorder->args, (uint64_t)action);
+    put_optional_string(&recorder->args, value);
+    put_signed(&recorder->results, status);
+    end_call(recorder, TRACE_ACT, started);
+    return status;
+}
+
+static int record_toggle_state(void* backend, void* element) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    int state = recorder->inner.ops->toggle_state(recorder->inner.backend, element);
+    put_varint(&recorder->args, handle_id(recorder, element, false));
+    put_signed(&recorder->results, state);
+    end_call(recorder, TRACE_TOGGLE_STATE, started);
+    return state;
+}
+
+static void record_click(void* backend, int x, int y, DesktopButton button, int count) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    recorder->inner.ops->click(recorder->inner.backend, x, y, button, count);
+    put_signed(&recorder->args, x);
+    put_signed(&recorder->args, y);
+    put_varint(&recorder->args, (uint64_t)button);
+    put_signed(&recorder->args, count);
+    end_call(recorder, TRACE_CLICK, started);
+}
+
+/* Recorded even when the backend has no layout, so a replay sends the same events. */
+static bool record_map_key(void* backend, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state) {
+    TraceRecorder* recorder = backend;
+    long long started = begin_call(recorder);
+    bool ok = recorder->inner.ops->map_key &&
+              recorder->inner.ops->map_key(recorder->inner.backend, codepoint, vkey, scan, state);
+    put_varint(&recorder->args, codepoint);
+    put_varint(&recorder->results, ok);
+    if (ok) {
+        put_varint(&recorder->results, *vkey);
+        put_varint(&recorder->results, *scan);
+        put_varint(&recorder->results, *state);
+    }
+    end_call(recorder, TRACE_MAP_KEY, started);
+    return ok;
+}
+
+static int record_send_keys(void* sink, const KeyEvent* events, int count) {
+    TraceRecorder* recorder = sink;
+    long long started = begin_call(recorder);
+    int sent = recorder->inner.ops->keys.send(recorder->inner.backend, events, count);
+    args_events(&recorder->args, events, count);
+    put_signed(&recorder->results, sent);
+    end_call(recorder, TRACE_SEND_KEYS, started);
+    return sent;
+}
+
+static void record_pause(void* sink, int milliseconds) {
+    TraceRecorder* recorder = sink;
+    recorder->inner.ops->keys.pause(recorder->inner.backend, milliseconds);
+}
+
+const DesktopOps TRACE_RECORD_OPS = {
+    { record_list_pids, record_process_name, record_main_window, record_window_alive },
+    record_window_root,
+    record_find,
+    record_release,
+    record_read,
+    record_read_value,
+    record_act,
+    record_toggle_state,
+    record_click,
+    record_map_key,
+    { record_send_keys, record_pause }
+};
+
+bool winctrl_trace_record_open(TraceRecorder* recorder, const Desktop* inner, const Clock* clock, const char* path,
+                               char* error, size_t error_size) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->inner = *inner;
+    recorder->clock = *clock;
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file || fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, recorder->file) != TRACE_MAGIC_SIZE) {
+        snprintf(error, error_size, "Could not create trace file: %s", path);
+        if (recorder->file) {
+            fclose(recorder->file);
+            recorder->file = NULL;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool winctrl_trace_record_close(TraceRecorder* recorder, char* error, size_t error_size) {
+    bool ok = !recorder->failed;
+    if (recorder->file && fclose(recorder->file) != 0) {
+        ok = false;
+    }
+    recorder->file = NULL;
+    free(recorder->handles);
+    free(recorder->args.data);
+    free(recorder->results.data);
+    free(recorder->record.data);
+    recorder->handles = NULL;
+    recorder->args = recorder->results = recorder->record = (TraceBuffer){ NULL, 0, 0, false };
+    if (!ok) {
+        snprintf(error, error_size, "Trace is incomplete: writing a record failed after %ld records", recorder->records);
+    }
+    return ok;
+}
+
+/* Replay */
+
+static size_t key_hash(uint8_t op, const uint8_t* args, size_t size) {
+    uint64_t hash = 1469598103934665603ULL ^ op;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ args[i]) * 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+static bool same_key(const TraceReplay* replay, const TraceRecord* record, uint8_t op, const uint8_t* args,
+                     size_t size) {
+    return record->op == op && record->args_size == size &&
+           (size == 0 || memcmp(replay->data + record->args, args, size) == 0);
+}
+
+/* Links every record into the chain of its op and arguments; the head of each chain is in a bucket. */
+static bool index_records(TraceReplay* replay) {
+    size_t buckets = 16;
+    while (buckets < (size_t)replay->record_count * 2) {
+        buckets *= 2;
+    }
+    replay->buckets = malloc(buckets * sizeof(int32_t));
+    if (!replay->buckets) {
+        return false;
+    }
+    replay->mask = buckets - 1;
+    for (size_t i = 0; i < buckets; i++) {
+        replay->buckets[i] = -1;
+    }
+
+    for (int i = 0; i < replay->record_count; i++) {
+        TraceRecord* record = &replay->records[i];
+        const uint8_t* args = replay->data + record->args;
+        size_t bucket = key_hash(record->op, args, record->args_size) & replay->mask;
+        int32_t head = replay->buckets[bucket];
+        while (head != -1 && !same_key(replay, &replay->records[head], record->op, args, record->args_size)) {
+            head = replay->records[head].next_key;
+        }
+        record->next_same = -1;
+        record->next_key = -1;
+        record->cursor = i;
+        if (head == -1) {
+            record->next_key = replay->buckets[bucket];
+            replay->buckets[bucket] = i;
+        } else {
+            /* While indexing, a head's cursor is the last record of its chain. */
+            replay->records[replay->records[head].cursor].next_same = i;
+            replay->records[head].cursor = i;
+        }
+    }
+    for (size_t bucket = 0; bucket <= replay->mask; bucket++) {
+        for (int32_t head = replay->buckets[bucket]; head != -1; head = replay->records[head].next_key) {
+            replay->records[head].cursor = head;
+        }
+    }
+    return true;
+}
+
+bool winctrl_trace_replay_load(TraceReplay* replay, const char* path, char* error, size_t error_size) {
+    memset(replay, 0, sizeof(*replay));
+    replay->clock = SYSTEM_CLOCK;
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        snprintf(error, error_size, "Could not open trace file: %s", path);
+        return false;
+    }
+
+    size_t capacity = 0;
+    bool ok = true;
+    for (;;) {
+        if (replay->size == capacity) {
+            capacity = capacity ? capacity * 2 : 64 * 1024;
+            uint8_t* grown = realloc(replay->data, capacity);
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            replay->data = grown;
+        }
+        size_t read = fread(replay->data + replay->size, 1, capacity - replay->size, file);
+        replay->size += read;
+        if (read == 0) break;
+    }
+    ok = ok && !ferror(file);
+    fclose(file);
+    if (!ok) {
+        snprintf(error, error_size, "Could not read trace file: %s", path);
+        winctrl_trace_replay_free(replay);
+        return false;
+    }
+    if (replay->size < TRACE_MAGIC_SIZE || memcmp(replay->data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+        snprintf(error, error_size, "Not a trace file: %s", path);
+        winctrl_trace_replay_free(replay);
+        return false;
+    }
+
+    int record_capacity = 0;
+    TraceReader reader = { replay->data + TRACE_MAGIC_SIZE, replay->data + replay->size, false };
+    while (reader.pos < reader.end) {
+        if (replay->record_count == record_capacity) {
+            record_capacity = record_capacity ? record_capacity * 2 : 1024;
+            TraceRecord* grown = realloc(replay->records, (size_t)record_capacity * sizeof(TraceRecord));
+            if (!grown) {
+                snprintf(error, error_size, "Out of memory loading trace");
+                winctrl_trace_replay_free(replay);
+                return false;
+            }
+            replay->records = grown;
+        }
+
+        TraceRecord* record = &replay->records[replay->record_count];
+        record->op = *reader.pos++;
+        record->latency_us = (uint32_t)get_varint(&reader);
+        uint64_t args_size = get_varint(&reader);
+        if (reader.failed || args_size > (uint64_t)(reader.end - reader.pos)) {
+            reader.failed = true;
+            break;
+        }
+        record->args = (uint32_t)(reader.pos - replay->data);
+        record->args_size = (uint32_t)args_size;
+        reader.pos += args_size;
+        uint64_t results_size = get_varint(&reader);
+        if (reader.failed || results_size > (uint64_t)(reader.end - reader.pos)) {
+            reader.failed = true;
+            break;
+        }
+        record->results = (uint32_t)(reader.pos - replay->data);
+        record->results_size = (uint32_t)results_size;
+        reader.pos += results_size;
+        if (record->op < TRACE_LIST_PIDS || record->op > TRACE_SEND_KEYS) {
+            reader.failed = true;
+            break;
+        }
+        replay->recorded_us += record->latency_us;
+        replay->record_count++;
+    }
+    if (reader.pos < reader.end || reader.failed) {
+        snprintf(error, error_size, "Trace is corrupt at record %d", replay->record_count + 1);
+        winctrl_trace_replay_free(replay);
+        return false;
+    }
+    if (!index_records(replay)) {
+        snprintf(error, error_size, "Out of memory loading trace");
+        winctrl_trace_replay_free(replay);
+        return false;
+    }
+    return true;
+}
+
+void winctrl_trace_replay_free(TraceReplay* replay) {
+    free(replay->data);
+    free(replay->records);
+    free(replay->buckets);
+    free(replay->args.data);
+    memset(replay, 0, sizeof(*replay));
+}
+
+static TraceBuffer* begin_replay(TraceReplay* replay) {
+    replay->args.size = 0;
+    return &replay->args;
+}
+
+/* Finds the next answer to the call in replay->args and waits its latency; false for a miss. */
+static bool replay_call(TraceReplay* replay, TraceOp op, TraceReader* results) {
+    const uint8_t* args = replay->args.data;
+    size_t size = replay->args.size;
+    int32_t head = -1;
+    if (!replay->args.failed && replay->buckets) {
+        head = replay->buckets[key_hash((uint8_t)op, args, size) & replay->mask];
+        while (head != -1 && !same_key(replay, &replay->records[head], (uint8_t)op, args, size)) {
+            head = replay->records[head].next_key;
+        }
+    }
+    if (head == -1) {
+        replay->misses++;
+        return false;
+    }
+
+    TraceRecord* record = &replay->records[replay->records[head].cursor];
+    if (record->next_same != -1) {
+        replay->records[head].cursor = record->next_same;
+    }
+    replay->replayed++;
+    winctrl_clock_sleep_us(&replay->clock, record->latency_us);
+    results->pos = replay->data + record->results;
+    results->end = results->pos + record->results_size;
+    results->failed = false;
+    return true;
+}
+
+static uint32_t replay_id(const void* element) {
+    return (uint32_t)(uintptr_t)element;
+}
+
+static void* replay_element(uint64_t id) {
+    return (void*)(uintptr_t)id;
+}
+
+static int replay_list_pids(void* backend, uint32_t* pids, int capacity) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), (uint64_t)capacity);
+    if (!replay_call(replay, TRACE_LIST_PIDS, &results)) {
+        return -1;
+    }
+    int count = (int)get_signed(&results);
+    for (int i = 0; i < count && i < capacity; i++) {
+        pids[i] = (uint32_t)get_varint(&results);
+    }
+    return results.failed ? -1 : count;
+}
+
+static bool replay_process_name(void* backend, uint32_t pid, char* name, size_t name_size) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), pid);
+    if (!replay_call(replay, TRACE_PROCESS_NAME, &results) || !get_bool(&results)) {
+        return false;
+    }
+    get_string(&results, name, name_size);
+    return !results.failed;
+}
+
+static uintptr_t replay_main_window(void* backend, uint32_t pid) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), pid);
+    return replay_call(replay, TRACE_MAIN_WINDOW, &results) ? (uintptr_t)get_varint(&results) : 0;
+}
+
+static bool replay_window_alive(void* backend, uintptr_t window, uint32_t pid) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    TraceBuffer* args = begin_replay(replay);
+    put_varint(args, window);
+    put_varint(args, pid);
+    return replay_call(replay, TRACE_WINDOW_ALIVE, &results) && get_bool(&results);
+}
+
+static void* replay_window_root(void* backend, uintptr_t window) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), window);
+    return replay_call(replay, TRACE_WINDOW_ROOT, &results) ? replay_element(get_varint(&results)) : NULL;
+}
+
+static bool replay_find(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+                        SelectorMatches* matches) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    TraceBuffer* args = begin_replay(replay);
+    put_varint(args, replay_id(node));
+    put_varint(args, descendants);
+    put_varint(args, first_only);
+    args_locator(args, locator);
+    if (!replay_call(replay, TRACE_FIND, &results) || !get_bool(&results)) {
+        return false;
+    }
+    uint64_t count = get_varint(&results);
+    for (uint64_t i = 0; i < count && !results.failed; i++) {
+        if (!winctrl_selector_matches_push(matches, replay_element(get_varint(&results)))) {
+            return false;
+        }
+    }
+    return !results.failed;
+}
+
+static void replay_release(void* backend, void* element) {
+    (void)backend;
+    (void)element;
+}
+
+static bool replay_read(void* backend, void* element, ElementInfo* info) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), replay_id(element));
+    if (!replay_call(replay, TRACE_READ, &results) || !get_bool(&results)) {
+        return false;
+    }
+    get_info(&results, info);
+    return !results.failed;
+}
+
+static bool replay_read_value(void* backend, void* element, char* value, size_t value_size) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), replay_id(element));
+    if (!replay_call(replay, TRACE_READ_VALUE, &results) || !get_bool(&results)) {
+        return false;
+    }
+    get_string(&results, value, value_size);
+    return !results.failed;
+}
+
+static int replay_act(void* backend, void* element, DesktopAction action, const char* value) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    TraceBuffer* args = begin_replay(replay);
+    put_varint(args, replay_id(element));
+    put_varint(args, (uint64_t)action);
+    put_optional_string(args, value);
+    return replay_call(replay, TRACE_ACT, &results) ? (int)get_signed(&results) : DESKTOP_FAILED;
+}
+
+static int replay_toggle_state(void* backend, void* element) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), replay_id(element));
+    return replay_call(replay, TRACE_TOGGLE_STATE, &results) ? (int)get_signed(&results) : -1;
+}
+
+static void replay_click(void* backend, int x, int y, DesktopButton button, int count) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    TraceBuffer* args = begin_replay(replay);
+    put_signed(args, x);
+    put_signed(args, y);
+    put_varint(args, (uint64_t)button);
+    put_signed(args, count);
+    replay_call(replay, TRACE_CLICK, &results);
+}
+
+static bool replay_map_key(void* backend, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state) {
+    TraceReplay* replay = backend;
+    TraceReader results;
+    put_varint(begin_replay(replay), codepoint);
+    if (!replay_call(replay, TRACE_MAP_KEY, &results) || !get_bool(&results)) {
+        return false;
+    }
+    *vkey = (uint16_t)get_varint(&results);
+    *scan = (uint16_t)get_varint(&results);
+    *state = (uint8_t)get_varint(&results);
+    return !results.failed;
+}
+
+static int replay_send_keys(void* sink, const KeyEvent* events, int count) {
+    TraceReplay* replay = sink;
+    TraceReader results;
+    args_events(begin_replay(replay), events, count);
+    return replay_call(replay, TRACE_SEND_KEYS, &results) ? (int)get_signed(&results) : 0;
+}
+
+static void replay_pause(void* sink, int milliseconds) {
+    TraceReplay* replay = sink;
+    winctrl_clock_sleep_ms(&replay->clock, milliseconds);
+}
+
+const DesktopOps TRACE_REPLAY_OPS = {
+    { replay_list_pids, replay_process_name, replay_main_window, replay_window_alive },
+    replay_window_root,
+    replay_find,
+    replay_release,
+    replay_read,
+    replay_read_value,
+    replay_act,
+    replay_toggle_state,
+    replay_click,
+    replay_map_key,
+    { replay_send_keys, replay_pause }
+};
@@ -0,0 +1,114 @@
+#ifndef WINCONTROL_TRACE_H
+#define WINCONTROL_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "clock.h"
+#include "desktop.h"
+
+#define TRACE_MAGIC "WCTRACE1"
+
+typedef enum {
+    TRACE_LIST_PIDS = 1,
+    TRACE_PROCESS_NAME,
+    TRACE_MAIN_WINDOW,
+    TRACE_WINDOW_ALIVE,
+    TRACE_WINDOW_ROOT,
+    TRACE_FIND,
+    TRACE_READ,
+    TRACE_READ_VALUE,
+    TRACE_ACT,
+    TRACE_TOGGLE_STATE,
+    TRACE_CLICK,
+    TRACE_MAP_KEY,
+    TRACE_SEND_KEYS
+} TraceOp;
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} TraceBuffer;
+
+typedef struct {
+    void* element;
+    uint32_t id;
+} TraceHandle;
+
+/*
+ * A trace file is TRACE_MAGIC followed by one record per desktop call:
+ * the TraceOp as a byte, the call's latency in microseconds, and the
+ * length and bytes of its arguments and then of its results. Numbers are
+ * LEB128 varints, signed ones zigzag-encoded; strings are a length and
+ * their bytes, with length 0 for NULL and the length plus one otherwise
+ * where NULL is allowed. Elements are numbered from 1 in the order they
+ * were returned, so a trace can be replayed where the recorded pointers
+ * mean nothing. Releases and keyboard pauses are not recorded.
+ */
+typedef struct {
+    Desktop inner;
+    Clock clock;
+    FILE* file;
+    TraceHandle* handles;
+    size_t handle_count;
+    size_t handle_mask;
+    uint32_t next_id;
+    TraceBuffer args;
+    TraceBuffer results;
+    TraceBuffer record;
+    long records;
+    bool failed;
+} TraceRecorder;
+
+/* Records every call made through TRACE_RECORD_OPS to inner into path; latency is measured on clock. */
+bool winctrl_trace_record_open(TraceRecorder* recorder, const Desktop* inner, const Clock* clock, const char* path,
+                               char* error, size_t error_size);
+/* Closes the file; returns false when any record could not be written. */
+bool winctrl_trace_record_close(TraceRecorder* recorder, char* error, size_t error_size);
+
+extern const DesktopOps TRACE_RECORD_OPS;
+
+typedef struct {
+    uint8_t op;
+    uint32_t latency_us;
+    uint32_t args;
+    uint32_t args_size;
+    uint32_t results;
+    uint32_t results_size;
+    int32_t next_same;
+    int32_t next_key;
+    int32_t cursor;
+} TraceRecord;
+
+/*
+ * Answers desktop calls from a recorded trace. A call is looked up by
+ * its operation and arguments, not by position, so a changed interpreter
+ * or cache that makes fewer or other calls still replays: calls with the
+ * same arguments get their recorded results in order, and the last one
+ * again once they run out. Each answer first waits the recorded latency
+ * on clock. A call the trace has no record for fails the way the
+ * operation fails and counts as a miss.
+ */
+typedef struct {
+    Clock clock;
+    uint8_t* data;
+    size_t size;
+    TraceRecord* records;
+    int record_count;
+    int32_t* buckets;
+    size_t mask;
+    TraceBuffer args;
+    long replayed;
+    long misses;
+    long long recorded_us;
+} TraceReplay;
+
+bool winctrl_trace_replay_load(TraceReplay* replay, const char* path, char* error, size_t error_size);
+void winctrl_trace_replay_free(TraceReplay* replay);
+
+extern const DesktopOps TRACE_REPLAY_OPS;
+
+#endif
@@ -0,0 +1,121 @@
+#include "variables.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t hash_name(const char* name) {
+    size_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int probe(const VariableContext* vars, const char* name, size_t hash, size_t* slot_out) {
+    size_t mask = vars->index_size - 1;
+    size_t slot = hash & mask;
+    while (vars->index[slot] != -1) {
+        const Variable* var = &vars->variables[vars->index[slot]];
+        if (var->hash == hash && strcmp(var->name, name) == 0) {
+            *slot_out = slot;
+            return vars->index[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    *slot_out = slot;
+    return -1;
+}
+
+static bool grow_index(VariableContext* vars) {
+    size_t new_size = vars->index_size ? vars->index_size * 2 : 32;
+    int* index = malloc(new_size * sizeof(int));
+    if (!index) return false;
+    for (size_t i = 0; i < new_size; i++) index[i] = -1;
+
+    for (int i = 0; i < vars->variable_count; i++) {
+        size_t slot = vars->variables[i].hash & (new_size - 1);
+        while (index[slot] != -1) slot = (slot + 1) & (new_size - 1);
+        index[slot] = i;
+    }
+
+    free(vars->index);
+    vars->index = index;
+    vars->index_size = new_size;
+    return true;
+}
+
+int winctrl_vars_find(const VariableContext* vars, const char* name) {
+    if (vars->variable_count == 0) return -1;
+    size_t slot;
+    return probe(vars, name, hash_name(name), &slot);
+}
+
+int winctrl_vars_declare(VariableContext* vars, const char* name) {
+    if (((size_t)vars->variable_count + 1) * 2 > vars->index_size && !grow_index(vars)) {
+        return -1;
+    }
+
+    size_t hash = hash_name(name);
+    size_t slot;
+    int existing = probe(vars, name, hash, &slot);
+    if (existing != -1) return existing;
+
+    if (vars->variable_count == vars->capacity) {
+        int new_capacity = vars->capacity ? vars->capacity * 2 : 16;
+        Variable* grown = realloc(vars->variables, (size_t)new_capacity * sizeof(Variable));
+        if (!grown) return -1;
+        vars->variables = grown;
+        vars->capacity = new_capacity;
+    }
+
+    char* stored_name = winctrl_arena_strndup(&vars->arena, name, strlen(name));
+    if (!stored_name) return -1;
+
+    Variable* var = &vars->variables[vars->variable_count];
+    var->name = stored_name;
+    var->hash = hash;
+    var->value = NULL;
+    vars->index[slot] = vars->variable_count;
+    return vars->variable_count++;
+}
+
+bool winctrl_vars_assign(VariableContext* vars, int slot, const char* value, size_t length) {
+    Variable* var = &vars->variables[slot];
+
+    if (!var->value || var->value->capacity < length + 1) {
+        size_t capacity = var->value ? var->value->capacity * 2 : 16;
+        while (capacity < length + 1) capacity *= 2;
+
+        VariableValue* grown = winctrl_arena_alloc(&vars->arena, sizeof(VariableValue) + capacity);
+        if (!grown) return false;
+        grown->capacity = capacity;
+        var->value = grown;
+    }
+
+    memmove(var->value->data, value, length);
+    var->value->data[length] = '\0';
+    var->value->length = length;
+    return true;
+}
+
+const char* winctrl_vars_get(const VariableContext* vars, const char* name) {
+    int slot = winctrl_vars_find(vars, name);
+    if (slot == -1 || !vars->variables[slot].value) return NULL;
+    return vars->variables[slot].value->data;
+}
+
+bool winctrl_vars_set(VariableContext* vars, const char* name, const char* value) {
+    int slot = winctrl_vars_declare(vars, name);
+    return slot != -1 && winctrl_vars_assign(vars, slot, value, strlen(value));
+}
+
+void winctrl_vars_free(VariableContext* vars) {
+    winctrl_arena_free(&vars->arena);
+    free(vars->variables);
+    free(vars->index);
+    vars->variables = NULL;
+    vars->variable_count = 0;
+    vars->capacity = 0;
+    vars->index = NULL;
+    vars->index_size = 0;
+}
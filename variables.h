@@ -0,0 +1,43 @@
+#ifndef WINCONTROL_VARIABLES_H
+#define WINCONTROL_VARIABLES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+
+typedef struct {
+    size_t length;
+    size_t capacity;
+    char data[];
+} VariableValue;
+
+typedef struct {
+    const char* name;
+    size_t hash;
+    VariableValue* value;
+} Variable;
+
+/*
+ * Variables are kept in insertion order in a dense array so an index stays
+ * valid for the lifetime of the context; the open-addressing index maps
+ * names to those positions. Names and values live in the arena. A value is
+ * rewritten in place while it fits and reallocated with doubled capacity
+ * otherwise.
+ */
+typedef struct {
+    Arena arena;
+    Variable* variables;
+    int variable_count;
+    int capacity;
+    int* index;
+    size_t index_size;
+} VariableContext;
+
+int winctrl_vars_find(const VariableContext* vars, const char* name);
+int winctrl_vars_declare(VariableContext* vars, const char* name);
+bool winctrl_vars_assign(VariableContext* vars, int slot, const char* value, size_t length);
+const char* winctrl_vars_get(const VariableContext* vars, const char* name);
+bool winctrl_vars_set(VariableContext* vars, const char* name, const char* value);
+void winctrl_vars_free(VariableContext* vars);
+
+#endif
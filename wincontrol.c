@@ -3,12 +3,16 @@
 #include <initguid.h>
 #include <UIAutomation.h>
 #include <stdio.h>
-#include <tlhelp32.h>
 #include <psapi.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdbool.h>
+#include <limits.h>
+
+/* Cross-process UI Automation calls made so far, on any thread; printed per action with -v. */
+static volatile LONG uia_calls;
+#define UIA_CALL(call) (InterlockedIncrement(&uia_calls), (call))
 
 #define VK_DELETE 0x2E
 #define VK_HOME   0x24
@@ -33,48 +37,853 @@ struct EnumData {
     HWND window;
 };
 
-bool evaluate_condition(WinControlContext* ctx, const char* condition);
-typedef bool (*CommandHandler)(WinControlContext* ctx, const Command* cmd);
 
-bool winctrl_initialize(WinControlContext* ctx) {
-    printf("Initializing COM...\n");
+static bool add_string_condition(IUIAutomation* automation, PROPERTYID property, const char* value,
+                                 IUIAutomationCondition** conditions, int* count) {
+    WCHAR wide_value[256];
+    MultiByteToWideChar(CP_UTF8, 0, value, -1, wide_value, 256);
 
-    HRESULT hr = CoInitialize(NULL);
-    if (FAILED(hr)) {
-        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-            "Failed to initialize COM: 0x%lx", hr);
-        printf("COM initialization failed: 0x%lx\n", hr);
+    VARIANT var;
+    var.vt = VT_BSTR;
+    var.bstrVal = SysAllocString(wide_value);
+    HRESULT hr = automation->lpVtbl->CreatePropertyCondition(automation, property, var, &conditions[*count]);
+    SysFreeString(var.bstrVal);
+
+    if (FAILED(hr)) return false;
+    (*count)++;
+    return true;
+}
+
+static void* build_uia_condition(void* backend, const Locator* locator) {
+    IUIAutomation* automation = backend;
+    IUIAutomationCondition* conditions[4] = {NULL};
+    int count = 0;
+    bool ok = true;
+
+    if (locator->automation_id) {
+        ok = add_string_condition(automation, UIA_AutomationIdPropertyId, locator->automation_id, conditions, &count);
+    }
+    if (ok && locator->class_name) {
+        ok = add_string_condition(automation, UIA_ClassNamePropertyId, locator->class_name, conditions, &count);
+    }
+    if (ok && locator->name) {
+        ok = add_string_condition(automation, UIA_NamePropertyId, locator->name, conditions, &count);
+    }
+    if (ok && locator->control_type != -1) {
+        VARIANT var;
+        var.vt = VT_I4;
+        var.lVal = locator->control_type;
+        ok = SUCCEEDED(automation->lpVtbl->CreatePropertyCondition(
+            automation, UIA_ControlTypePropertyId, var, &conditions[count]));
+        if (ok) count++;
+    }
+
+    IUIAutomationCondition* condition = NULL;
+    if (ok && count == 0) {
+        ok = SUCCEEDED(automation->lpVtbl->CreateTrueCondition(automation, &condition));
+    } else if (ok) {
+        condition = conditions[0];
+        condition->lpVtbl->AddRef(condition);
+        for (int i = 1; ok && i < count; i++) {
+            IUIAutomationCondition* combined = NULL;
+            ok = SUCCEEDED(automation->lpVtbl->CreateAndCondition(automation, condition, conditions[i], &combined));
+            condition->lpVtbl->Release(condition);
+            condition = combined;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        conditions[i]->lpVtbl->Release(conditions[i]);
+    }
+    return ok ? condition : NULL;
+}
+
+static void release_uia_condition(void* backend, void* condition) {
+    IUIAutomationCondition* uia_condition = condition;
+    uia_condition->lpVtbl->Release(uia_condition);
+}
+
+static const LocatorCacheOps UIA_CONDITION_OPS = {
+    build_uia_condition,
+    release_uia_condition,
+    NULL
+};
+
+static IUIAutomationElement* get_root_element(WinControlContext* ctx);
+static const DesktopOps WIN_DESKTOP_OPS;
+
+/* Reads the prefetched runtime ID, or asks the target process when cached is false; returns its length or 0. */
+static int read_runtime_id(IUIAutomationElement* element, bool cached, int32_t* ids, int capacity) {
+    VARIANT runtime_id;
+    VariantInit(&runtime_id);
+    HRESULT hr = cached
+        ? element->lpVtbl->GetCachedPropertyValue(element, UIA_RuntimeIdPropertyId, &runtime_id)
+        : UIA_CALL(element->lpVtbl->GetCurrentPropertyValue(element, UIA_RuntimeIdPropertyId, &runtime_id));
+
+    int length = 0;
+    int32_t* data = NULL;
+    if (SUCCEEDED(hr) && runtime_id.vt == (VT_I4 | VT_ARRAY) && runtime_id.parray) {
+        LONG lower = 0;
+        LONG upper = -1;
+        SafeArrayGetLBound(runtime_id.parray, 1, &lower);
+        SafeArrayGetUBound(runtime_id.parray, 1, &upper);
+        if (upper >= lower && upper - lower < capacity && SUCCEEDED(SafeArrayAccessData(runtime_id.parray, (void**)&data))) {
+            length = (int)(upper - lower + 1);
+            memcpy(ids, data, (size_t)length * sizeof(int32_t));
+            SafeArrayUnaccessData(runtime_id.parray);
+        }
+    }
+    VariantClear(&runtime_id);
+    return length;
+}
+
+static bool cached_string_is(IUIAutomationElement* element, PROPERTYID property, const char* expected) {
+    if (!expected) {
+        return true;
+    }
+    WCHAR wide_expected[256];
+    MultiByteToWideChar(CP_UTF8, 0, expected, -1, wide_expected, 256);
+
+    VARIANT value;
+    VariantInit(&value);
+    bool same = SUCCEEDED(element->lpVtbl->GetCachedPropertyValue(element, property, &value)) &&
+                value.vt == VT_BSTR && wcscmp(value.bstrVal ? value.bstrVal : L"", wide_expected) == 0;
+    VariantClear(&value);
+    return same;
+}
+
+/* Checks a prefetched element against a locator the way the search condition would. */
+static bool element_matches_locator(IUIAutomationElement* element, const Locator* locator) {
+    CONTROLTYPEID control_type = 0;
+    if (locator->control_type != -1 &&
+        (FAILED(element->lpVtbl->get_CachedControlType(element, &control_type)) || control_type != locator->control_type)) {
         return false;
     }
-    printf("COM initialized successfully\n");
+    return cached_string_is(element, UIA_AutomationIdPropertyId, locator->automation_id) &&
+           cached_string_is(element, UIA_ClassNamePropertyId, locator->class_name) &&
+           cached_string_is(element, UIA_NamePropertyId, locator->name);
+}
 
-    printf("Creating UI Automation instance...\n");
-    hr = CoCreateInstance(&CLSID_CUIAutomation, NULL,
-        CLSCTX_INPROC_SERVER, &IID_IUIAutomation,
-        (void**)&ctx->automation);
+/* Learned paths compare runtime IDs of siblings, fetched for a whole level in one FindAllBuildCache. */
+static IUIAutomationCacheRequest* runtime_id_request(WinControlContext* ctx) {
+    if (ctx->runtime_ids) {
+        return ctx->runtime_ids;
+    }
+    IUIAutomationCacheRequest* request = NULL;
+    IUIAutomationCondition* raw_view = NULL;
+    HRESULT hr = ctx->automation->lpVtbl->CreateCacheRequest(ctx->automation, &request);
+    if (SUCCEEDED(hr)) hr = request->lpVtbl->AddProperty(request, UIA_RuntimeIdPropertyId);
+    if (SUCCEEDED(hr)) hr = ctx->automation->lpVtbl->CreateTrueCondition(ctx->automation, &raw_view);
+    if (SUCCEEDED(hr)) hr = request->lpVtbl->put_TreeFilter(request, raw_view);
+    if (raw_view) raw_view->lpVtbl->Release(raw_view);
+    if (FAILED(hr) && request) {
+        request->lpVtbl->Release(request);
+        request = NULL;
+    }
+    ctx->runtime_ids = request;
+    return request;
+}
 
-    if (FAILED(hr)) {
-        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-            "Failed to create UI Automation instance: 0x%lx (Try running as administrator)", hr);
-        printf("UI Automation creation failed: 0x%lx\n", hr);
-        CoUninitialize();
+static bool same_runtime_id(const int32_t* a, int a_length, const int32_t* b, int b_length) {
+    return a_length > 0 && a_length == b_length && memcmp(a, b, (size_t)a_length * sizeof(int32_t)) == 0;
+}
+
+/* Returns the raw-view position of the child with the given runtime ID, or -1. */
+static int find_child_by_runtime_id(WinControlContext* ctx, IUIAutomationElement* parent,
+    const int32_t* runtime_id, int runtime_id_length, IUIAutomationElement** child) {
+    Locator any = { NULL, NULL, -1, NULL };
+    IUIAutomationCondition* condition = winctrl_locator_cache_get(&ctx->conditions, &any);
+    IUIAutomationCacheRequest* request = runtime_id_request(ctx);
+    IUIAutomationElementArray* children = NULL;
+    if (!condition || !request ||
+        FAILED(UIA_CALL(parent->lpVtbl->FindAllBuildCache(parent, TreeScope_Children, condition, request, &children))) ||
+        !children) {
+        return -1;
+    }
+
+    int length = 0;
+    int found = -1;
+    children->lpVtbl->get_Length(children, &length);
+    for (int i = 0; found == -1 && i < length; i++) {
+        IUIAutomationElement* element = NULL;
+        if (FAILED(children->lpVtbl->GetElement(children, i, &element)) || !element) {
+            continue;
+        }
+        int32_t ids[PATH_MAX_RUNTIME_ID];
+        int ids_length = read_runtime_id(element, true, ids, PATH_MAX_RUNTIME_ID);
+        if (same_runtime_id(ids, ids_length, runtime_id, runtime_id_length)) {
+            found = i;
+            if (child) {
+                element->lpVtbl->AddRef(element);
+                *child = element;
+            }
+        }
+        element->lpVtbl->Release(element);
+    }
+    children->lpVtbl->Release(children);
+    return found;
+}
+
+/*
+ * Records where a found element sits below the window root: its child
+ * index at each level of the raw view, and its runtime ID. This costs two
+ * calls per level, once per locator, so later runs can skip the search.
+ */
+static void learn_path(WinControlContext* ctx, IUIAutomationElement* root, IUIAutomationElement* element,
+    const Locator* locator) {
+    int32_t root_id[PATH_MAX_RUNTIME_ID];
+    int32_t target_id[PATH_MAX_RUNTIME_ID];
+    int32_t child_id[PATH_MAX_RUNTIME_ID];
+    int root_length = read_runtime_id(root, false, root_id, PATH_MAX_RUNTIME_ID);
+    int target_length = read_runtime_id(element, true, target_id, PATH_MAX_RUNTIME_ID);
+    IUIAutomationCacheRequest* request = runtime_id_request(ctx);
+    IUIAutomationTreeWalker* walker = NULL;
+    if (root_length == 0 || target_length == 0 || !request ||
+        FAILED(ctx->automation->lpVtbl->get_RawViewWalker(ctx->automation, &walker))) {
+        return;
+    }
+
+    int32_t reversed[PATH_MAX_STEPS];
+    int depth = 0;
+    int child_length = target_length;
+    memcpy(child_id, target_id, sizeof(target_id));
+    IUIAutomationElement* child = element;
+    child->lpVtbl->AddRef(child);
+    bool reached_root = false;
+    while (!reached_root && depth < PATH_MAX_STEPS) {
+        IUIAutomationElement* parent = NULL;
+        UIA_CALL(walker->lpVtbl->GetParentElementBuildCache(walker, child, request, &parent));
+        child->lpVtbl->Release(child);
+        child = parent;
+        if (!parent) {
+            break;
+        }
+        int index = find_child_by_runtime_id(ctx, parent, child_id, child_length, NULL);
+        if (index < 0) {
+            break;
+        }
+        reversed[depth++] = index;
+        child_length = read_runtime_id(parent, true, child_id, PATH_MAX_RUNTIME_ID);
+        reached_root = same_runtime_id(child_id, child_length, root_id, root_length);
+    }
+    if (child) child->lpVtbl->Release(child);
+    walker->lpVtbl->Release(walker);
+
+    if (reached_root) {
+        int32_t steps[PATH_MAX_STEPS];
+        for (int i = 0; i < depth; i++) {
+            steps[i] = reversed[depth - 1 - i];
+        }
+        winctrl_path_index_learn(&ctx->paths, ctx->target->process_name, ctx->target->window_class, locator,
+            steps, depth, target_id, target_length);
+    }
+}
+
+/*
+ * Follows a path learned on an earlier run: one FindAll over the children
+ * at each level, then a refresh of the element it ends at. If that element
+ * no longer matches the locator, its runtime ID is looked for among the
+ * same siblings, which covers elements inserted before it while the
+ * process stayed the same. A path that leads nowhere is forgotten and the
+ * caller searches as before.
+ */
+static IUIAutomationElement* follow_learned_path(WinControlContext* ctx, IUIAutomationElement* root,
+    const Locator* locator) {
+    const LearnedPath* path = winctrl_path_index_find(&ctx->paths, ctx->target->process_name, ctx->target->window_class, locator);
+    if (!path) {
+        return NULL;
+    }
+
+    Locator any = { NULL, NULL, -1, NULL };
+    IUIAutomationElement* parent = NULL;
+    IUIAutomationElement* current = root;
+    current->lpVtbl->AddRef(current);
+    for (int i = 0; current && i < path->step_count; i++) {
+        SelectorMatches children = { NULL, 0, 0 };
+        IUIAutomationElement* child = NULL;
+        if (ctx->desktop.ops->find(ctx->desktop.backend, current, false, &any, false, &children) &&
+            path->steps[i] < children.count) {
+            child = children.items[path->steps[i]];
+        }
+        for (int j = 0; j < children.count; j++) {
+            if (children.items[j] != child) {
+                ctx->desktop.ops->release(ctx->desktop.backend, children.items[j]);
+            }
+        }
+        free(children.items);
+        if (parent) parent->lpVtbl->Release(parent);
+        parent = current;
+        current = child;
+    }
+
+    IUIAutomationElement* element = NULL;
+    if (current) {
+        UIA_CALL(current->lpVtbl->BuildUpdatedCache(current, ctx->prefetch, &element));
+        current->lpVtbl->Release(current);
+    }
+    if (element && !element_matches_locator(element, locator)) {
+        element->lpVtbl->Release(element);
+        element = NULL;
+    }
+
+    int32_t steps[PATH_MAX_STEPS];
+    memcpy(steps, path->steps, (size_t)path->step_count * sizeof(int32_t));
+    int step_count = path->step_count;
+    if (!element && parent && step_count > 0) {
+        IUIAutomationElement* moved = NULL;
+        int index = find_child_by_runtime_id(ctx, parent, path->runtime_id, path->runtime_id_length, &moved);
+        if (moved) {
+            UIA_CALL(moved->lpVtbl->BuildUpdatedCache(moved, ctx->prefetch, &element));
+            moved->lpVtbl->Release(moved);
+        }
+        if (element && element_matches_locator(element, locator)) {
+            steps[step_count - 1] = index;
+            winctrl_path_index_learn(&ctx->paths, ctx->target->process_name, ctx->target->window_class, locator,
+                steps, step_count, path->runtime_id, path->runtime_id_length);
+        } else if (element) {
+            element->lpVtbl->Release(element);
+            element = NULL;
+        }
+    }
+    if (parent) parent->lpVtbl->Release(parent);
+
+    if (element) {
+        ctx->paths.hits++;
+        return element;
+    }
+    ctx->paths.misses++;
+    winctrl_path_index_forget(&ctx->paths, ctx->target->process_name, ctx->target->window_class, locator);
+    return NULL;
+}
+
+/*
+ * What a window search on a worker thread needs. It holds its own
+ * references because a search that lost the race may still be running
+ * after the lookup has returned.
+ */
+typedef struct {
+    IUIAutomation* automation;
+    IUIAutomationCondition* condition;
+    IUIAutomationCacheRequest* prefetch;
+    HWND windows[MAX_SEARCH_WINDOWS];
+} WindowSearch;
+
+static void* search_window(void* backend, void* scope, const volatile long* cancelled) {
+    WindowSearch* search = backend;
+    HWND* window = scope;
+    IUIAutomationElement* root = NULL;
+    UIA_CALL(search->automation->lpVtbl->ElementFromHandle(search->automation, *window, &root));
+    if (!root) {
+        return NULL;
+    }
+
+    IUIAutomationElement* element = NULL;
+    if (!InterlockedCompareExchange((volatile LONG*)cancelled, 0, 0)) {
+        UIA_CALL(root->lpVtbl->FindFirstBuildCache(root, TreeScope_Descendants, search->condition, search->prefetch, &element));
+    }
+    root->lpVtbl->Release(root);
+    return element;
+}
+
+static void release_window_result(void* backend, void* result) {
+    IUIAutomationElement* element = result;
+    element->lpVtbl->Release(element);
+}
+
+static void finish_window_search(void* backend) {
+    WindowSearch* search = backend;
+    search->prefetch->lpVtbl->Release(search->prefetch);
+    search->condition->lpVtbl->Release(search->condition);
+    search->automation->lpVtbl->Release(search->automation);
+    free(search);
+}
+
+static const SearchOps WINDOW_SEARCH_OPS = {
+    search_window,
+    release_window_result,
+    finish_window_search
+};
+
+static void enter_worker_apartment(void* user) {
+    CoInitializeEx(NULL, COINIT_MULTITHREADED);
+}
+
+static void leave_worker_apartment(void* user) {
+    CoUninitialize();
+}
+
+typedef struct {
+    DWORD process_id;
+    HWND* windows;
+    int count;
+} ProcessWindows;
+
+static BOOL CALLBACK collect_window_callback(HWND hwnd, LPARAM lParam) {
+    ProcessWindows* data = (ProcessWindows*)lParam;
+    DWORD window_process_id = 0;
+    GetWindowThreadProcessId(hwnd, &window_process_id);
+    if (window_process_id == data->process_id && IsWindowVisible(hwnd) && hwnd != data->windows[0]) {
+        data->windows[data->count++] = hwnd;
+    }
+    return data->count < MAX_SEARCH_WINDOWS;
+}
+
+/* Returns a new reference to the first match below root, found through the desktop backend, or NULL. */
+static IUIAutomationElement* desktop_find_first(WinControlContext* ctx, void* root, const Locator* locator,
+    bool* searched) {
+    SelectorMatches matches = { NULL, 0, 0 };
+    *searched = ctx->desktop.ops->find(ctx->desktop.backend, root, true, locator, true, &matches);
+    IUIAutomationElement* element = matches.count > 0 ? matches.items[0] : NULL;
+    for (int i = 1; i < matches.count; i++) {
+        ctx->desktop.ops->release(ctx->desktop.backend, matches.items[i]);
+    }
+    free(matches.items);
+    return element;
+}
+
+/*
+ * Searches every visible top-level window of the process at once, on the
+ * worker pool, and keeps the first match. The attached window is queued
+ * first so it is searched even when there are more windows than workers.
+ * A process with one window is searched through the desktop backend like
+ * every other lookup. The race calls FindFirstBuildCache on the workers
+ * directly, since each worker runs in its own apartment and the backend's
+ * condition cache belongs to the calling thread.
+ */
+static IUIAutomationElement* search_process_windows(WinControlContext* ctx, IUIAutomationElement* root,
+    const Locator* locator, bool* in_main_window) {
+    WindowSearch* search = calloc(1, sizeof(WindowSearch));
+    ProcessWindows data = { ctx->target->process_id, NULL, 1 };
+    if (search) {
+        search->windows[0] = ctx->target->window;
+        data.windows = search->windows;
+        EnumWindows(collect_window_callback, (LPARAM)&data);
+    }
+
+    IUIAutomationElement* element = NULL;
+    if (data.count == 1) {
+        free(search);
+        bool searched;
+        *in_main_window = true;
+        return desktop_find_first(ctx, root, locator, &searched);
+    }
+
+    IUIAutomationCondition* condition = winctrl_locator_cache_get(&ctx->conditions, locator);
+    if (!condition) {
+        free(search);
+        return NULL;
+    }
+
+    if (!ctx->workers) {
+        ctx->workers = winctrl_workers_create(WORKER_POOL_THREADS, enter_worker_apartment, leave_worker_apartment, NULL);
+    }
+
+    void* scopes[MAX_SEARCH_WINDOWS];
+    for (int i = 0; i < data.count; i++) {
+        scopes[i] = &search->windows[i];
+    }
+    search->automation = ctx->automation;
+    search->condition = condition;
+    search->prefetch = ctx->prefetch;
+    search->automation->lpVtbl->AddRef(search->automation);
+    search->condition->lpVtbl->AddRef(search->condition);
+    search->prefetch->lpVtbl->AddRef(search->prefetch);
+
+    int winner = -1;
+    element = winctrl_search_race(ctx->workers, &WINDOW_SEARCH_OPS, search, scopes, data.count, &winner);
+    *in_main_window = winner == 0;
+    return element;
+}
+
+/*
+ * Found elements are cached per locator and dropped when the window's UI
+ * changes. A search tries the path learned for the locator first, then
+ * every window of the process, and learns the path of what it finds in
+ * the attached window.
+ */
+static void* build_uia_element(void* backend, const Locator* locator) {
+    WinControlContext* ctx = backend;
+    IUIAutomationElement* root = get_root_element(ctx);
+    if (!root) {
+        return NULL;
+    }
+
+    IUIAutomationElement* element = follow_learned_path(ctx, root, locator);
+    if (element) {
+        root->lpVtbl->Release(root);
+        return element;
+    }
+
+    bool in_main_window = false;
+    element = search_process_windows(ctx, root, locator, &in_main_window);
+    if (element && in_main_window) {
+        learn_path(ctx, root, element, locator);
+    }
+    root->lpVtbl->Release(root);
+    return element;
+}
+
+static void release_uia_element(void* backend, void* value) {
+    IUIAutomationElement* element = value;
+    element->lpVtbl->Release(element);
+}
+
+/*
+ * Refreshes the prefetched properties in one round trip, so a cached
+ * element never reports an old position. The refresh fails with
+ * UIA_E_ELEMENTNOTAVAILABLE once the element is gone.
+ */
+static bool validate_uia_element(void* backend, void** value) {
+    WinControlContext* ctx = backend;
+    IUIAutomationElement* element = *value;
+    IUIAutomationElement* updated = NULL;
+    HRESULT hr = UIA_CALL(element->lpVtbl->BuildUpdatedCache(element, ctx->prefetch, &updated));
+    if (FAILED(hr) || !updated) {
         return false;
     }
+    element->lpVtbl->Release(element);
+    *value = updated;
+    return true;
+}
 
-    printf("UI Automation instance created successfully\n");
+static const LocatorCacheOps UIA_ELEMENT_OPS = {
+    build_uia_element,
+    release_uia_element,
+    validate_uia_element
+};
 
-    ctx->current_process_id = 0;
-    ctx->current_window = NULL;
-    ctx->last_error[0] = '\0';
-    ctx->vars.variable_count = 0;
-    ctx->typing_delay_ms = 0;
-    ctx->log_file = NULL;
-    ctx->log_filename[0] = '\0';
+typedef struct {
+    IUIAutomationStructureChangedEventHandler iface;
+    volatile LONG refs;
+    UiEventCallback callback;
+    void* user;
+} StructureChangedHandler;
 
+typedef struct {
+    IUIAutomationPropertyChangedEventHandler iface;
+    volatile LONG refs;
+    UiEventCallback callback;
+    void* user;
+} PropertyChangedHandler;
+
+static HRESULT STDMETHODCALLTYPE structure_handler_query_interface(IUIAutomationStructureChangedEventHandler* This, REFIID riid, void** object) {
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_IUIAutomationStructureChangedEventHandler)) {
+        *object = This;
+        This->lpVtbl->AddRef(This);
+        return S_OK;
+    }
+    *object = NULL;
+    return E_NOINTERFACE;
+}
 
+static ULONG STDMETHODCALLTYPE structure_handler_add_ref(IUIAutomationStructureChangedEventHandler* This) {
+    return InterlockedIncrement(&((StructureChangedHandler*)This)->refs);
+}
+
+static ULONG STDMETHODCALLTYPE structure_handler_release(IUIAutomationStructureChangedEventHandler* This) {
+    ULONG refs = InterlockedDecrement(&((StructureChangedHandler*)This)->refs);
+    if (refs == 0) {
+        free(This);
+    }
+    return refs;
+}
+
+static HRESULT STDMETHODCALLTYPE structure_handler_handle(IUIAutomationStructureChangedEventHandler* This,
+    IUIAutomationElement* sender, enum StructureChangeType change_type, SAFEARRAY* runtime_id) {
+    StructureChangedHandler* handler = (StructureChangedHandler*)This;
+    handler->callback(handler->user, UI_EVENT_STRUCTURE_CHANGED);
+    return S_OK;
+}
+
+static const IUIAutomationStructureChangedEventHandlerVtbl STRUCTURE_HANDLER_VTBL = {
+    structure_handler_query_interface,
+    structure_handler_add_ref,
+    structure_handler_release,
+    structure_handler_handle
+};
+
+static HRESULT STDMETHODCALLTYPE property_handler_query_interface(IUIAutomationPropertyChangedEventHandler* This, REFIID riid, void** object) {
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_IUIAutomationPropertyChangedEventHandler)) {
+        *object = This;
+        This->lpVtbl->AddRef(This);
+        return S_OK;
+    }
+    *object = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE property_handler_add_ref(IUIAutomationPropertyChangedEventHandler* This) {
+    return InterlockedIncrement(&((PropertyChangedHandler*)This)->refs);
+}
+
+static ULONG STDMETHODCALLTYPE property_handler_release(IUIAutomationPropertyChangedEventHandler* This) {
+    ULONG refs = InterlockedDecrement(&((PropertyChangedHandler*)This)->refs);
+    if (refs == 0) {
+        free(This);
+    }
+    return refs;
+}
+
+static HRESULT STDMETHODCALLTYPE property_handler_handle(IUIAutomationPropertyChangedEventHandler* This,
+    IUIAutomationElement* sender, PROPERTYID property_id, VARIANT value) {
+    PropertyChangedHandler* handler = (PropertyChangedHandler*)This;
+    handler->callback(handler->user, UI_EVENT_PROPERTY_CHANGED);
+    return S_OK;
+}
+
+static const IUIAutomationPropertyChangedEventHandlerVtbl PROPERTY_HANDLER_VTBL = {
+    property_handler_query_interface,
+    property_handler_add_ref,
+    property_handler_release,
+    property_handler_handle
+};
+
+typedef struct {
+    IUIAutomationEventHandler iface;
+    volatile LONG refs;
+    UiEventCallback callback;
+    void* user;
+} WindowOpenedHandler;
+
+static HRESULT STDMETHODCALLTYPE opened_handler_query_interface(IUIAutomationEventHandler* This, REFIID riid, void** object) {
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_IUIAutomationEventHandler)) {
+        *object = This;
+        This->lpVtbl->AddRef(This);
+        return S_OK;
+    }
+    *object = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE opened_handler_add_ref(IUIAutomationEventHandler* This) {
+    return InterlockedIncrement(&((WindowOpenedHandler*)This)->refs);
+}
+
+static ULONG STDMETHODCALLTYPE opened_handler_release(IUIAutomationEventHandler* This) {
+    ULONG refs = InterlockedDecrement(&((WindowOpenedHandler*)This)->refs);
+    if (refs == 0) {
+        free(This);
+    }
+    return refs;
+}
+
+static HRESULT STDMETHODCALLTYPE opened_handler_handle(IUIAutomationEventHandler* This,
+    IUIAutomationElement* sender, EVENTID event_id) {
+    WindowOpenedHandler* handler = (WindowOpenedHandler*)This;
+    handler->callback(handler->user, UI_EVENT_WINDOW_OPENED);
+    return S_OK;
+}
+
+static const IUIAutomationEventHandlerVtbl OPENED_HANDLER_VTBL = {
+    opened_handler_query_interface,
+    opened_handler_add_ref,
+    opened_handler_release,
+    opened_handler_handle
+};
+
+/* Only properties a Locator can match on; other changes cannot make a cached element wrong. */
+static PROPERTYID watched_properties[] = {
+    UIA_AutomationIdPropertyId,
+    UIA_ClassNamePropertyId,
+    UIA_NamePropertyId,
+    UIA_ControlTypePropertyId
+};
+
+typedef struct {
+    IUIAutomation* automation;
+    IUIAutomationElement* root;
+    IUIAutomationElement* desktop;
+    StructureChangedHandler* structure;
+    PropertyChangedHandler* property;
+    WindowOpenedHandler* opened;
+} UiaEventSource;
+
+static void uia_unsubscribe(void* source) {
+    UiaEventSource* uia = source;
+    if (uia->root) {
+        if (uia->structure) {
+            UIA_CALL(uia->automation->lpVtbl->RemoveStructureChangedEventHandler(uia->automation, uia->root, &uia->structure->iface));
+        }
+        if (uia->property) {
+            UIA_CALL(uia->automation->lpVtbl->RemovePropertyChangedEventHandler(uia->automation, uia->root, &uia->property->iface));
+        }
+        if (uia->opened) {
+            UIA_CALL(uia->automation->lpVtbl->RemoveAutomationEventHandler(uia->automation,
+                UIA_Window_WindowOpenedEventId, uia->root, &uia->opened->iface));
+        }
+        uia->root->lpVtbl->Release(uia->root);
+        uia->root = NULL;
+    }
+    if (uia->desktop) {
+        UIA_CALL(uia->automation->lpVtbl->RemoveAutomationEventHandler(uia->automation,
+            UIA_Window_WindowOpenedEventId, uia->desktop, &uia->opened->iface));
+        uia->desktop->lpVtbl->Release(uia->desktop);
+        uia->desktop = NULL;
+    }
+    if (uia->structure) {
+        uia->structure->iface.lpVtbl->Release(&uia->structure->iface);
+        uia->structure = NULL;
+    }
+    if (uia->property) {
+        uia->property->iface.lpVtbl->Release(&uia->property->iface);
+        uia->property = NULL;
+    }
+    if (uia->opened) {
+        uia->opened->iface.lpVtbl->Release(&uia->opened->iface);
+        uia->opened = NULL;
+    }
+}
+
+static bool uia_subscribe(void* source, void* root, UiEventCallback callback, void* user) {
+    UiaEventSource* uia = source;
+    uia_unsubscribe(uia);
+
+    uia->structure = calloc(1, sizeof(StructureChangedHandler));
+    uia->property = calloc(1, sizeof(PropertyChangedHandler));
+    uia->opened = calloc(1, sizeof(WindowOpenedHandler));
+    if (!uia->structure || !uia->property || !uia->opened) {
+        free(uia->structure);
+        free(uia->property);
+        free(uia->opened);
+        uia->structure = NULL;
+        uia->property = NULL;
+        uia->opened = NULL;
+        return false;
+    }
+    uia->structure->iface.lpVtbl = &STRUCTURE_HANDLER_VTBL;
+    uia->structure->refs = 1;
+    uia->structure->callback = callback;
+    uia->structure->user = user;
+    uia->property->iface.lpVtbl = &PROPERTY_HANDLER_VTBL;
+    uia->property->refs = 1;
+    uia->property->callback = callback;
+    uia->property->user = user;
+    uia->opened->iface.lpVtbl = &OPENED_HANDLER_VTBL;
+    uia->opened->refs = 1;
+    uia->opened->callback = callback;
+    uia->opened->user = user;
+
+    uia->root = root;
+    uia->root->lpVtbl->AddRef(uia->root);
+
+    HRESULT hr = UIA_CALL(uia->automation->lpVtbl->AddStructureChangedEventHandler(
+        uia->automation, uia->root, TreeScope_Subtree, NULL, &uia->structure->iface));
+    if (SUCCEEDED(hr)) {
+        hr = UIA_CALL(uia->automation->lpVtbl->AddPropertyChangedEventHandlerNativeArray(
+            uia->automation, uia->root, TreeScope_Subtree, NULL, &uia->property->iface,
+            watched_properties, (int)(sizeof(watched_properties) / sizeof(watched_properties[0]))));
+    }
+    if (SUCCEEDED(hr)) {
+        hr = UIA_CALL(uia->automation->lpVtbl->AddAutomationEventHandler(uia->automation,
+            UIA_Window_WindowOpenedEventId, uia->root, TreeScope_Subtree, NULL, &uia->opened->iface));
+    }
+    if (FAILED(hr)) {
+        printf("Failed to register UI change handlers: 0x%lx\n", hr);
+        uia_unsubscribe(uia);
+        return false;
+    }
+
+    /* Dialogs may open as new top-level windows; missing them only costs the polling fallback. */
+    if (SUCCEEDED(UIA_CALL(uia->automation->lpVtbl->GetRootElement(uia->automation, &uia->desktop)))) {
+        hr = UIA_CALL(uia->automation->lpVtbl->AddAutomationEventHandler(uia->automation,
+            UIA_Window_WindowOpenedEventId, uia->desktop, TreeScope_Children, NULL, &uia->opened->iface));
+        if (FAILED(hr)) {
+            uia->desktop->lpVtbl->Release(uia->desktop);
+            uia->desktop = NULL;
+        }
+    } else {
+        uia->desktop = NULL;
+    }
     return true;
 }
 
+/*
+ * Runs on UI Automation threads: marks the attachment's element cache
+ * stale and wakes any WaitForElement. Attachments that are not in use
+ * keep receiving events, so their caches are still valid after USE.
+ */
+static void on_ui_event(void* user, UiEventKind kind) {
+    Attachment* attachment = user;
+    if (kind != UI_EVENT_WINDOW_OPENED) {
+        winctrl_locator_cache_invalidate(&attachment->elements);
+        InterlockedIncrement(&attachment->ui_changes);
+    }
+    InterlockedIncrement(&attachment->ui_events);
+    winctrl_waiter_signal(&attachment->ctx->waiter);
+}
+
+/* Learned paths are keyed by the lower-case executable name and the window class. */
+static void remember_window_key(WinControlContext* ctx) {
+    const char* process_name = winctrl_registry_process_name(&ctx->processes, ctx->target->process_id);
+    strcpy_s(ctx->target->process_name, sizeof(ctx->target->process_name), process_name ? process_name : "");
+    ctx->target->window_class[0] = '\0';
+    GetClassNameA(ctx->target->window, ctx->target->window_class, sizeof(ctx->target->window_class));
+}
+
+/*
+ * Points the element cache at the newly attached window. Without change
+ * events a cached element could keep matching after its name or id
+ * changed, so the cache is bypassed when the subscription fails.
+ */
+static void watch_current_window(WinControlContext* ctx) {
+    remember_window_key(ctx);
+    winctrl_locator_cache_clear(&ctx->target->elements);
+    winctrl_snapshot_free(&ctx->target->snapshot);
+    ctx->target->snapshot_ready = false;
+    ctx->target->watching = false;
+    if (ctx->target->root) {
+        ctx->target->root->lpVtbl->Release(ctx->target->root);
+        ctx->target->root = NULL;
+    }
+    if (ctx->target->recorded_root) {
+        ctx->target->recorded_root->lpVtbl->Release(ctx->target->recorded_root);
+        ctx->target->recorded_root = NULL;
+    }
+
+    IUIAutomationElement* root = get_root_element(ctx);
+    if (!root) {
+        return;
+    }
+    ctx->target->watching = ctx->target->events.ops.subscribe(ctx->target->events.source, root, on_ui_event, ctx->target);
+    ctx->target->root = root;
+}
+
+/*
+ * Everything the element actions read, and what a learned path is checked
+ * against, fetched together with the element in one round trip.
+ */
+static const PROPERTYID prefetched_properties[] = {
+    UIA_NamePropertyId,
+    UIA_AutomationIdPropertyId,
+    UIA_ClassNamePropertyId,
+    UIA_ControlTypePropertyId,
+    UIA_ValueValuePropertyId,
+    UIA_BoundingRectanglePropertyId,
+    UIA_IsOffscreenPropertyId,
+    UIA_IsEnabledPropertyId,
+    UIA_RuntimeIdPropertyId
+};
+
+static HRESULT create_prefetch_request(IUIAutomation* automation, IUIAutomationCacheRequest** request) {
+    HRESULT hr = automation->lpVtbl->CreateCacheRequest(automation, request);
+    for (size_t i = 0; SUCCEEDED(hr) && i < sizeof(prefetched_properties) / sizeof(prefetched_properties[0]); i++) {
+        hr = (*request)->lpVtbl->AddProperty(*request, prefetched_properties[i]);
+    }
+    if (SUCCEEDED(hr)) {
+        hr = (*request)->lpVtbl->AddPattern(*request, UIA_ValuePatternId);
+    }
+    /* Searches and learned paths walk the raw view, so the prefetch must not skip what they find. */
+    IUIAutomationCondition* raw_view = NULL;
+    if (SUCCEEDED(hr)) hr = automation->lpVtbl->CreateTrueCondition(automation, &raw_view);
+    if (SUCCEEDED(hr)) hr = (*request)->lpVtbl->put_TreeFilter(*request, raw_view);
+    if (raw_view) raw_view->lpVtbl->Release(raw_view);
+    if (FAILED(hr) && *request) {
+        (*request)->lpVtbl->Release(*request);
+        *request = NULL;
+    }
+    return hr;
+}
+
 static void print_window_info(HWND hwnd) {
     char title[256] = {0};
     char class_name[256] = {0};
@@ -92,7 +901,6 @@ static BOOL CALLBACK enum_windows_callback(HWND hwnd, LPARAM lParam) {
     GetWindowThreadProcessId(hwnd, &window_process_id);
 
     if (window_process_id == data->process_id) {
-        print_window_info(hwnd);
         if (IsWindowVisible(hwnd) && !IsIconic(hwnd)) {
             char title[256] = {0};
             GetWindowTextA(hwnd, title, sizeof(title));
@@ -109,76 +917,364 @@ static BOOL CALLBACK enum_windows_callback(HWND hwnd, LPARAM lParam) {
     return TRUE;
 }
 
+/* EnumProcesses only returns PIDs; a full buffer may mean it was cut short, so ask for a bigger one. */
+static int win_list_pids(void* backend, uint32_t* pids, int capacity) {
+    DWORD bytes = 0;
+    if (!EnumProcesses((DWORD*)pids, (DWORD)capacity * sizeof(DWORD), &bytes)) {
+        return -1;
+    }
+    int count = (int)(bytes / sizeof(DWORD));
+    return count == capacity ? capacity * 2 : count;
+}
+
+static bool win_process_name(void* backend, uint32_t pid, char* name, size_t name_size) {
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!process) {
+        return false;
+    }
+    WCHAR image[MAX_PATH];
+    DWORD size = MAX_PATH;
+    DWORD exit_code = 0;
+    bool ok = GetExitCodeProcess(process, &exit_code) && exit_code == STILL_ACTIVE &&
+              QueryFullProcessImageNameW(process, 0, image, &size);
+    CloseHandle(process);
+    if (ok) {
+        const WCHAR* base = wcsrchr(image, L'\\');
+        ok = WideCharToMultiByte(CP_UTF8, 0, base ? base + 1 : image, -1, name, (int)name_size, NULL, NULL) > 0;
+    }
+    return ok;
+}
+
+static uintptr_t win_main_window(void* backend, uint32_t pid) {
+    struct EnumData data = { pid, NULL };
+    EnumWindows(enum_windows_callback, (LPARAM)&data);
+    return (uintptr_t)data.window;
+}
+
+static bool win_window_alive(void* backend, uintptr_t window, uint32_t pid) {
+    HWND hwnd = (HWND)window;
+    DWORD window_process_id = 0;
+    return IsWindow(hwnd) && GetWindowThreadProcessId(hwnd, &window_process_id) && window_process_id == pid &&
+           IsWindowVisible(hwnd) && !IsIconic(hwnd);
+}
+
+static const ProcessSourceOps WINDOWS_PROCESS_OPS = {
+    win_list_pids,
+    win_process_name,
+    win_main_window,
+    win_window_alive
+};
+
+static Attachment* create_attachment(WinControlContext* ctx, const char* name) {
+    Attachment* attachment = calloc(1, sizeof(Attachment));
+    UiaEventSource* uia_events = calloc(1, sizeof(UiaEventSource));
+    if (!attachment || !uia_events) {
+        free(attachment);
+        free(uia_events);
+        return NULL;
+    }
+    strcpy_s(attachment->name, sizeof(attachment->name), name);
+    attachment->ctx = ctx;
+    winctrl_locator_cache_init(&attachment->elements, &UIA_ELEMENT_OPS, ctx, LOCATOR_CACHE_LIMIT);
+    winctrl_snapshot_init(&attachment->snapshot);
+    uia_events->automation = ctx->automation;
+    attachment->events.ops.subscribe = uia_subscribe;
+    attachment->events.ops.unsubscribe = uia_unsubscribe;
+    attachment->events.source = uia_events;
+    return attachment;
+}
+
+static void free_attachment(Attachment* attachment) {
+    attachment->events.ops.unsubscribe(attachment->events.source);
+    free(attachment->events.source);
+    winctrl_snapshot_free(&attachment->snapshot);
+    winctrl_locator_cache_free(&attachment->elements);
+    if (attachment->root) {
+        attachment->root->lpVtbl->Release(attachment->root);
+    }
+    if (attachment->recorded_root) {
+        attachment->recorded_root->lpVtbl->Release(attachment->recorded_root);
+    }
+    free(attachment);
+}
+
+bool winctrl_initialize(WinControlContext* ctx) {
+    printf("Initializing COM...\n");
+
+    HRESULT hr = CoInitialize(NULL);
+    if (FAILED(hr)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Failed to initialize COM: 0x%lx", hr);
+        printf("COM initialization failed: 0x%lx\n", hr);
+        return false;
+    }
+    printf("COM initialized successfully\n");
+
+    printf("Creating UI Automation instance...\n");
+    hr = CoCreateInstance(&CLSID_CUIAutomation, NULL,
+        CLSCTX_INPROC_SERVER, &IID_IUIAutomation,
+        (void**)&ctx->automation);
+
+    if (FAILED(hr)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Failed to create UI Automation instance: 0x%lx (Try running as administrator)", hr);
+        printf("UI Automation creation failed: 0x%lx\n", hr);
+        CoUninitialize();
+        return false;
+    }
+
+    printf("UI Automation instance created successfully\n");
+
+    ctx->prefetch = NULL;
+    hr = create_prefetch_request(ctx->automation, &ctx->prefetch);
+    if (FAILED(hr)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Failed to create UI Automation cache request: 0x%lx", hr);
+        IUIAutomation_Release(ctx->automation);
+        ctx->automation = NULL;
+        CoUninitialize();
+        return false;
+    }
+    winctrl_locator_cache_init(&ctx->conditions, &UIA_CONDITION_OPS, ctx->automation, LOCATOR_CACHE_LIMIT);
+
+    ctx->last_error[0] = '\0';
+    memset(&ctx->vars, 0, sizeof(ctx->vars));
+    memset(&ctx->modules, 0, sizeof(ctx->modules));
+    ctx->traced_calls = 0;
+    /* The unnamed attachment is what AttachProcess without AS uses until a USE switches away. */
+    ctx->attachment_count = 0;
+    ctx->target = create_attachment(ctx, "");
+    if (ctx->target) {
+        ctx->attachments[ctx->attachment_count++] = ctx->target;
+    }
+    ctx->if_condition_slot = winctrl_vars_declare(&ctx->vars, "_IF_CONDITION");
+    ctx->contains_result_slot = winctrl_vars_declare(&ctx->vars, "_CONTAINS_RESULT");
+    bool waiter_ready = winctrl_waiter_init(&ctx->waiter);
+    if (!ctx->target || !waiter_ready || ctx->if_condition_slot == -1 || ctx->contains_result_slot == -1 ||
+        !winctrl_vars_assign(&ctx->vars, ctx->if_condition_slot, "true", 4) ||
+        !winctrl_vars_assign(&ctx->vars, ctx->contains_result_slot, "false", 5)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Failed to allocate variable store");
+        winctrl_vars_free(&ctx->vars);
+        if (waiter_ready) {
+            winctrl_waiter_free(&ctx->waiter);
+        }
+        if (ctx->target) {
+            free_attachment(ctx->target);
+            ctx->target = NULL;
+            ctx->attachment_count = 0;
+        }
+        winctrl_locator_cache_free(&ctx->conditions);
+        ctx->prefetch->lpVtbl->Release(ctx->prefetch);
+        ctx->prefetch = NULL;
+        IUIAutomation_Release(ctx->automation);
+        ctx->automation = NULL;
+        CoUninitialize();
+        return false;
+    }
+    ctx->typing_delay_ms = 0;
+    ctx->clock = SYSTEM_CLOCK;
+    ctx->desktop.ops = &WIN_DESKTOP_OPS;
+    ctx->desktop.backend = ctx;
+    winctrl_keys_init(&ctx->keys);
+    winctrl_settle_defaults(&ctx->settle);
+    ctx->log_file = NULL;
+    ctx->log_filename[0] = '\0';
+    ctx->runtime_ids = NULL;
+    ctx->workers = NULL;
+    ctx->recorder = NULL;
+    winctrl_registry_init(&ctx->processes, &WINDOWS_PROCESS_OPS, NULL);
+
+    char error[256];
+    if (!winctrl_path_index_load(&ctx->paths, LEARNED_PATHS_FILE, error, sizeof(error))) {
+        printf("Warning: %s, starting with no learned paths\n", error);
+    }
+
+    return true;
+}
 
 void winctrl_cleanup(WinControlContext* ctx) {
+    winctrl_stop_recording(ctx);
+    winctrl_vars_free(&ctx->vars);
+    winctrl_modules_free(&ctx->modules);
     if (ctx->automation) {
+        winctrl_workers_destroy(ctx->workers);
+        ctx->workers = NULL;
+        for (int i = 0; i < ctx->attachment_count; i++) {
+            free_attachment(ctx->attachments[i]);
+        }
+        ctx->attachment_count = 0;
+        ctx->target = NULL;
+        winctrl_waiter_free(&ctx->waiter);
+        winctrl_locator_cache_free(&ctx->conditions);
+        char error[256];
+        if (ctx->paths.dirty && !winctrl_path_index_save(&ctx->paths, LEARNED_PATHS_FILE, error, sizeof(error))) {
+            printf("Warning: %s\n", error);
+        }
+        winctrl_path_index_free(&ctx->paths);
+        winctrl_registry_free(&ctx->processes);
+        winctrl_keys_free(&ctx->keys);
+        if (ctx->runtime_ids) {
+            ctx->runtime_ids->lpVtbl->Release(ctx->runtime_ids);
+            ctx->runtime_ids = NULL;
+        }
+        ctx->prefetch->lpVtbl->Release(ctx->prefetch);
+        ctx->prefetch = NULL;
         IUIAutomation_Release(ctx->automation);
         ctx->automation = NULL;
     }
     CoUninitialize();
 }
 
-static IUIAutomationCondition* create_name_condition(WinControlContext* ctx, const char* name) {
-    IUIAutomationCondition* condition = NULL;
-    WCHAR wide_name[256];
-    MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, 256);
-
-    VARIANT var;
-    var.vt = VT_BSTR;
-    var.bstrVal = SysAllocString(wide_name);
+static void drop_recorded_roots(WinControlContext* ctx) {
+    for (int i = 0; i < ctx->attachment_count; i++) {
+        Attachment* attachment = ctx->attachments[i];
+        if (attachment->recorded_root) {
+            attachment->recorded_root->lpVtbl->Release(attachment->recorded_root);
+            attachment->recorded_root = NULL;
+        }
+    }
+}
 
-    ctx->automation->lpVtbl->CreatePropertyCondition(
-        ctx->automation,
-        UIA_NamePropertyId,
-        var,
-        &condition
-    );
+/*
+ * Records every desktop call into a trace that WinControlSim -p replays.
+ * While recording, element searches skip the element cache, learned
+ * paths and snapshots and go through the desktop, so the trace holds
+ * each search the script makes; the process's windows are searched in
+ * turn rather than raced. Process lookups go through it as well.
+ */
+bool winctrl_start_recording(WinControlContext* ctx, const char* path) {
+    if (ctx->recorder) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Already recording");
+        return false;
+    }
+    TraceRecorder* recorder = malloc(sizeof(TraceRecorder));
+    if (!recorder) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Failed to allocate trace recorder");
+        return false;
+    }
+    if (!winctrl_trace_record_open(recorder, &ctx->desktop, &ctx->clock, path, ctx->last_error,
+            sizeof(ctx->last_error))) {
+        free(recorder);
+        return false;
+    }
 
-    SysFreeString(var.bstrVal);
-    return condition;
+    ctx->recorder = recorder;
+    ctx->desktop.ops = &TRACE_RECORD_OPS;
+    ctx->desktop.backend = recorder;
+    drop_recorded_roots(ctx);
+    winctrl_registry_free(&ctx->processes);
+    winctrl_registry_init(&ctx->processes, &TRACE_RECORD_OPS.processes, recorder);
+    printf("Recording desktop calls to %s\n", path);
+    return true;
 }
 
+bool winctrl_stop_recording(WinControlContext* ctx) {
+    TraceRecorder* recorder = ctx->recorder;
+    if (!recorder) {
+        return true;
+    }
+
+    ctx->desktop = recorder->inner;
+    ctx->recorder = NULL;
+    drop_recorded_roots(ctx);
+    winctrl_registry_free(&ctx->processes);
+    winctrl_registry_init(&ctx->processes, &WINDOWS_PROCESS_OPS, NULL);
+    long records = recorder->records;
+    bool ok = winctrl_trace_record_close(recorder, ctx->last_error, sizeof(ctx->last_error));
+    free(recorder);
+    if (ok) {
+        printf("Recorded %ld desktop calls\n", records);
+    }
+    return ok;
+}
 
+/* The window's root as the desktop returned it, so the trace knows the element searches start from. */
+static IUIAutomationElement* get_recorded_root(WinControlContext* ctx) {
+    if (!ctx->target->recorded_root) {
+        ctx->target->recorded_root = ctx->desktop.ops->window_root(ctx->desktop.backend, (uintptr_t)ctx->target->window);
+    }
+    return ctx->target->recorded_root;
+}
 
 static IUIAutomationElement* get_root_element(WinControlContext* ctx) {
-    IUIAutomationElement* root = NULL;
-    ctx->automation->lpVtbl->ElementFromHandle(
+    IUIAutomationElement* root = ctx->target->root;
+    if (root) {
+        root->lpVtbl->AddRef(root);
+        return root;
+    }
+    UIA_CALL(ctx->automation->lpVtbl->ElementFromHandle(
         ctx->automation,
-        ctx->current_window,
+        ctx->target->window,
         &root
-    );
+    ));
     return root;
 }
 
-bool winctrl_set_variable(WinControlContext* ctx, const char* name, const char* value) {
-    for (int i = 0; i < ctx->vars.variable_count; i++) {
-        if (strcmp(ctx->vars.variables[i].name, name) == 0) {
-            strncpy_s(ctx->vars.variables[i].value,
-                     sizeof(ctx->vars.variables[i].value),
-                     value, _TRUNCATE);
-            return true;
+/*
+ * Property reads prefer the values prefetched with the element and only
+ * go back to the target process for elements found without the prefetch
+ * request.
+ */
+static HRESULT read_name(IUIAutomationElement* element, BSTR* name) {
+    HRESULT hr = element->lpVtbl->get_CachedName(element, name);
+    if (FAILED(hr)) {
+        hr = UIA_CALL(element->lpVtbl->get_CurrentName(element, name));
+    }
+    return hr;
+}
+
+static HRESULT read_value(IUIAutomationElement* element, BSTR* value) {
+    IUIAutomationValuePattern* valuePattern = NULL;
+    HRESULT hr = element->lpVtbl->GetCachedPattern(element, UIA_ValuePatternId, (IUnknown**)&valuePattern);
+    if (SUCCEEDED(hr) && valuePattern) {
+        hr = valuePattern->lpVtbl->get_CachedValue(valuePattern, value);
+        valuePattern->lpVtbl->Release(valuePattern);
+        if (SUCCEEDED(hr)) {
+            return hr;
         }
     }
 
-    if (ctx->vars.variable_count < MAX_VARIABLES) {
-        strncpy_s(ctx->vars.variables[ctx->vars.variable_count].name,
-                 sizeof(ctx->vars.variables[ctx->vars.variable_count].name),
-                 name, _TRUNCATE);
-        strncpy_s(ctx->vars.variables[ctx->vars.variable_count].value,
-                 sizeof(ctx->vars.variables[ctx->vars.variable_count].value),
-                 value, _TRUNCATE);
-        ctx->vars.variable_count++;
-        return true;
+    valuePattern = NULL;
+    hr = UIA_CALL(element->lpVtbl->GetCurrentPattern(element, UIA_ValuePatternId, (IUnknown**)&valuePattern));
+    if (FAILED(hr) || !valuePattern) {
+        return FAILED(hr) ? hr : E_FAIL;
     }
+    hr = UIA_CALL(valuePattern->lpVtbl->get_CurrentValue(valuePattern, value));
+    valuePattern->lpVtbl->Release(valuePattern);
+    return hr;
+}
 
-    return false;
+static HRESULT read_offscreen(IUIAutomationElement* element, BOOL* offscreen) {
+    HRESULT hr = element->lpVtbl->get_CachedIsOffscreen(element, offscreen);
+    if (FAILED(hr)) {
+        hr = UIA_CALL(element->lpVtbl->get_CurrentIsOffscreen(element, offscreen));
+    }
+    return hr;
+}
+
+long winctrl_uia_call_count(void) {
+    return uia_calls;
+}
+
+void winctrl_trace_finished(WinControlContext* ctx, const Instruction* insn) {
+    printf("UI Automation calls for %s: %ld\n", insn->def->name, uia_calls - ctx->traced_calls);
+    ctx->traced_calls = uia_calls;
+}
+
+bool winctrl_set_variable(WinControlContext* ctx, const char* name, const char* value) {
+    if (!winctrl_vars_set(&ctx->vars, name, value)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Out of memory while setting variable: %s", name);
+        return false;
+    }
+    return true;
 }
 
 bool winctrl_get_element_text(IUIAutomationElement* element, char* text, size_t text_size) {
     if (!element || !text) return false;
 
     BSTR name = NULL;
-    HRESULT hr = element->lpVtbl->get_CurrentName(element, &name);
+    HRESULT hr = read_name(element, &name);
 
     if (SUCCEEDED(hr) && name) {
         WideCharToMultiByte(CP_UTF8, 0, name, -1, text, (int)text_size, NULL, NULL);
@@ -186,19 +1282,12 @@ bool winctrl_get_element_text(IUIAutomationElement* element, char* text, size_t
         return true;
     }
 
-    IUIAutomationValuePattern* valuePattern = NULL;
-    hr = element->lpVtbl->GetCurrentPattern(element, UIA_ValuePatternId, (IUnknown**)&valuePattern);
-
-    if (SUCCEEDED(hr) && valuePattern) {
-        BSTR value = NULL;
-        hr = valuePattern->lpVtbl->get_CurrentValue(valuePattern, &value);
-        if (SUCCEEDED(hr) && value) {
-            WideCharToMultiByte(CP_UTF8, 0, value, -1, text, (int)text_size, NULL, NULL);
-            SysFreeString(value);
-            valuePattern->lpVtbl->Release(valuePattern);
-            return true;
-        }
-        valuePattern->lpVtbl->Release(valuePattern);
+    BSTR value = NULL;
+    hr = read_value(element, &value);
+    if (SUCCEEDED(hr) && value) {
+        WideCharToMultiByte(CP_UTF8, 0, value, -1, text, (int)text_size, NULL, NULL);
+        SysFreeString(value);
+        return true;
     }
 
     return false;
@@ -207,73 +1296,111 @@ bool winctrl_get_element_text(IUIAutomationElement* element, char* text, size_t
 static bool get_element_rect(IUIAutomationElement* element, RECT* rect) {
     if (!element || !rect) return false;
 
-    HRESULT hr = element->lpVtbl->get_CurrentBoundingRectangle(element, rect);
+    HRESULT hr = element->lpVtbl->get_CachedBoundingRectangle(element, rect);
+    if (FAILED(hr)) {
+        hr = UIA_CALL(element->lpVtbl->get_CurrentBoundingRectangle(element, rect));
+    }
     return SUCCEEDED(hr);
 }
 
 
 
-HWND winctrl_get_main_window(WinControlContext* ctx) {
-    printf("Searching for main window of process %lu\n", ctx->current_process_id);
-
-    struct EnumData {
-        DWORD process_id;
-        HWND window;
-    } data = { ctx->current_process_id, NULL };
+/* The main window is remembered per process and only searched for again once it is gone or hidden. */
+HWND winctrl_get_main_window(WinControlContext* ctx, DWORD process_id) {
+    HWND window = (HWND)winctrl_registry_main_window(&ctx->processes, process_id);
 
-    EnumWindows(enum_windows_callback, (LPARAM)&data);
-
-    if (!data.window) {
-        printf("No suitable window found for process %lu\n", ctx->current_process_id);
+    if (!window) {
+        printf("No suitable window found for process %lu\n", process_id);
     } else {
-        printf("Found main window for process %lu\n", ctx->current_process_id);
+        print_window_info(window);
     }
 
-    return data.window;
+    return window;
 }
+
 bool winctrl_attach_process(WinControlContext* ctx, const char* process_name) {
     printf("Trying to attach to process: %s\n", process_name);
 
-    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-    if (snapshot == INVALID_HANDLE_VALUE) {
+    DWORD process_id = winctrl_registry_find_name(&ctx->processes, process_name);
+    if (!process_id) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Process '%s' not found", process_name);
+        return false;
+    }
+    printf("Found process '%s' with PID: %lu\n", process_name, process_id);
+
+    /* The attachment keeps its old process, window and subscription until the new window is found. */
+    HWND window = winctrl_get_main_window(ctx, process_id);
+    if (!window) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-            "Failed to create process snapshot");
+            "Could not find main window for process '%s'", process_name);
         return false;
     }
 
-    PROCESSENTRY32W pe32;
-    pe32.dwSize = sizeof(pe32);
-    bool found = false;
-
-    if (Process32FirstW(snapshot, &pe32)) {
-        do {
-            char curr_name[MAX_PATH];
-            wcstombs_s(NULL, curr_name, sizeof(curr_name), pe32.szExeFile, _TRUNCATE);
-
-            if (_stricmp(curr_name, process_name) == 0) {
-                ctx->current_process_id = pe32.th32ProcessID;
-                printf("Found process '%s' with PID: %lu\n", process_name, ctx->current_process_id);
-                found = true;
-                break;
-            }
-        } while (Process32NextW(snapshot, &pe32));
+    ctx->target->process_id = process_id;
+    ctx->target->window = window;
+    watch_current_window(ctx);
+    return true;
+}
+
+static Attachment* find_attachment(WinControlContext* ctx, const char* name) {
+    for (int i = 0; i < ctx->attachment_count; i++) {
+        if (_stricmp(ctx->attachments[i]->name, name) == 0) {
+            return ctx->attachments[i];
+        }
+    }
+    return NULL;
+}
+
+bool winctrl_attach_process_as(WinControlContext* ctx, const char* process_name, const char* name) {
+    Attachment* attachment = find_attachment(ctx, name);
+    bool created = false;
+    if (!attachment) {
+        if (ctx->attachment_count >= MAX_ATTACHMENTS) {
+            sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+                "Too many attachments (limit %d)", MAX_ATTACHMENTS);
+            return false;
+        }
+        if (strlen(name) >= sizeof(attachment->name)) {
+            sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+                "Attachment name is too long: %s", name);
+            return false;
+        }
+        attachment = create_attachment(ctx, name);
+        if (!attachment) {
+            sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+                "Failed to allocate attachment '%s'", name);
+            return false;
+        }
+        created = true;
+    }
+
+    Attachment* previous = ctx->target;
+    ctx->target = attachment;
+    if (!winctrl_attach_process(ctx, process_name)) {
+        ctx->target = previous;
+        if (created) {
+            free_attachment(attachment);
+        }
+        return false;
     }
 
-    CloseHandle(snapshot);
-
-    if (!found) {
-        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-            "Process '%s' not found", process_name);
-        return false;
+    if (created) {
+        ctx->attachments[ctx->attachment_count++] = attachment;
     }
+    printf("Attached '%s' as %s\n", process_name, name);
+    return true;
+}
 
-    ctx->current_window = winctrl_get_main_window(ctx);
-    if (!ctx->current_window) {
+bool winctrl_use_attachment(WinControlContext* ctx, const char* name) {
+    Attachment* attachment = find_attachment(ctx, name);
+    if (!attachment || !attachment->window) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-            "Could not find main window for process '%s'", process_name);
+            "No attachment named '%s'", name);
         return false;
     }
-
+    ctx->target = attachment;
+    printf("Using %s (PID %lu)\n", name, attachment->process_id);
     return true;
 }
 
@@ -293,15 +1420,13 @@ bool winctrl_click_element(IUIAutomationElement* element) {
     printf("Clicking element at coordinates: %d, %d\n", centerX, centerY);
 
     BOOL isOffscreen = FALSE;
-    element->lpVtbl->get_CurrentIsOffscreen(element, &isOffscreen);
+    read_offscreen(element, &isOffscreen);
     if (isOffscreen) {
         printf("Warning: Element appears to be offscreen\n");
         return false;
     }
 
     winctrl_click(centerX, centerY);
-    Sleep(100);
-
     return true;
 }
 
@@ -309,7 +1434,10 @@ bool winctrl_is_element_enabled(IUIAutomationElement* element, bool* enabled) {
     if (!element || !enabled) return false;
 
     BOOL is_enabled = FALSE;
-    HRESULT hr = element->lpVtbl->get_CurrentIsEnabled(element, &is_enabled);
+    HRESULT hr = element->lpVtbl->get_CachedIsEnabled(element, &is_enabled);
+    if (FAILED(hr)) {
+        hr = UIA_CALL(element->lpVtbl->get_CurrentIsEnabled(element, &is_enabled));
+    }
     if (SUCCEEDED(hr)) {
         *enabled = is_enabled ? true : false;
         return true;
@@ -317,60 +1445,163 @@ bool winctrl_is_element_enabled(IUIAutomationElement* element, bool* enabled) {
     return false;
 }
 
-void winctrl_click(int x, int y) {
+/* Sends the button events in one call, so nothing can come between them and no sleep is needed. */
+static void send_mouse(int x, int y, const DWORD* flags, int count) {
+    INPUT inputs[4];
+    memset(inputs, 0, sizeof(inputs));
+    for (int i = 0; i < count; i++) {
+        inputs[i].type = INPUT_MOUSE;
+        inputs[i].mi.dwFlags = flags[i];
+    }
     SetCursorPos(x, y);
-    mouse_event(MOUSEEVENTF_LEFTDOWN, 0, 0, 0, 0);
-    Sleep(10);
-    mouse_event(MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
+    SendInput((UINT)count, inputs, sizeof(INPUT));
+}
+
+void winctrl_click(int x, int y) {
+    static const DWORD flags[] = { MOUSEEVENTF_LEFTDOWN, MOUSEEVENTF_LEFTUP };
+    send_mouse(x, y, flags, 2);
 }
 
 void winctrl_right_click_coordinates(int x, int y) {
-    SetCursorPos(x, y);
-    mouse_event(MOUSEEVENTF_RIGHTDOWN, 0, 0, 0, 0);
-    Sleep(10);
-    mouse_event(MOUSEEVENTF_RIGHTUP, 0, 0, 0, 0);
+    winctrl_right_click(x, y);
 }
 
 void winctrl_double_click_coordinates(int x, int y) {
-    SetCursorPos(x, y);
-    mouse_event(MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
-    Sleep(10);
-    mouse_event(MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
+    winctrl_double_click(x, y);
 }
 
 void winctrl_right_click(int x, int y) {
-    SetCursorPos(x, y);
-    mouse_event(MOUSEEVENTF_RIGHTDOWN, 0, 0, 0, 0);
-    Sleep(10);
-    mouse_event(MOUSEEVENTF_RIGHTUP, 0, 0, 0, 0);
+    static const DWORD flags[] = { MOUSEEVENTF_RIGHTDOWN, MOUSEEVENTF_RIGHTUP };
+    send_mouse(x, y, flags, 2);
 }
 
 void winctrl_double_click(int x, int y) {
-    winctrl_click(x, y);
-    Sleep(10);
-    winctrl_click(x, y);
+    static const DWORD flags[] = { MOUSEEVENTF_LEFTDOWN, MOUSEEVENTF_LEFTUP, MOUSEEVENTF_LEFTDOWN, MOUSEEVENTF_LEFTUP };
+    send_mouse(x, y, flags, 4);
+}
+
+static bool win_layout_map(void* layout, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state) {
+    if (codepoint > 0xFFFF) {
+        return false;
+    }
+    SHORT mapped = VkKeyScanExW((WCHAR)codepoint, (HKL)layout);
+    if (mapped == -1 || (HIBYTE(mapped) & ~(KEY_STATE_SHIFT | KEY_STATE_CTRL | KEY_STATE_ALT))) {
+        return false;
+    }
+    *vkey = LOBYTE(mapped);
+    *scan = (uint16_t)MapVirtualKeyExW(LOBYTE(mapped), MAPVK_VK_TO_VSC, (HKL)layout);
+    *state = HIBYTE(mapped);
+    return true;
+}
+
+static int win_send_input(void* sink, const KeyEvent* events, int count) {
+    (void)sink;
+    INPUT inputs[KEY_BATCH_MAX];
+    memset(inputs, 0, (size_t)count * sizeof(INPUT));
+    for (int i = 0; i < count; i++) {
+        inputs[i].type = INPUT_KEYBOARD;
+        if (events[i].unicode) {
+            inputs[i].ki.wScan = events[i].code;
+            inputs[i].ki.dwFlags = KEYEVENTF_UNICODE;
+        } else {
+            inputs[i].ki.wVk = events[i].code;
+            inputs[i].ki.wScan = events[i].scan;
+        }
+        if (events[i].up) {
+            inputs[i].ki.dwFlags |= KEYEVENTF_KEYUP;
+        }
+    }
+    return (int)SendInput((UINT)count, inputs, sizeof(INPUT));
+}
+
+static void win_pause(void* sink, int milliseconds) {
+    WinControlContext* ctx = sink;
+    winctrl_clock_sleep_ms(&ctx->clock, milliseconds);
 }
 
-void winctrl_send_keys(WinControlContext* ctx, const char* text) {
-    HKL layout = GetKeyboardLayout(0);
+bool winctrl_send_keys(WinControlContext* ctx, const char* text) {
+    return winctrl_desktop_type(&ctx->desktop, &ctx->keys, text, ctx->typing_delay_ms,
+                                ctx->last_error, sizeof(ctx->last_error));
+}
 
-    while (*text) {
-        SHORT vkey = VkKeyScanEx(*text, layout);
-        BYTE scanCode = MapVirtualKeyEx(LOBYTE(vkey), 0, layout);
+void winctrl_sleep(WinControlContext* ctx, int milliseconds) {
+    winctrl_clock_sleep_ms(&ctx->clock, milliseconds);
+}
 
-        keybd_event(LOBYTE(vkey), scanCode, 0, 0);
-        Sleep(10);
-        keybd_event(LOBYTE(vkey), scanCode, KEYEVENTF_KEYUP, 0);
+/*
+ * Settling watches the attachment in use: every UI Automation event it
+ * receives counts as a change, and input idle asks WaitForInputIdle,
+ * which treats a process it cannot open or without a message queue as
+ * idle.
+ */
+typedef struct {
+    Attachment* attachment;
+    UiWaiter* waiter;
+    HANDLE process;
+    const Clock* clock;
+} WinSettleSignals;
+
+static long long win_settle_now(void* signals) {
+    WinSettleSignals* win = signals;
+    return winctrl_clock_now_ms(win->clock);
+}
 
-        if (ctx->typing_delay_ms > 0) {
-            Sleep(ctx->typing_delay_ms);
-        }
-        text++;
+static void win_settle_wait(void* signals, int timeout_ms) {
+    WinSettleSignals* win = signals;
+    winctrl_waiter_wait(win->waiter, timeout_ms);
+}
+
+static long win_settle_changes(void* signals) {
+    WinSettleSignals* win = signals;
+    return InterlockedCompareExchange(&win->attachment->ui_events, 0, 0);
+}
+
+static bool win_settle_input_idle(void* signals) {
+    WinSettleSignals* win = signals;
+    return !win->process || WaitForInputIdle(win->process, 0) != WAIT_TIMEOUT;
+}
+
+static const SettleSignalOps WIN_SETTLE_OPS = {
+    win_settle_now,
+    win_settle_wait,
+    win_settle_changes,
+    win_settle_input_idle
+};
+
+static bool settle_target(WinControlContext* ctx, const SettlePolicy* policy) {
+    if (!ctx->target->window) {
+        return true;
+    }
+    WinSettleSignals signals = { ctx->target, &ctx->waiter, NULL, &ctx->clock };
+    if (policy->input_idle) {
+        signals.process = OpenProcess(SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, ctx->target->process_id);
+    }
+    bool settled = winctrl_settle(&ctx->settle, policy, &WIN_SETTLE_OPS, &signals);
+    if (signals.process) {
+        CloseHandle(signals.process);
+    }
+    return settled;
+}
+
+/* Runs the action's settle policy after it succeeded; a settle that times out does not fail the action. */
+static bool settle_after(WinControlContext* ctx, SettleAction action, bool done) {
+    if (done) {
+        settle_target(ctx, &ctx->settle.policies[action]);
     }
+    return done;
 }
 
-void winctrl_sleep(int milliseconds) {
-    Sleep(milliseconds);
+bool winctrl_wait_idle(WinControlContext* ctx, int timeout_ms) {
+    SettlePolicy policy = ctx->settle.policies[SETTLE_IDLE];
+    if (timeout_ms > 0) {
+        policy.timeout_ms = timeout_ms;
+    }
+    if (!settle_target(ctx, &policy)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Application did not become idle within %d ms", policy.timeout_ms);
+        return false;
+    }
+    return true;
 }
 
 bool winctrl_click_menu_item(WinControlContext* ctx, const char* menu, const char* item) {
@@ -386,10 +1617,9 @@ bool winctrl_click_menu_item(WinControlContext* ctx, const char* menu, const cha
     winctrl_click_element(menuElement);
     menuElement->lpVtbl->Release(menuElement);
 
-    Sleep(500);
-
+    /* Returns as soon as the menu has opened far enough to show the item. */
     IUIAutomationElement* itemElement = NULL;
-    if (!winctrl_find_element_by_name(ctx, item, &itemElement)) {
+    if (!winctrl_wait_for_element(ctx, item, ctx->settle.policies[SETTLE_ELEMENT].timeout_ms, &itemElement)) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error),
             "Could not find menu item: %s", item);
         return false;
@@ -531,54 +1761,235 @@ void winctrl_end_logging(WinControlContext* ctx) {
 }
 
 bool winctrl_attach_pid(WinControlContext* ctx, DWORD process_id) {
-    if (!winctrl_is_process_running(process_id)) {
+    if (!winctrl_registry_has_pid(&ctx->processes, process_id)) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error),
             "Process ID %lu not found", process_id);
         return false;
     }
 
-    ctx->current_process_id = process_id;
-    ctx->current_window = winctrl_get_main_window(ctx);
-
-    if (!ctx->current_window) {
+    HWND window = winctrl_get_main_window(ctx, process_id);
+    if (!window) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error),
             "Could not find main window for process ID %lu", process_id);
         return false;
     }
 
+    ctx->target->process_id = process_id;
+    ctx->target->window = window;
+    watch_current_window(ctx);
     return true;
 }
 
 void winctrl_send_keys_with_modifier(WinModifierKeys modifiers, WORD key) {
-    if (modifiers & WMOD_CTRL) {
-        keybd_event(VK_CONTROL, 0, 0, 0);
+    static const struct {
+        WinModifierKeys modifier;
+        WORD key;
+    } MODIFIER_KEYS[] = {
+        { WMOD_CTRL, VK_CONTROL }, { WMOD_ALT, VK_MENU }, { WMOD_SHIFT, VK_SHIFT }, { WMOD_WIN, VK_LWIN }
+    };
+
+    /* Modifiers go down in order and up in reverse around the key, all in one SendInput call. */
+    INPUT inputs[10];
+    int count = 0;
+    memset(inputs, 0, sizeof(inputs));
+    for (int i = 0; i < 4; i++) {
+        if (modifiers & MODIFIER_KEYS[i].modifier) {
+            inputs[count].type = INPUT_KEYBOARD;
+            inputs[count++].ki.wVk = MODIFIER_KEYS[i].key;
+        }
+    }
+    inputs[count].type = INPUT_KEYBOARD;
+    inputs[count++].ki.wVk = key;
+    inputs[count].type = INPUT_KEYBOARD;
+    inputs[count].ki.wVk = key;
+    inputs[count++].ki.dwFlags = KEYEVENTF_KEYUP;
+    for (int i = 3; i >= 0; i--) {
+        if (modifiers & MODIFIER_KEYS[i].modifier) {
+            inputs[count].type = INPUT_KEYBOARD;
+            inputs[count].ki.wVk = MODIFIER_KEYS[i].key;
+            inputs[count++].ki.dwFlags = KEYEVENTF_KEYUP;
+        }
+    }
+    SendInput((UINT)count, inputs, sizeof(INPUT));
+}
+
+static char* bstr_to_utf8(BSTR str) {
+    if (!str) {
+        return NULL;
+    }
+    int size = WideCharToMultiByte(CP_UTF8, 0, str, -1, NULL, 0, NULL, NULL);
+    char* text = size > 0 ? malloc((size_t)size) : NULL;
+    if (text) {
+        WideCharToMultiByte(CP_UTF8, 0, str, -1, text, size, NULL, NULL);
+    }
+    return text;
+}
+
+static bool capture_element(Snapshot* snapshot, IUIAutomationElement* element, int parent) {
+    BSTR name = NULL;
+    BSTR automation_id = NULL;
+    BSTR class_name = NULL;
+    CONTROLTYPEID control_type = 0;
+    RECT rect = {0};
+    element->lpVtbl->get_CachedName(element, &name);
+    element->lpVtbl->get_CachedAutomationId(element, &automation_id);
+    element->lpVtbl->get_CachedClassName(element, &class_name);
+    element->lpVtbl->get_CachedControlType(element, &control_type);
+    element->lpVtbl->get_CachedBoundingRectangle(element, &rect);
+
+    SnapshotElement fields = {0};
+    char* name_text = bstr_to_utf8(name);
+    char* id_text = bstr_to_utf8(automation_id);
+    char* class_text = bstr_to_utf8(class_name);
+    fields.name = name_text;
+    fields.automation_id = id_text;
+    fields.class_name = class_text;
+    fields.control_type = control_type;
+    fields.left = rect.left;
+    fields.top = rect.top;
+    fields.right = rect.right;
+    fields.bottom = rect.bottom;
+
+    VARIANT runtime_id;
+    VariantInit(&runtime_id);
+    int32_t* ids = NULL;
+    if (SUCCEEDED(element->lpVtbl->GetCachedPropertyValue(element, UIA_RuntimeIdPropertyId, &runtime_id)) &&
+        runtime_id.vt == (VT_I4 | VT_ARRAY) && runtime_id.parray) {
+        LONG lower = 0;
+        LONG upper = -1;
+        SafeArrayGetLBound(runtime_id.parray, 1, &lower);
+        SafeArrayGetUBound(runtime_id.parray, 1, &upper);
+        if (upper >= lower && SUCCEEDED(SafeArrayAccessData(runtime_id.parray, (void**)&ids))) {
+            fields.runtime_id = ids;
+            fields.runtime_id_length = (int)(upper - lower + 1);
+        }
+    }
+
+    int index = winctrl_snapshot_add(snapshot, parent, &fields);
+
+    if (ids) SafeArrayUnaccessData(runtime_id.parray);
+    VariantClear(&runtime_id);
+    free(name_text);
+    free(id_text);
+    free(class_text);
+    SysFreeString(name);
+    SysFreeString(automation_id);
+    SysFreeString(class_name);
+    if (index == -1) {
+        return false;
     }
-    if (modifiers & WMOD_ALT) {
-        keybd_event(VK_MENU, 0, 0, 0);
+
+    IUIAutomationElementArray* children = NULL;
+    if (FAILED(element->lpVtbl->GetCachedChildren(element, &children)) || !children) {
+        return true;
     }
-    if (modifiers & WMOD_SHIFT) {
-        keybd_event(VK_SHIFT, 0, 0, 0);
+
+    int length = 0;
+    children->lpVtbl->get_Length(children, &length);
+    bool ok = true;
+    for (int i = 0; ok && i < length; i++) {
+        IUIAutomationElement* child = NULL;
+        if (SUCCEEDED(children->lpVtbl->GetElement(children, i, &child)) && child) {
+            ok = capture_element(snapshot, child, index);
+            child->lpVtbl->Release(child);
+        }
     }
-    if (modifiers & WMOD_WIN) {
-        keybd_event(VK_LWIN, 0, 0, 0);
+    children->lpVtbl->Release(children);
+    return ok;
+}
+
+static HRESULT create_snapshot_request(IUIAutomation* automation, IUIAutomationCacheRequest** request) {
+    static const PROPERTYID properties[] = {
+        UIA_NamePropertyId,
+        UIA_AutomationIdPropertyId,
+        UIA_ClassNamePropertyId,
+        UIA_ControlTypePropertyId,
+        UIA_BoundingRectanglePropertyId,
+        UIA_RuntimeIdPropertyId
+    };
+
+    IUIAutomationCondition* raw_view = NULL;
+    HRESULT hr = automation->lpVtbl->CreateCacheRequest(automation, request);
+    for (size_t i = 0; SUCCEEDED(hr) && i < sizeof(properties) / sizeof(properties[0]); i++) {
+        hr = (*request)->lpVtbl->AddProperty(*request, properties[i]);
+    }
+    if (SUCCEEDED(hr)) hr = (*request)->lpVtbl->put_TreeScope(*request, TreeScope_Subtree);
+    if (SUCCEEDED(hr)) hr = (*request)->lpVtbl->put_AutomationElementMode(*request, AutomationElementMode_None);
+    /* FindFirst searches the raw view, so the snapshot has to hold the same elements. */
+    if (SUCCEEDED(hr)) hr = automation->lpVtbl->CreateTrueCondition(automation, &raw_view);
+    if (SUCCEEDED(hr)) hr = (*request)->lpVtbl->put_TreeFilter(*request, raw_view);
+    if (raw_view) raw_view->lpVtbl->Release(raw_view);
+    if (FAILED(hr) && *request) {
+        (*request)->lpVtbl->Release(*request);
+        *request = NULL;
+    }
+    return hr;
+}
+
+/*
+ * Captures the attached window's whole subtree in one BuildUpdatedCache
+ * round trip. ElementExists and ContainsElementText are answered from it
+ * until the window reports a change.
+ */
+bool winctrl_take_snapshot(WinControlContext* ctx) {
+    if (!ctx->target->window) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "No window attached");
+        return false;
     }
 
-    keybd_event(key, 0, 0, 0);
-    Sleep(10);
-    keybd_event(key, 0, KEYEVENTF_KEYUP, 0);
+    winctrl_snapshot_free(&ctx->target->snapshot);
+    ctx->target->snapshot_ready = false;
+    long changes = InterlockedCompareExchange(&ctx->target->ui_changes, 0, 0);
+
+    IUIAutomationCacheRequest* request = NULL;
+    HRESULT hr = create_snapshot_request(ctx->automation, &request);
+    IUIAutomationElement* root = SUCCEEDED(hr) ? get_root_element(ctx) : NULL;
+    IUIAutomationElement* cached_root = NULL;
+    if (root) {
+        hr = UIA_CALL(root->lpVtbl->BuildUpdatedCache(root, request, &cached_root));
+        root->lpVtbl->Release(root);
+    }
+    if (request) request->lpVtbl->Release(request);
+    if (FAILED(hr) || !cached_root) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Failed to capture UI tree: 0x%lx", hr);
+        return false;
+    }
 
-    if (modifiers & WMOD_WIN) {
-        keybd_event(VK_LWIN, 0, KEYEVENTF_KEYUP, 0);
+    bool ok = capture_element(&ctx->target->snapshot, cached_root, -1) && winctrl_snapshot_finish(&ctx->target->snapshot);
+    cached_root->lpVtbl->Release(cached_root);
+    if (!ok) {
+        winctrl_snapshot_free(&ctx->target->snapshot);
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Out of memory while capturing UI tree");
+        return false;
     }
-    if (modifiers & WMOD_SHIFT) {
-        keybd_event(VK_SHIFT, 0, KEYEVENTF_KEYUP, 0);
+
+    ctx->target->snapshot_ready = true;
+    ctx->target->snapshot_changes = changes;
+    printf("Snapshot captured: %d elements\n", ctx->target->snapshot.count);
+    return true;
+}
+
+static bool snapshot_current(WinControlContext* ctx) {
+    if (!ctx->target->snapshot_ready || ctx->recorder) {
+        return false;
     }
-    if (modifiers & WMOD_ALT) {
-        keybd_event(VK_MENU, 0, KEYEVENTF_KEYUP, 0);
+    if (InterlockedCompareExchange(&ctx->target->ui_changes, 0, 0) != ctx->target->snapshot_changes) {
+        printf("Window changed, snapshot discarded\n");
+        ctx->target->snapshot_ready = false;
+        return false;
     }
-    if (modifiers & WMOD_CTRL) {
-        keybd_event(VK_CONTROL, 0, KEYEVENTF_KEYUP, 0);
+    return true;
+}
+
+/* Looks a locator up in the snapshot; returns false when there is no current snapshot to answer from. */
+static bool find_in_snapshot(WinControlContext* ctx, const ElementProperties* props, int* node) {
+    if (!snapshot_current(ctx)) {
+        return false;
     }
+
+    Locator locator = { props->automation_id, props->class_name, props->control_type, NULL };
+    *node = winctrl_snapshot_find(&ctx->target->snapshot, &locator);
+    return true;
 }
 
 bool winctrl_get_element_text_by_properties(WinControlContext* ctx,
@@ -586,15 +1997,34 @@ bool winctrl_get_element_text_by_properties(WinControlContext* ctx,
     char* text_out,
     size_t text_out_size) {
 
+    int node;
+    if (find_in_snapshot(ctx, props, &node)) {
+        if (node == -1) {
+            return false;
+        }
+        strncpy_s(text_out, text_out_size, winctrl_snapshot_string(&ctx->target->snapshot, ctx->target->snapshot.nodes[node].name), _TRUNCATE);
+        return true;
+    }
+
     IUIAutomationElement* element = NULL;
     if (!winctrl_find_element_by_properties(ctx, props, &element)) {
         return false;
     }
 
+    bool success = false;
+    if (ctx->recorder) {
+        ElementInfo info;
+        success = ctx->desktop.ops->read(ctx->desktop.backend, element, &info);
+        if (success) {
+            strncpy_s(text_out, text_out_size, info.name, _TRUNCATE);
+        }
+        element->lpVtbl->Release(element);
+        return success;
+    }
+
     BSTR bstr_value = NULL;
-    HRESULT hr = element->lpVtbl->get_CurrentName(element, &bstr_value);
+    HRESULT hr = read_name(element, &bstr_value);
 
-    bool success = false;
     if (SUCCEEDED(hr) && bstr_value) {
         WideCharToMultiByte(CP_UTF8, 0, bstr_value, -1, text_out, (int)text_out_size, NULL, NULL);
         success = true;
@@ -620,16 +2050,16 @@ bool winctrl_is_process_running(DWORD process_id) {
     return running;
 }
 bool winctrl_bring_to_front(WinControlContext* ctx) {
-    if (!ctx->current_window) {
+    if (!ctx->target->window) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error),
             "No window attached");
         return false;
     }
 
-    if (IsIconic(ctx->current_window)) {
-        ShowWindow(ctx->current_window, SW_RESTORE);
+    if (IsIconic(ctx->target->window)) {
+        ShowWindow(ctx->target->window, SW_RESTORE);
     }
-    return SetForegroundWindow(ctx->current_window) != 0;
+    return SetForegroundWindow(ctx->target->window) != 0;
 }
 
 const char* winctrl_get_last_error(WinControlContext* ctx) {
@@ -637,97 +2067,156 @@ const char* winctrl_get_last_error(WinControlContext* ctx) {
 }
 
 const char* winctrl_get_variable(WinControlContext* ctx, const char* name) {
-    for (int i = 0; i < ctx->vars.variable_count; i++) {
-        if (strcmp(ctx->vars.variables[i].name, name) == 0) {
-            return ctx->vars.variables[i].value;
-        }
+    return winctrl_vars_get(&ctx->vars, name);
+}
+
+static const char* operand_value(WinControlContext* ctx, const Operand* operand) {
+    if (operand->slot < 0) {
+        return operand->str;
     }
-    return NULL;
+
+    const VariableValue* value = ctx->vars.variables[operand->slot].value;
+    if (!value) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Variable used before it was set: %s", operand->str + 1);
+        return NULL;
+    }
+    return value->data;
 }
 
-static bool handle_click(WinControlContext* ctx, const Command* cmd) {
-    winctrl_click(atoi(cmd->params[0]), atoi(cmd->params[1]));
-    return true;
+static bool set_flag_variable(WinControlContext* ctx, int slot, bool value) {
+    return winctrl_vars_assign(&ctx->vars, slot, value ? "true" : "false", value ? 4 : 5);
 }
 
-static bool handle_send_keystroke(WinControlContext* ctx, const Command* cmd) {
-    const char* text_to_send;
-    if (cmd->params[0][0] == '$') {
-        text_to_send = winctrl_get_variable(ctx, cmd->params[0] + 1);
-        if (!text_to_send) {
-            sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-                "Variable not found: %s", cmd->params[0] + 1);
-            return false;
-        }
-    } else {
-        text_to_send = cmd->params[0];
+static bool click_at(WinControlContext* ctx, const Instruction* insn, DesktopButton button, int count) {
+    ctx->desktop.ops->click(ctx->desktop.backend, insn->args[0].num, insn->args[1].num, button, count);
+    return settle_after(ctx, SETTLE_INPUT, true);
+}
+
+static bool handle_click(WinControlContext* ctx, const Instruction* insn) {
+    return click_at(ctx, insn, DESKTOP_LEFT, 1);
+}
+
+static bool handle_send_keystroke(WinControlContext* ctx, const Instruction* insn) {
+    const char* text_to_send = operand_value(ctx, &insn->args[0]);
+    if (!text_to_send) {
+        return false;
     }
     printf("Sending keystroke: %s\n", text_to_send);
-    winctrl_send_keys(ctx, text_to_send);
-    return true;
+    return settle_after(ctx, SETTLE_INPUT, winctrl_send_keys(ctx, text_to_send));
 }
 
-static bool handle_start_log(WinControlContext* ctx, const Command* cmd) {
-    return winctrl_start_logging(ctx, cmd->params[0]);
+static bool handle_start_log(WinControlContext* ctx, const Instruction* insn) {
+    return winctrl_start_logging(ctx, insn->args[0].str);
 }
 
-static bool handle_log(WinControlContext* ctx, const Command* cmd) {
-    winctrl_log(ctx, LOG_NORMAL, cmd->params[0]);
+static bool handle_log(WinControlContext* ctx, const Instruction* insn) {
+    winctrl_log(ctx, LOG_NORMAL, insn->args[0].str);
     return true;
 }
 
-static bool handle_log_warning(WinControlContext* ctx, const Command* cmd) {
-    winctrl_log(ctx, LOG_WARNING, cmd->params[0]);
+static bool handle_log_warning(WinControlContext* ctx, const Instruction* insn) {
+    winctrl_log(ctx, LOG_WARNING, insn->args[0].str);
     return true;
 }
 
-static bool handle_log_error(WinControlContext* ctx, const Command* cmd) {
-    winctrl_log(ctx, LOG_ERROR, cmd->params[0]);
+static bool handle_log_error(WinControlContext* ctx, const Instruction* insn) {
+    winctrl_log(ctx, LOG_ERROR, insn->args[0].str);
     return true;
 }
 
-static bool handle_log_header(WinControlContext* ctx, const Command* cmd) {
-    winctrl_log(ctx, LOG_HEADER, cmd->params[0]);
+static bool handle_log_header(WinControlContext* ctx, const Instruction* insn) {
+    winctrl_log(ctx, LOG_HEADER, insn->args[0].str);
     return true;
 }
 
-static bool handle_end_log(WinControlContext* ctx, const Command* cmd) {
+static bool handle_end_log(WinControlContext* ctx, const Instruction* insn) {
     winctrl_end_logging(ctx);
     return true;
 }
 
-static bool handle_sleep(WinControlContext* ctx, const Command* cmd) {
-    int ms = atoi(cmd->params[0]);
+static bool handle_sleep(WinControlContext* ctx, const Instruction* insn) {
+    int ms = insn->args[0].num;
     printf("Sleeping for %d ms\n", ms);
-    winctrl_sleep(ms);
+    winctrl_sleep(ctx, ms);
     return true;
 }
 
-static bool handle_attach_process(WinControlContext* ctx, const Command* cmd) {
-    printf("Attaching to process: %s\n", cmd->params[0]);
-    return winctrl_attach_process(ctx, cmd->params[0]);
+static bool handle_attach_process(WinControlContext* ctx, const Instruction* insn) {
+    printf("Attaching to process: %s\n", insn->args[0].str);
+    if (insn->argc == 1) {
+        return winctrl_attach_process(ctx, insn->args[0].str);
+    }
+    if (insn->argc == 3 && _stricmp(insn->args[1].str, "AS") == 0) {
+        const char* name = operand_value(ctx, &insn->args[2]);
+        return name && winctrl_attach_process_as(ctx, insn->args[0].str, name);
+    }
+    sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+        "Usage: AttachProcess \"process\" [AS name]");
+    return false;
 }
 
-static bool handle_bring_to_front(WinControlContext* ctx, const Command* cmd) {
-    printf("Bringing window to front\n");
-    return winctrl_bring_to_front(ctx);
+static bool handle_use(WinControlContext* ctx, const Instruction* insn) {
+    const char* name = operand_value(ctx, &insn->args[0]);
+    return name && winctrl_use_attachment(ctx, name);
 }
 
-static bool handle_right_click(WinControlContext* ctx, const Command* cmd) {
-    winctrl_right_click_coordinates(atoi(cmd->params[0]), atoi(cmd->params[1]));
+static bool parse_milliseconds(WinControlContext* ctx, const Operand* operand, int* milliseconds) {
+    const char* text = operand_value(ctx, operand);
+    if (!text) {
+        return false;
+    }
+    char* end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end || value < 0 || value > INT_MAX) {
+        return false;
+    }
+    *milliseconds = (int)value;
     return true;
 }
 
-static bool handle_double_click(WinControlContext* ctx, const Command* cmd) {
-    winctrl_double_click_coordinates(atoi(cmd->params[0]), atoi(cmd->params[1]));
+static bool handle_wait_idle(WinControlContext* ctx, const Instruction* insn) {
+    int timeout_ms = 0;
+    if (insn->argc > 1 || (insn->argc == 1 && !parse_milliseconds(ctx, &insn->args[0], &timeout_ms))) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Usage: WaitIdle [timeout_ms]");
+        return false;
+    }
+    printf("Waiting for the application to become idle\n");
+    return winctrl_wait_idle(ctx, timeout_ms);
+}
+
+static bool handle_set_settle(WinControlContext* ctx, const Instruction* insn) {
+    SettleAction action;
+    if (!winctrl_settle_action_from_name(insn->args[0].str, &action)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Unknown settle action '%s' (expected input, element or idle)", insn->args[0].str);
+        return false;
+    }
+    SettlePolicy* policy = &ctx->settle.policies[action];
+    policy->min_ms = insn->args[1].num;
+    policy->quiet_ms = insn->args[2].num;
+    policy->timeout_ms = insn->args[3].num;
     return true;
 }
 
-static bool handle_contains_element_text(WinControlContext* ctx, const Command* cmd) {
+static bool handle_bring_to_front(WinControlContext* ctx, const Instruction* insn) {
+    printf("Bringing window to front\n");
+    return winctrl_bring_to_front(ctx);
+}
+
+static bool handle_right_click(WinControlContext* ctx, const Instruction* insn) {
+    return click_at(ctx, insn, DESKTOP_RIGHT, 1);
+}
+
+static bool handle_double_click(WinControlContext* ctx, const Instruction* insn) {
+    return click_at(ctx, insn, DESKTOP_LEFT, 2);
+}
+
+static bool handle_contains_element_text(WinControlContext* ctx, const Instruction* insn) {
     ElementProperties props;
-    props.automation_id = cmd->params[0];
-    props.class_name = cmd->params[1];
-    props.control_type = atoi(cmd->params[2]);
+    props.automation_id = insn->args[0].str;
+    props.class_name = insn->args[1].str;
+    props.control_type = insn->args[2].num;
 
     char element_text[256] = {0};
     if (!winctrl_get_element_text_by_properties(ctx, &props, element_text, sizeof(element_text))) {
@@ -735,20 +2224,13 @@ static bool handle_contains_element_text(WinControlContext* ctx, const Command*
         return false;
     }
 
-    const char* search_text;
-    if (cmd->params[3][0] == '$') {
-        search_text = winctrl_get_variable(ctx, cmd->params[3] + 1);
-        if (!search_text) {
-            sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-                "Variable not found: %s", cmd->params[3] + 1);
-            return false;
-        }
-    } else {
-        search_text = cmd->params[3];
+    const char* search_text = operand_value(ctx, &insn->args[3]);
+    if (!search_text) {
+        return false;
     }
 
     bool contains = (strstr(element_text, search_text) != NULL);
-    winctrl_set_variable(ctx, "_CONTAINS_RESULT", contains ? "true" : "false");
+    set_flag_variable(ctx, ctx->contains_result_slot, contains);
 
     printf("Checking if element text '%s' contains '%s': %s\n",
         element_text, search_text, contains ? "yes" : "no");
@@ -756,136 +2238,331 @@ static bool handle_contains_element_text(WinControlContext* ctx, const Command*
     return true;
 }
 
-static bool handle_right_click_element(WinControlContext* ctx, const Command* cmd) {
+/* Clicks the middle of an element through the desktop, so a recording sees the read and the click. */
+static bool click_found(WinControlContext* ctx, IUIAutomationElement* element, DesktopButton button, int count) {
+    bool clicked = winctrl_desktop_click(&ctx->desktop, element, button, count, ctx->last_error,
+        sizeof(ctx->last_error));
+    element->lpVtbl->Release(element);
+    return settle_after(ctx, SETTLE_ELEMENT, clicked);
+}
+
+static bool handle_right_click_element(WinControlContext* ctx, const Instruction* insn) {
+    ElementProperties props;
+    props.automation_id = strcmp(insn->args[0].str, "null") == 0 ? NULL : insn->args[0].str;
+    props.class_name = strcmp(insn->args[1].str, "null") == 0 ? NULL : insn->args[1].str;
+    props.control_type = insn->args[2].num;
+
+    IUIAutomationElement* element = NULL;
+    if (winctrl_find_element_by_properties(ctx, &props, &element)) {
+        printf("Found element, right-clicking...\n");
+        return click_found(ctx, element, DESKTOP_RIGHT, 1);
+    }
+    return false;
+}
+
+static bool handle_double_click_element(WinControlContext* ctx, const Instruction* insn) {
+    ElementProperties props;
+    props.automation_id = strcmp(insn->args[0].str, "null") == 0 ? NULL : insn->args[0].str;
+    props.class_name = strcmp(insn->args[1].str, "null") == 0 ? NULL : insn->args[1].str;
+    props.control_type = insn->args[2].num;
+
+    IUIAutomationElement* element = NULL;
+    if (winctrl_find_element_by_properties(ctx, &props, &element)) {
+        printf("Found element, double-clicking...\n");
+        return click_found(ctx, element, DESKTOP_LEFT, 2);
+    }
+    return false;
+}
+
+/*
+ * Presses the last operand with the modifiers named before it held down,
+ * through the desktop so a recording sees it. Unknown modifiers are
+ * ignored, as they always were.
+ */
+static bool send_mod_key(WinControlContext* ctx, const Instruction* insn) {
+    uint16_t modifiers[4];
+    int modifier_count = 0;
+    for (int i = 0; i < insn->argc - 1; i++) {
+        uint16_t modifier = winctrl_desktop_modifier_key(insn->args[i].str);
+        bool repeated = false;
+        for (int j = 0; j < modifier_count; j++) {
+            repeated = repeated || modifiers[j] == modifier;
+        }
+        if (modifier && !repeated) {
+            modifiers[modifier_count++] = modifier;
+        }
+    }
+
+    const char* name = insn->args[insn->argc - 1].str;
+    WORD key = winctrl_desktop_named_key(&ctx->desktop, name);
+    if (!key) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Invalid key combination: unknown key %s", name);
+        return false;
+    }
+    return settle_after(ctx, SETTLE_INPUT, winctrl_desktop_chord(&ctx->desktop, &ctx->keys, modifiers,
+        modifier_count, key, ctx->last_error, sizeof(ctx->last_error)));
+}
+
+static bool handle_send_mod_key(WinControlContext* ctx, const Instruction* insn) {
+    printf("Sending modified key: %s + %s\n", insn->args[0].str, insn->args[1].str);
+    return send_mod_key(ctx, insn);
+}
+
+static bool handle_set(WinControlContext* ctx, const Instruction* insn) {
+    if (!winctrl_vars_assign(&ctx->vars, insn->args[0].slot, insn->args[1].str, strlen(insn->args[1].str))) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Out of memory while setting variable: %s", insn->args[0].str);
+        return false;
+    }
+    return true;
+}
+
+/* Operands are resolved as the evaluation reaches them, so a branch AND/OR skips may name unset variables. */
+static bool test_condition(WinControlContext* ctx, const Instruction* insn, bool* result) {
+    if (!winctrl_condition_evaluate(ctx, &ctx->vars, insn->condition, result,
+                                    ctx->last_error, sizeof(ctx->last_error))) {
+        return false;
+    }
+    set_flag_variable(ctx, ctx->if_condition_slot, *result);
+    return true;
+}
+
+static bool properties_from_operands(WinControlContext* ctx, const Operand* args, int argc,
+                                     ElementProperties* props) {
+    const char* id = operand_value(ctx, &args[0]);
+    const char* class_name = argc > 1 ? operand_value(ctx, &args[1]) : "null";
+    if (!id || !class_name) {
+        return false;
+    }
+
+    props->automation_id = strcmp(id, "null") == 0 ? NULL : id;
+    props->class_name = strcmp(class_name, "null") == 0 ? NULL : class_name;
+    props->control_type = argc > 2 ? args[2].num : -1;
+    return true;
+}
+
+static bool predicate_element_exists(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    ElementProperties props;
+    if (!properties_from_operands(ctx, args, argc, &props)) {
+        return false;
+    }
+
+    int node;
+    if (find_in_snapshot(ctx, &props, &node)) {
+        *result = node != -1;
+        return true;
+    }
+
+    IUIAutomationElement* element = NULL;
+    *result = winctrl_find_element_by_properties(ctx, &props, &element);
+    if (element) element->lpVtbl->Release(element);
+    return true;
+}
+
+static bool predicate_element_not_exists(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    if (!predicate_element_exists(ctx, args, argc, result)) {
+        return false;
+    }
+    *result = !*result;
+    return true;
+}
+
+static bool predicate_contains_element_text(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    ElementProperties props;
+    const char* search_text = operand_value(ctx, &args[3]);
+    if (!search_text || !properties_from_operands(ctx, args, argc, &props)) {
+        return false;
+    }
+
+    char element_text[256] = {0};
+    *result = winctrl_get_element_text_by_properties(ctx, &props, element_text, sizeof(element_text)) &&
+              strstr(element_text, search_text) != NULL;
+    return true;
+}
+
+static bool handle_wait_for_element(WinControlContext* ctx, const Instruction* insn) {
     ElementProperties props;
-    props.automation_id = strcmp(cmd->params[0], "null") == 0 ? NULL : cmd->params[0];
-    props.class_name = strcmp(cmd->params[1], "null") == 0 ? NULL : cmd->params[1];
-    props.control_type = atoi(cmd->params[2]);
+    if (!properties_from_operands(ctx, insn->args, 3, &props)) {
+        return false;
+    }
+
+    printf("Waiting up to %d ms for element\n", insn->args[3].num);
+    IUIAutomationElement* element = NULL;
+    if (!winctrl_wait_for_element_by_properties(ctx, &props, insn->args[3].num, &element)) {
+        return false;
+    }
+    element->lpVtbl->Release(element);
+    return true;
+}
 
+static bool handle_click_selector(WinControlContext* ctx, const Instruction* insn) {
+    const char* selector = operand_value(ctx, &insn->args[0]);
     IUIAutomationElement* element = NULL;
-    if (winctrl_find_element_by_properties(ctx, &props, &element)) {
-        printf("Found element, right-clicking...\n");
-        bool clicked = winctrl_right_click_element(element);
-        element->lpVtbl->Release(element);
-        return clicked;
+    if (!selector || !winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
     }
-    return false;
+    return click_found(ctx, element, DESKTOP_LEFT, 1);
 }
 
-static bool handle_double_click_element(WinControlContext* ctx, const Command* cmd) {
-    ElementProperties props;
-    props.automation_id = strcmp(cmd->params[0], "null") == 0 ? NULL : cmd->params[0];
-    props.class_name = strcmp(cmd->params[1], "null") == 0 ? NULL : cmd->params[1];
-    props.control_type = atoi(cmd->params[2]);
-
+static bool handle_right_click_selector(WinControlContext* ctx, const Instruction* insn) {
+    const char* selector = operand_value(ctx, &insn->args[0]);
     IUIAutomationElement* element = NULL;
-    if (winctrl_find_element_by_properties(ctx, &props, &element)) {
-        printf("Found element, double-clicking...\n");
-        bool clicked = winctrl_double_click_element(element);
-        element->lpVtbl->Release(element);
-        return clicked;
+    if (!selector || !winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
     }
-    return false;
+    return click_found(ctx, element, DESKTOP_RIGHT, 1);
 }
 
-static bool handle_send_mod_key(WinControlContext* ctx, const Command* cmd) {
-    WinModifierKeys mod = WMOD_NONE;
-    WORD key = 0;
+static bool handle_double_click_selector(WinControlContext* ctx, const Instruction* insn) {
+    const char* selector = operand_value(ctx, &insn->args[0]);
+    IUIAutomationElement* element = NULL;
+    if (!selector || !winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
+    }
+    return click_found(ctx, element, DESKTOP_LEFT, 2);
+}
 
-    if (strcmp(cmd->params[0], "CTRL") == 0) mod = WMOD_CTRL;
-    else if (strcmp(cmd->params[0], "ALT") == 0) mod = WMOD_ALT;
-    else if (strcmp(cmd->params[0], "SHIFT") == 0) mod = WMOD_SHIFT;
-    else if (strcmp(cmd->params[0], "WIN") == 0) mod = WMOD_WIN;
+static bool handle_set_element_value(WinControlContext* ctx, const Instruction* insn) {
+    const char* selector = operand_value(ctx, &insn->args[0]);
+    const char* value = operand_value(ctx, &insn->args[1]);
+    IUIAutomationElement* element = NULL;
+    if (!selector || !value || !winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
+    }
+    bool set = winctrl_set_element_value(ctx, element, value);
+    element->lpVtbl->Release(element);
+    return settle_after(ctx, SETTLE_ELEMENT, set);
+}
 
-    if (strlen(cmd->params[1]) == 1) {
-        key = VkKeyScanEx(cmd->params[1][0], GetKeyboardLayout(0)) & 0xFF;
-    } else {
-        if (strcmp(cmd->params[1], "TAB") == 0) key = VK_TAB;
-        else if (strcmp(cmd->params[1], "ENTER") == 0) key = VK_RETURN;
-        else if (strcmp(cmd->params[1], "ESC") == 0) key = VK_ESCAPE;
+static bool handle_invoke_selector(WinControlContext* ctx, const Instruction* insn) {
+    const char* selector = operand_value(ctx, &insn->args[0]);
+    IUIAutomationElement* element = NULL;
+    if (!selector || !winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
     }
+    bool invoked = winctrl_invoke_element(ctx, element);
+    element->lpVtbl->Release(element);
+    return settle_after(ctx, SETTLE_ELEMENT, invoked);
+}
 
-    if (key != 0) {
-        printf("Sending modified key: %s + %s\n", cmd->params[0], cmd->params[1]);
-        winctrl_send_keys_with_modifier(mod, key);
-        return true;
+static bool handle_toggle(WinControlContext* ctx, const Instruction* insn) {
+    const char* selector = operand_value(ctx, &insn->args[0]);
+    const char* state = insn->argc > 1 ? operand_value(ctx, &insn->args[1]) : "";
+    if (!selector || !state) {
+        return false;
+    }
+    if (insn->argc > 2 || (state[0] && _stricmp(state, "on") != 0 && _stricmp(state, "off") != 0)) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Usage: Toggle \"selector\" [on|off]");
+        return false;
     }
 
-    sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-        "Invalid key combination: %s + %s", cmd->params[0], cmd->params[1]);
-    return false;
+    IUIAutomationElement* element = NULL;
+    if (!winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
+    }
+    bool toggled = state[0]
+        ? winctrl_check_checkbox(ctx, element, _stricmp(state, "on") == 0)
+        : winctrl_toggle_element(ctx, element);
+    element->lpVtbl->Release(element);
+    return settle_after(ctx, SETTLE_ELEMENT, toggled);
 }
 
-static bool handle_set(WinControlContext* ctx, const Command* cmd) {
-    return winctrl_set_variable(ctx, cmd->params[0], cmd->params[1]);
+static bool expand_selector(WinControlContext* ctx, const Instruction* insn, bool expand) {
+    const char* selector = operand_value(ctx, &insn->args[0]);
+    IUIAutomationElement* element = NULL;
+    if (!selector || !winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
+    }
+    bool done = winctrl_expand_collapse(ctx, element, expand);
+    element->lpVtbl->Release(element);
+    return settle_after(ctx, SETTLE_ELEMENT, done);
 }
 
-static bool handle_if(WinControlContext* ctx, const Command* cmd) {
-    char condition[512] = {0};
-    strncpy_s(condition, sizeof(condition), cmd->params[0], _TRUNCATE);
-    for (int i = 1; i < cmd->param_count; i++) {
-        strncat_s(condition, sizeof(condition), " ", _TRUNCATE);
-        strncat_s(condition, sizeof(condition), cmd->params[i], _TRUNCATE);
-    }
-    printf("Evaluating condition: %s\n", condition);
-    bool condition_met = evaluate_condition(ctx, condition);
-    winctrl_set_variable(ctx, "_IF_CONDITION", condition_met ? "true" : "false");
-    return true;
+static bool handle_expand(WinControlContext* ctx, const Instruction* insn) {
+    return expand_selector(ctx, insn, true);
 }
 
-static bool handle_endif(WinControlContext* ctx, const Command* cmd) {
-    winctrl_set_variable(ctx, "_IF_CONDITION", "true");
-    return true;
+static bool handle_collapse(WinControlContext* ctx, const Instruction* insn) {
+    return expand_selector(ctx, insn, false);
 }
 
-static bool handle_set_delay(WinControlContext* ctx, const Command* cmd) {
-    ctx->typing_delay_ms = atoi(cmd->params[0]);
-    return true;
+static bool handle_select_item(WinControlContext* ctx, const Instruction* insn) {
+    if (insn->argc > 2) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Usage: SelectItem \"selector\" [\"item\"]");
+        return false;
+    }
+    const char* selector = operand_value(ctx, &insn->args[0]);
+    const char* item = insn->argc > 1 ? operand_value(ctx, &insn->args[1]) : NULL;
+    IUIAutomationElement* element = NULL;
+    if (!selector || (insn->argc > 1 && !item) || !winctrl_find_element_by_selector(ctx, selector, &element)) {
+        return false;
+    }
+    bool selected = item ? winctrl_select_combo_item(ctx, element, item) : winctrl_select_item(ctx, element);
+    element->lpVtbl->Release(element);
+    return settle_after(ctx, SETTLE_ELEMENT, selected);
 }
 
-static bool handle_send_multi_mod_key(WinControlContext* ctx, const Command* cmd) {
-    WinModifierKeys mods = WMOD_NONE;
-    for (int i = 0; i < cmd->param_count - 1; i++) {
-        if (strcmp(cmd->params[i], "CTRL") == 0) mods |= WMOD_CTRL;
-        else if (strcmp(cmd->params[i], "ALT") == 0) mods |= WMOD_ALT;
-        else if (strcmp(cmd->params[i], "SHIFT") == 0) mods |= WMOD_SHIFT;
-        else if (strcmp(cmd->params[i], "WIN") == 0) mods |= WMOD_WIN;
+static int select_element(WinControlContext* ctx, const Selector* selector, IUIAutomationElement** element);
+
+static bool predicate_element_matches(WinControlContext* ctx, const Operand* args, int argc, bool* result) {
+    const char* text = operand_value(ctx, &args[0]);
+    if (!text) {
+        return false;
     }
 
-    WORD key = 0;
-    const char* keyStr = cmd->params[cmd->param_count - 1];
+    Selector selector;
+    if (!winctrl_selector_compile(text, &selector, ctx->last_error, sizeof(ctx->last_error))) {
+        return false;
+    }
 
-    if (strlen(keyStr) == 1) {
-        key = VkKeyScanEx(keyStr[0], GetKeyboardLayout(0)) & 0xFF;
+    if (snapshot_current(ctx)) {
+        *result = winctrl_snapshot_select(&ctx->target->snapshot, &selector) != -1;
     } else {
-        if (strcmp(keyStr, "TAB") == 0) key = VK_TAB;
-        else if (strcmp(keyStr, "ENTER") == 0) key = VK_RETURN;
-        else if (strcmp(keyStr, "ESC") == 0) key = VK_ESCAPE;
-        else if (strcmp(keyStr, "DELETE") == 0) key = VK_DELETE;
+        IUIAutomationElement* element = NULL;
+        *result = ctx->target->window && select_element(ctx, &selector, &element) == 1;
+        if (element) element->lpVtbl->Release(element);
     }
+    winctrl_selector_free(&selector);
+    return true;
+}
 
-    if (key != 0) {
-        winctrl_send_keys_with_modifier(mods, key);
-        return true;
+static bool handle_snapshot(WinControlContext* ctx, const Instruction* insn) {
+    return winctrl_take_snapshot(ctx);
+}
+
+static bool handle_save_snapshot(WinControlContext* ctx, const Instruction* insn) {
+    if (ctx->target->snapshot.count == 0) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "No snapshot taken");
+        return false;
     }
+    printf("Saving snapshot to %s\n", insn->args[0].str);
+    return winctrl_snapshot_save(&ctx->target->snapshot, insn->args[0].str, ctx->last_error, sizeof(ctx->last_error));
+}
 
-    sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-        "Invalid key combination. Modifiers: %d, Key: %s", mods, keyStr);
-    return false;
+static bool handle_set_delay(WinControlContext* ctx, const Instruction* insn) {
+    ctx->typing_delay_ms = insn->args[0].num;
+    return true;
+}
+
+static bool handle_send_multi_mod_key(WinControlContext* ctx, const Instruction* insn) {
+    if (insn->argc < 1) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Usage: SendMultiModKey [modifiers...] key");
+        return false;
+    }
+    return send_mod_key(ctx, insn);
 }
 
-static bool handle_click_element(WinControlContext* ctx, const Command* cmd) {
+static bool handle_click_element(WinControlContext* ctx, const Instruction* insn) {
     ElementProperties props;
-    props.automation_id = strcmp(cmd->params[0], "null") == 0 ? NULL : cmd->params[0];
-    props.class_name = strcmp(cmd->params[1], "null") == 0 ? NULL : cmd->params[1];
-    props.control_type = atoi(cmd->params[2]);
+    props.automation_id = strcmp(insn->args[0].str, "null") == 0 ? NULL : insn->args[0].str;
+    props.class_name = strcmp(insn->args[1].str, "null") == 0 ? NULL : insn->args[1].str;
+    props.control_type = insn->args[2].num;
 
     IUIAutomationElement* element = NULL;
     if (winctrl_find_element_by_properties(ctx, &props, &element)) {
         printf("Found element, clicking...\n");
-        bool clicked = winctrl_click_element(element);
-        element->lpVtbl->Release(element);
-        return clicked;
+        return click_found(ctx, element, DESKTOP_LEFT, 1);
     }
 
     sprintf_s(ctx->last_error, sizeof(ctx->last_error),
@@ -893,175 +2570,152 @@ static bool handle_click_element(WinControlContext* ctx, const Command* cmd) {
     return false;
 }
 
-typedef struct {
-    const char* name;
-    int param_count;
-    CommandHandler handler;
-} CommandDefinition;
-
 static const CommandDefinition COMMAND_TABLE[] = {
-    {"Click", 2, handle_click},
-    {"SendKeystroke", 1, handle_send_keystroke},
-    {"StartLog", 1, handle_start_log},
-    {"Log", 1, handle_log},
-    {"LogWarning", 1, handle_log_warning},
-    {"LogError", 1, handle_log_error},
-    {"LogHeader", 1, handle_log_header},
-    {"EndLog", 0, handle_end_log},
-    {"Sleep", 1, handle_sleep},
-    {"AttachProcess", 1, handle_attach_process},
-    {"BringToFront", 0, handle_bring_to_front},
-    {"RightClick", 2, handle_right_click},
-    {"DoubleClick", 2, handle_double_click},
-    {"ContainsElementText", 4, handle_contains_element_text},
-    {"RightClickElementByProperties", 3, handle_right_click_element},
-    {"DoubleClickElementByProperties", 3, handle_double_click_element},
-    {"SendModKey", 2, handle_send_mod_key},
-    {"SET", 2, handle_set},
-    {"IF", -1, handle_if},
-    {"ENDIF", 0, handle_endif},
-    {"SetDelay", 1, handle_set_delay},
-    {"SendMultiModKey", -1, handle_send_multi_mod_key},
-    {"ClickElementByProperties", 3, handle_click_element},
-    {NULL, 0, NULL}
+    {"Click", "ii", handle_click},
+    {"SendKeystroke", "v", handle_send_keystroke},
+    {"StartLog", "s", handle_start_log},
+    {"Log", "s", handle_log},
+    {"LogWarning", "s", handle_log_warning},
+    {"LogError", "s", handle_log_error},
+    {"LogHeader", "s", handle_log_header},
+    {"EndLog", "", handle_end_log},
+    {"Sleep", "i", handle_sleep},
+    {"AttachProcess", "s*", handle_attach_process},
+    {"USE", "s", handle_use},
+    {"BringToFront", "", handle_bring_to_front},
+    {"RightClick", "ii", handle_right_click},
+    {"DoubleClick", "ii", handle_double_click},
+    {"ContainsElementText", "ssnv", handle_contains_element_text, FLOW_NONE, NULL, predicate_contains_element_text},
+    {"RightClickElementByProperties", "ssn", handle_right_click_element},
+    {"DoubleClickElementByProperties", "ssn", handle_double_click_element},
+    {"SendModKey", "ss", handle_send_mod_key},
+    {"SET", "ws", handle_set},
+    {"IF", "*", NULL, FLOW_IF, test_condition},
+    {"ELSEIF", "*", NULL, FLOW_ELSEIF, test_condition},
+    {"ELSE", "", NULL, FLOW_ELSE},
+    {"ENDIF", "", NULL, FLOW_ENDIF},
+    {"LOOP", "v", NULL, FLOW_LOOP},
+    {"ENDLOOP", "", NULL, FLOW_ENDLOOP},
+    {"WHILE", "*", NULL, FLOW_WHILE, test_condition},
+    {"ENDWHILE", "", NULL, FLOW_ENDWHILE},
+    {"FOREACH", "ws*", NULL, FLOW_FOREACH},
+    {"ENDFOREACH", "", NULL, FLOW_ENDFOREACH},
+    {"BREAK", "", NULL, FLOW_BREAK},
+    {"CONTINUE", "", NULL, FLOW_CONTINUE},
+    {"SUB", "s*", NULL, FLOW_SUB},
+    {"ENDSUB", "", NULL, FLOW_ENDSUB},
+    {"RETURN", "", NULL, FLOW_RETURN},
+    {"CALL", "s*", NULL, FLOW_CALL},
+    {"INCLUDE", "s", NULL, FLOW_INCLUDE},
+    {"ElementExists", "v?vn", NULL, FLOW_PREDICATE, NULL, predicate_element_exists},
+    {"ElementNotExists", "v?vn", NULL, FLOW_PREDICATE, NULL, predicate_element_not_exists},
+    {"WaitForElement", "vvni", handle_wait_for_element},
+    {"ClickElement", "v", handle_click_selector},
+    {"RightClickElement", "v", handle_right_click_selector},
+    {"DoubleClickElement", "v", handle_double_click_selector},
+    {"InvokeElement", "v", handle_invoke_selector},
+    {"SetElementValue", "vv", handle_set_element_value},
+    {"Toggle", "v*", handle_toggle},
+    {"Expand", "v", handle_expand},
+    {"Collapse", "v", handle_collapse},
+    {"SelectItem", "v*", handle_select_item},
+    {"ElementMatches", "v", NULL, FLOW_PREDICATE, NULL, predicate_element_matches},
+    {"Snapshot", "", handle_snapshot},
+    {"SaveSnapshot", "s", handle_save_snapshot},
+    {"SetDelay", "i", handle_set_delay},
+    {"SetSettle", "siii", handle_set_settle},
+    {"WaitIdle", "*", handle_wait_idle},
+    {"SendMultiModKey", "*", handle_send_multi_mod_key},
+    {"ClickElementByProperties", "ssn", handle_click_element},
+    {NULL, NULL, NULL}
 };
 
+bool winctrl_parse_script(WinControlContext* ctx, const char* filename, Script* script) {
+    return winctrl_script_load(filename, script, ctx->last_error, sizeof(ctx->last_error));
+}
+
+bool winctrl_compile_script(WinControlContext* ctx, const Script* script, Program* program) {
+    return winctrl_program_compile(COMMAND_TABLE, script->first, script->count, script->path,
+        &ctx->modules, &ctx->vars, program, ctx->last_error, sizeof(ctx->last_error));
+}
+
+bool winctrl_run_script(WinControlContext* ctx, const Program* program, bool trace, int* fault_index) {
+    ctx->traced_calls = uia_calls;
+    return winctrl_program_run(ctx, program, trace, ctx->last_error, sizeof(ctx->last_error), fault_index);
+}
+
 bool winctrl_execute_command(WinControlContext* ctx, const Command* cmd) {
-    printf("Executing command: %s with %d parameters\n", cmd->name, cmd->param_count);
-    for(int i = 0; i < cmd->param_count; i++) {
-        printf("Parameter %d: '%s'\n", i, cmd->params[i]);
-    }
-
-    for (const CommandDefinition* def = COMMAND_TABLE; def->name != NULL; def++) {
-        if (strcmp(cmd->name, def->name) == 0) {
-            if (def->param_count != -1 && cmd->param_count != def->param_count) {
-                sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-                    "Invalid parameter count for %s: expected %d, got %d",
-                    cmd->name, def->param_count, cmd->param_count);
-                return false;
-            }
-            return def->handler(ctx, cmd);
-        }
+    Program program;
+    if (!winctrl_program_compile(COMMAND_TABLE, cmd, 1, NULL, NULL, &ctx->vars, &program,
+            ctx->last_error, sizeof(ctx->last_error))) {
+        return false;
     }
 
-    sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-        "Unknown command: %s", cmd->name);
-    return false;
+    bool result = winctrl_run_script(ctx, &program, true, NULL);
+    winctrl_program_free(&program);
+    return result;
 }
 
-static bool create_property_condition(WinControlContext* ctx,
-                                    int property_id,
-                                    VARIANT value,
-                                    IUIAutomationCondition** condition) {
-    HRESULT hr = ctx->automation->lpVtbl->CreatePropertyCondition(
-        ctx->automation,
-        property_id,
-        value,
-        condition
-    );
-    return SUCCEEDED(hr);
+/*
+ * The recording counterpart of search_process_windows: the attached window
+ * first, then the process's other windows one after another through the
+ * desktop, so the trace holds each search in an order a replay repeats.
+ */
+static IUIAutomationElement* record_process_windows(WinControlContext* ctx, const Locator* locator,
+    bool* searched) {
+    IUIAutomationElement* root = get_recorded_root(ctx);
+    *searched = false;
+    IUIAutomationElement* element = root ? desktop_find_first(ctx, root, locator, searched) : NULL;
+    if (element || !*searched) {
+        return element;
+    }
+
+    HWND windows[MAX_SEARCH_WINDOWS];
+    windows[0] = ctx->target->window;
+    ProcessWindows data = { ctx->target->process_id, windows, 1 };
+    EnumWindows(collect_window_callback, (LPARAM)&data);
+    for (int i = 1; !element && i < data.count; i++) {
+        void* window_root = ctx->desktop.ops->window_root(ctx->desktop.backend, (uintptr_t)windows[i]);
+        if (!window_root) continue;
+        bool window_searched;
+        element = desktop_find_first(ctx, window_root, locator, &window_searched);
+        ctx->desktop.ops->release(ctx->desktop.backend, window_root);
+    }
+    return element;
 }
 
+/* Returns a new reference, like FindFirst, so callers release the element as before. */
+static HRESULT find_first(WinControlContext* ctx, const Locator* locator, IUIAutomationElement** element) {
+    if (ctx->recorder) {
+        bool searched = false;
+        *element = record_process_windows(ctx, locator, &searched);
+        return searched ? S_OK : E_FAIL;
+    }
+    if (!ctx->target->watching) {
+        *element = build_uia_element(ctx, locator);
+        return S_OK;
+    }
+
+    *element = winctrl_locator_cache_get(&ctx->target->elements, locator);
+    if (*element) {
+        (*element)->lpVtbl->AddRef(*element);
+    }
+    return S_OK;
+}
 
 bool winctrl_find_element_by_properties(WinControlContext* ctx,
     const ElementProperties* props,
     IUIAutomationElement** element) {
 
-    if (!ctx->current_window) {
+    if (!ctx->target->window) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error), "No window attached");
         return false;
     }
 
     printf("Looking for element with properties...\n");
 
-    IUIAutomationCondition* conditions[3] = {NULL};
-    int condition_count = 0;
-
-    if (props->automation_id) {
-        WCHAR wide_id[256];
-        MultiByteToWideChar(CP_UTF8, 0, props->automation_id, -1, wide_id, 256);
-        VARIANT var;
-        var.vt = VT_BSTR;
-        var.bstrVal = SysAllocString(wide_id);
-        ctx->automation->lpVtbl->CreatePropertyCondition(
-            ctx->automation,
-            UIA_AutomationIdPropertyId,
-            var,
-            &conditions[condition_count++]
-        );
-        SysFreeString(var.bstrVal);
-    }
-
-    if (props->class_name) {
-        WCHAR wide_class[256];
-        MultiByteToWideChar(CP_UTF8, 0, props->class_name, -1, wide_class, 256);
-        VARIANT var;
-        var.vt = VT_BSTR;
-        var.bstrVal = SysAllocString(wide_class);
-        ctx->automation->lpVtbl->CreatePropertyCondition(
-            ctx->automation,
-            UIA_ClassNamePropertyId,
-            var,
-            &conditions[condition_count++]
-        );
-        SysFreeString(var.bstrVal);
-    }
-
-    if (props->control_type != -1) {
-        VARIANT var;
-        var.vt = VT_I4;
-        var.lVal = props->control_type;
-        ctx->automation->lpVtbl->CreatePropertyCondition(
-            ctx->automation,
-            UIA_ControlTypePropertyId,
-            var,
-            &conditions[condition_count++]
-        );
-    }
-
-    IUIAutomationCondition* final_condition = NULL;
-    if (condition_count > 0) {
-        if (condition_count == 1) {
-            final_condition = conditions[0];
-        } else {
-            final_condition = conditions[0];
-            for (int i = 1; i < condition_count; i++) {
-                IUIAutomationCondition* temp = final_condition;
-                ctx->automation->lpVtbl->CreateAndCondition(
-                    ctx->automation,
-                    temp,
-                    conditions[i],
-                    &final_condition
-                );
-                if (i > 1) {
-                    temp->lpVtbl->Release(temp);
-                }
-                conditions[i]->lpVtbl->Release(conditions[i]);
-            }
-            conditions[0]->lpVtbl->Release(conditions[0]);
-        }
-    }
-
-    IUIAutomationElement* root = NULL;
-    HRESULT hr = ctx->automation->lpVtbl->ElementFromHandle(
-        ctx->automation,
-        ctx->current_window,
-        &root
-    );
-
-    if (SUCCEEDED(hr) && root) {
-        hr = root->lpVtbl->FindFirst(
-            root,
-            TreeScope_Descendants,
-            final_condition,
-            element
-        );
-        root->lpVtbl->Release(root);
-    }
-
-    if (final_condition) {
-        final_condition->lpVtbl->Release(final_condition);
-    }
+    Locator locator = { props->automation_id, props->class_name, props->control_type, NULL };
+    HRESULT hr = find_first(ctx, &locator, element);
 
     if (SUCCEEDED(hr) && *element) {
         printf("Element found!\n");
@@ -1074,113 +2728,190 @@ bool winctrl_find_element_by_properties(WinControlContext* ctx,
 
 
 bool winctrl_find_element_by_name(WinControlContext* ctx, const char* name, IUIAutomationElement** element) {
-    if (!ctx->current_window) {
+    if (!ctx->target->window) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error), "No window attached");
         return false;
     }
 
     printf("Looking for element: %s\n", name);
 
-    WCHAR wide_name[256];
-    MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, 256);
+    Locator locator = { NULL, NULL, -1, name };
+    HRESULT hr = find_first(ctx, &locator, element);
 
-    VARIANT var;
-    var.vt = VT_BSTR;
-    var.bstrVal = SysAllocString(wide_name);
+    if (FAILED(hr) || !*element) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Element not found: %s", name);
+        return false;
+    }
 
-    IUIAutomationCondition* condition = NULL;
-    HRESULT hr = ctx->automation->lpVtbl->CreatePropertyCondition(
-        ctx->automation,
-        UIA_NamePropertyId,
-        var,
-        &condition
-    );
+    printf("Found element: %s\n", name);
+    return true;
+}
 
-    if (FAILED(hr)) {
-        SysFreeString(var.bstrVal);
-        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Failed to create search condition");
+/* Child steps search TreeScope_Children only; the last step fetches its element with the prefetch request. */
+static bool uia_find_nodes(void* backend, void* node, bool descendants, const Locator* locator, bool first_only,
+    SelectorMatches* matches) {
+    WinControlContext* ctx = backend;
+    IUIAutomationElement* parent = node;
+    IUIAutomationCondition* condition = winctrl_locator_cache_get(&ctx->conditions, locator);
+    if (!condition) {
         return false;
     }
+    TreeScope scope = descendants ? TreeScope_Descendants : TreeScope_Children;
 
-    IUIAutomationElement* root = NULL;
-    hr = ctx->automation->lpVtbl->ElementFromHandle(
-        ctx->automation,
-        ctx->current_window,
-        &root
-    );
+    if (first_only) {
+        IUIAutomationElement* element = NULL;
+        HRESULT hr = UIA_CALL(parent->lpVtbl->FindFirstBuildCache(parent, scope, condition, ctx->prefetch, &element));
+        if (FAILED(hr)) {
+            return false;
+        }
+        if (element && !winctrl_selector_matches_push(matches, element)) {
+            element->lpVtbl->Release(element);
+            return false;
+        }
+        return true;
+    }
 
+    IUIAutomationElementArray* found = NULL;
+    HRESULT hr = UIA_CALL(parent->lpVtbl->FindAll(parent, scope, condition, &found));
     if (FAILED(hr)) {
-        condition->lpVtbl->Release(condition);
-        SysFreeString(var.bstrVal);
-        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Failed to get root element");
         return false;
     }
+    if (!found) {
+        return true;
+    }
 
-    hr = root->lpVtbl->FindFirst(
-        root,
-        TreeScope_Descendants,
-        condition,
-        element
-    );
+    int length = 0;
+    found->lpVtbl->get_Length(found, &length);
+    bool ok = true;
+    for (int i = 0; ok && i < length; i++) {
+        IUIAutomationElement* element = NULL;
+        if (SUCCEEDED(found->lpVtbl->GetElement(found, i, &element)) && element &&
+            !winctrl_selector_matches_push(matches, element)) {
+            element->lpVtbl->Release(element);
+            ok = false;
+        }
+    }
+    found->lpVtbl->Release(found);
+    return ok;
+}
 
-    root->lpVtbl->Release(root);
-    condition->lpVtbl->Release(condition);
-    SysFreeString(var.bstrVal);
+static void uia_release_node(void* backend, void* node) {
+    IUIAutomationElement* element = node;
+    element->lpVtbl->Release(element);
+}
 
-    if (FAILED(hr) || !*element) {
-        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "Element not found: %s", name);
-        return false;
+/*
+ * Returns 1 with a new reference in element, 0 when nothing matches, -1 when a search failed.
+ * The recorded root belongs to the target; the live one is a new reference.
+ */
+static int select_element(WinControlContext* ctx, const Selector* selector, IUIAutomationElement** element) {
+    *element = NULL;
+    IUIAutomationElement* root = ctx->recorder ? get_recorded_root(ctx) : get_root_element(ctx);
+    if (!root) {
+        return -1;
     }
 
-    printf("Found element: %s\n", name);
-    return true;
+    void* result = NULL;
+    SelectorTreeOps tree = { ctx->desktop.ops->find, ctx->desktop.ops->release };
+    int status = winctrl_selector_evaluate(selector, &tree, ctx->desktop.backend, root, &result);
+    if (!ctx->recorder) {
+        root->lpVtbl->Release(root);
+    }
+    *element = result;
+    return status;
 }
 
-bool winctrl_find_element_by_id(WinControlContext* ctx, const char* automation_id, IUIAutomationElement** element) {
-    if (!ctx->current_window) {
+bool winctrl_find_element_by_selector(WinControlContext* ctx, const char* text, IUIAutomationElement** element) {
+    *element = NULL;
+    if (!ctx->target->window) {
         sprintf_s(ctx->last_error, sizeof(ctx->last_error), "No window attached");
         return false;
     }
 
-    WCHAR wide_id[256];
-    MultiByteToWideChar(CP_UTF8, 0, automation_id, -1, wide_id, 256);
+    Selector selector;
+    if (!winctrl_selector_compile(text, &selector, ctx->last_error, sizeof(ctx->last_error))) {
+        return false;
+    }
 
-    VARIANT var;
-    var.vt = VT_BSTR;
-    var.bstrVal = SysAllocString(wide_id);
+    printf("Looking for element: %s\n", text);
+    int status = select_element(ctx, &selector, element);
+    winctrl_selector_free(&selector);
+    if (status == 1) {
+        return true;
+    }
 
-    IUIAutomationCondition* condition = NULL;
-    if (!create_property_condition(ctx, UIA_AutomationIdPropertyId, var, &condition)) {
-        SysFreeString(var.bstrVal);
+    sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+        status == 0 ? "No element matches selector: %s" : "Element search failed for selector: %s", text);
+    return false;
+}
+
+bool winctrl_find_element_by_id(WinControlContext* ctx, const char* automation_id, IUIAutomationElement** element) {
+    if (!ctx->target->window) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "No window attached");
         return false;
     }
 
-    IUIAutomationElement* root = NULL;
-    ctx->automation->lpVtbl->ElementFromHandle(ctx->automation, ctx->current_window, &root);
+    Locator locator = { automation_id, NULL, -1, NULL };
+    HRESULT hr = find_first(ctx, &locator, element);
+    return SUCCEEDED(hr) && *element != NULL;
+}
 
-    HRESULT hr = root->lpVtbl->FindFirst(root, TreeScope_Descendants, condition, element);
+typedef struct {
+    WinControlContext* ctx;
+    const Locator* locator;
+    IUIAutomationElement* element;
+} ElementWait;
+
+static int probe_element(void* user) {
+    ElementWait* wait = user;
+    find_first(wait->ctx, wait->locator, &wait->element);
+    return wait->element ? 1 : 0;
+}
 
-    root->lpVtbl->Release(root);
-    condition->lpVtbl->Release(condition);
-    SysFreeString(var.bstrVal);
+/*
+ * Searches again whenever the window reports a change or a window opens.
+ * Without change events the fallback polling is the only trigger, so it
+ * is kept short.
+ */
+static bool wait_for_locator(WinControlContext* ctx, const Locator* locator, int timeout_ms, IUIAutomationElement** element) {
+    *element = NULL;
+    if (!ctx->target->window) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error), "No window attached");
+        return false;
+    }
 
-    return SUCCEEDED(hr) && *element != NULL;
+    ElementWait wait = { ctx, locator, NULL };
+    int max_poll_ms = ctx->target->watching ? WAIT_POLL_MAX_MS : WAIT_POLL_UNWATCHED_MS;
+    if (winctrl_wait_until(&ctx->waiter, probe_element, &wait, timeout_ms, max_poll_ms) <= 0) {
+        return false;
+    }
+    *element = wait.element;
+    return true;
 }
 
 bool winctrl_wait_for_element(WinControlContext* ctx, const char* name, int timeout_ms, IUIAutomationElement** element) {
-    int elapsed = 0;
-    const int sleep_interval = 100;
-
-    while (elapsed < timeout_ms) {
-        if (winctrl_find_element_by_name(ctx, name, element)) {
-            return true;
-        }
-        Sleep(sleep_interval);
-        elapsed += sleep_interval;
+    Locator locator = { NULL, NULL, -1, name };
+    if (wait_for_locator(ctx, &locator, timeout_ms, element)) {
+        return true;
+    }
+    if (ctx->target->window) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Timeout waiting for element: %s", name);
     }
+    return false;
+}
 
-    sprintf_s(ctx->last_error, sizeof(ctx->last_error),
-        "Timeout waiting for element: %s", name);
+bool winctrl_wait_for_element_by_properties(WinControlContext* ctx, const ElementProperties* props, int timeout_ms,
+    IUIAutomationElement** element) {
+    Locator locator = { props->automation_id, props->class_name, props->control_type, NULL };
+    if (wait_for_locator(ctx, &locator, timeout_ms, element)) {
+        return true;
+    }
+    if (ctx->target->window) {
+        sprintf_s(ctx->last_error, sizeof(ctx->last_error),
+            "Timeout after %d ms waiting for element: %s", timeout_ms,
+            props->automation_id ? props->automation_id : props->class_name ? props->class_name : "(any)");
+    }
     return false;
 }
 
@@ -1195,12 +2926,7 @@ bool winctrl_right_click_element(IUIAutomationElement* element) {
 
     printf("Right-clicking element at coordinates: %d, %d\n", centerX, centerY);
 
-    SetCursorPos(centerX, centerY);
-    mouse_event(MOUSEEVENTF_RIGHTDOWN, 0, 0, 0, 0);
-    Sleep(10);
-    mouse_event(MOUSEEVENTF_RIGHTUP, 0, 0, 0, 0);
-    Sleep(100);
-
+    winctrl_right_click(centerX, centerY);
     return true;
 }
 
@@ -1217,172 +2943,229 @@ bool winctrl_double_click_element(IUIAutomationElement* element) {
 
     printf("Double-clicking element at coordinates: %d, %d\n", centerX, centerY);
 
-    SetCursorPos(centerX, centerY);
-    mouse_event(MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
-    Sleep(10);
-    mouse_event(MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_LEFTUP, 0, 0, 0, 0);
-    Sleep(100);
-
+    winctrl_double_click(centerX, centerY);
     return true;
 }
 
-bool evaluate_condition(WinControlContext* ctx, const char* condition) {
-    if (strncmp(condition, "ElementExists", 12) == 0) {
-        const char* element_name = condition + 13;
-        IUIAutomationElement* element = NULL;
-        ElementProperties props = {0};
-        props.automation_id = element_name;
-        return winctrl_find_element_by_properties(ctx, &props, &element);
-    }
+/*
+ * The Windows desktop: element actions go through the control's own UI
+ * Automation pattern, which is one call into the target process and needs
+ * neither the cursor nor focus. desktop.c falls back to synthesized input
+ * for controls without the pattern.
+ */
+static bool get_pattern(IUIAutomationElement* element, PATTERNID pattern_id, void** pattern) {
+    *pattern = NULL;
+    HRESULT hr = UIA_CALL(element->lpVtbl->GetCurrentPattern(element, pattern_id, (IUnknown**)pattern));
+    return SUCCEEDED(hr) && *pattern;
+}
 
-    if (strncmp(condition, "ElementNotExists", 15) == 0) {
-        const char* element_name = condition + 16;
-        IUIAutomationElement* element = NULL;
-        ElementProperties props = {0};
-        props.automation_id = element_name;
-        bool exists = winctrl_find_element_by_properties(ctx, &props, &element);
-        if (element) element->lpVtbl->Release(element);
-        return !exists;
+static BSTR utf8_to_bstr(const char* text) {
+    int length = MultiByteToWideChar(CP_UTF8, 0, text, -1, NULL, 0);
+    BSTR str = length > 0 ? SysAllocStringLen(NULL, (UINT)(length - 1)) : NULL;
+    if (str) {
+        MultiByteToWideChar(CP_UTF8, 0, text, -1, str, length);
     }
+    return str;
+}
 
-    if (strncmp(condition, "ContainsElementText", 18) == 0) {
-        char params[4][256] = {0};
-        int param_count = 0;
-
-        const char* start = condition + 19;
-        char* token;
-        char* next_token = NULL;
-        char condition_copy[512];
-        strncpy_s(condition_copy, sizeof(condition_copy), start, _TRUNCATE);
-
-        token = strtok_s(condition_copy, " ", &next_token);
-        while (token && param_count < 4) {
-            if (token[0] == '"') {
-                token++;
-                char* end_quote = strrchr(token, '"');
-                if (end_quote) *end_quote = '\0';
-            }
-            strncpy_s(params[param_count], sizeof(params[param_count]), token, _TRUNCATE);
-            param_count++;
-            token = strtok_s(NULL, " ", &next_token);
-        }
+static void take_bstr(BSTR str, char* text, size_t text_size) {
+    text[0] = '\0';
+    if (str) {
+        WideCharToMultiByte(CP_UTF8, 0, str, -1, text, (int)text_size, NULL, NULL);
+        SysFreeString(str);
+    }
+}
 
-        if (param_count == 4) {
-            ElementProperties props = {0};
-            props.automation_id = params[0];
-            props.class_name = params[1];
-            props.control_type = atoi(params[2]);
+static void* win_window_root(void* backend, uintptr_t window) {
+    WinControlContext* ctx = backend;
+    IUIAutomationElement* root = NULL;
+    UIA_CALL(ctx->automation->lpVtbl->ElementFromHandleBuildCache(ctx->automation, (HWND)window, ctx->prefetch, &root));
+    return root;
+}
 
-            char element_text[256] = {0};
-            IUIAutomationElement* element = NULL;
+static bool win_read(void* backend, void* element, ElementInfo* info) {
+    (void)backend;
+    IUIAutomationElement* el = element;
+    RECT rect;
+    if (!get_element_rect(el, &rect)) {
+        return false;
+    }
 
-            const char* compare_text;
-            if (params[3][0] == '$') {
-                compare_text = winctrl_get_variable(ctx, params[3] + 1);
-                if (!compare_text) {
-                    return false;
-                }
-            } else {
-                compare_text = params[3];
-            }
+    BSTR name = NULL;
+    BSTR automation_id = NULL;
+    BSTR class_name = NULL;
+    CONTROLTYPEID control_type = 0;
+    BOOL offscreen = FALSE;
+    bool enabled = false;
+    read_name(el, &name);
+    if (FAILED(el->lpVtbl->get_CachedAutomationId(el, &automation_id))) {
+        UIA_CALL(el->lpVtbl->get_CurrentAutomationId(el, &automation_id));
+    }
+    if (FAILED(el->lpVtbl->get_CachedClassName(el, &class_name))) {
+        UIA_CALL(el->lpVtbl->get_CurrentClassName(el, &class_name));
+    }
+    if (FAILED(el->lpVtbl->get_CachedControlType(el, &control_type))) {
+        UIA_CALL(el->lpVtbl->get_CurrentControlType(el, &control_type));
+    }
+    read_offscreen(el, &offscreen);
+    winctrl_is_element_enabled(el, &enabled);
+
+    take_bstr(name, info->name, sizeof(info->name));
+    take_bstr(automation_id, info->automation_id, sizeof(info->automation_id));
+    take_bstr(class_name, info->class_name, sizeof(info->class_name));
+    info->control_type = control_type;
+    info->rect = (DesktopRect){ rect.left, rect.top, rect.right, rect.bottom };
+    info->enabled = enabled;
+    info->offscreen = offscreen ? true : false;
+    return true;
+}
 
-            if (winctrl_find_element_by_properties(ctx, &props, &element)) {
-                BSTR bstr_value = NULL;
-                if (SUCCEEDED(element->lpVtbl->get_CurrentName(element, &bstr_value)) && bstr_value) {
-                    WideCharToMultiByte(CP_UTF8, 0, bstr_value, -1, element_text, sizeof(element_text), NULL, NULL);
-                    SysFreeString(bstr_value);
-                    element->lpVtbl->Release(element);
+static bool win_read_value(void* backend, void* element, char* value, size_t value_size) {
+    (void)backend;
+    BSTR text = NULL;
+    if (FAILED(read_value(element, &text)) || !text) {
+        return false;
+    }
+    take_bstr(text, value, value_size);
+    return true;
+}
 
-                    return (strstr(element_text, compare_text) != NULL);
-                }
-                element->lpVtbl->Release(element);
-            }
+static int win_act(void* backend, void* element, DesktopAction action, const char* value) {
+    (void)backend;
+    IUIAutomationElement* el = element;
+    HRESULT hr = E_FAIL;
+    switch (action) {
+    case DESKTOP_INVOKE: {
+        IUIAutomationInvokePattern* pattern;
+        if (!get_pattern(el, UIA_InvokePatternId, (void**)&pattern)) return DESKTOP_UNSUPPORTED;
+        hr = UIA_CALL(pattern->lpVtbl->Invoke(pattern));
+        pattern->lpVtbl->Release(pattern);
+        break;
+    }
+    case DESKTOP_SET_VALUE: {
+        IUIAutomationValuePattern* pattern;
+        if (!get_pattern(el, UIA_ValuePatternId, (void**)&pattern)) return DESKTOP_UNSUPPORTED;
+        BOOL read_only = FALSE;
+        UIA_CALL(pattern->lpVtbl->get_CurrentIsReadOnly(pattern, &read_only));
+        BSTR wide_value = read_only ? NULL : utf8_to_bstr(value);
+        if (wide_value) {
+            hr = UIA_CALL(pattern->lpVtbl->SetValue(pattern, wide_value));
+            SysFreeString(wide_value);
         }
-        return false;
+        pattern->lpVtbl->Release(pattern);
+        break;
+    }
+    case DESKTOP_TOGGLE: {
+        IUIAutomationTogglePattern* pattern;
+        if (!get_pattern(el, UIA_TogglePatternId, (void**)&pattern)) return DESKTOP_UNSUPPORTED;
+        hr = UIA_CALL(pattern->lpVtbl->Toggle(pattern));
+        pattern->lpVtbl->Release(pattern);
+        break;
+    }
+    case DESKTOP_EXPAND:
+    case DESKTOP_COLLAPSE: {
+        IUIAutomationExpandCollapsePattern* pattern;
+        if (!get_pattern(el, UIA_ExpandCollapsePatternId, (void**)&pattern)) return DESKTOP_UNSUPPORTED;
+        bool expand = action == DESKTOP_EXPAND;
+        ExpandCollapseState state = ExpandCollapseState_Collapsed;
+        hr = UIA_CALL(pattern->lpVtbl->get_CurrentExpandCollapseState(pattern, &state));
+        bool expanded = state == ExpandCollapseState_Expanded || state == ExpandCollapseState_PartiallyExpanded;
+        if (SUCCEEDED(hr) && state != ExpandCollapseState_LeafNode && expanded != expand) {
+            hr = expand ? UIA_CALL(pattern->lpVtbl->Expand(pattern)) : UIA_CALL(pattern->lpVtbl->Collapse(pattern));
+        }
+        pattern->lpVtbl->Release(pattern);
+        break;
+    }
+    case DESKTOP_SELECT: {
+        IUIAutomationSelectionItemPattern* pattern;
+        if (!get_pattern(el, UIA_SelectionItemPatternId, (void**)&pattern)) return DESKTOP_UNSUPPORTED;
+        hr = UIA_CALL(pattern->lpVtbl->Select(pattern));
+        pattern->lpVtbl->Release(pattern);
+        break;
+    }
+    case DESKTOP_FOCUS:
+        hr = UIA_CALL(el->lpVtbl->SetFocus(el));
+        break;
     }
+    if (FAILED(hr)) {
+        printf("UI Automation pattern call failed (0x%08lx)\n", (unsigned long)hr);
+        return DESKTOP_FAILED;
+    }
+    return DESKTOP_DONE;
+}
 
-    return false;
+static int win_toggle_state(void* backend, void* element) {
+    (void)backend;
+    IUIAutomationTogglePattern* pattern;
+    if (!get_pattern(element, UIA_TogglePatternId, (void**)&pattern)) {
+        return -1;
+    }
+    ToggleState state = ToggleState_Indeterminate;
+    HRESULT hr = UIA_CALL(pattern->lpVtbl->get_CurrentToggleState(pattern, &state));
+    pattern->lpVtbl->Release(pattern);
+    return SUCCEEDED(hr) ? (int)state : -1;
 }
 
+static void win_click(void* backend, int x, int y, DesktopButton button, int count) {
+    (void)backend;
+    DWORD flags[4];
+    count = count > 2 ? 2 : count;
+    for (int i = 0; i < count; i++) {
+        flags[2 * i] = button == DESKTOP_RIGHT ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_LEFTDOWN;
+        flags[2 * i + 1] = button == DESKTOP_RIGHT ? MOUSEEVENTF_RIGHTUP : MOUSEEVENTF_LEFTUP;
+    }
+    printf("Clicking at coordinates: %d, %d\n", x, y);
+    send_mouse(x, y, flags, 2 * count);
+}
 
+static bool win_map_key(void* backend, uint32_t codepoint, uint16_t* vkey, uint16_t* scan, uint8_t* state) {
+    (void)backend;
+    return win_layout_map(GetKeyboardLayout(0), codepoint, vkey, scan, state);
+}
 
-int winctrl_parse_script(const char* filename, Command* commands, int max_commands) {
-    FILE* file;
-    if (fopen_s(&file, filename, "r") != 0) {
-        return -1;
-    }
+static const DesktopOps WIN_DESKTOP_OPS = {
+    { win_list_pids, win_process_name, win_main_window, win_window_alive },
+    win_window_root,
+    uia_find_nodes,
+    uia_release_node,
+    win_read,
+    win_read_value,
+    win_act,
+    win_toggle_state,
+    win_click,
+    win_map_key,
+    { win_send_input, win_pause }
+};
 
-    char line[512];
-    int count = 0;
-    bool skip_commands = false;
+bool winctrl_set_element_value(WinControlContext* ctx, IUIAutomationElement* element, const char* value) {
+    return winctrl_desktop_perform(&ctx->desktop, element, DESKTOP_SET_VALUE, value, &ctx->keys,
+                                   ctx->typing_delay_ms, ctx->last_error, sizeof(ctx->last_error));
+}
 
-    while (fgets(line, sizeof(line), file) && count < max_commands) {
-        char* comment = strchr(line, '#');
-        if (comment) {
-            *comment = '\0';
-        }
+bool winctrl_invoke_element(WinControlContext* ctx, IUIAutomationElement* element) {
+    return winctrl_desktop_perform(&ctx->desktop, element, DESKTOP_INVOKE, NULL, &ctx->keys,
+                                   ctx->typing_delay_ms, ctx->last_error, sizeof(ctx->last_error));
+}
 
-        bool isEmpty = true;
-        for (char* p = line; *p; p++) {
-            if (!isspace(*p)) {
-                isEmpty = false;
-                break;
-            }
-        }
-        if (isEmpty) continue;
-
-        Command* current_cmd = &commands[count];
-        current_cmd->param_count = 0;
-
-        char* next_token = NULL;
-        char* token = strtok_s(line, " \t\n\r", &next_token);
-        if (!token) continue;
-
-        strncpy_s(current_cmd->name, sizeof(current_cmd->name), token, _TRUNCATE);
-
-        while ((token = strtok_s(NULL, " \t\n\r", &next_token)) != NULL &&
-               current_cmd->param_count < 4) {
-
-            if (token[0] == '"') {
-                token++;
-
-                char* end_quote = strrchr(token, '"');
-                if (end_quote) {
-                    *end_quote = '\0';
-                    strncpy_s(current_cmd->params[current_cmd->param_count],
-                        sizeof(current_cmd->params[current_cmd->param_count]),
-                        token, _TRUNCATE);
-                } else {
-                    char full_param[256] = {0};
-                    strncpy_s(full_param, sizeof(full_param), token, _TRUNCATE);
-
-                    while ((token = strtok_s(NULL, "\n\r", &next_token)) != NULL) {
-                        strncat_s(full_param, sizeof(full_param), " ", _TRUNCATE);
-                        strncat_s(full_param, sizeof(full_param), token, _TRUNCATE);
-
-                        if (strchr(token, '"')) {
-                            char* end = strrchr(full_param, '"');
-                            if (end) *end = '\0';
-                            break;
-                        }
-                    }
-
-                    strncpy_s(current_cmd->params[current_cmd->param_count],
-                        sizeof(current_cmd->params[current_cmd->param_count]),
-                        full_param, _TRUNCATE);
-                }
-            } else {
-                strncpy_s(current_cmd->params[current_cmd->param_count],
-                    sizeof(current_cmd->params[current_cmd->param_count]),
-                    token, _TRUNCATE);
-            }
+bool winctrl_toggle_element(WinControlContext* ctx, IUIAutomationElement* element) {
+    return winctrl_desktop_perform(&ctx->desktop, element, DESKTOP_TOGGLE, NULL, &ctx->keys,
+                                   ctx->typing_delay_ms, ctx->last_error, sizeof(ctx->last_error));
+}
 
-            current_cmd->param_count++;
-        }
+bool winctrl_check_checkbox(WinControlContext* ctx, IUIAutomationElement* element, bool check) {
+    return winctrl_desktop_set_toggle(&ctx->desktop, element, check, ctx->last_error, sizeof(ctx->last_error));
+}
 
-        count++;
-    }
+bool winctrl_expand_collapse(WinControlContext* ctx, IUIAutomationElement* element, bool expand) {
+    return winctrl_desktop_perform(&ctx->desktop, element, expand ? DESKTOP_EXPAND : DESKTOP_COLLAPSE, NULL,
+                                   &ctx->keys, ctx->typing_delay_ms, ctx->last_error, sizeof(ctx->last_error));
+}
+
+bool winctrl_select_item(WinControlContext* ctx, IUIAutomationElement* element) {
+    return winctrl_desktop_perform(&ctx->desktop, element, DESKTOP_SELECT, NULL, &ctx->keys,
+                                   ctx->typing_delay_ms, ctx->last_error, sizeof(ctx->last_error));
+}
 
-    fclose(file);
-    return count;
-}
\ No newline at end of file
+bool winctrl_select_combo_item(WinControlContext* ctx, IUIAutomationElement* element, const char* item) {
+    return winctrl_desktop_select_item(&ctx->desktop, element, item, ctx->last_error, sizeof(ctx->last_error));
+}
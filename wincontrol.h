@@ -5,13 +5,31 @@
 #include <stdbool.h>
 #include <time.h>
 #include <stdio.h>
+#include "script.h"
+#include "variables.h"
+#include "locator.h"
+#include "events.h"
+#include "snapshot.h"
+#include "selector.h"
+#include "paths.h"
+#include "workers.h"
+#include "registry.h"
+#include "keys.h"
+#include "settle.h"
+#include "desktop.h"
+#include "clock.h"
+#include "trace.h"
+
+#define LOCATOR_CACHE_LIMIT 1024
+#define WAIT_POLL_MAX_MS 1000
+#define WAIT_POLL_UNWATCHED_MS 100
+#define LEARNED_PATHS_FILE "wincontrol.paths"
+#define MAX_SEARCH_WINDOWS 32
+#define MAX_ATTACHMENTS 16
 
 typedef interface IUIAutomation IUIAutomation;
 typedef interface IUIAutomationElement IUIAutomationElement;
-
-#define MAX_VARIABLES 100
-#define MAX_VAR_NAME 32
-#define MAX_VAR_VALUE 256
+typedef interface IUIAutomationCacheRequest IUIAutomationCacheRequest;
 
 typedef enum {
     WMOD_NONE = 0,
@@ -28,83 +46,123 @@ typedef enum {
     LOG_HEADER
 } LogLevel;
 
-typedef struct {
-    char name[MAX_VAR_NAME];
-    char value[MAX_VAR_VALUE];
-} Variable;
-
-typedef struct {
-    Variable variables[MAX_VARIABLES];
-    int variable_count;
-} VariableContext;
-
-typedef struct {
-    char name[32];
-    char params[4][256];
-    int param_count;
-} Command;
-
 typedef struct {
     const char* automation_id;
     const char* class_name;
     int control_type;
 } ElementProperties;
 
+
+/*
+ * One attached application. Each keeps its own window, element cache,
+ * event subscription and snapshot, so a script can switch between
+ * several with USE without attaching again. name is empty for the
+ * attachment AttachProcess uses without AS.
+ */
 typedef struct {
+    char name[64];
+    WinControlContext* ctx;
+    DWORD process_id;
+    HWND window;
+    IUIAutomationElement* root;
+    IUIAutomationElement* recorded_root;
+    LocatorCache elements;
+    UiEventSource events;
+    bool watching;
+    volatile long ui_changes;
+    volatile long ui_events;
+    Snapshot snapshot;
+    bool snapshot_ready;
+    long snapshot_changes;
+    char process_name[MAX_PATH];
+    char window_class[256];
+} Attachment;
+
+struct WinControlContext {
     IUIAutomation* automation;
-    DWORD current_process_id;
-    HWND current_window;
+    IUIAutomationCacheRequest* prefetch;
+    IUIAutomationCacheRequest* runtime_ids;
+    Desktop desktop;
+    Clock clock;
+    LocatorCache conditions;
+    Attachment* target;
+    Attachment* attachments[MAX_ATTACHMENTS];
+    int attachment_count;
+    UiWaiter waiter;
+    PathIndex paths;
+    WorkerPool* workers;
+    ProcessRegistry processes;
+    long traced_calls;
     char last_error[256];
     VariableContext vars;
+    ModuleCache modules;
+    int if_condition_slot;
+    int contains_result_slot;
     FILE* log_file;
     char log_filename[256];
     int typing_delay_ms;
-} WinControlContext;
+    KeyEventBuffer keys;
+    SettlePolicies settle;
+    TraceRecorder* recorder;
+};
 
 bool winctrl_initialize(WinControlContext* ctx);
 void winctrl_cleanup(WinControlContext* ctx);
 const char* winctrl_get_last_error(WinControlContext* ctx);
+long winctrl_uia_call_count(void);
 
 void winctrl_click(int x, int y);
 void winctrl_right_click(int x, int y);
 void winctrl_double_click(int x, int y);
 void winctrl_right_click_coordinates(int x, int y);
 void winctrl_double_click_coordinates(int x, int y);
-void winctrl_send_keys(WinControlContext* ctx, const char* text);
+bool winctrl_send_keys(WinControlContext* ctx, const char* text);
 void winctrl_send_keys_with_modifier(WinModifierKeys modifiers, WORD key);
-void winctrl_sleep(int milliseconds);
+void winctrl_sleep(WinControlContext* ctx, int milliseconds);
+bool winctrl_wait_idle(WinControlContext* ctx, int timeout_ms);
+bool winctrl_start_recording(WinControlContext* ctx, const char* path);
+bool winctrl_stop_recording(WinControlContext* ctx);
 
 
 bool winctrl_attach_process(WinControlContext* ctx, const char* process_name);
 bool winctrl_attach_pid(WinControlContext* ctx, DWORD process_id);
+bool winctrl_attach_process_as(WinControlContext* ctx, const char* process_name, const char* name);
+bool winctrl_use_attachment(WinControlContext* ctx, const char* name);
 bool winctrl_bring_to_front(WinControlContext* ctx);
 bool winctrl_is_process_running(DWORD process_id);
 bool winctrl_find_element_by_properties(WinControlContext* ctx, const ElementProperties* props, IUIAutomationElement** element);
 bool winctrl_find_element_by_name(WinControlContext* ctx, const char* name, IUIAutomationElement** element);
 bool winctrl_find_element_by_id(WinControlContext* ctx, const char* automation_id, IUIAutomationElement** element);
+bool winctrl_find_element_by_selector(WinControlContext* ctx, const char* selector, IUIAutomationElement** element);
 bool winctrl_find_element_by_class(WinControlContext* ctx, const char* class_name, IUIAutomationElement** element);
 bool winctrl_find_element_by_type(WinControlContext* ctx, int control_type, IUIAutomationElement** element);
 bool winctrl_wait_for_element(WinControlContext* ctx, const char* name, int timeout_ms, IUIAutomationElement** element);
+bool winctrl_wait_for_element_by_properties(WinControlContext* ctx, const ElementProperties* props, int timeout_ms, IUIAutomationElement** element);
 bool winctrl_get_element_text(IUIAutomationElement* element, char* text, size_t text_size);
+bool winctrl_take_snapshot(WinControlContext* ctx);
 bool winctrl_get_element_text_by_properties(WinControlContext* ctx, const ElementProperties* props, char* text_out, size_t text_out_size);
-bool winctrl_set_element_value(IUIAutomationElement* element, const char* value);
+bool winctrl_set_element_value(WinControlContext* ctx, IUIAutomationElement* element, const char* value);
 bool winctrl_is_element_enabled(IUIAutomationElement* element, bool* enabled);
 bool winctrl_is_element_visible(IUIAutomationElement* element, bool* visible);
 bool winctrl_click_element(IUIAutomationElement* element);
 bool winctrl_right_click_element(IUIAutomationElement* element);
 bool winctrl_double_click_element(IUIAutomationElement* element);
-bool winctrl_select_combo_item(IUIAutomationElement* element, const char* item);
-bool winctrl_check_checkbox(IUIAutomationElement* element, bool check);
-bool winctrl_expand_collapse(IUIAutomationElement* element, bool expand);
+bool winctrl_invoke_element(WinControlContext* ctx, IUIAutomationElement* element);
+bool winctrl_toggle_element(WinControlContext* ctx, IUIAutomationElement* element);
+bool winctrl_select_item(WinControlContext* ctx, IUIAutomationElement* element);
+bool winctrl_select_combo_item(WinControlContext* ctx, IUIAutomationElement* element, const char* item);
+bool winctrl_check_checkbox(WinControlContext* ctx, IUIAutomationElement* element, bool check);
+bool winctrl_expand_collapse(WinControlContext* ctx, IUIAutomationElement* element, bool expand);
 bool winctrl_click_menu_item(WinControlContext* ctx, const char* menu, const char* item);
 bool winctrl_compare_text(const char* text1, const char* text2);
 bool winctrl_set_variable(WinControlContext* ctx, const char* name, const char* value);
 const char* winctrl_get_variable(WinControlContext* ctx, const char* name);
-bool evaluate_condition(WinControlContext* ctx, const char* condition);
 bool winctrl_start_logging(WinControlContext* ctx, const char* base_filename);
 void winctrl_log(WinControlContext* ctx, LogLevel level, const char* message);
 void winctrl_end_logging(WinControlContext* ctx);
-int winctrl_parse_script(const char* filename, Command* commands, int max_commands);
+bool winctrl_parse_script(WinControlContext* ctx, const char* filename, Script* script);
 bool winctrl_execute_command(WinControlContext* ctx, const Command* cmd);
+bool winctrl_compile_script(WinControlContext* ctx, const Script* script, Program* program);
+bool winctrl_run_script(WinControlContext* ctx, const Program* program, bool trace, int* fault_index);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,378 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "workers.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define bump_counter(counter) InterlockedIncrement(counter)
+#define set_flag(flag) InterlockedExchange(flag, 1)
+#define read_flag(flag) InterlockedCompareExchange((volatile long*)(flag), 0, 0)
+#else
+#include <pthread.h>
+#include <time.h>
+#define bump_counter(counter) __atomic_add_fetch(counter, 1, __ATOMIC_SEQ_CST)
+#define set_flag(flag) __atomic_store_n(flag, 1, __ATOMIC_SEQ_CST)
+#define read_flag(flag) __atomic_load_n(flag, __ATOMIC_SEQ_CST)
+#endif
+
+typedef struct SearchRace SearchRace;
+
+typedef struct RaceJob {
+    SearchRace* race;
+    int index;
+    struct RaceJob* next;
+} RaceJob;
+
+/*
+ * Shared by the caller and every search. refs counts the searches still
+ * queued or running plus the caller; whoever drops the last one frees it.
+ * Everything except cancelled is guarded by the pool lock.
+ */
+struct SearchRace {
+    SearchOps ops;
+    void* backend;
+    void** scopes;
+    RaceJob* jobs;
+    volatile long cancelled;
+    void* result;
+    int winner;
+    int pending;
+    int refs;
+};
+
+struct WorkerPool {
+#ifdef _WIN32
+    SRWLOCK lock;
+    CONDITION_VARIABLE work;
+    CONDITION_VARIABLE done;
+    HANDLE* threads;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t* threads;
+#endif
+    int thread_count;
+    RaceJob* head;
+    RaceJob* tail;
+    bool stopping;
+    WorkerThreadHook start;
+    WorkerThreadHook stop;
+    void* user;
+};
+
+#ifdef _WIN32
+
+static bool init_sync(WorkerPool* pool) {
+    InitializeSRWLock(&pool->lock);
+    InitializeConditionVariable(&pool->work);
+    InitializeConditionVariable(&pool->done);
+    return true;
+}
+
+static void free_sync(WorkerPool* pool) {
+    (void)pool;
+}
+
+static void lock_pool(WorkerPool* pool) {
+    AcquireSRWLockExclusive(&pool->lock);
+}
+
+static void unlock_pool(WorkerPool* pool) {
+    ReleaseSRWLockExclusive(&pool->lock);
+}
+
+static void wait_work(WorkerPool* pool) {
+    SleepConditionVariableSRW(&pool->work, &pool->lock, INFINITE, 0);
+}
+
+static void wait_done(WorkerPool* pool) {
+    SleepConditionVariableSRW(&pool->done, &pool->lock, INFINITE, 0);
+}
+
+static void wake_workers(WorkerPool* pool) {
+    WakeAllConditionVariable(&pool->work);
+}
+
+static void wake_callers(WorkerPool* pool) {
+    WakeAllConditionVariable(&pool->done);
+}
+
+static void sleep_ms(int milliseconds) {
+    Sleep((DWORD)milliseconds);
+}
+
+#else
+
+static bool init_sync(WorkerPool* pool) {
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        return false;
+    }
+    if (pthread_cond_init(&pool->work, NULL) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        return false;
+    }
+    if (pthread_cond_init(&pool->done, NULL) != 0) {
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        return false;
+    }
+    return true;
+}
+
+static void free_sync(WorkerPool* pool) {
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+static void lock_pool(WorkerPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+}
+
+static void unlock_pool(WorkerPool* pool) {
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void wait_work(WorkerPool* pool) {
+    pthread_cond_wait(&pool->work, &pool->lock);
+}
+
+static void wait_done(WorkerPool* pool) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+}
+
+static void wake_workers(WorkerPool* pool) {
+    pthread_cond_broadcast(&pool->work);
+}
+
+static void wake_callers(WorkerPool* pool) {
+    pthread_cond_broadcast(&pool->done);
+}
+
+static void sleep_ms(int milliseconds) {
+    struct timespec delay = { milliseconds / 1000, (long)(milliseconds % 1000) * 1000000 };
+    nanosleep(&delay, NULL);
+}
+
+#endif
+
+static void free_race(SearchRace* race) {
+    race->ops.finish(race->backend);
+    free(race);
+}
+
+static void run_job(WorkerPool* pool, RaceJob* job) {
+    SearchRace* race = job->race;
+    void* found = NULL;
+    if (!read_flag(&race->cancelled)) {
+        found = race->ops.search(race->backend, race->scopes[job->index], &race->cancelled);
+    }
+
+    lock_pool(pool);
+    if (found && !race->result) {
+        race->result = found;
+        race->winner = job->index;
+        set_flag(&race->cancelled);
+        found = NULL;
+    }
+    race->pending--;
+    bool last = --race->refs == 0;
+    wake_callers(pool);
+    unlock_pool(pool);
+
+    if (found) {
+        race->ops.release(race->backend, found);
+    }
+    if (last) {
+        free_race(race);
+    }
+}
+
+static void worker_loop(WorkerPool* pool) {
+    if (pool->start) pool->start(pool->user);
+    for (;;) {
+        lock_pool(pool);
+        while (!pool->head && !pool->stopping) {
+            wait_work(pool);
+        }
+        RaceJob* job = pool->head;
+        if (job) {
+            pool->head = job->next;
+            if (!pool->head) pool->tail = NULL;
+        }
+        unlock_pool(pool);
+
+        if (!job) {
+            break;
+        }
+        run_job(pool, job);
+    }
+    if (pool->stop) pool->stop(pool->user);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID param) {
+    worker_loop(param);
+    return 0;
+}
+#else
+static void* worker_main(void* param) {
+    worker_loop(param);
+    return NULL;
+}
+#endif
+
+static void stop_workers(WorkerPool* pool) {
+    lock_pool(pool);
+    pool->stopping = true;
+    wake_workers(pool);
+    unlock_pool(pool);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+#else
+        pthread_join(pool->threads[i], NULL);
+#endif
+    }
+    pool->thread_count = 0;
+}
+
+WorkerPool* winctrl_workers_create(int threads, WorkerThreadHook start, WorkerThreadHook stop, void* user) {
+    WorkerPool* pool = calloc(1, sizeof(WorkerPool));
+    if (!pool) return NULL;
+    pool->threads = calloc((size_t)threads, sizeof(pool->threads[0]));
+    if (!pool->threads || !init_sync(pool)) {
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pool->start = start;
+    pool->stop = stop;
+    pool->user = user;
+
+    for (int i = 0; i < threads; i++) {
+#ifdef _WIN32
+        pool->threads[i] = CreateThread(NULL, 0, worker_main, pool, 0, NULL);
+        bool started = pool->threads[i] != NULL;
+#else
+        bool started = pthread_create(&pool->threads[i], NULL, worker_main, pool) == 0;
+#endif
+        if (!started) {
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        free_sync(pool);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void winctrl_workers_destroy(WorkerPool* pool) {
+    if (!pool) return;
+    stop_workers(pool);
+    free_sync(pool);
+    free(pool->threads);
+    free(pool);
+}
+
+static void* search_in_turn(const SearchOps* ops, void* backend, void* const* scopes, int count, int* winner) {
+    volatile long cancelled = 0;
+    void* result = NULL;
+    for (int i = 0; !result && i < count; i++) {
+        result = ops->search(backend, scopes[i], &cancelled);
+        if (result) *winner = i;
+    }
+    ops->finish(backend);
+    return result;
+}
+
+void* winctrl_search_race(WorkerPool* pool, const SearchOps* ops, void* backend, void* const* scopes, int count,
+                          int* winner) {
+    *winner = -1;
+    SearchRace* race = pool && count > 1
+        ? calloc(1, sizeof(SearchRace) + (size_t)count * (sizeof(RaceJob) + sizeof(void*)))
+        : NULL;
+    if (!race) {
+        return search_in_turn(ops, backend, scopes, count, winner);
+    }
+
+    race->ops = *ops;
+    race->backend = backend;
+    race->jobs = (RaceJob*)(race + 1);
+    race->scopes = (void**)(race->jobs + count);
+    race->winner = -1;
+    race->pending = count;
+    race->refs = count + 1;
+    memcpy(race->scopes, scopes, (size_t)count * sizeof(void*));
+    for (int i = 0; i < count; i++) {
+        race->jobs[i].race = race;
+        race->jobs[i].index = i;
+        race->jobs[i].next = i + 1 < count ? &race->jobs[i + 1] : NULL;
+    }
+
+    lock_pool(pool);
+    if (pool->tail) {
+        pool->tail->next = &race->jobs[0];
+    } else {
+        pool->head = &race->jobs[0];
+    }
+    pool->tail = &race->jobs[count - 1];
+    wake_workers(pool);
+
+    while (!race->result && race->pending > 0) {
+        wait_done(pool);
+    }
+    void* result = race->result;
+    *winner = race->winner;
+    set_flag(&race->cancelled);
+    bool last = --race->refs == 0;
+    unlock_pool(pool);
+
+    if (last) {
+        free_race(race);
+    }
+    return result;
+}
+
+static void* simulated_search(void* backend, void* scope, const volatile long* cancelled) {
+    SimulatedSearch* sim = backend;
+    const SimulatedScope* window = scope;
+    bump_counter(&sim->searches);
+    for (int waited = 0; waited < window->delay_ms; waited++) {
+        if (read_flag(cancelled)) {
+            bump_counter(&sim->cancelled);
+            return NULL;
+        }
+        sleep_ms(1);
+    }
+    return window->result;
+}
+
+static void simulated_release(void* backend, void* result) {
+    SimulatedSearch* sim = backend;
+    (void)result;
+    bump_counter(&sim->released);
+}
+
+static void simulated_finish(void* backend) {
+    SimulatedSearch* sim = backend;
+    bump_counter(&sim->finished);
+}
+
+const SearchOps SIMULATED_SEARCH_OPS = {
+    simulated_search,
+    simulated_release,
+    simulated_finish
+};
@@ -0,0 +1,59 @@
+#ifndef WINCONTROL_WORKERS_H
+#define WINCONTROL_WORKERS_H
+
+#include <stdbool.h>
+
+#define WORKER_POOL_THREADS 4
+
+typedef void (*WorkerThreadHook)(void* user);
+
+/*
+ * A fixed set of threads taking searches from one queue. start runs on
+ * each thread before its first job and stop after its last, which is
+ * where the Windows pool enters the multithreaded COM apartment.
+ */
+typedef struct WorkerPool WorkerPool;
+
+WorkerPool* winctrl_workers_create(int threads, WorkerThreadHook start, WorkerThreadHook stop, void* user);
+/* Lets queued jobs finish, with their races cancelled, then joins the threads. */
+void winctrl_workers_destroy(WorkerPool* pool);
+
+/*
+ * One search per scope, such as a top-level window. search should check
+ * cancelled between expensive steps and return NULL once it is set.
+ * release drops a result that lost the race; finish is called once the
+ * last search is done and owns cleaning up backend.
+ */
+typedef struct {
+    void* (*search)(void* backend, void* scope, const volatile long* cancelled);
+    void (*release)(void* backend, void* result);
+    void (*finish)(void* backend);
+} SearchOps;
+
+/*
+ * Searches all scopes at once and returns the first result, with its
+ * scope's position in winner, or NULL when none matched. It returns as
+ * soon as one search matches; the others are cancelled and may still be
+ * running, so backend and scopes must not live on the caller's stack.
+ * Without a pool the scopes are searched one after another.
+ */
+void* winctrl_search_race(WorkerPool* pool, const SearchOps* ops, void* backend, void* const* scopes, int count,
+                          int* winner);
+
+/* A scope of the simulated search: searching it takes delay_ms and finds result, or nothing when it is NULL. */
+typedef struct {
+    int delay_ms;
+    void* result;
+} SimulatedScope;
+
+/* Backend of SIMULATED_SEARCH_OPS; counts what the race did with each search. */
+typedef struct {
+    volatile long searches;
+    volatile long cancelled;
+    volatile long released;
+    volatile long finished;
+} SimulatedSearch;
+
+extern const SearchOps SIMULATED_SEARCH_OPS;
+
+#endif